@@ -0,0 +1,87 @@
+// Host benchmark of the sensor fusion.
+//
+// Usage: fusion_bench [scale]
+//
+// Runs the reference trajectory of fusion_reference.hpp through the fusion with
+// and without the gyro bias estimate and prints tilt error, heading drift and
+// the learned bias of both, then times update() and projects the cost of 6
+// sensors at 1 kHz. The accuracy bounds are checked by fusion_accuracy_test.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "fusion_reference.hpp"
+
+static std::atomic<size_t> allocationCount{0};
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+int main(int argc, char **argv)
+{
+    size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1;
+    if (scale == 0)
+    {
+        scale = 1;
+    }
+
+    Reference reference = buildReference(1);
+    const double degrees = 180.0 / M_PI;
+
+    FusionConfig noBias = SensorFusion::defaultConfig();
+    noBias.restDuration = INT64_MAX;
+    Accuracy without = evaluate(reference, noBias);
+    Accuracy with = evaluate(reference, SensorFusion::defaultConfig());
+    printf("reference trajectory: %zu samples at %d Hz, gyro bias %.3f %.3f %.3f rad/s\n", reference.samples.size(),
+           SAMPLE_RATE, GYRO_BIAS[0], GYRO_BIAS[1], GYRO_BIAS[2]);
+    printf("%-24s %10s %10s %14s %12s\n", "", "tilt rms", "tilt max", "heading drift", "bias error");
+    printf("%-24s %9.3f° %9.3f° %13.3f° %12.5f\n", "without bias estimate", without.tiltRms * degrees,
+           without.tiltMax * degrees, without.headingDrift * degrees, without.biasError);
+    printf("%-24s %9.3f° %9.3f° %13.3f° %12.5f\n", "with bias estimate", with.tiltRms * degrees,
+           with.tiltMax * degrees, with.headingDrift * degrees, with.biasError);
+    printf("\n");
+
+    SensorFusion fusion;
+    const std::vector<ImuSample> &samples = reference.samples;
+    size_t iterations = 20 * scale;
+    size_t allocationsBefore = allocationCount.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        fusion.reset();
+        fusion.update(samples.data(), samples.size());
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations = allocationCount.load() - allocationsBefore;
+    Quaternion q = fusion.getRotation();
+    asm volatile("" : : "r,m"(q) : "memory");
+
+    double updates = (double)iterations * samples.size();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / updates;
+    printf("update: %.1f ns/sample, %.0f samples/s, %.3f allocs/sample\n", ns, 1e9 / ns, allocations / updates);
+    printf("6 sensors x 1 kHz: %.2f%% of one host core\n", 6 * 1000 * ns / 1e9 * 100);
+    return 0;
+}
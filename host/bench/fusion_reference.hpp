@@ -0,0 +1,186 @@
+#pragma once
+
+// Reference trajectory of the fusion checks, shared by fusion_bench and
+// fusion_accuracy_test. A known trajectory (rest, 20 s of motion about all
+// axes, rest) is turned into 1 kHz gyro and accelerometer samples with noise
+// and a constant gyro bias, evaluate() compares the fusion output against the
+// true rotation.
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "fusion/sensor_fusion.hpp"
+
+#define SAMPLE_RATE 1000
+#define REST_SECONDS 5
+#define MOTION_SECONDS 20
+#define SETTLE_SECONDS 2
+#define GRAVITY 9.80665
+
+struct TruthQuaternion
+{
+    double w, x, y, z;
+
+    TruthQuaternion operator*(const TruthQuaternion &o) const
+    {
+        return {w * o.w - x * o.x - y * o.y - z * o.z,
+                w * o.x + x * o.w + y * o.z - z * o.y,
+                w * o.y - x * o.z + y * o.w + z * o.x,
+                w * o.z + x * o.y - y * o.x + z * o.w};
+    }
+
+    TruthQuaternion normalized() const
+    {
+        double n = sqrt(w * w + x * x + y * y + z * z);
+        return {w / n, x / n, y / n, z / n};
+    }
+
+    // v' = q v q*
+    void rotate(const double v[3], double out[3]) const
+    {
+        TruthQuaternion p = (*this) * TruthQuaternion{0, v[0], v[1], v[2]} * TruthQuaternion{w, -x, -y, -z};
+        out[0] = p.x;
+        out[1] = p.y;
+        out[2] = p.z;
+    }
+};
+
+struct Reference
+{
+    std::vector<ImuSample> samples;
+    std::vector<TruthQuaternion> truth;
+};
+
+static const double GYRO_BIAS[3] = {0.010, -0.008, 0.012};
+
+// Body frame angular velocity, zero at rest and ramped in and out of the motion
+inline void angularVelocity(double t, double omega[3])
+{
+    double motion = t - REST_SECONDS;
+    if (motion <= 0 || motion >= MOTION_SECONDS)
+    {
+        omega[0] = omega[1] = omega[2] = 0;
+        return;
+    }
+    double envelope = sin(M_PI * motion / MOTION_SECONDS);
+    omega[0] = 1.5 * envelope * sin(2 * M_PI * 0.5 * motion);
+    omega[1] = 1.2 * envelope * sin(2 * M_PI * 0.3 * motion + 1.0);
+    omega[2] = 1.0 * envelope * sin(2 * M_PI * 0.2 * motion + 2.0);
+}
+
+inline Reference buildReference(uint32_t seed)
+{
+    Reference reference;
+    std::mt19937 random(seed);
+    std::normal_distribution<double> gyroNoise(0.0, 0.005);
+    std::normal_distribution<double> accelNoise(0.0, 0.05);
+
+    size_t count = (size_t)(2 * REST_SECONDS + MOTION_SECONDS) * SAMPLE_RATE;
+    double dt = 1.0 / SAMPLE_RATE;
+    TruthQuaternion q = {cos(0.15), sin(0.15), 0, 0};
+    const int substeps = 10;
+    for (size_t i = 0; i < count; i++)
+    {
+        double t = i * dt;
+        if (i > 0)
+        {
+            for (int s = 0; s < substeps; s++)
+            {
+                double omega[3];
+                angularVelocity(t - dt + (s + 0.5) * dt / substeps, omega);
+                double angle = sqrt(omega[0] * omega[0] + omega[1] * omega[1] + omega[2] * omega[2]) * dt / substeps;
+                if (angle > 0)
+                {
+                    double scale = sin(angle / 2) / (angle / (dt / substeps));
+                    q = (q * TruthQuaternion{cos(angle / 2), omega[0] * scale, omega[1] * scale, omega[2] * scale}).normalized();
+                }
+            }
+        }
+        double omega[3];
+        angularVelocity(t, omega);
+        double up[3] = {0, 0, GRAVITY};
+        double accel[3];
+        TruthQuaternion{q.w, -q.x, -q.y, -q.z}.rotate(up, accel);
+
+        ImuSample sample;
+        sample.timestamp = (int64_t)i * 1000000 / SAMPLE_RATE;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sample.angularVelocity[axis] = (float)(omega[axis] + GYRO_BIAS[axis] + gyroNoise(random));
+            sample.acceleration[axis] = (float)(accel[axis] + accelNoise(random));
+        }
+        reference.samples.push_back(sample);
+        reference.truth.push_back(q);
+    }
+    return reference;
+}
+
+inline double angleBetween(const double a[3], const double b[3])
+{
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    double na = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    double nb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    double c = dot / (na * nb);
+    return acos(c > 1 ? 1 : (c < -1 ? -1 : c));
+}
+
+// Heading part of the world frame error rotation, its twist about world z
+inline double headingError(const TruthQuaternion &estimate, const TruthQuaternion &truth)
+{
+    TruthQuaternion error = estimate * TruthQuaternion{truth.w, -truth.x, -truth.y, -truth.z};
+    return 2.0 * atan2(error.z, error.w);
+}
+
+struct Accuracy
+{
+    double tiltRms;
+    double tiltMax;
+    double headingDrift;
+    double biasError;
+};
+
+inline Accuracy evaluate(const Reference &reference, const FusionConfig &config)
+{
+    SensorFusion fusion;
+    fusion.configure(config);
+    double sumSquares = 0, tiltMax = 0;
+    size_t counted = 0;
+    double headingAfterRest = 0, heading = 0;
+    for (size_t i = 0; i < reference.samples.size(); i++)
+    {
+        fusion.update(reference.samples[i]);
+        Quaternion e = fusion.getRotation();
+        TruthQuaternion estimate = {e.w, e.x, e.y, e.z};
+        const TruthQuaternion &truth = reference.truth[i];
+        // Tilt error: world up seen from the sensor, estimated vs true
+        double up[3] = {0, 0, 1}, estimatedUp[3], trueUp[3];
+        TruthQuaternion{estimate.w, -estimate.x, -estimate.y, -estimate.z}.rotate(up, estimatedUp);
+        TruthQuaternion{truth.w, -truth.x, -truth.y, -truth.z}.rotate(up, trueUp);
+        double tilt = angleBetween(estimatedUp, trueUp);
+        if (i >= (size_t)SETTLE_SECONDS * SAMPLE_RATE)
+        {
+            sumSquares += tilt * tilt;
+            tiltMax = tilt > tiltMax ? tilt : tiltMax;
+            counted++;
+        }
+        double difference = headingError(estimate, truth);
+        heading = atan2(sin(difference), cos(difference));
+        if (i == (size_t)REST_SECONDS * SAMPLE_RATE)
+        {
+            headingAfterRest = heading;
+        }
+    }
+    // Drift from the end of the first rest on, the bias is learned during it
+    double drift = heading - headingAfterRest;
+    double headingDrift = fabs(atan2(sin(drift), cos(drift)));
+    float bias[3];
+    fusion.getGyroBias(bias);
+    double biasError = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        biasError = fmax(biasError, fabs(bias[axis] - GYRO_BIAS[axis]));
+    }
+    return {sqrt(sumSquares / counted), tiltMax, headingDrift, biasError};
+}
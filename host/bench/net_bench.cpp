@@ -0,0 +1,354 @@
+// Host benchmark of the packet serialization, send and receive paths.
+//
+// Usage: net_bench [scale]
+// Reports packets/s, ns/packet and heap allocations per packet for each path,
+// then checks the profiler's p50/p99 estimates against their bounds and fails
+// if one is exceeded. The smallest-three error bound is checked by
+// quaternion_codec_test.
+// The send paths go through UdpServer to a loopback sink socket that is never
+// drained, so the kernel drops the datagrams once its buffer is full. The
+// transport rows compare the per-datagram cost of the socket and in-memory
+// backends, the raw lwIP one only runs on the device and shows up in the
+// profiler's send and stack send stages there.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <algorithm>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "network/loopback_transport.hpp"
+#include "network/net_buffer.hpp"
+#include "network/packet_schema.hpp"
+#include "network/packet_writer.hpp"
+#include "network/quaternion_codec.hpp"
+#include "network/slimevr_client.hpp"
+#include "utils/deferred_log.hpp"
+#include "utils/profiler.hpp"
+#include "utils/timing.hpp"
+
+static std::atomic<size_t> allocationCount{0};
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+template <typename T>
+static inline void doNotOptimize(T const &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename Fn>
+static void runBenchmark(const char *name, size_t iterations, size_t packetsPerIteration, Fn fn)
+{
+    for (size_t i = 0; i < iterations / 10 + 1; i++)
+    {
+        fn();
+    }
+
+    size_t allocationsBefore = allocationCount.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations = allocationCount.load() - allocationsBefore;
+
+    double packets = (double)iterations * packetsPerIteration;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-40s %14.0f %12.1f %14.3f\n", name, packets / (ns / 1e9), ns / packets, allocations / packets);
+}
+
+static int openSink(int *port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if (sock < 0 || bind(sock, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+        return -1;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(sock, (sockaddr *)&address, &length);
+    *port = ntohs(address.sin_port);
+    return sock;
+}
+
+#define QUATERNION_SET_SIZE 1024
+
+static Quaternion randomQuaternion()
+{
+    Quaternion q;
+    q.x = (float)esp_random() / UINT32_MAX * 2.0f - 1.0f;
+    q.y = (float)esp_random() / UINT32_MAX * 2.0f - 1.0f;
+    q.z = (float)esp_random() / UINT32_MAX * 2.0f - 1.0f;
+    q.w = (float)esp_random() / UINT32_MAX * 2.0f - 1.0f;
+    return q.normalized();
+}
+
+// Percentiles from the log-linear buckets must be at or above the exact ones
+// and at most one bucket width (25%) higher
+static bool checkProfilerPercentiles(size_t iterations)
+{
+    ProfileSummary summary[PROFILER_CORES][PROFILE_STAGE_COUNT];
+    Profiler::collect(summary);
+    std::vector<uint32_t> recorded(iterations);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        // Log-uniform between 2^6 and 2^22 cycles
+        double exponent = 6.0 + 16.0 * esp_random() / (double)UINT32_MAX;
+        recorded[i] = (uint32_t)pow(2.0, exponent);
+        Profiler::record(PROFILE_RECEIVE, recorded[i]);
+    }
+    Profiler::collect(summary);
+    std::sort(recorded.begin(), recorded.end());
+    uint32_t p50 = recorded[(iterations + 1) / 2 - 1];
+    uint32_t p99 = recorded[iterations - iterations / 100 - 1];
+    const ProfileSummary &result = summary[0][PROFILE_RECEIVE];
+    printf("profiler over %zu samples: p50=%u (exact %u) p99=%u (exact %u) max=%u (exact %u)\n", iterations,
+           result.p50, p50, result.p99, p99, result.max, recorded.back());
+    return result.count == iterations && result.max == recorded.back() &&
+           result.p50 >= p50 && result.p50 <= p50 + p50 / 4 &&
+           result.p99 >= p99 && result.p99 <= p99 + p99 / 4;
+}
+
+int main(int argc, char **argv)
+{
+    size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1;
+    if (scale == 0)
+    {
+        scale = 1;
+    }
+    const size_t encodeIterations = 2000000 * scale;
+    const size_t sendIterations = 50000 * scale;
+    const uint8_t sensorCount = 6;
+    // Send failures and rejected packets log on every iteration, far more than
+    // the flush task keeps up with. The records are still built, not queued.
+    DeferredLog::setOutput(DEFERRED_LOG_DISCARD);
+
+    printf("%-40s %14s %12s %14s\n", "path", "packets/s", "ns/packet", "allocs/packet");
+
+    NetBuffer buffer(512);
+    float x = 0.25f, y = -0.5f, z = 9.81f;
+    uint64_t number = 0;
+
+    runBenchmark("encode accel: NetBuffer::write*", encodeIterations, 1, [&]()
+                 {
+        buffer.reset();
+        buffer.writeByte(0);
+        buffer.writeByte(0);
+        buffer.writeByte(0);
+        buffer.writeByte(PACKET_ACCEL);
+        buffer.writeULong(number++);
+        buffer.writeFloat(x);
+        buffer.writeFloat(y);
+        buffer.writeFloat(z);
+        buffer.writeByte(1);
+        doNotOptimize(buffer.getBuffer()[0]); });
+
+    runBenchmark("encode accel: PacketWriter", encodeIterations, 1, [&]()
+                 {
+        buffer.reset();
+        unsigned char *packet = buffer.reserve(PacketSize<uint32_t, uint64_t, float, float, float, uint8_t>::value);
+        PacketWriter(packet).put<uint32_t>(PACKET_ACCEL).put(number++).put(x).put(y).put(z).put<uint8_t>(1);
+        doNotOptimize(packet[0]); });
+
+    runBenchmark("encode accel: AccelPacket schema", encodeIterations, 1, [&]()
+                 {
+        buffer.reset();
+        unsigned char *packet = buffer.reserve(AccelPacket::wireSize);
+        AccelPacket::encode(packet, number++, x, y, z, 1);
+        doNotOptimize(packet[0]); });
+
+    runBenchmark("encode bundle: 6x accel schema", encodeIterations / sensorCount, 1, [&]()
+                 {
+        buffer.reset();
+        BundlePacket::encode(buffer.reserve(BundlePacket::wireSize), number++);
+        for (uint8_t id = 1; id <= sensorCount; id++)
+        {
+            AccelPacket::encodeBundled(buffer.reserve(AccelPacket::bundledSize), x, y, z, id);
+        }
+        doNotOptimize(buffer.getBuffer()[0]); });
+
+    Quaternion quaternions[QUATERNION_SET_SIZE];
+    for (size_t i = 0; i < QUATERNION_SET_SIZE; i++)
+    {
+        quaternions[i] = randomQuaternion();
+    }
+    size_t next = 0;
+
+    runBenchmark("encode rotation: RotationPacket schema", encodeIterations, 1, [&]()
+                 {
+        const Quaternion &q = quaternions[next++ % QUATERNION_SET_SIZE];
+        buffer.reset();
+        unsigned char *packet = buffer.reserve(RotationPacket::wireSize);
+        RotationPacket::encode(packet, number++, 1, ROTATION_DATA_TYPE_NORMAL, q.x, q.y, q.z, q.w, 0);
+        doNotOptimize(packet[0]); });
+
+    runBenchmark("encode rotation: smallest-three compact", encodeIterations, 1, [&]()
+                 {
+        const Quaternion &q = quaternions[next++ % QUATERNION_SET_SIZE];
+        buffer.reset();
+        unsigned char *packet = buffer.reserve(CompactRotationPacket::wireSize);
+        CompactQuaternion compact = smallestThree::encode(q);
+        CompactRotationPacket::encode(packet, number++, 1, compact.a, compact.b, compact.c);
+        doNotOptimize(packet[0]); });
+
+    runBenchmark("decode rotation: smallest-three", encodeIterations, 1, [&]()
+                 {
+        CompactQuaternion compact = smallestThree::encode(quaternions[next++ % QUATERNION_SET_SIZE]);
+        Quaternion q = smallestThree::decode(compact);
+        doNotOptimize(q); });
+
+    int sinkPort = 0;
+    int sink = openSink(&sinkPort);
+    if (sink < 0)
+    {
+        fprintf(stderr, "Failed to open loopback sink socket\n");
+        return 1;
+    }
+
+    sockaddr_in sinkAddress = {};
+    sinkAddress.sin_family = AF_INET;
+    sinkAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sinkAddress.sin_port = htons(sinkPort);
+    SlimeVRClient client;
+    if (client.udpServer.start(0) != ESP_OK || client.udpServer.connect(sinkAddress) != ESP_OK)
+    {
+        fprintf(stderr, "Failed to open client socket\n");
+        return 1;
+    }
+    for (uint8_t id = 1; id <= sensorCount; id++)
+    {
+        client.registerSensor(id);
+        client.setAcceleration(id, x, y, z);
+    }
+
+    runBenchmark("send: sendAcceleration per sensor", sendIterations, sensorCount, [&]()
+                 {
+        for (uint8_t id = 1; id <= sensorCount; id++)
+        {
+            client.sendAcceleration(id);
+        } });
+
+    runBenchmark("send: sendBundle (6 sensors)", sendIterations, 1, [&]()
+                 { client.sendBundle(); });
+
+    for (uint8_t id = 1; id <= sensorCount; id++)
+    {
+        client.setRotation(id, quaternions[id]);
+    }
+
+    runBenchmark("send: sendBundle (6x rotation+accel)", sendIterations, 1, [&]()
+                 { client.sendBundle(); });
+
+    client.setCompactRotation(true);
+    runBenchmark("send: sendBundle (6x compact+accel)", sendIterations, 1, [&]()
+                 { client.sendBundle(); });
+
+    runBenchmark("send: sendSensorInfo", sendIterations, 1, [&]()
+                 { client.sendSensorInfo(1); });
+
+    // acquire() and submit() of a 64 byte datagram, what every packet pays on
+    // top of serializing it
+    const unsigned char datagram[64] = {0};
+    LoopbackTransport loopback;
+    loopback.start(0);
+    UdpTransport *transports[] = {&client.udpServer, &loopback};
+    const char *transportRows[] = {"transport: socket submit 64 B", "transport: loopback submit 64 B"};
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+    {
+        UdpTransport *transport = transports[i];
+        runBenchmark(transportRows[i], sendIterations * 10, 1, [&]()
+                     { transport->sendTo(sinkAddress, datagram, sizeof(datagram)); });
+    }
+
+    SlimeVRClient loopbackClient;
+    loopbackClient.setTransport(&loopback);
+    loopback.connect(sinkAddress);
+    for (uint8_t id = 1; id <= sensorCount; id++)
+    {
+        loopbackClient.registerSensor(id);
+        loopbackClient.setAcceleration(id, x, y, z);
+        loopbackClient.setRotation(id, quaternions[id]);
+    }
+    loopbackClient.setCompactRotation(true);
+    runBenchmark("send loopback: sendBundle (6x compact)", sendIterations, 1, [&]()
+                 { loopbackClient.sendBundle(); });
+
+    // Receive dispatch of a connected client, from the packet header to the
+    // handler. Handled types only log, the records are discarded.
+    unsigned char inbound[SLIMEVR_RECEIVE_BUFFER_SIZE] = {PACKET_HANDSHAKE};
+    client.internalPacketReceived(inbound, sizeof(uint32_t), sinkAddress, sizeof(sinkAddress));
+    uint64_t serverNumber = 0;
+
+    runBenchmark("receive: dispatch sensor info", sendIterations * 10, 1, [&]()
+                 {
+        ReceiveSensorInfoPacket::encode(inbound, serverNumber++, 1, 0);
+        client.internalPacketReceived(inbound, ReceiveSensorInfoPacket::wireSize, sinkAddress, sizeof(sinkAddress)); });
+
+    runBenchmark("receive: drop unknown type", sendIterations * 10, 1, [&]()
+                 {
+        BundlePacket::encode(inbound, serverNumber++);
+        client.internalPacketReceived(inbound, BundlePacket::wireSize, sinkAddress, sizeof(sinkAddress)); });
+
+    runBenchmark("receive: reject short ping pong", sendIterations * 10, 1, [&]()
+                 {
+        PingPongPacket::encode(inbound, serverNumber++, 0);
+        client.internalPacketReceived(inbound, PingPongPacket::wireSize - 1, sinkAddress, sizeof(sinkAddress)); });
+
+    uint32_t profiled = 0;
+    runBenchmark("profiler: record", sendIterations, 1, [&]()
+                 { Profiler::record(PROFILE_RECEIVE, profiled++); });
+
+    close(sink);
+
+    printf("\nrotation payload: %zu bytes as floats, %zu bytes compact (bundled %zu vs %zu)\n",
+           RotationPacket::payloadSize, CompactRotationPacket::payloadSize,
+           RotationPacket::bundledSize, CompactRotationPacket::bundledSize);
+    return checkProfilerPercentiles(100000 * scale) ? 0 : 1;
+}
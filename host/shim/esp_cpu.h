@@ -0,0 +1,21 @@
+#pragma once
+
+// The host "cycle counter" counts nanoseconds, which matches
+// CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ=1000 in the host sdkconfig.h.
+
+#include <stdint.h>
+#include <time.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (esp_cpu_cycle_count_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+inline int esp_cpu_get_core_id()
+{
+    return 0;
+}
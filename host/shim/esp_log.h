@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL 2
+#endif
+
+#define HOST_LOG(level, letter, tag, format, ...)                              \
+    do                                                                         \
+    {                                                                          \
+        if (level <= HOST_LOG_LEVEL)                                           \
+        {                                                                      \
+            fprintf(stderr, letter " (%s): " format "\n", tag, ##__VA_ARGS__); \
+        }                                                                      \
+    } while (0)
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+__attribute__((format(printf, 3, 4))) inline void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void)tag;
+    if (level > HOST_LOG_LEVEL)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(5, "V", tag, format, ##__VA_ARGS__)
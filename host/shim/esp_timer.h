@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+inline int64_t esp_timer_get_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
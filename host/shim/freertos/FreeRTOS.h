@@ -0,0 +1,38 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS types used by the firmware. Tasks map onto
+// pthreads, see freertos_shim.cpp.
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "esp_attr.h"
+
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ 100
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+// Critical sections only serialize tasks on the host, nothing masks interrupts
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_MUTEX_INITIALIZER}
+#define portMUX_INITIALIZE(mux) pthread_mutex_init(&(mux)->mutex, NULL)
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
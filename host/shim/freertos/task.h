@@ -0,0 +1,17 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameters, UBaseType_t priority, TaskHandle_t *createdTask,
+                                   BaseType_t coreId);
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *createdTask);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
@@ -0,0 +1,147 @@
+#include "freertos/task.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+
+struct HostTask
+{
+    TaskFunction_t function;
+    void *parameters;
+};
+
+static void *hostTaskEntry(void *arg)
+{
+    HostTask task = *(HostTask *)arg;
+    delete (HostTask *)arg;
+    task.function(task.parameters);
+    return nullptr;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameters, UBaseType_t priority, TaskHandle_t *createdTask,
+                                   BaseType_t coreId)
+{
+    pthread_t thread;
+    HostTask *task = new HostTask{function, parameters};
+    if (pthread_create(&thread, nullptr, hostTaskEntry, task) != 0)
+    {
+        delete task;
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (createdTask != nullptr)
+    {
+        *createdTask = (TaskHandle_t)thread;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *createdTask)
+{
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameters, priority, createdTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == nullptr || (pthread_t)task == pthread_self())
+    {
+        pthread_exit(nullptr);
+    }
+    pthread_cancel((pthread_t)task);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * configTICK_RATE_HZ + now.tv_nsec / (1000000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return (TaskHandle_t)pthread_self();
+}
+
+// Notification counters live next to the tasks, keyed by their handle and
+// created on first use, so threads not started by xTaskCreate work as well.
+struct HostNotification
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    uint32_t value;
+};
+
+static pthread_mutex_t notificationsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<TaskHandle_t, HostNotification *> notifications;
+
+static HostNotification *notificationOf(TaskHandle_t task)
+{
+    pthread_mutex_lock(&notificationsLock);
+    HostNotification *&notification = notifications[task];
+    if (notification == nullptr)
+    {
+        notification = new HostNotification();
+        pthread_mutex_init(&notification->mutex, nullptr);
+        pthread_condattr_t attributes;
+        pthread_condattr_init(&attributes);
+        pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+        pthread_cond_init(&notification->condition, &attributes);
+        pthread_condattr_destroy(&attributes);
+        notification->value = 0;
+    }
+    pthread_mutex_unlock(&notificationsLock);
+    return notification;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    HostNotification *notification = notificationOf(task);
+    pthread_mutex_lock(&notification->mutex);
+    notification->value++;
+    pthread_cond_signal(&notification->condition);
+    pthread_mutex_unlock(&notification->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    HostNotification *notification = notificationOf(xTaskGetCurrentTaskHandle());
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t waitNs = (uint64_t)ticksToWait * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += waitNs / 1000000000;
+    deadline.tv_nsec += waitNs % 1000000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&notification->mutex);
+    while (notification->value == 0 && ticksToWait > 0)
+    {
+        int res = ticksToWait == portMAX_DELAY
+                      ? pthread_cond_wait(&notification->condition, &notification->mutex)
+                      : pthread_cond_timedwait(&notification->condition, &notification->mutex, &deadline);
+        if (res != 0 && notification->value == 0)
+        {
+            break;
+        }
+    }
+    uint32_t value = notification->value;
+    if (value > 0)
+    {
+        notification->value = clearCountOnExit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&notification->mutex);
+    return value;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host values for the sdkconfig options read by the firmware sources.
+
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 1000
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LWIP_UDP_RECVMBOX_SIZE 16
+#define CONFIG_SLIMEFY_PROFILER 1
@@ -0,0 +1,4 @@
+#pragma once
+
+#define PRO_CPU_NUM (0)
+#define APP_CPU_NUM (1)
@@ -0,0 +1,163 @@
+// Checks that a bundle carries the same per-sensor payloads as the standalone
+// packets. The same samples are sent once with sendBundle() and once with
+// sendRotation()/sendAcceleration() through LoopbackTransport, the bundle is
+// split on its u16 length and u32 type prefixes and every inner packet is
+// compared byte for byte with the standalone packet minus its header. Runs
+// with float and compact rotations. Exits non-zero on any difference.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "network/loopback_transport.hpp"
+#include "network/packet_schema.hpp"
+#include "network/slimevr_client.hpp"
+
+// Sensor 2 has no rotation, like an IMU before its first fusion update
+static const uint8_t SENSOR_IDS[] = {0, 1, 2, 5};
+
+static int failures = 0;
+
+static void fail(const char *mode, const char *message, int index)
+{
+    fprintf(stderr, "%s: %s (inner packet %d)\n", mode, message, index);
+    failures++;
+}
+
+static bool takeDatagram(LoopbackTransport &transport, LoopbackDatagram *datagram, const char *mode)
+{
+    if (!transport.takeSent(datagram))
+    {
+        fprintf(stderr, "%s: nothing was sent\n", mode);
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+static void run(bool compactRotation)
+{
+    const char *mode = compactRotation ? "compact" : "float";
+    LoopbackTransport transport;
+    SlimeVRClient client;
+    client.setTransport(&transport);
+    client.setCompactRotation(compactRotation);
+    transport.start(0);
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(SLIMEVR_SERVER_PORT);
+    transport.connect(server);
+
+    for (size_t i = 0; i < sizeof(SENSOR_IDS); i++)
+    {
+        uint8_t id = SENSOR_IDS[i];
+        client.registerSensor(id);
+        client.setAcceleration(id, 0.25f * id - 1.0f, 9.81f - id, 0.125f * i);
+        if (id != 2)
+        {
+            float angle = 0.3f * (i + 1);
+            client.setRotation(id, Quaternion{sinf(angle) * 0.6f, -sinf(angle) * 0.8f, 0.0f, cosf(angle)});
+        }
+    }
+
+    LoopbackDatagram bundle;
+    if (client.sendBundle() != ESP_OK || !takeDatagram(transport, &bundle, mode))
+    {
+        fail(mode, "bundle was not sent", -1);
+        return;
+    }
+    BundlePacket::View view(bundle.data, bundle.size);
+    if (!view.isValid())
+    {
+        fail(mode, "not a bundle", -1);
+        return;
+    }
+
+    // The standalone packets in the order sendBundle() puts them in
+    LoopbackDatagram expected[2 * sizeof(SENSOR_IDS)];
+    size_t expectedCount = 0;
+    for (uint8_t id : SENSOR_IDS)
+    {
+        if (id != 2)
+        {
+            if (client.sendRotation(id) != ESP_OK || !takeDatagram(transport, &expected[expectedCount++], mode))
+            {
+                fail(mode, "rotation was not sent", expectedCount - 1);
+                return;
+            }
+        }
+        if (client.sendAcceleration(id) != ESP_OK || !takeDatagram(transport, &expected[expectedCount++], mode))
+        {
+            fail(mode, "acceleration was not sent", expectedCount - 1);
+            return;
+        }
+    }
+
+    NetReader reader(bundle.data, bundle.size);
+    reader.skip(PACKET_HEADER_SIZE);
+    size_t index = 0;
+    while (reader.remaining() > 0)
+    {
+        uint16_t length;
+        uint32_t type;
+        if (reader.readUShort(&length) != ESP_OK || length < sizeof(type) || reader.readUInt(&type) != ESP_OK)
+        {
+            fail(mode, "truncated prefix", index);
+            return;
+        }
+        const unsigned char *payload = reader.view(length - sizeof(type));
+        if (payload == nullptr)
+        {
+            fail(mode, "length runs past the datagram", index);
+            return;
+        }
+        if (index >= expectedCount)
+        {
+            fail(mode, "more inner packets than standalone ones", index);
+            return;
+        }
+        const LoopbackDatagram &standalone = expected[index];
+        size_t standaloneSize = standalone.size - PACKET_HEADER_SIZE;
+        if (type != endian::loadBigEndian<uint32_t>(standalone.data))
+        {
+            fail(mode, "packet type differs", index);
+        }
+        else if (length - sizeof(type) != standaloneSize)
+        {
+            fail(mode, "payload size differs", index);
+        }
+        else if (memcmp(payload, standalone.data + PACKET_HEADER_SIZE, standaloneSize) != 0)
+        {
+            fail(mode, "payload differs", index);
+        }
+        index++;
+    }
+    if (index != expectedCount)
+    {
+        fail(mode, "fewer inner packets than standalone ones", index);
+    }
+    size_t standaloneBytes = 0;
+    for (size_t i = 0; i < expectedCount; i++)
+    {
+        standaloneBytes += expected[i].size;
+    }
+    printf("%s: %zu inner packets in %zu bytes, %zu bytes as standalone packets\n", mode, index, bundle.size,
+           standaloneBytes);
+}
+
+int main()
+{
+    run(false);
+    run(true);
+    if (failures > 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
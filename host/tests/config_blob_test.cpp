@@ -0,0 +1,156 @@
+// Checks how a stored config blob and the Kconfig defaults of a build are
+// merged at boot. Values stored by a build with the same defaults win, a
+// build with other defaults replaces the stream and power settings and the
+// credentials unless its SSID is empty, a blob of version 3 takes the
+// defaults once and a corrupt blob falls back to them. Exits non-zero on any
+// difference.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "storage/config_blob.hpp"
+
+static int failures = 0;
+
+static void check(bool condition, const char *name, const char *message)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "%s: %s\n", name, message);
+        failures++;
+    }
+}
+
+static StoredConfig buildDefaults(const char *ssid, uint32_t sendPeriod)
+{
+    StoredConfig defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    strncpy(defaults.wifi.ssid, ssid, sizeof(defaults.wifi.ssid) - 1);
+    strncpy(defaults.wifi.password, ssid[0] != '\0' ? "password" : "", sizeof(defaults.wifi.password) - 1);
+    defaults.stream.sendPeriod = sendPeriod;
+    defaults.stream.minRate = 10.0f;
+    defaults.stream.bundle = true;
+    defaults.power.listenInterval = 1;
+    defaults.power.latencyBudget = 110000;
+    return defaults;
+}
+
+// What the first boot of a build with these defaults stores
+static size_t firstBoot(const StoredConfig &defaults, uint8_t *blob)
+{
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(nullptr, 0, defaults, &config);
+    check(result == CONFIG_DEFAULTS, "first boot", "nothing stored did not load as DEFAULTS");
+    return configEncode(config, blob, CONFIG_BLOB_MAX_SIZE);
+}
+
+static void sameBuild()
+{
+    StoredConfig defaults = buildDefaults("", 10000);
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
+    StoredConfig stored;
+    configDecode(nullptr, 0, defaults, &stored);
+    strcpy(stored.wifi.ssid, "provisioned");
+    stored.stream.sendPeriod = 20000;
+    stored.calibration[1].valid = true;
+    size_t size = configEncode(stored, blob, sizeof(blob));
+
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(blob, size, defaults, &config);
+    check(result == CONFIG_LOADED, "same build", "not LOADED");
+    check(memcmp(&config, &stored, sizeof(config)) == 0, "same build", "stored values did not win");
+}
+
+static void newCredentials()
+{
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
+    size_t size = firstBoot(buildDefaults("", 10000), blob);
+
+    StoredConfig defaults = buildDefaults("home", 5000);
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(blob, size, defaults, &config);
+    check(result == CONFIG_NEW_DEFAULTS, "new credentials", "not NEW_DEFAULTS");
+    check(strcmp(config.wifi.ssid, "home") == 0, "new credentials", "Kconfig SSID did not replace the empty one");
+    check(strcmp(config.wifi.password, "password") == 0, "new credentials", "Kconfig password not applied");
+    check(config.stream.sendPeriod == 5000, "new credentials", "Kconfig send period not applied");
+
+    // Stored by that boot, the next one loads it as is
+    size = configEncode(config, blob, sizeof(blob));
+    StoredConfig again;
+    result = configDecode(blob, size, defaults, &again);
+    check(result == CONFIG_LOADED, "new credentials", "second boot not LOADED");
+    check(memcmp(&again, &config, sizeof(again)) == 0, "new credentials", "second boot changed the config");
+}
+
+static void emptySsidKeepsCredentials()
+{
+    StoredConfig defaults = buildDefaults("", 10000);
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
+    StoredConfig stored;
+    configDecode(nullptr, 0, buildDefaults("home", 10000), &stored);
+    size_t size = configEncode(stored, blob, sizeof(blob));
+
+    defaults.power.powerSave = true;
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(blob, size, defaults, &config);
+    check(result == CONFIG_NEW_DEFAULTS, "empty SSID", "not NEW_DEFAULTS");
+    check(strcmp(config.wifi.ssid, "home") == 0, "empty SSID", "stored credentials were dropped");
+    check(config.power.powerSave, "empty SSID", "Kconfig power settings not applied");
+}
+
+static void version3()
+{
+    StoredConfig defaults = buildDefaults("home", 10000);
+    StoredConfig stored;
+    configDecode(nullptr, 0, buildDefaults("", 10000), &stored);
+    stored.calibration[2].valid = true;
+
+    // Version 3 ends right before defaultsCrc
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
+    ConfigHeader header;
+    header.magic = CONFIG_MAGIC;
+    header.version = 3;
+    header.size = offsetof(StoredConfig, defaultsCrc);
+    header.crc = configCrc((const uint8_t *)&stored, header.size);
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &stored, header.size);
+
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(blob, sizeof(header) + header.size, defaults, &config);
+    check(result == CONFIG_NEW_DEFAULTS, "version 3", "not NEW_DEFAULTS");
+    check(strcmp(config.wifi.ssid, "home") == 0, "version 3", "Kconfig SSID not applied");
+    check(config.calibration[2].valid, "version 3", "calibration lost");
+    check(config.defaultsCrc == configDefaultsCrc(defaults), "version 3", "defaults CRC not recorded");
+}
+
+static void corrupt()
+{
+    StoredConfig defaults = buildDefaults("home", 10000);
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
+    size_t size = firstBoot(defaults, blob);
+    blob[size - 1] ^= 0x01;
+
+    StoredConfig config;
+    ConfigLoadResult result = configDecode(blob, size, defaults, &config);
+    check(result == CONFIG_CORRUPT, "corrupt", "not CORRUPT");
+    check(strcmp(config.wifi.ssid, "home") == 0 && config.stream.sendPeriod == 10000, "corrupt",
+          "defaults not used");
+}
+
+int main()
+{
+    sameBuild();
+    newCredentials();
+    emptySsidKeepsCredentials();
+    version3();
+    corrupt();
+    if (failures > 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,33 @@
+// Runs the reference trajectory of fusion_reference.hpp through the fusion
+// with its default config and checks tilt error over the whole run, heading
+// drift from the end of the first rest to the end of the run and the learned
+// gyro bias against fixed bounds. Exits non-zero if one is out of bounds.
+
+#include <cmath>
+#include <cstdio>
+
+#include "fusion_reference.hpp"
+
+#define MAX_TILT_RMS_DEG 1.0
+#define MAX_TILT_DEG 3.0
+#define MAX_HEADING_DRIFT_DEG 2.0
+#define MAX_BIAS_ERROR 0.002
+
+int main()
+{
+    Reference reference = buildReference(1);
+    const double degrees = 180.0 / M_PI;
+    Accuracy accuracy = evaluate(reference, SensorFusion::defaultConfig());
+    printf("tilt rms %.3f° (bound %.1f°), tilt max %.3f° (%.1f°), heading drift %.3f° (%.1f°), "
+           "bias error %.5f rad/s (%.3f)\n",
+           accuracy.tiltRms * degrees, MAX_TILT_RMS_DEG, accuracy.tiltMax * degrees, MAX_TILT_DEG,
+           accuracy.headingDrift * degrees, MAX_HEADING_DRIFT_DEG, accuracy.biasError, MAX_BIAS_ERROR);
+    if (accuracy.tiltRms * degrees > MAX_TILT_RMS_DEG || accuracy.tiltMax * degrees > MAX_TILT_DEG ||
+        accuracy.headingDrift * degrees > MAX_HEADING_DRIFT_DEG || accuracy.biasError > MAX_BIAS_ERROR)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
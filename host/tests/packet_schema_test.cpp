@@ -0,0 +1,180 @@
+// Round trips every packet schema. Each packet is encoded with encode() and
+// encodeBundled(), the datagram is decoded with its View and every field is
+// compared with what went in. The bundled form must carry the same payload
+// behind its length and type prefix, neither encoder may write past its
+// size, and views reject datagrams that are too short or of another type,
+// down to the upper bytes of the u32 type.
+// Exits non-zero on any difference.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "network/packet_schema.hpp"
+
+// Bytes after the packet that must stay untouched
+#define GUARD_SIZE 16
+#define GUARD_BYTE 0xA5
+
+static int failures = 0;
+
+static void fail(const char *name, const char *message, int field = -1)
+{
+    if (field >= 0)
+    {
+        fprintf(stderr, "%s: %s (field %d)\n", name, message, field);
+    }
+    else
+    {
+        fprintf(stderr, "%s: %s\n", name, message);
+    }
+    failures++;
+}
+
+static bool guardIntact(const unsigned char *guard)
+{
+    for (size_t i = 0; i < GUARD_SIZE; i++)
+    {
+        if (guard[i] != GUARD_BYTE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every field type is trivially copyable, compared bit for bit so floats
+// round trip exactly
+template <typename Packet, typename Tuple, size_t... I>
+static void checkFields(const char *name, const typename Packet::View &view, const Tuple &fields,
+                        std::index_sequence<I...>)
+{
+    (void)name;
+    (void)view;
+    (void)fields;
+    (
+        [&]
+        {
+            auto decoded = view.template get<I>();
+            const auto &expected = std::get<I>(fields);
+            static_assert(std::is_same<decltype(decoded), typename std::decay<decltype(expected)>::type>::value,
+                          "View returns another type than the schema declares");
+            if (memcmp(&decoded, &expected, sizeof(decoded)) != 0)
+            {
+                fail(name, "field differs after decoding", I);
+            }
+        }(),
+        ...);
+}
+
+template <typename Packet, typename... Fields>
+static void roundTrip(const char *name, const Fields &...fields)
+{
+    static_assert(sizeof...(Fields) == Packet::fieldCount, "Wrong number of fields for the schema");
+    const uint64_t number = 0x0102030405060708ull + Packet::type;
+
+    unsigned char datagram[Packet::wireSize + GUARD_SIZE];
+    memset(datagram, GUARD_BYTE, sizeof(datagram));
+    Packet::encode(datagram, number, fields...);
+    if (!guardIntact(datagram + Packet::wireSize))
+    {
+        fail(name, "encode() wrote past wireSize");
+    }
+    if (endian::loadBigEndian<uint32_t>(datagram) != Packet::type)
+    {
+        fail(name, "wrong packet type in the header");
+    }
+
+    typename Packet::View view(datagram, Packet::wireSize);
+    if (!view.isValid())
+    {
+        fail(name, "view rejected the encoded packet");
+        return;
+    }
+    if (view.packetNumber() != number)
+    {
+        fail(name, "packet number differs after decoding");
+    }
+    checkFields<Packet>(name, view, std::tuple<Fields...>(fields...), std::index_sequence_for<Fields...>());
+
+    if (typename Packet::View(datagram, Packet::wireSize - 1).isValid())
+    {
+        fail(name, "view accepted a truncated packet");
+    }
+    unsigned char other[Packet::wireSize];
+    memcpy(other, datagram, sizeof(other));
+    other[3] = Packet::type + 1;
+    if (typename Packet::View(other, sizeof(other)).isValid())
+    {
+        fail(name, "view accepted another packet type");
+    }
+    memcpy(other, datagram, sizeof(other));
+    other[0] = 0x01;
+    if (typename Packet::View(other, sizeof(other)).isValid())
+    {
+        fail(name, "view only checked the low byte of the packet type");
+    }
+
+    unsigned char bundled[Packet::bundledSize + GUARD_SIZE];
+    memset(bundled, GUARD_BYTE, sizeof(bundled));
+    Packet::encodeBundled(bundled, fields...);
+    if (!guardIntact(bundled + Packet::bundledSize))
+    {
+        fail(name, "encodeBundled() wrote past bundledSize");
+    }
+    if (endian::loadBigEndian<uint16_t>(bundled) != Packet::bundledSize - sizeof(uint16_t))
+    {
+        fail(name, "wrong length prefix in the bundled packet");
+    }
+    if (endian::loadBigEndian<uint32_t>(bundled + sizeof(uint16_t)) != Packet::type)
+    {
+        fail(name, "wrong packet type in the bundled packet");
+    }
+    if (memcmp(bundled + BUNDLED_PACKET_HEADER_SIZE, datagram + PACKET_HEADER_SIZE, Packet::payloadSize) != 0)
+    {
+        fail(name, "bundled payload differs from the datagram payload");
+    }
+    printf("%-18s type %3u, %2zu fields, %2zu bytes, %2zu bundled\n", name, Packet::type, Packet::fieldCount,
+           Packet::wireSize, Packet::bundledSize);
+}
+
+int main()
+{
+    roundTrip<HeartbeatPacket>("Heartbeat");
+    roundTrip<HandshakePacket>("Handshake", (int32_t)5, (int32_t)8, (int32_t)2, (int32_t)-1, (int32_t)0x7FFFFFFF,
+                               (int32_t)INT32_MIN, (int32_t)16, ShortString<5>{{'0', '.', '3', '.', '3'}},
+                               Bytes<6>{{0xC4, 0xDE, 0xE2, 0x13, 0x95, 0xEC}});
+    roundTrip<AccelPacket>("Accel", -9.81f, 0.125f, 1e-20f, (uint8_t)7);
+    roundTrip<RotationPacket>("Rotation", (uint8_t)3, (uint8_t)ROTATION_DATA_TYPE_NORMAL, 0.5f, -0.5f, 0.5f,
+                              -0.5f, (uint8_t)255);
+    roundTrip<CompactRotationPacket>("CompactRotation", (uint8_t)1, (uint16_t)0xFFFF, (uint16_t)0x8001,
+                                     (uint16_t)0x1234);
+    roundTrip<SensorInfoPacket>("SensorInfo", (uint8_t)2, (uint8_t)1, (uint8_t)8);
+    roundTrip<ReceiveSensorInfoPacket>("ReceiveSensorInfo", (uint8_t)4, (uint8_t)0);
+    roundTrip<PingPongPacket>("PingPong", (int32_t)-123456789);
+    roundTrip<BundlePacket>("Bundle");
+    roundTrip<ProfilePacket>("Profile", (uint8_t)PACKET_INSPECTION_PACKETTYPE_PROFILE, (uint8_t)2, (uint8_t)1,
+                             (uint16_t)240, (uint32_t)100000, (uint32_t)20479, (uint32_t)4193956,
+                             (uint32_t)0xFFFFFFFF);
+
+    // ShortString carries its length in front of the characters
+    unsigned char handshake[HandshakePacket::wireSize];
+    HandshakePacket::encode(handshake, 0, 0, 0, 0, 0, 0, 0, 0, ShortString<5>{{'a', 'b', 'c', 'd', 'e'}},
+                            Bytes<6>{});
+    const unsigned char *version = handshake + PACKET_HEADER_SIZE + HandshakePacket::offset<7>();
+    if (version[0] != 5 || memcmp(version + 1, "abcde", 5) != 0)
+    {
+        fail("Handshake", "version string is not length prefixed");
+    }
+
+    if (failures > 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
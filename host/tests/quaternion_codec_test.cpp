@@ -0,0 +1,80 @@
+// Checks the smallest-three round trip error against MAX_ANGLE_ERROR, over
+// random unit quaternions and the edge cases: identity, components at +-1,
+// two or four components of equal size and a negative largest component.
+// Exits non-zero when one is exceeded.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "network/quaternion_codec.hpp"
+
+#define RANDOM_QUATERNIONS 1000000
+
+static uint32_t randomState = 0x2545F491;
+
+// xorshift32, the same quaternions on every run
+static float randomComponent()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (float)randomState / UINT32_MAX * 2.0f - 1.0f;
+}
+
+// Angle of the rotation between two quaternions. Both are renormalized in double
+// first, acos near 1 would otherwise turn float rounding into the dominant error.
+static double rotationError(const Quaternion &a, const Quaternion &b)
+{
+    double lengthA = sqrt((double)a.x * a.x + (double)a.y * a.y + (double)a.z * a.z + (double)a.w * a.w);
+    double lengthB = sqrt((double)b.x * b.x + (double)b.y * b.y + (double)b.z * b.z + (double)b.w * b.w);
+    double dot = fabs((double)a.x * b.x + (double)a.y * b.y + (double)a.z * b.z + (double)a.w * b.w) / (lengthA * lengthB);
+    return 2.0 * acos(dot > 1.0 ? 1.0 : dot);
+}
+
+static double roundTripError(const Quaternion &q)
+{
+    return rotationError(q, smallestThree::decode(smallestThree::encode(q)));
+}
+
+int main()
+{
+    double maxError = 0.0;
+    double sumError = 0.0;
+    for (size_t i = 0; i < RANDOM_QUATERNIONS; i++)
+    {
+        Quaternion q = Quaternion{randomComponent(), randomComponent(), randomComponent(), randomComponent()}.normalized();
+        double error = roundTripError(q);
+        sumError += error;
+        maxError = fmax(maxError, error);
+    }
+
+    const float half = 0.70710678f;
+    const Quaternion edges[] = {
+        {0.0f, 0.0f, 0.0f, 1.0f},
+        {1.0f, 0.0f, 0.0f, 0.0f},
+        {0.0f, -1.0f, 0.0f, 0.0f},
+        {0.0f, 0.0f, 0.0f, -1.0f},
+        {half, 0.0f, 0.0f, half},
+        {0.0f, -half, half, 0.0f},
+        {0.5f, -0.5f, 0.5f, -0.5f},
+        {-0.1f, 0.2f, -0.3f, -0.927362f},
+    };
+    double maxEdgeError = 0.0;
+    for (const Quaternion &edge : edges)
+    {
+        maxEdgeError = fmax(maxEdgeError, roundTripError(edge.normalized()));
+    }
+
+    printf("smallest-three round trip over %d quaternions: avg=%.6f deg max=%.6f deg, edge cases max=%.6f deg, "
+           "bound=%.6f deg\n",
+           RANDOM_QUATERNIONS, sumError / RANDOM_QUATERNIONS * 180.0 / M_PI, maxError * 180.0 / M_PI,
+           maxEdgeError * 180.0 / M_PI, smallestThree::MAX_ANGLE_ERROR * 180.0 / M_PI);
+    if (maxError > smallestThree::MAX_ANGLE_ERROR || maxEdgeError > smallestThree::MAX_ANGLE_ERROR)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,515 @@
+// Runs the IMU acquisition scheduler against simulated I2C buses.
+//
+// Usage: acq_sim [ticks] [period_us] [frequency_hz]
+// Default: 2000 ticks of 7000 us on 400 kHz buses
+//
+// Both buses carry a mux with three BMI160 models behind it, laid out like the
+// firmware: two sensors on channel 0 and one on channel 1. Every transaction
+// sleeps for its time on the wire. The run fails when a bus ever carries two
+// transactions at once, a device is accessed while its channel is not
+// selected, a channel is selected more than once per tick, the buses do not
+// overlap, a lane misses a tick, or the aligned samples drift from the
+// simulated motion by more than one sample period allows. Ticks during which
+// the host itself stalled are left out of the timing checks, the run fails
+// when that leaves too few.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sensors/imu_acquisition.hpp"
+#include "utils/timing.hpp"
+
+#define SIM_WARMUP_TICKS 20
+#define SIM_SAMPLE_RATE 200
+#define SIM_SAMPLE_PERIOD_US (1000000 / SIM_SAMPLE_RATE)
+#define SIM_FIFO_FRAMES (BMI160_FIFO_SIZE / BMI160_FRAME_SIZE)
+#define SIM_MOTION_FREQUENCY 1.0
+#define SIM_MOTION_AMPLITUDE 9.80665
+#define SIM_ACCELERATION_SCALE (4 * 9.80665 / 32768.0)
+// A 1 ms sleep that takes this much longer means the host stalled
+#define SIM_STALL_US 2000
+// A stall this long before a tick can still leave a lane busy in it
+#define SIM_STALL_REACH_TICKS 3
+#define SIM_MAX_STALLED_FRACTION 0.5
+
+#define REG_CHIP_ID 0x00
+#define REG_FIFO_LENGTH 0x22
+#define REG_FIFO_DATA 0x24
+#define REG_CMD 0x7E
+#define CMD_FIFO_FLUSH 0xB0
+
+struct Interval
+{
+    int64_t start;
+    int64_t end;
+};
+
+static void sleepMicros(int64_t us)
+{
+    struct timespec duration = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    nanosleep(&duration, nullptr);
+}
+
+// Sleeps 1 ms at a time and keeps every sleep that overran. The simulation
+// runs on wall clock time and cannot judge ticks the host did not run.
+class StallMonitor
+{
+private:
+    std::atomic<bool> running;
+    std::mutex lock;
+    std::vector<Interval> stalls;
+    std::thread thread;
+
+public:
+    StallMonitor() : running(true)
+    {
+        this->thread = std::thread([this]()
+                                   {
+            while (this->running)
+            {
+                int64_t start = micros64();
+                sleepMicros(1000);
+                int64_t end = micros64();
+                if (end - start > 1000 + SIM_STALL_US)
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->stalls.push_back({start, end});
+                }
+            } });
+    }
+
+    ~StallMonitor()
+    {
+        this->stop();
+    }
+
+    void stop()
+    {
+        if (this->running.exchange(false))
+        {
+            this->thread.join();
+        }
+    }
+
+    // After stop()
+    bool overlaps(int64_t start, int64_t end) const
+    {
+        for (const Interval &stall : this->stalls)
+        {
+            if (stall.start < end && stall.end > start)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t count() const
+    {
+        return this->stalls.size();
+    }
+};
+
+// One I2C controller and its wires
+class SimPort
+{
+private:
+    uint32_t frequency;
+    std::atomic<int> active;
+
+public:
+    std::atomic<uint32_t> collisions;
+    std::vector<Interval> transfers;
+
+    explicit SimPort(uint32_t frequency) : frequency(frequency), active(0), collisions(0) {}
+
+    // Address, register and data bytes plus ACK bits, start and stop
+    void transfer(size_t bytes)
+    {
+        if (this->active.fetch_add(1) != 0)
+        {
+            this->collisions++;
+        }
+        int64_t start = micros64();
+        sleepMicros((int64_t)(bytes * 9 + 2) * 1000000 / this->frequency);
+        this->transfers.push_back({start, micros64()});
+        this->active.fetch_sub(1);
+    }
+};
+
+class SimMux : public BusMux
+{
+private:
+    SimPort &port;
+
+public:
+    explicit SimMux(SimPort &port) : port(port) {}
+
+protected:
+    esp_err_t writeChannelMask(uint8_t) override
+    {
+        this->port.transfer(2);
+        return ESP_OK;
+    }
+};
+
+static double motion(int64_t time)
+{
+    return SIM_MOTION_AMPLITUDE * sin(2 * M_PI * SIM_MOTION_FREQUENCY * time / 1e6);
+}
+
+// Register model of a BMI160 with a headerless accel+gyro FIFO. Frames are
+// produced by its own clock, which starts at a random phase at FIFO flush.
+class SimBmi160 : public ImuBus
+{
+private:
+    SimPort &port;
+    SimMux &mux;
+    uint8_t channel;
+    int64_t origin;
+    int64_t nextFrame;
+    int64_t pendingFrames;
+
+public:
+    uint32_t misroutes;
+
+    SimBmi160(SimPort &port, SimMux &mux, uint8_t channel)
+        : port(port), mux(mux), channel(channel), origin(0), nextFrame(0), pendingFrames(0), misroutes(0) {}
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override
+    {
+        this->check();
+        memset(data, 0, length);
+        if (reg == REG_CHIP_ID)
+        {
+            data[0] = 0xD1;
+        }
+        else if (reg == REG_FIFO_LENGTH && length == 2)
+        {
+            this->pendingFrames = this->available();
+            size_t bytes = this->pendingFrames * BMI160_FRAME_SIZE;
+            data[0] = bytes & 0xFF;
+            data[1] = bytes >> 8;
+        }
+        else if (reg == REG_FIFO_DATA)
+        {
+            this->popFrames(data, length);
+        }
+        // The register contents are taken when the transaction starts. A
+        // host that oversleeps the wire time would otherwise hand the driver
+        // frames newer than the timestamp it took before the read.
+        this->port.transfer(3 + length);
+        return ESP_OK;
+    }
+
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override
+    {
+        this->check();
+        this->port.transfer(3);
+        if (reg == REG_CMD && value == CMD_FIFO_FLUSH)
+        {
+            this->origin = micros64() + rand() % SIM_SAMPLE_PERIOD_US;
+            this->nextFrame = 0;
+        }
+        return ESP_OK;
+    }
+
+private:
+    void check()
+    {
+        if (this->mux.getSelected() != this->channel)
+        {
+            this->misroutes++;
+        }
+    }
+
+    int64_t frameTime(int64_t frame)
+    {
+        return this->origin + frame * SIM_SAMPLE_PERIOD_US;
+    }
+
+    // A full FIFO drops its oldest frames
+    int64_t available()
+    {
+        int64_t now = micros64();
+        if (now < this->origin)
+        {
+            return 0;
+        }
+        int64_t produced = (now - this->origin) / SIM_SAMPLE_PERIOD_US + 1;
+        if (produced - this->nextFrame > SIM_FIFO_FRAMES)
+        {
+            this->nextFrame = produced - SIM_FIFO_FRAMES;
+        }
+        return produced - this->nextFrame;
+    }
+
+    void popFrames(uint8_t *data, size_t length)
+    {
+        memset(data, 0x80, length);
+        size_t frames = std::min<size_t>(length / BMI160_FRAME_SIZE, this->pendingFrames);
+        for (size_t i = 0; i < frames; i++)
+        {
+            uint8_t *frame = data + i * BMI160_FRAME_SIZE;
+            memset(frame, 0, BMI160_FRAME_SIZE);
+            int16_t raw = (int16_t)lround(motion(this->frameTime(this->nextFrame + i)) / SIM_ACCELERATION_SCALE);
+            frame[6] = raw & 0xFF;
+            frame[7] = (raw >> 8) & 0xFF;
+        }
+        this->nextFrame += frames;
+    }
+};
+
+struct SimSensor
+{
+    uint8_t id;
+    uint8_t bus;
+    uint8_t channel;
+};
+
+// Registered interleaved on purpose, the plan has to group the channels
+static const SimSensor LAYOUT[] = {
+    {1, 0, 0}, {3, 0, 1}, {2, 0, 0},
+    {4, 1, 0}, {6, 1, 1}, {5, 1, 0},
+};
+#define SIM_SENSOR_COUNT (sizeof(LAYOUT) / sizeof(LAYOUT[0]))
+
+static int64_t overlap(const std::vector<Interval> &a, const std::vector<Interval> &b)
+{
+    int64_t total = 0;
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size())
+    {
+        int64_t start = std::max(a[i].start, b[j].start);
+        int64_t end = std::min(a[i].end, b[j].end);
+        if (end > start)
+        {
+            total += end - start;
+        }
+        if (a[i].end < b[j].end)
+        {
+            i++;
+        }
+        else
+        {
+            j++;
+        }
+    }
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    int ticks = SIM_WARMUP_TICKS + (argc > 1 ? atoi(argv[1]) : 2000);
+    int64_t period = argc > 2 ? atoll(argv[2]) : 7000;
+    uint32_t frequency = argc > 3 ? (uint32_t)atoi(argv[3]) : 400000;
+    srand(1);
+
+    SimPort ports[ACQUISITION_MAX_BUSES] = {SimPort(frequency), SimPort(frequency)};
+    SimMux muxes[ACQUISITION_MAX_BUSES] = {SimMux(ports[0]), SimMux(ports[1])};
+    std::vector<SimBmi160 *> devices;
+    std::vector<Bmi160 *> imus;
+    // Never freed, stop() only tells the lane tasks to exit and they may
+    // still look at it after main returned
+    ImuAcquisition &acquisition = *new ImuAcquisition();
+    for (const SimSensor &layout : LAYOUT)
+    {
+        SimBmi160 *device = new SimBmi160(ports[layout.bus], muxes[layout.bus], layout.channel);
+        MuxedImuBus *bus = new MuxedImuBus(*device, muxes[layout.bus], layout.channel);
+        Bmi160 *imu = new Bmi160(*bus);
+        if (imu->init(Bmi160::defaultConfig()) != ESP_OK ||
+            acquisition.addSensor(layout.id, *imu, layout.bus, layout.channel) != ESP_OK)
+        {
+            fprintf(stderr, "sensor %d failed to initialize\n", layout.id);
+            return 1;
+        }
+        devices.push_back(device);
+        imus.push_back(imu);
+    }
+    if (acquisition.start() != ESP_OK)
+    {
+        fprintf(stderr, "acquisition failed to start\n");
+        return 1;
+    }
+    for (SimPort &port : ports)
+    {
+        port.transfers.clear();
+    }
+    uint32_t switchesBefore[ACQUISITION_MAX_BUSES] = {muxes[0].getSwitches(), muxes[1].getSwitches()};
+
+    // What a tick did, judged once the run is over and every stall is known
+    struct TickResult
+    {
+        int64_t start;
+        int64_t end;
+        bool failed;
+        uint32_t timeouts;
+        uint32_t errors;
+        uint32_t busySkips;
+        size_t compared;
+        double squaredError;
+        double maxError;
+    };
+    std::vector<TickResult> results;
+    AcquiredSample samples[ACQUISITION_MAX_SENSORS];
+    StallMonitor monitor;
+    int64_t next = micros64() + period;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        while (micros64() < next)
+        {
+            sleepMicros(next - micros64());
+        }
+        // The first ticks drain the backlog the FIFOs collected while the
+        // other sensors initialized, measuring starts once they caught up
+        if (tick == SIM_WARMUP_TICKS)
+        {
+            acquisition.resetStats();
+            for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+            {
+                switchesBefore[bus] = muxes[bus].getSwitches();
+            }
+        }
+        int64_t tickTime = micros64();
+        next += period;
+        size_t count = 0;
+        AcquisitionStats before = acquisition.getStats();
+        esp_err_t res = acquisition.acquire(tickTime, samples, ACQUISITION_MAX_SENSORS, &count);
+        AcquisitionStats after = acquisition.getStats();
+        if (tick < SIM_WARMUP_TICKS)
+        {
+            continue;
+        }
+        TickResult result = {tickTime, micros64(), res != ESP_OK, after.timeouts - before.timeouts, 0, 0, 0, 0, 0};
+        for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+        {
+            result.errors += after.buses[bus].errors - before.buses[bus].errors;
+            result.busySkips += after.buses[bus].busySkips - before.buses[bus].busySkips;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!samples[i].valid)
+            {
+                continue;
+            }
+            double error = fabs(samples[i].aligned.acceleration[0] - motion(tickTime));
+            result.squaredError += error * error;
+            result.maxError = std::max(result.maxError, error);
+            result.compared++;
+        }
+        results.push_back(result);
+    }
+    monitor.stop();
+
+    double squaredError = 0;
+    double maxError = 0;
+    size_t compared = 0;
+    int failedTicks = 0;
+    uint32_t timeouts = 0;
+    uint32_t errors = 0;
+    uint32_t busySkips = 0;
+    int stalledTicks = 0;
+    for (const TickResult &result : results)
+    {
+        if (monitor.overlaps(result.start - SIM_STALL_REACH_TICKS * period, result.end))
+        {
+            stalledTicks++;
+            continue;
+        }
+        failedTicks += result.failed ? 1 : 0;
+        timeouts += result.timeouts;
+        errors += result.errors;
+        busySkips += result.busySkips;
+        squaredError += result.squaredError;
+        maxError = std::max(maxError, result.maxError);
+        compared += result.compared;
+    }
+    AcquisitionStats stats = acquisition.getStats();
+    acquisition.stop();
+
+    bool ok = true;
+    printf("ticks=%lu failed=%d timeouts=%lu latency avg=%lldus max=%lldus skew avg=%lldus max=%lldus gap max=%lldus\n",
+           (unsigned long)stats.ticks, failedTicks, (unsigned long)stats.timeouts,
+           (long long)(stats.ticks > 0 ? stats.totalLatency / stats.ticks : 0), (long long)stats.maxLatency,
+           (long long)(stats.ticks > 0 ? stats.totalSkew / stats.ticks : 0), (long long)stats.maxSkew,
+           (long long)stats.maxAlignmentGap);
+    int64_t busySum = 0;
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        const AcquisitionBusStats &busStats = stats.buses[bus];
+        uint32_t switches = muxes[bus].getSwitches() - switchesBefore[bus];
+        uint32_t misroutes = 0;
+        for (size_t i = 0; i < SIM_SENSOR_COUNT; i++)
+        {
+            misroutes += LAYOUT[i].bus == bus ? devices[i]->misroutes : 0;
+        }
+        busySum += busStats.busyTime;
+        printf("bus %d: sensors=%lu reads=%lu errors=%lu skips=%lu busy=%.1f%% max tick busy=%lldus "
+               "switches=%lu collisions=%lu misroutes=%lu\n",
+               bus, (unsigned long)busStats.sensors, (unsigned long)busStats.reads, (unsigned long)busStats.errors,
+               (unsigned long)busStats.busySkips, 100 * busStats.utilisation, (long long)busStats.maxTickBusyTime,
+               (unsigned long)switches, (unsigned long)ports[bus].collisions.load(), (unsigned long)misroutes);
+        if (ports[bus].collisions > 0 || misroutes > 0)
+        {
+            fprintf(stderr, "FAIL: bus %d carried overlapping or misrouted transactions\n", bus);
+            ok = false;
+        }
+        // Two channels per bus, each selected once per tick
+        if (switches > 2 * stats.ticks + 2)
+        {
+            fprintf(stderr, "FAIL: bus %d switched the mux %lu times in %lu ticks\n", bus,
+                    (unsigned long)switches, (unsigned long)stats.ticks);
+            ok = false;
+        }
+    }
+
+    int64_t overlapped = overlap(ports[0].transfers, ports[1].transfers);
+    int64_t smallerBusy = std::min(stats.buses[0].busyTime, stats.buses[1].busyTime);
+    printf("overlap=%lldus (%.1f%% of the less busy bus) latency/serial=%.2f\n", (long long)overlapped,
+           smallerBusy > 0 ? 100.0 * overlapped / smallerBusy : 0.0,
+           busySum > 0 ? (double)stats.totalLatency / busySum : 0.0);
+    if (overlapped < smallerBusy / 2 || stats.totalLatency >= busySum)
+    {
+        fprintf(stderr, "FAIL: the buses did not run concurrently\n");
+        ok = false;
+    }
+    printf("host stalls=%zu, %d of %zu ticks left out of the timing checks\n", monitor.count(), stalledTicks,
+           results.size());
+    if (errors > 0 || busySkips > 0)
+    {
+        fprintf(stderr, "FAIL: %lu bus errors, %lu missed ticks\n", (unsigned long)errors, (unsigned long)busySkips);
+        ok = false;
+    }
+    if (stalledTicks > SIM_MAX_STALLED_FRACTION * results.size())
+    {
+        fprintf(stderr, "FAIL: the host stalled too often to judge the timing\n");
+        ok = false;
+    }
+    if (failedTicks > 0 || timeouts > 0)
+    {
+        fprintf(stderr, "FAIL: %d ticks failed\n", failedTicks);
+        ok = false;
+    }
+
+    // Reconstructed timestamps are late by the age of the newest frame, at
+    // most one sample period plus the FIFO length read
+    double slope = 2 * M_PI * SIM_MOTION_FREQUENCY * SIM_MOTION_AMPLITUDE;
+    double bound = slope * (SIM_SAMPLE_PERIOD_US + 1000) / 1e6;
+    double rmsError = compared > 0 ? sqrt(squaredError / compared) : 0;
+    printf("alignment: %zu samples rms=%.4f max=%.4f bound=%.4f m/s^2\n", compared, rmsError, maxError, bound);
+    if (compared == 0 || maxError > bound)
+    {
+        fprintf(stderr, "FAIL: aligned samples out of bounds\n");
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+// Runs BurstScheduler against a simulated access point beacon clock.
+//
+// Usage: burst_sim [duration_s] [drift_ppm] [sync_ms]
+// Defaults: 60 40 1000
+//
+// Samples arrive every 7 ms with some jitter and queue like in the sample
+// pipeline. The access point sends a beacon whenever its TSF is a multiple of
+// 102.4 ms. Its TSF runs drift_ppm fast against the local clock and starts at
+// a random offset. The station reads the TSF every sync_ms like the firmware
+// does and the scheduler only learns the beacon times from that. Every burst
+// is checked against the real wake windows. For each listen interval and
+// latency budget it prints the latency, how many bursts caught a wake window,
+// and the radio duty cycle of the model in burst_scheduler.hpp (both the
+// real one and the scheduler's own estimate). The first row is the radio
+// kept awake. Exits non-zero if a sample waited longer than its budget, the
+// queue overflowed, or fewer than 95% of the bursts were aligned while the
+// budget covered a whole wake period.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "network/burst_scheduler.hpp"
+
+#define SIM_SAMPLE_PERIOD_US 7000
+#define SIM_SAMPLE_JITTER_US 300
+// As SAMPLE_PIPELINE_RING_SIZE
+#define SIM_QUEUE_CAPACITY 32
+// esp_timer callbacks and the TX task wakeup are not instant
+#define SIM_TIMER_LATENCY_US 80
+// Slack on the budget for that latency
+#define SIM_LATENCY_SLACK_US 500
+
+// TSF of the access point as a function of the local clock
+struct BeaconClock
+{
+    int64_t offset; // us
+    double drift;   // relative, 40 ppm = 40e-6
+
+    int64_t tsf(int64_t local) const
+    {
+        return offset + local + (int64_t)(local * drift);
+    }
+
+    // Local time of the latest TSF multiple of period at or before local
+    int64_t wakeBefore(int64_t local, int64_t period) const
+    {
+        int64_t start = tsf(local);
+        int64_t wake = start - start % period;
+        return local - (int64_t)((start - wake) / (1.0 + drift));
+    }
+};
+
+struct SimResult
+{
+    uint32_t bursts;
+    uint32_t aligned; // inside a real wake window
+    uint32_t frames;
+    uint32_t overflows;
+    int64_t totalLatency;
+    int64_t maxLatency;
+    int64_t awakeTime; // us, real, from the radio model
+    int64_t estimatedAwake;
+    int64_t duration;
+};
+
+static int64_t jitter()
+{
+    return (int64_t)(rand() % (2 * SIM_SAMPLE_JITTER_US + 1)) - SIM_SAMPLE_JITTER_US;
+}
+
+static SimResult simulate(uint8_t listenInterval, int64_t budget, int64_t duration, double drift, int64_t syncPeriod)
+{
+    BeaconClock clock;
+    clock.offset = (int64_t)rand() * 1000 + rand() % 1000;
+    clock.drift = drift;
+
+    BurstScheduler scheduler;
+    BurstConfig config = BurstScheduler::defaultConfig();
+    config.listenInterval = listenInterval;
+    config.latencyBudget = budget;
+    scheduler.configure(config);
+    int64_t wakePeriod = scheduler.getWakePeriod();
+
+    SimResult result = {};
+    result.duration = duration;
+    int64_t queue[SIM_QUEUE_CAPACITY];
+    size_t head = 0;
+    size_t depth = 0;
+    int64_t nextSample = SIM_SAMPLE_PERIOD_US;
+    int64_t nextSync = 0;
+    int64_t timer = -1;
+    scheduler.resetStats(0);
+
+    for (;;)
+    {
+        int64_t now = nextSample;
+        if (timer >= 0 && timer < now)
+        {
+            now = timer;
+        }
+        if (nextSync < now)
+        {
+            now = nextSync;
+        }
+        if (now >= duration)
+        {
+            break;
+        }
+
+        if (now == nextSync)
+        {
+            // Same as WifiManager::getBeaconTime
+            scheduler.syncBeacon(now - clock.tsf(now) % wakePeriod);
+            nextSync += syncPeriod;
+            continue;
+        }
+        if (now == nextSample)
+        {
+            if (depth < SIM_QUEUE_CAPACITY)
+            {
+                queue[(head + depth) % SIM_QUEUE_CAPACITY] = now;
+                depth++;
+            }
+            else
+            {
+                result.overflows++;
+            }
+            nextSample += SIM_SAMPLE_PERIOD_US + jitter();
+        }
+        else
+        {
+            timer = -1;
+        }
+
+        // What SamplePipeline::sendBurst does on every wakeup
+        if (depth == 0)
+        {
+            continue;
+        }
+        int64_t burstTime = scheduler.getBurstTime(queue[head], depth, SIM_QUEUE_CAPACITY);
+        if (burstTime > now)
+        {
+            timer = burstTime + SIM_TIMER_LATENCY_US;
+            continue;
+        }
+        bool forced = depth + 1 >= SIM_QUEUE_CAPACITY;
+        int64_t totalLatency = 0;
+        int64_t maxLatency = 0;
+        uint32_t count = (uint32_t)depth;
+        while (depth > 0)
+        {
+            int64_t latency = now - queue[head];
+            totalLatency += latency;
+            maxLatency = latency > maxLatency ? latency : maxLatency;
+            head = (head + 1) % SIM_QUEUE_CAPACITY;
+            depth--;
+        }
+        scheduler.onBurst(now, count, totalLatency, maxLatency, forced);
+
+        bool aligned = now - clock.wakeBefore(now, wakePeriod) < BURST_BEACON_AWAKE_US;
+        result.bursts++;
+        result.aligned += aligned ? 1 : 0;
+        result.frames += count;
+        result.totalLatency += totalLatency;
+        result.maxLatency = maxLatency > result.maxLatency ? maxLatency : result.maxLatency;
+        result.awakeTime += (aligned ? 0 : BURST_TX_AWAKE_US) + (int64_t)count * BURST_FRAME_AIRTIME_US;
+    }
+    result.awakeTime += duration / wakePeriod * BURST_BEACON_AWAKE_US;
+    BurstStats stats = scheduler.getStats(duration);
+    result.estimatedAwake = stats.awakeTime;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int64_t duration = (argc > 1 ? strtoll(argv[1], nullptr, 10) : 60) * 1000000;
+    double drift = (argc > 2 ? strtod(argv[2], nullptr) : 40.0) * 1e-6;
+    int64_t syncPeriod = (argc > 3 ? strtoll(argv[3], nullptr, 10) : 1000) * 1000;
+    if (duration <= 0 || syncPeriod <= 0)
+    {
+        fprintf(stderr, "Duration and sync period must be positive\n");
+        return 1;
+    }
+    srand(1);
+
+    printf("%-8s %-9s %11s %11s %9s %12s %9s %9s\n", "listen", "budget", "avg", "max", "aligned", "frames/burst",
+           "duty", "est duty");
+    printf("%-8s %-9s %9.1fms %9.1fms %9s %12.1f %8.1f%% %9s\n", "-", "awake", 0.0, 0.0, "-", 1.0, 100.0, "-");
+
+    const uint8_t listenIntervals[] = {1, 2};
+    const int64_t budgets[] = {20000, 50000, 110000, 220000};
+    bool ok = true;
+    for (uint8_t listenInterval : listenIntervals)
+    {
+        for (int64_t budget : budgets)
+        {
+            SimResult result = simulate(listenInterval, budget, duration, drift, syncPeriod);
+            double alignedShare = result.bursts > 0 ? (double)result.aligned / result.bursts : 0.0;
+            printf("%-8u %6.0fms %9.1fms %9.1fms %8.1f%% %12.1f %8.1f%% %8.1f%%\n", listenInterval, budget / 1000.0,
+                   result.frames > 0 ? result.totalLatency / 1000.0 / result.frames : 0.0,
+                   result.maxLatency / 1000.0, 100.0 * alignedShare,
+                   result.bursts > 0 ? (double)result.frames / result.bursts : 0.0,
+                   100.0 * result.awakeTime / result.duration, 100.0 * result.estimatedAwake / result.duration);
+            int64_t wakePeriod = (int64_t)BURST_BEACON_INTERVAL_US * listenInterval;
+            if (result.maxLatency > budget + SIM_LATENCY_SLACK_US || result.overflows > 0 ||
+                (budget >= wakePeriod + BURST_BEACON_AWAKE_US && alignedShare < 0.95))
+            {
+                printf("  failed: overflows=%u\n", result.overflows);
+                ok = false;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
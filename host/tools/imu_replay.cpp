@@ -0,0 +1,328 @@
+// Replays a recorded register trace against the IMU driver.
+//
+// Usage: imu_replay [trace]
+//        imu_replay --annotate <capture>
+// Default: host/traces/bmi160_fifo.trace
+//
+// Every bus access of the driver must match the next R/W line of the trace,
+// reads return the recorded bytes. The samples decoded from each FIFO burst
+// are compared against the S lines and the final stats against the C line.
+// Exits non-zero on the first mismatch.
+//
+// --annotate takes the R/W lines printed with SLIMEFY_IMU_TRACE and prints
+// them as a trace with the decoded S lines and the C line filled in. A
+// burst cut off by the end of the capture is dropped.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "sensors/bmi160.hpp"
+
+#define REPLAY_FIFO_CAPACITY 8
+#define REPLAY_TOLERANCE 1e-4f
+
+struct TraceAccess
+{
+    bool write;
+    uint8_t reg;
+    std::vector<uint8_t> data;
+    int line;
+};
+
+struct ExpectedSample
+{
+    float values[6];
+    int line;
+};
+
+class TraceImuBus : public ImuBus
+{
+private:
+    const std::vector<TraceAccess> &accesses;
+    size_t position;
+    bool failed;
+    bool exhausted;
+    // Accesses replayed since the last takeEcho(), as trace lines
+    std::string echo;
+
+public:
+    TraceImuBus(const std::vector<TraceAccess> &accesses)
+        : accesses(accesses), position(0), failed(false), exhausted(false) {}
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override
+    {
+        const TraceAccess *access = next();
+        if (access == nullptr || access->write || access->reg != reg || access->data.size() != length)
+        {
+            return mismatch("read", reg, length, access);
+        }
+        memcpy(data, access->data.data(), length);
+        char line[8];
+        snprintf(line, sizeof(line), "R %02X", reg);
+        echo += line;
+        for (size_t i = 0; i < length; i++)
+        {
+            snprintf(line, sizeof(line), " %02X", data[i]);
+            echo += line;
+        }
+        echo += "\n";
+        return ESP_OK;
+    }
+
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override
+    {
+        const TraceAccess *access = next();
+        if (access == nullptr || !access->write || access->reg != reg || access->data[0] != value)
+        {
+            return mismatch("write", reg, value, access);
+        }
+        char line[16];
+        snprintf(line, sizeof(line), "W %02X %02X\n", reg, value);
+        echo += line;
+        return ESP_OK;
+    }
+
+    bool done() const
+    {
+        return position == accesses.size();
+    }
+
+    bool hasFailed() const
+    {
+        return failed;
+    }
+
+    // The driver ran past the last line, anything else is a mismatch
+    bool hasRunOut() const
+    {
+        return exhausted;
+    }
+
+    std::string takeEcho()
+    {
+        std::string lines;
+        lines.swap(echo);
+        return lines;
+    }
+
+private:
+    const TraceAccess *next()
+    {
+        return position < accesses.size() ? &accesses[position++] : nullptr;
+    }
+
+    esp_err_t mismatch(const char *kind, uint8_t reg, size_t value, const TraceAccess *access)
+    {
+        if (access == nullptr)
+        {
+            exhausted = true;
+            fprintf(stderr, "%s of 0x%02X (%zu) past the end of the trace\n", kind, reg, value);
+        }
+        else
+        {
+            fprintf(stderr, "line %d: driver did a %s of 0x%02X (%zu), trace has a %s of 0x%02X (%zu)\n", access->line,
+                    kind, reg, value, access->write ? "write" : "read", access->reg,
+                    access->write ? (size_t)access->data[0] : access->data.size());
+        }
+        failed = true;
+        return ESP_FAIL;
+    }
+};
+
+static bool loadTrace(const char *path, std::vector<TraceAccess> &accesses, std::vector<ExpectedSample> &samples,
+                      unsigned long expectedStats[4], bool *hasStats)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        perror(path);
+        return false;
+    }
+    char line[4096];
+    int number = 0;
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        number++;
+        char *cursor = line;
+        char kind = line[0];
+        if (kind == 'R' || kind == 'W')
+        {
+            TraceAccess access;
+            access.write = kind == 'W';
+            access.line = number;
+            access.reg = (uint8_t)strtoul(cursor + 1, &cursor, 16);
+            for (;;)
+            {
+                char *end;
+                unsigned long value = strtoul(cursor, &end, 16);
+                if (end == cursor)
+                {
+                    break;
+                }
+                access.data.push_back((uint8_t)value);
+                cursor = end;
+            }
+            if (access.data.empty() || (access.write && access.data.size() != 1))
+            {
+                fprintf(stderr, "line %d: malformed access\n", number);
+                fclose(file);
+                return false;
+            }
+            accesses.push_back(access);
+        }
+        else if (kind == 'S')
+        {
+            ExpectedSample sample;
+            sample.line = number;
+            for (int i = 0; i < 6; i++)
+            {
+                sample.values[i] = strtof(cursor + (i == 0 ? 1 : 0), &cursor);
+            }
+            samples.push_back(sample);
+        }
+        else if (kind == 'C')
+        {
+            *hasStats = sscanf(line + 1, "%lu %lu %lu %lu", &expectedStats[0], &expectedStats[1],
+                               &expectedStats[2], &expectedStats[3]) == 4;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static int annotate(const char *path, const std::vector<TraceAccess> &accesses)
+{
+    TraceImuBus bus(accesses);
+    Bmi160 imu(bus);
+    esp_err_t res = imu.init(Bmi160::defaultConfig());
+    if (res != ESP_OK)
+    {
+        fprintf(stderr, "init failed: %s\n", esp_err_to_name(res));
+        return 1;
+    }
+    printf("# BMI160 captured with SLIMEFY_IMU_TRACE from %s, annotated by imu_replay.\n", path);
+    printf("# S lines are what the driver decoded, check them before checking this in.\n");
+    printf("%s", bus.takeEcho().c_str());
+
+    size_t decoded = 0;
+    int64_t now = 0;
+    ImuStats stats = imu.getStats();
+    while (!bus.done())
+    {
+        ImuSample samples[REPLAY_FIFO_CAPACITY];
+        size_t count = 0;
+        now += 10000;
+        res = imu.readFifo(samples, REPLAY_FIFO_CAPACITY, &count, now);
+        if (res != ESP_OK && bus.hasRunOut())
+        {
+            fprintf(stderr, "dropped the burst cut off by the end of the capture\n");
+            break;
+        }
+        if (res != ESP_OK || bus.hasFailed())
+        {
+            fprintf(stderr, "readFifo failed: %s\n", esp_err_to_name(res));
+            return 1;
+        }
+        printf("%s", bus.takeEcho().c_str());
+        for (size_t i = 0; i < count; i++, decoded++)
+        {
+            const ImuSample &sample = samples[i];
+            printf("S %.5f %.5f %.5f %.6f %.6f %.6f\n", sample.acceleration[0], sample.acceleration[1],
+                   sample.acceleration[2], sample.angularVelocity[0], sample.angularVelocity[1],
+                   sample.angularVelocity[2]);
+        }
+        // Stats as of the last burst that made it into the output
+        stats = imu.getStats();
+    }
+    printf("C %lu %lu %lu %lu\n", (unsigned long)stats.bursts, (unsigned long)stats.frames,
+           (unsigned long)stats.emptyReads, (unsigned long)stats.overruns);
+    fprintf(stderr, "%zu samples decoded\n", decoded);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool annotating = argc > 2 && strcmp(argv[1], "--annotate") == 0;
+    const char *path = annotating ? argv[2] : argc > 1 ? argv[1] : "host/traces/bmi160_fifo.trace";
+    std::vector<TraceAccess> accesses;
+    std::vector<ExpectedSample> expected;
+    unsigned long expectedStats[4];
+    bool hasStats = false;
+    if (!loadTrace(path, accesses, expected, expectedStats, &hasStats))
+    {
+        return 1;
+    }
+    if (annotating)
+    {
+        return annotate(path, accesses);
+    }
+
+    TraceImuBus bus(accesses);
+    Bmi160 imu(bus);
+    esp_err_t res = imu.init(Bmi160::defaultConfig());
+    if (res != ESP_OK)
+    {
+        fprintf(stderr, "init failed: %s\n", esp_err_to_name(res));
+        return 1;
+    }
+
+    size_t checked = 0;
+    int64_t now = 0;
+    while (!bus.done())
+    {
+        ImuSample samples[REPLAY_FIFO_CAPACITY];
+        size_t count = 0;
+        now += 10000;
+        res = imu.readFifo(samples, REPLAY_FIFO_CAPACITY, &count, now);
+        if (res != ESP_OK || bus.hasFailed())
+        {
+            fprintf(stderr, "readFifo failed: %s\n", esp_err_to_name(res));
+            return 1;
+        }
+        for (size_t i = 0; i < count; i++, checked++)
+        {
+            if (checked >= expected.size())
+            {
+                fprintf(stderr, "driver decoded more samples than the trace lists\n");
+                return 1;
+            }
+            const ImuSample &sample = samples[i];
+            const float actual[6] = {sample.acceleration[0], sample.acceleration[1], sample.acceleration[2],
+                                     sample.angularVelocity[0], sample.angularVelocity[1], sample.angularVelocity[2]};
+            for (int axis = 0; axis < 6; axis++)
+            {
+                float tolerance = REPLAY_TOLERANCE * fmaxf(1.0f, fabsf(expected[checked].values[axis]));
+                if (fabsf(actual[axis] - expected[checked].values[axis]) > tolerance)
+                {
+                    fprintf(stderr, "line %d: axis %d decoded as %f, expected %f\n", expected[checked].line, axis,
+                            actual[axis], expected[checked].values[axis]);
+                    return 1;
+                }
+            }
+        }
+    }
+    if (checked != expected.size())
+    {
+        fprintf(stderr, "driver decoded %zu samples, the trace lists %zu\n", checked, expected.size());
+        return 1;
+    }
+
+    ImuStats stats = imu.getStats();
+    printf("%zu accesses, %zu samples: bursts=%lu frames=%lu bytes=%lu empty=%lu overruns=%lu errors=%lu\n",
+           accesses.size(), checked, (unsigned long)stats.bursts, (unsigned long)stats.frames,
+           (unsigned long)stats.bytes, (unsigned long)stats.emptyReads, (unsigned long)stats.overruns,
+           (unsigned long)stats.errors);
+    if (hasStats && (stats.bursts != expectedStats[0] || stats.frames != expectedStats[1] ||
+                     stats.emptyReads != expectedStats[2] || stats.overruns != expectedStats[3]))
+    {
+        fprintf(stderr, "stats differ from the trace: bursts=%lu frames=%lu empty=%lu overruns=%lu\n",
+                expectedStats[0], expectedStats[1], expectedStats[2], expectedStats[3]);
+        return 1;
+    }
+    return 0;
+}
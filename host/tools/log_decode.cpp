@@ -0,0 +1,129 @@
+// Decodes the deferred log records in a captured console log.
+//
+// Usage: log_decode [capture]
+// Default: reads stdin, e.g. tracker_sim ... binary | log_decode
+//
+// Lines that start with "#DL " are records dumped by the firmware's deferred
+// log in binary mode. They are printed the way the flush task would format
+// them, with the core they were recorded on. Every other line is passed
+// through unchanged. Counts go to stderr at the end, exits non-zero when a
+// record line could not be decoded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/deferred_log_formats.hpp"
+
+#define DECODE_LINE_SIZE 1024
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static uint32_t loadBigEndian(const uint8_t *bytes, size_t size)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// Prints one record, false if the line is not a valid record
+static bool decodeRecord(const char *hex)
+{
+    uint8_t bytes[8 + 4 * DEFERRED_LOG_MAX_ARGS];
+    size_t size = 0;
+    while (hex[0] != '\0' && hex[0] != '\n' && hex[0] != '\r')
+    {
+        int high = hexValue(hex[0]);
+        int low = hex[1] != '\0' ? hexValue(hex[1]) : -1;
+        if (high < 0 || low < 0 || size == sizeof(bytes))
+        {
+            return false;
+        }
+        bytes[size++] = (uint8_t)(high << 4 | low);
+        hex += 2;
+    }
+    if (size < 8)
+    {
+        return false;
+    }
+    uint8_t core = bytes[0];
+    uint32_t timestamp = loadBigEndian(bytes + 1, 4);
+    uint16_t format = (uint16_t)loadBigEndian(bytes + 5, 2);
+    uint8_t argCount = bytes[7];
+    if (format >= LOG_FORMAT_COUNT || argCount != LOG_FORMATS[format].argCount || size != 8 + 4 * (size_t)argCount)
+    {
+        return false;
+    }
+    unsigned long args[DEFERRED_LOG_MAX_ARGS] = {};
+    for (uint8_t i = 0; i < argCount; i++)
+    {
+        args[i] = loadBigEndian(bytes + 8 + 4 * i, 4);
+    }
+    const LogFormatInfo &info = LOG_FORMATS[format];
+    char message[256];
+    snprintf(message, sizeof(message), info.format, args[0], args[1], args[2], args[3], args[4], args[5]);
+    printf("%c (%lu) [%d] %s: %s\n", info.level, (unsigned long)timestamp, core, info.tag, message);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    if (argc > 1)
+    {
+        input = fopen(argv[1], "r");
+        if (input == nullptr)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    const size_t prefixLength = strlen(DEFERRED_LOG_DUMP_PREFIX);
+    unsigned long decoded = 0;
+    unsigned long malformed = 0;
+    unsigned long passed = 0;
+    char line[DECODE_LINE_SIZE];
+    while (fgets(line, sizeof(line), input) != nullptr)
+    {
+        if (strncmp(line, DEFERRED_LOG_DUMP_PREFIX, prefixLength) != 0)
+        {
+            fputs(line, stdout);
+            passed++;
+            continue;
+        }
+        if (decodeRecord(line + prefixLength))
+        {
+            decoded++;
+        }
+        else
+        {
+            printf("? %s", line);
+            malformed++;
+        }
+    }
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+    fprintf(stderr, "records=%lu malformed=%lu other lines=%lu\n", decoded, malformed, passed);
+    return malformed == 0 ? 0 : 1;
+}
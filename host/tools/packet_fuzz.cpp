@@ -0,0 +1,244 @@
+// Feeds the inbound corpus and random mutations of it to SlimeVRClient's
+// receive path.
+//
+// Usage: packet_fuzz [corpus] [rounds] [seed]
+// Defaults: host/traces/inbound.corpus 1000000 1
+//
+// Every datagram is copied so that its last byte sits right in front of a
+// PROT_NONE page, a read past the end of it faults. Seeds first go to a
+// client that is not connected yet, then everything goes to a connected one.
+// Clients send through LoopbackTransport, replies never leave the process.
+// Heap allocations are counted while datagrams are handled. Exits non-zero
+// on a fault or if anything was allocated. The client's deferred log is
+// discarded, only the number of records is printed.
+
+#include <atomic>
+#include <new>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <vector>
+
+#include "network/loopback_transport.hpp"
+#include "network/packet_schema.hpp"
+#include "network/slimevr_client.hpp"
+#include "utils/deferred_log.hpp"
+
+static std::atomic<size_t> allocationCount{0};
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+static void onFault(int)
+{
+    static const char message[] = "read past the end of a datagram\n";
+    (void)!write(STDOUT_FILENO, message, sizeof(message) - 1);
+    _exit(1);
+}
+
+static bool loadCorpus(const char *path, std::vector<std::vector<uint8_t>> &corpus)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        perror(path);
+        return false;
+    }
+    char line[4 * SLIMEVR_RECEIVE_BUFFER_SIZE];
+    int number = 0;
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        number++;
+        char *cursor = line;
+        while (*cursor == ' ' || *cursor == '\t')
+        {
+            cursor++;
+        }
+        if (*cursor == '#' || *cursor == '\n' || *cursor == '\0')
+        {
+            continue;
+        }
+        std::vector<uint8_t> datagram;
+        if (*cursor != '-')
+        {
+            for (;;)
+            {
+                char *end;
+                unsigned long value = strtoul(cursor, &end, 16);
+                if (end == cursor)
+                {
+                    break;
+                }
+                if (value > 0xFF || datagram.size() == SLIMEVR_RECEIVE_BUFFER_SIZE)
+                {
+                    fprintf(stderr, "%s:%d: bad datagram\n", path, number);
+                    fclose(file);
+                    return false;
+                }
+                datagram.push_back((uint8_t)value);
+                cursor = end;
+            }
+        }
+        corpus.push_back(datagram);
+    }
+    fclose(file);
+    return true;
+}
+
+// One of: flip bits, cut it short, append random bytes or set the type byte
+// to something near the handled types
+static size_t mutate(const std::vector<uint8_t> &seed, unsigned char *datagram)
+{
+    size_t size = seed.size();
+    memcpy(datagram, seed.data(), size);
+    switch (esp_random() % 4)
+    {
+    case 0:
+        for (uint32_t flips = 1 + esp_random() % 4; size > 0 && flips > 0; flips--)
+        {
+            datagram[esp_random() % size] ^= (unsigned char)(1 << (esp_random() % 8));
+        }
+        break;
+    case 1:
+        size = size > 0 ? esp_random() % size : 0;
+        break;
+    case 2:
+        for (uint32_t extra = 1 + esp_random() % 32; extra > 0 && size < SLIMEVR_RECEIVE_BUFFER_SIZE; extra--)
+        {
+            datagram[size++] = (unsigned char)esp_random();
+        }
+        break;
+    default:
+        if (size >= sizeof(uint32_t))
+        {
+            datagram[3] = (unsigned char)(esp_random() % (SLIMEVR_INBOUND_TYPES + 4));
+        }
+        break;
+    }
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "host/traces/inbound.corpus";
+    unsigned long rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000;
+    unsigned long seed = argc > 3 ? strtoul(argv[3], nullptr, 10) : 1;
+    srand(seed);
+
+    std::vector<std::vector<uint8_t>> corpus;
+    if (!loadCorpus(path, corpus) || corpus.empty())
+    {
+        fprintf(stderr, "No datagrams in %s\n", path);
+        return 1;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    unsigned char *pages = (unsigned char *)mmap(nullptr, 2 * pageSize, PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED || mprotect(pages + pageSize, pageSize, PROT_NONE) != 0)
+    {
+        perror("mmap");
+        return 1;
+    }
+    unsigned char *guard = pages + pageSize;
+    static unsigned char scratch[SLIMEVR_RECEIVE_BUFFER_SIZE];
+    signal(SIGSEGV, onFault);
+    signal(SIGBUS, onFault);
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(SLIMEVR_SERVER_PORT);
+    DeferredLog::setOutput(DEFERRED_LOG_DISCARD);
+
+    size_t disconnectedAllocations = 0;
+    for (const std::vector<uint8_t> &datagram : corpus)
+    {
+        LoopbackTransport transport;
+        SlimeVRClient client;
+        client.setTransport(&transport);
+        transport.start(0);
+        unsigned char *slot = guard - datagram.size();
+        memcpy(slot, datagram.data(), datagram.size());
+        size_t before = allocationCount.load();
+        client.internalPacketReceived(slot, datagram.size(), server, sizeof(server));
+        disconnectedAllocations += allocationCount.load() - before;
+    }
+
+    LoopbackTransport transport;
+    SlimeVRClient client;
+    client.setTransport(&transport);
+    transport.start(0);
+    const unsigned char handshake[] = {PACKET_HANDSHAKE, 0, 0, 0};
+    memcpy(guard - sizeof(handshake), handshake, sizeof(handshake));
+    client.internalPacketReceived(guard - sizeof(handshake), sizeof(handshake), server, sizeof(server));
+    if (!client.isConnected())
+    {
+        fprintf(stderr, "Client did not take the handshake\n");
+        return 1;
+    }
+
+    size_t allocationsBefore = allocationCount.load();
+    for (const std::vector<uint8_t> &datagram : corpus)
+    {
+        unsigned char *slot = guard - datagram.size();
+        memcpy(slot, datagram.data(), datagram.size());
+        client.internalPacketReceived(slot, datagram.size(), server, sizeof(server));
+    }
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        size_t size = mutate(corpus[esp_random() % corpus.size()], scratch);
+        unsigned char *slot = guard - size;
+        memcpy(slot, scratch, size);
+        client.internalPacketReceived(slot, size, server, sizeof(server));
+    }
+    size_t connectedAllocations = allocationCount.load() - allocationsBefore;
+
+    ReceiveStats stats = client.getReceiveStats();
+    printf("%zu seeds, %lu mutated datagrams: malformed=%u unknown=%u\n", corpus.size(), rounds, stats.malformed,
+           stats.unknown);
+    printf("replies: %u, log records: %u\n", transport.getStats().sent, DeferredLog::getStats().recorded);
+    printf("allocations while handling: %zu before the connection, %zu after\n", disconnectedAllocations,
+           connectedAllocations);
+    return disconnectedAllocations == 0 && connectedAllocations == 0 ? 0 : 1;
+}
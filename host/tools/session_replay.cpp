@@ -0,0 +1,373 @@
+// Records a simulated session into an image and replays session images.
+//
+// Usage: session_replay record [image] [seconds]
+//        session_replay [image] [speed]
+// Default: session.img, 60 seconds, speed 0 (as fast as possible)
+//
+// record runs the firmware's sampling and send path on a simulated clock:
+// four BMI160 at 200 Hz moving in bursts with rest in between, read once per
+// 7 ms tick, aligned, fused and framed like sampleSensors() does it, plus two
+// sensors with stand-in values. Frames go through a SlimeVRClient whose
+// datagrams are recorded by a RecordingTransport. The image has the layout
+// of the session partition, so a dump of a tracker's partition replays the
+// same way. Replaying prints the encoding density and the comparison of the
+// replayed packets and exits non-zero when any of them differs.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "network/loopback_transport.hpp"
+#include "network/recording_transport.hpp"
+#include "network/slimevr_client.hpp"
+#include "sensors/imu_acquisition.hpp"
+#include "storage/session_recorder.hpp"
+#include "storage/session_replay.hpp"
+#include "utils/timing.hpp"
+
+// Size of the session partition in partitions.csv
+#define SIM_IMAGE_SIZE 0x2F0000
+#define SIM_TICK_US 7000
+#define SIM_SEND_DELAY_US 400
+#define SIM_SAMPLE_PERIOD_US 5000
+#define SIM_IMUS 4
+#define SIM_SENSORS 6
+#define SIM_ACCELERATION_SCALE (4 * 9.80665f / 32768.0f)
+#define SIM_ANGULAR_VELOCITY_SCALE (2000 * 0.017453293f / 32768.0f)
+// Seconds of motion, then of rest
+#define SIM_MOTION_SECONDS 3
+#define SIM_REST_SECONDS 2
+
+class ImageStore : public SessionStore
+{
+public:
+    std::vector<uint8_t> image;
+
+    explicit ImageStore(size_t size) : image(size, 0xFF) {}
+
+    uint32_t getBlockCount() override
+    {
+        return image.size() / SESSION_BLOCK_SIZE;
+    }
+
+    esp_err_t writeBlock(uint32_t index, const uint8_t *block) override
+    {
+        if (index >= getBlockCount())
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(image.data() + (size_t)index * SESSION_BLOCK_SIZE, block, SESSION_BLOCK_SIZE);
+        return ESP_OK;
+    }
+
+    esp_err_t readBlock(uint32_t index, uint8_t *block) override
+    {
+        if (index >= getBlockCount())
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(block, image.data() + (size_t)index * SESSION_BLOCK_SIZE, SESSION_BLOCK_SIZE);
+        return ESP_OK;
+    }
+
+    // Blocks up to the first one that is still erased
+    size_t getUsedBlocks()
+    {
+        size_t used = 0;
+        while (used < getBlockCount() && image[used * SESSION_BLOCK_SIZE] != 0xFF)
+        {
+            used++;
+        }
+        return used;
+    }
+};
+
+struct SimImu
+{
+    uint8_t id;
+    int64_t nextSample;
+    double phase;
+    ImuSample previous;
+    bool hasPrevious;
+    bool hasSample;
+    float acceleration[3];
+    SensorFusion fusion;
+};
+
+static uint32_t noiseState = 0x12345678;
+
+// Roughly the noise of a BMI160 at rest, in LSB
+static int noise(int amplitude)
+{
+    noiseState ^= noiseState << 13;
+    noiseState ^= noiseState >> 17;
+    noiseState ^= noiseState << 5;
+    return (int)(noiseState % (2 * amplitude + 1)) - amplitude;
+}
+
+static int16_t clampRaw(double value)
+{
+    return (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : lround(value));
+}
+
+// FIFO frames the driver decodes at readTime, timestamps counting back from it
+static size_t readFifo(SimImu &imu, int64_t readTime, ImuSample *samples)
+{
+    size_t count = 0;
+    while (imu.nextSample <= readTime && count < ACQUISITION_FIFO_BATCH)
+    {
+        double t = imu.nextSample / 1e6;
+        bool moving = fmod(t, SIM_MOTION_SECONDS + SIM_REST_SECONDS) < SIM_MOTION_SECONDS;
+        double swing = moving ? sin(2 * M_PI * 0.8 * t + imu.phase) : 0.0;
+        int16_t raw[6];
+        raw[0] = clampRaw(swing * 3.0 / SIM_ANGULAR_VELOCITY_SCALE + noise(2));
+        raw[1] = clampRaw(swing * 1.5 / SIM_ANGULAR_VELOCITY_SCALE + noise(2));
+        raw[2] = clampRaw(noise(2));
+        raw[3] = clampRaw(swing * 2.0 / SIM_ACCELERATION_SCALE + noise(20));
+        raw[4] = clampRaw(noise(20));
+        raw[5] = clampRaw(9.80665 / SIM_ACCELERATION_SCALE + noise(20));
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            samples[count].angularVelocity[axis] = raw[axis] * SIM_ANGULAR_VELOCITY_SCALE;
+            samples[count].acceleration[axis] = raw[3 + axis] * SIM_ACCELERATION_SCALE;
+        }
+        count++;
+        imu.nextSample += SIM_SAMPLE_PERIOD_US;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        samples[i].timestamp = readTime - (int64_t)(count - 1 - i) * SIM_SAMPLE_PERIOD_US;
+    }
+    return count;
+}
+
+static int record(const char *path, int seconds)
+{
+    ImageStore store(SIM_IMAGE_SIZE);
+    SessionRecorder *recorder = new SessionRecorder();
+    LoopbackTransport loopback;
+    RecordingTransport transport(loopback, *recorder);
+    SlimeVRClient *client = new SlimeVRClient();
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(6969);
+    client->setTransport(&transport);
+    transport.start(0);
+    transport.connect(server);
+    for (uint8_t id = 1; id <= SIM_SENSORS; id++)
+    {
+        client->registerSensor(id);
+    }
+    client->setRateLimits(20.0f, 1000000.0f / SIM_TICK_US);
+    client->setBundleEnabled(true);
+    SuppressionConfig suppression;
+    suppression.accelerationThreshold = 0.05f;
+    suppression.angleThreshold = 0.02f;
+    suppression.keyframePeriod = 250000;
+    client->setSuppression(suppression);
+
+    SessionStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.bundle = true;
+    stream.compactRotation = false;
+    stream.accelerationThreshold = suppression.accelerationThreshold;
+    stream.angleThreshold = suppression.angleThreshold;
+    stream.keyframePeriod = suppression.keyframePeriod;
+    for (uint8_t id = 1; id <= SIM_SENSORS; id++)
+    {
+        stream.sensorMask |= 1u << id;
+    }
+    stream.standInSeed = 0x9E3779B9;
+    uint32_t standInState = stream.standInSeed;
+    if (recorder->start(store, 0x51DE0001, stream, false) != ESP_OK)
+    {
+        fprintf(stderr, "recorder did not start\n");
+        return 1;
+    }
+
+    SimImu *imus = new SimImu[SIM_IMUS];
+    for (size_t i = 0; i < SIM_IMUS; i++)
+    {
+        SimImu &imu = imus[i];
+        imu.id = (uint8_t)(i + 1);
+        imu.nextSample = 1000000 + (int64_t)i * 700;
+        imu.phase = i * 0.9;
+        imu.hasPrevious = false;
+        imu.hasSample = false;
+        SessionSensor sensor;
+        sensor.id = imu.id;
+        sensor.accelerationScale = SIM_ACCELERATION_SCALE;
+        sensor.angularVelocityScale = SIM_ANGULAR_VELOCITY_SCALE;
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            sensor.gyroBias[axis] = 0.001f * (float)(i + axis);
+        }
+        imu.fusion.setGyroBias(sensor.gyroBias);
+        recorder->addSensor(sensor);
+    }
+
+    int64_t end = 1000000 + (int64_t)seconds * 1000000;
+    uint32_t ticks = 0;
+    uint32_t sent = 0;
+    uint32_t throttled = 0;
+    for (int64_t tick = 1000000; tick < end && recorder->isRecording(); tick += SIM_TICK_US)
+    {
+        SampleFrame frame;
+        frame.timestamp = tick;
+        frame.sensorCount = 0;
+        for (size_t i = 0; i < SIM_IMUS; i++)
+        {
+            SimImu &imu = imus[i];
+            ImuSample samples[ACQUISITION_FIFO_BATCH];
+            size_t count = readFifo(imu, tick + 150 * (int64_t)i, samples);
+            recorder->recordSamples(imu.id, samples, count);
+            ImuSample aligned;
+            int64_t gap;
+            if (!ImuAcquisition::alignSamples(tick, samples, count, &imu.previous, &imu.hasPrevious, &aligned, &gap))
+            {
+                continue;
+            }
+            if (count > 0)
+            {
+                imu.fusion.update(samples, count);
+            }
+            memcpy(imu.acceleration, aligned.acceleration, sizeof(imu.acceleration));
+            imu.hasSample = true;
+        }
+        for (uint8_t id = 1; id <= SIM_SENSORS; id++)
+        {
+            SensorSample &sample = frame.samples[frame.sensorCount++];
+            sample.id = id;
+            sample.hasRotation = false;
+            if (id <= SIM_IMUS && imus[id - 1].hasSample)
+            {
+                memcpy(sample.acceleration, imus[id - 1].acceleration, sizeof(sample.acceleration));
+                sample.rotation = imus[id - 1].fusion.getRotation();
+                sample.hasRotation = true;
+                continue;
+            }
+            sample.acceleration[0] = nextStandInValue(standInState);
+            sample.acceleration[1] = nextStandInValue(standInState);
+            sample.acceleration[2] = nextStandInValue(standInState);
+        }
+        recorder->recordTick(tick);
+        ticks++;
+
+        for (uint8_t i = 0; i < frame.sensorCount; i++)
+        {
+            const SensorSample &sample = frame.samples[i];
+            client->setAcceleration(sample.id, sample.acceleration[0], sample.acceleration[1], sample.acceleration[2]);
+            if (sample.hasRotation)
+            {
+                client->setRotation(sample.id, sample.rotation);
+            }
+        }
+        int64_t sendTime = tick + SIM_SEND_DELAY_US;
+        esp_err_t res = client->sendSensorData(sendTime);
+        recorder->recordSend(frame.timestamp, sendTime, res);
+        sent += res == ESP_OK;
+        throttled += res == ESP_ERR_NOT_FINISHED;
+        LoopbackDatagram datagram;
+        while (loopback.takeSent(&datagram))
+        {
+        }
+        recorder->drain();
+    }
+    recorder->finish();
+
+    SessionRecorderStats stats = recorder->getStats();
+    size_t used = store.getUsedBlocks();
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr || fwrite(store.image.data(), 1, store.image.size(), file) != store.image.size())
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    fclose(file);
+
+    double recorded = ticks * (double)SIM_TICK_US / 1e6;
+    double bytesPerSecond = used * SESSION_BLOCK_SIZE / recorded;
+    printf("recorded %.1f s: ticks=%u sends=%u throttled=%u samples=%u packets=%u records=%u\n", recorded, ticks,
+           sent, throttled, stats.samples, stats.packets, stats.records);
+    printf("blocks=%zu/%u (%.1f KB) %.1f B/sample %.1f KB/s, the partition holds %.1f min\n", used,
+           stats.blockCapacity, used * SESSION_BLOCK_SIZE / 1024.0, (double)used * SESSION_BLOCK_SIZE / stats.samples,
+           bytesPerSecond / 1024.0, stats.blockCapacity * SESSION_BLOCK_SIZE / bytesPerSecond / 60.0);
+    printf("stopped: full=%d overrun=%d dropped=%u write errors=%u\n", stats.full, stats.overrun, stats.dropped,
+           stats.writeErrors);
+    delete[] imus;
+    delete client;
+    delete recorder;
+    return stats.writeErrors == 0 && !stats.overrun ? 0 : 1;
+}
+
+static int replay(const char *path, float speed)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    ImageStore store(size > 0 ? (size_t)size : 0);
+    if (fread(store.image.data(), 1, store.image.size(), file) != store.image.size())
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    SessionReplay *session = new SessionReplay();
+    esp_err_t res = session->run(store, speed);
+    SessionReplayStats stats = session->getStats();
+    delete session;
+    if (stats.blocks == 0)
+    {
+        fprintf(stderr, "no session in %s (%s)\n", path, esp_err_to_name(res));
+        return 1;
+    }
+
+    double recorded = stats.recordedDuration / 1e6;
+    double replayed = stats.replayDuration / 1e6;
+    printf("session: %u blocks, %.1f s, %u ticks, %u samples, %.1f B/sample\n", stats.blocks, recorded, stats.ticks,
+           stats.samples, stats.samples > 0 ? (double)stats.blocks * SESSION_BLOCK_SIZE / stats.samples : 0.0);
+    printf("sends=%u throttled=%u failed=%u frames missing=%u\n", stats.sends, stats.throttled, stats.failed,
+           stats.framesMissing);
+    printf("packets: recorded=%u matched=%u mismatched=%u missing=%u extra=%u fingerprint=%08x\n",
+           stats.packetsRecorded, stats.packetsMatched, stats.packetsMismatched, stats.packetsMissing,
+           stats.packetsExtra, stats.fingerprint);
+    printf("replayed in %.3f s (%.0fx), %.0f samples/s, fusion %.2f us/sample, send %.2f us/frame\n", replayed,
+           replayed > 0 ? recorded / replayed : 0.0, replayed > 0 ? stats.samples / replayed : 0.0,
+           stats.samples > 0 ? stats.fusionCycles / (double)CPU_CYCLES_PER_MICROSECOND / stats.samples : 0.0,
+           stats.sends > 0 ? stats.serializeCycles / (double)CPU_CYCLES_PER_MICROSECOND / stats.sends : 0.0);
+    if (res != ESP_OK)
+    {
+        printf("session ended early: %s\n", esp_err_to_name(res));
+    }
+    bool ok = res == ESP_OK && stats.packetsRecorded > 0 && stats.packetsMismatched == 0 &&
+              stats.packetsMissing == 0 && stats.packetsExtra == 0;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "record") == 0)
+    {
+        const char *path = argc > 2 ? argv[2] : "session.img";
+        int seconds = argc > 3 ? atoi(argv[3]) : 60;
+        return record(path, seconds > 0 ? seconds : 60);
+    }
+    const char *path = argc > 1 ? argv[1] : "session.img";
+    float speed = argc > 2 ? (float)atof(argv[2]) : 0.0f;
+    return replay(path, speed);
+}
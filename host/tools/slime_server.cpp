@@ -0,0 +1,735 @@
+// Minimal SlimeVR server stand-in for load and latency measurements on loopback.
+//
+// Usage: slime_server [options]
+//   --port N                local port of the server (default 6970)
+//   --tracker HOST:PORT     tracker to discover, may be repeated (default 127.0.0.1:6969)
+//   --duration S            seconds to run, 0 runs forever (default 30)
+//   --heartbeat-ms N        heartbeat interval (default 1000)
+//   --ping-ms N             PACKET_PING_PONG interval (default 250)
+//   --report-ms N           statistics report interval (default 5000)
+//   --loss PCT              drop this share of incoming datagrams (default 0)
+//   --capacity N            drop incoming datagrams above N per second (default 0, unlimited)
+//
+// The server sends a discovery packet to every tracker until it answers with a
+// handshake, replies to the handshake, then issues heartbeats and ping-pongs.
+// For every tracker it records datagram and sample rates, inter-arrival jitter,
+// packet number gaps and round trip times. PACKET_PING_PONG probes sent by the
+// tracker are echoed once so it can measure its own round trip time. The loss
+// and capacity options turn loopback into a lossy link for the tracker's rate
+// controller, dropped datagrams show up as gaps. Profiler summaries the
+// tracker sends as PACKET_INSPECTION are printed with the latest p50/p99 per
+// stage and core.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <vector>
+
+#include "network/packet_schema.hpp"
+
+#define HISTOGRAM_BUCKETS 16
+#define PING_SLOTS 64
+// Matches PROFILER_CORES and ProfileStage in src/utils/profiler.hpp
+#define PROFILE_CORES 2
+#define PROFILE_STAGES 6
+
+static const char *PROFILE_STAGE_NAMES[PROFILE_STAGES] = {"sampling", "fusion", "serialize", "send", "receive",
+                                                            "stack send"};
+
+static const char HANDSHAKE_REPLY[] = "Hey OVR =D 5";
+
+static int64_t nowMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Power of two buckets in microseconds, bucket 0 holds everything below 64 us.
+struct Histogram
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+
+    void reset()
+    {
+        memset(this, 0, sizeof(*this));
+        min = INT64_MAX;
+    }
+
+    void add(int64_t value)
+    {
+        int bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && value >= (64LL << bucket))
+        {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+        sum += value;
+        if (value < min)
+        {
+            min = value;
+        }
+        if (value > max)
+        {
+            max = value;
+        }
+    }
+
+    int64_t percentile(double p) const
+    {
+        uint64_t target = (uint64_t)(p * count);
+        uint64_t seen = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            seen += buckets[i];
+            if (seen > target)
+            {
+                return 64LL << i;
+            }
+        }
+        return max;
+    }
+
+    void print(const char *name) const
+    {
+        if (count == 0)
+        {
+            printf("    %-8s no samples\n", name);
+            return;
+        }
+        printf("    %-8s n=%llu min=%lldus avg=%lldus max=%lldus p50<%lldus p99<%lldus\n", name,
+               (unsigned long long)count, (long long)min, (long long)(sum / (int64_t)count), (long long)max,
+               (long long)percentile(0.5), (long long)percentile(0.99));
+        printf("             ");
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            printf(" %llu", (unsigned long long)buckets[i]);
+        }
+        printf("\n");
+    }
+};
+
+struct Tracker
+{
+    sockaddr_in address;
+    bool connected;
+
+    uint64_t datagrams;
+    uint64_t samples;
+    uint64_t heartbeats;
+    uint64_t lastPacketNumber;
+    bool hasPacketNumber;
+    uint64_t sequenceGaps;
+    uint64_t reordered;
+
+    int64_t lastArrival;
+    int64_t lastInterval;
+    double jitter;
+    Histogram interArrival;
+
+    int32_t nextPingId;
+    int64_t pingSentAt[PING_SLOTS];
+    uint64_t pingsSent;
+    uint64_t pongs;
+    Histogram rtt;
+
+    int32_t echoedIds[PING_SLOTS];
+    size_t nextEcho;
+    uint64_t probesEchoed;
+
+    double linkTokens;
+    int64_t lastLinkUpdate;
+    uint64_t linkDrops;
+
+    uint64_t windowDatagrams;
+    uint64_t windowSamples;
+    uint64_t nextPacketNumber;
+
+    struct ProfileReport
+    {
+        bool valid;
+        uint16_t cyclesPerMicro;
+        uint32_t count;
+        uint32_t p50;
+        uint32_t p99;
+        uint32_t max;
+    } profile[PROFILE_CORES][PROFILE_STAGES];
+};
+
+struct Options
+{
+    int port = 6970;
+    std::vector<sockaddr_in> trackers;
+    int durationSeconds = 30;
+    int heartbeatMs = 1000;
+    int pingMs = 250;
+    int reportMs = 5000;
+    double lossPercent = 0;
+    int capacity = 0;
+};
+
+class StandInServer
+{
+private:
+    int sock;
+    Options options;
+    std::vector<Tracker> trackers;
+
+public:
+    StandInServer(const Options &options) : sock(-1), options(options)
+    {
+        for (const sockaddr_in &address : options.trackers)
+        {
+            Tracker tracker;
+            memset(&tracker, 0, sizeof(tracker));
+            tracker.address = address;
+            tracker.interArrival.reset();
+            tracker.rtt.reset();
+            trackers.push_back(tracker);
+        }
+    }
+
+    ~StandInServer()
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+    }
+
+    bool start()
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock < 0)
+        {
+            perror("socket");
+            return false;
+        }
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(options.port);
+        if (bind(sock, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            perror("bind");
+            return false;
+        }
+        return true;
+    }
+
+    void run()
+    {
+        int64_t start = nowMicros();
+        int64_t nextDiscovery = start;
+        int64_t nextHeartbeat = start + options.heartbeatMs * 1000LL;
+        int64_t nextPing = start + options.pingMs * 1000LL;
+        int64_t nextReport = start + options.reportMs * 1000LL;
+        int64_t lastReport = start;
+        int64_t end = options.durationSeconds > 0 ? start + options.durationSeconds * 1000000LL : INT64_MAX;
+
+        unsigned char buffer[1500];
+        for (;;)
+        {
+            int64_t now = nowMicros();
+            if (now >= end)
+            {
+                break;
+            }
+            if (now >= nextDiscovery)
+            {
+                sendDiscovery();
+                nextDiscovery = now + 500000;
+            }
+            if (now >= nextHeartbeat)
+            {
+                sendHeartbeats();
+                nextHeartbeat += options.heartbeatMs * 1000LL;
+            }
+            if (now >= nextPing)
+            {
+                sendPings(now);
+                nextPing += options.pingMs * 1000LL;
+            }
+            if (now >= nextReport)
+            {
+                report(now - lastReport);
+                lastReport = now;
+                nextReport += options.reportMs * 1000LL;
+            }
+
+            int64_t deadline = nextDiscovery;
+            deadline = deadline < nextHeartbeat ? deadline : nextHeartbeat;
+            deadline = deadline < nextPing ? deadline : nextPing;
+            deadline = deadline < nextReport ? deadline : nextReport;
+            deadline = deadline < end ? deadline : end;
+            int timeoutMs = (int)((deadline - now + 999) / 1000);
+
+            pollfd fd = {sock, POLLIN, 0};
+            if (poll(&fd, 1, timeoutMs < 0 ? 0 : timeoutMs) <= 0)
+            {
+                continue;
+            }
+            for (;;)
+            {
+                sockaddr_in source;
+                socklen_t sourceLength = sizeof(source);
+                ssize_t length = recvfrom(sock, buffer, sizeof(buffer), MSG_DONTWAIT, (sockaddr *)&source, &sourceLength);
+                if (length < 0)
+                {
+                    break;
+                }
+                packetReceived(buffer, (size_t)length, source, nowMicros());
+            }
+        }
+        report(nowMicros() - lastReport);
+    }
+
+private:
+    Tracker *findTracker(const sockaddr_in &address)
+    {
+        for (Tracker &tracker : trackers)
+        {
+            if (tracker.address.sin_addr.s_addr == address.sin_addr.s_addr && tracker.address.sin_port == address.sin_port)
+            {
+                return &tracker;
+            }
+        }
+        return nullptr;
+    }
+
+    void sendTo(const Tracker &tracker, const unsigned char *data, size_t size)
+    {
+        if (sendto(sock, data, size, 0, (const sockaddr *)&tracker.address, sizeof(tracker.address)) < 0)
+        {
+            fprintf(stderr, "sendto failed: %s\n", strerror(errno));
+        }
+    }
+
+    // Any datagram that does not start with PACKET_HANDSHAKE makes an
+    // unconnected tracker answer with its own handshake.
+    void sendDiscovery()
+    {
+        unsigned char packet[HeartbeatPacket::wireSize];
+        HeartbeatPacket::encode(packet, 0);
+        for (Tracker &tracker : trackers)
+        {
+            if (!tracker.connected)
+            {
+                sendTo(tracker, packet, sizeof(packet));
+            }
+        }
+    }
+
+    void sendHeartbeats()
+    {
+        unsigned char packet[HeartbeatPacket::wireSize];
+        for (Tracker &tracker : trackers)
+        {
+            if (tracker.connected)
+            {
+                HeartbeatPacket::encode(packet, tracker.nextPacketNumber++);
+                sendTo(tracker, packet, sizeof(packet));
+            }
+        }
+    }
+
+    void sendPings(int64_t now)
+    {
+        unsigned char packet[PingPongPacket::wireSize];
+        for (Tracker &tracker : trackers)
+        {
+            if (!tracker.connected)
+            {
+                continue;
+            }
+            int32_t id = tracker.nextPingId++;
+            tracker.pingSentAt[id % PING_SLOTS] = now;
+            tracker.pingsSent++;
+            PingPongPacket::encode(packet, tracker.nextPacketNumber++, id);
+            sendTo(tracker, packet, sizeof(packet));
+        }
+    }
+
+    void packetReceived(const unsigned char *data, size_t size, const sockaddr_in &source, int64_t now)
+    {
+        Tracker *tracker = findTracker(source);
+        if (tracker == nullptr)
+        {
+            Tracker added;
+            memset(&added, 0, sizeof(added));
+            added.address = source;
+            added.interArrival.reset();
+            added.rtt.reset();
+            trackers.push_back(added);
+            tracker = &trackers.back();
+        }
+        if (size < PACKET_HEADER_SIZE)
+        {
+            return;
+        }
+        if (tracker->connected && linkDrops(*tracker, now))
+        {
+            tracker->linkDrops++;
+            return;
+        }
+
+        uint8_t type = data[3];
+        uint64_t number = endian::loadBigEndian<uint64_t>(data + sizeof(uint32_t));
+
+        if (type == PACKET_HANDSHAKE)
+        {
+            unsigned char reply[1 + sizeof(HANDSHAKE_REPLY) - 1];
+            reply[0] = PACKET_HANDSHAKE;
+            memcpy(reply + 1, HANDSHAKE_REPLY, sizeof(HANDSHAKE_REPLY) - 1);
+            sendTo(*tracker, reply, sizeof(reply));
+            if (!tracker->connected)
+            {
+                printf("tracker %s:%d connected\n", inet_ntoa(source.sin_addr), ntohs(source.sin_port));
+            }
+            tracker->connected = true;
+            tracker->hasPacketNumber = false;
+            return;
+        }
+
+        tracker->datagrams++;
+        tracker->windowDatagrams++;
+        trackArrival(*tracker, now);
+        // Pongs are our own pings echoed back and carry the server's packet number
+        if (type != PACKET_PING_PONG || !isOwnPing(*tracker, data, size))
+        {
+            trackSequence(*tracker, number);
+        }
+
+        switch (type)
+        {
+        case PACKET_HEARTBEAT:
+            tracker->heartbeats++;
+            break;
+        case PACKET_PING_PONG:
+        {
+            PingPongPacket::View pong(data, size);
+            if (!pong.isValid())
+            {
+                break;
+            }
+            int32_t id = pong.get<0>();
+            if (isOwnPing(*tracker, data, size))
+            {
+                tracker->rtt.add(now - tracker->pingSentAt[id % PING_SLOTS]);
+                tracker->pongs++;
+            }
+            else
+            {
+                echoProbe(*tracker, data, size, id);
+            }
+            break;
+        }
+        case PACKET_BUNDLE:
+            countBundle(*tracker, data + PACKET_HEADER_SIZE, size - PACKET_HEADER_SIZE);
+            break;
+        case PACKET_ACCEL:
+        case PACKET_ROTATION_DATA:
+        case PACKET_ROTATION_COMPACT:
+            tracker->samples++;
+            tracker->windowSamples++;
+            break;
+        case PACKET_INSPECTION:
+            readProfile(*tracker, data, size);
+            break;
+        }
+    }
+
+    void readProfile(Tracker &tracker, const unsigned char *data, size_t size)
+    {
+        ProfilePacket::View packet(data, size);
+        if (!packet.isValid() || packet.get<0>() != PACKET_INSPECTION_PACKETTYPE_PROFILE)
+        {
+            return;
+        }
+        uint8_t stage = packet.get<1>();
+        uint8_t core = packet.get<2>();
+        if (stage >= PROFILE_STAGES || core >= PROFILE_CORES || packet.get<3>() == 0)
+        {
+            return;
+        }
+        Tracker::ProfileReport &report = tracker.profile[core][stage];
+        report.valid = true;
+        report.cyclesPerMicro = packet.get<3>();
+        report.count = packet.get<4>();
+        report.p50 = packet.get<5>();
+        report.p99 = packet.get<6>();
+        report.max = packet.get<7>();
+    }
+
+    bool isOwnPing(const Tracker &tracker, const unsigned char *data, size_t size)
+    {
+        PingPongPacket::View ping(data, size);
+        if (!ping.isValid())
+        {
+            return false;
+        }
+        int32_t id = ping.get<0>();
+        return id >= 0 && id < tracker.nextPingId && tracker.nextPingId - id <= PING_SLOTS;
+    }
+
+    // The tracker echoes pings it does not know as server pings, remembering
+    // what was echoed keeps a late probe from bouncing back and forth forever.
+    void echoProbe(Tracker &tracker, const unsigned char *data, size_t size, int32_t id)
+    {
+        for (size_t i = 0; i < PING_SLOTS; i++)
+        {
+            if (tracker.echoedIds[i] == id && tracker.probesEchoed > i)
+            {
+                return;
+            }
+        }
+        tracker.echoedIds[tracker.nextEcho] = id;
+        tracker.nextEcho = (tracker.nextEcho + 1) % PING_SLOTS;
+        tracker.probesEchoed++;
+        sendTo(tracker, data, size);
+    }
+
+    // Random loss first, then a token bucket of capacity datagrams per second
+    // with one second of burst.
+    bool linkDrops(Tracker &tracker, int64_t now)
+    {
+        if (options.lossPercent > 0 && rand() % 10000 < (int)(options.lossPercent * 100))
+        {
+            return true;
+        }
+        if (options.capacity <= 0)
+        {
+            return false;
+        }
+        if (tracker.lastLinkUpdate == 0)
+        {
+            tracker.linkTokens = options.capacity;
+        }
+        else
+        {
+            tracker.linkTokens += options.capacity * (now - tracker.lastLinkUpdate) / 1e6;
+            if (tracker.linkTokens > options.capacity)
+            {
+                tracker.linkTokens = options.capacity;
+            }
+        }
+        tracker.lastLinkUpdate = now;
+        if (tracker.linkTokens < 1.0)
+        {
+            return true;
+        }
+        tracker.linkTokens -= 1.0;
+        return false;
+    }
+
+    void countBundle(Tracker &tracker, const unsigned char *data, size_t size)
+    {
+        size_t position = 0;
+        while (position + sizeof(uint16_t) <= size)
+        {
+            uint16_t length = endian::loadBigEndian<uint16_t>(data + position);
+            position += sizeof(uint16_t);
+            if (length < sizeof(uint32_t) || position + length > size)
+            {
+                return;
+            }
+            uint8_t type = data[position + 3];
+            if (type == PACKET_ACCEL || type == PACKET_ROTATION_DATA || type == PACKET_ROTATION_COMPACT)
+            {
+                tracker.samples++;
+                tracker.windowSamples++;
+            }
+            position += length;
+        }
+    }
+
+    // RFC 3550 style jitter: smoothed difference between consecutive inter-arrival intervals.
+    void trackArrival(Tracker &tracker, int64_t now)
+    {
+        if (tracker.lastArrival != 0)
+        {
+            int64_t interval = now - tracker.lastArrival;
+            tracker.interArrival.add(interval);
+            if (tracker.lastInterval != 0)
+            {
+                int64_t difference = interval - tracker.lastInterval;
+                if (difference < 0)
+                {
+                    difference = -difference;
+                }
+                tracker.jitter += ((double)difference - tracker.jitter) / 16.0;
+            }
+            tracker.lastInterval = interval;
+        }
+        tracker.lastArrival = now;
+    }
+
+    void trackSequence(Tracker &tracker, uint64_t number)
+    {
+        if (tracker.hasPacketNumber)
+        {
+            if (number > tracker.lastPacketNumber + 1)
+            {
+                tracker.sequenceGaps += number - tracker.lastPacketNumber - 1;
+            }
+            else if (number <= tracker.lastPacketNumber)
+            {
+                tracker.reordered++;
+                return;
+            }
+        }
+        tracker.lastPacketNumber = number;
+        tracker.hasPacketNumber = true;
+    }
+
+    void report(int64_t windowMicros)
+    {
+        double seconds = windowMicros / 1e6;
+        for (Tracker &tracker : trackers)
+        {
+            printf("tracker %s:%d %s\n", inet_ntoa(tracker.address.sin_addr), ntohs(tracker.address.sin_port),
+                   tracker.connected ? "connected" : "waiting for handshake");
+            if (!tracker.connected)
+            {
+                continue;
+            }
+            printf("    rate     %.1f datagrams/s %.1f samples/s\n",
+                   tracker.windowDatagrams / seconds, tracker.windowSamples / seconds);
+            printf("    totals   datagrams=%llu samples=%llu heartbeats=%llu gaps=%llu reordered=%llu pings=%llu pongs=%llu\n",
+                   (unsigned long long)tracker.datagrams, (unsigned long long)tracker.samples,
+                   (unsigned long long)tracker.heartbeats, (unsigned long long)tracker.sequenceGaps,
+                   (unsigned long long)tracker.reordered, (unsigned long long)tracker.pingsSent,
+                   (unsigned long long)tracker.pongs);
+            printf("    link     dropped=%llu probes echoed=%llu\n",
+                   (unsigned long long)tracker.linkDrops, (unsigned long long)tracker.probesEchoed);
+            printf("    jitter   %.1fus\n", tracker.jitter);
+            tracker.interArrival.print("arrival");
+            tracker.rtt.print("rtt");
+            for (int core = 0; core < PROFILE_CORES; core++)
+            {
+                for (int stage = 0; stage < PROFILE_STAGES; stage++)
+                {
+                    const Tracker::ProfileReport &report = tracker.profile[core][stage];
+                    if (!report.valid)
+                    {
+                        continue;
+                    }
+                    double scale = 1.0 / report.cyclesPerMicro;
+                    printf("    profile  core %d %-10s n=%u p50=%.2fus p99=%.2fus max=%.2fus\n", core,
+                           PROFILE_STAGE_NAMES[stage], report.count, report.p50 * scale, report.p99 * scale,
+                           report.max * scale);
+                }
+            }
+            tracker.windowDatagrams = 0;
+            tracker.windowSamples = 0;
+        }
+        fflush(stdout);
+    }
+};
+
+static bool parseEndpoint(const char *text, sockaddr_in &address)
+{
+    char host[64];
+    const char *colon = strchr(text, ':');
+    if (colon == nullptr || (size_t)(colon - text) >= sizeof(host))
+    {
+        return false;
+    }
+    memcpy(host, text, colon - text);
+    host[colon - text] = '\0';
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(colon + 1));
+    return inet_pton(AF_INET, host, &address.sin_addr) == 1;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--port") == 0)
+        {
+            options.port = atoi(value);
+        }
+        else if (strcmp(arg, "--tracker") == 0)
+        {
+            sockaddr_in address;
+            if (!parseEndpoint(value, address))
+            {
+                fprintf(stderr, "Invalid tracker endpoint: %s\n", value);
+                return 1;
+            }
+            options.trackers.push_back(address);
+        }
+        else if (strcmp(arg, "--duration") == 0)
+        {
+            options.durationSeconds = atoi(value);
+        }
+        else if (strcmp(arg, "--heartbeat-ms") == 0)
+        {
+            options.heartbeatMs = atoi(value);
+        }
+        else if (strcmp(arg, "--ping-ms") == 0)
+        {
+            options.pingMs = atoi(value);
+        }
+        else if (strcmp(arg, "--report-ms") == 0)
+        {
+            options.reportMs = atoi(value);
+        }
+        else if (strcmp(arg, "--loss") == 0)
+        {
+            options.lossPercent = atof(value);
+        }
+        else if (strcmp(arg, "--capacity") == 0)
+        {
+            options.capacity = atoi(value);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 1;
+        }
+    }
+    if (options.trackers.empty())
+    {
+        sockaddr_in address;
+        parseEndpoint("127.0.0.1:6969", address);
+        options.trackers.push_back(address);
+    }
+    if (options.heartbeatMs <= 0 || options.pingMs <= 0 || options.reportMs <= 0)
+    {
+        fprintf(stderr, "Intervals must be positive\n");
+        return 1;
+    }
+
+    StandInServer server(options);
+    if (!server.start())
+    {
+        return 1;
+    }
+    server.run();
+    return 0;
+}
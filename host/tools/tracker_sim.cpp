@@ -0,0 +1,159 @@
+// Runs SlimeVRClient on the host as a simulated tracker, to be paired with slime_server.
+//
+// Usage: tracker_sim [port] [sensors] [period_us] [bundle] [duration_s] [min_rate] [moving] [server] [log]
+// Defaults: 6969 6 7000 1 30 20 sensors none text
+//
+// The sampling period sets the maximum send rate of the rate controller, its
+// state is printed every second. Only the first [moving] sensors move, the
+// others sit still with a little noise and get suppressed down to keyframes.
+// [server] is a cached HOST:PORT to handshake with first. Discovery
+// handshakes are broadcast to 127.255.255.255 on its port (6970 without
+// one). The time to the server and to the first sample packet are printed at
+// the end. The profiler summary is sent to the server every second. [log]
+// "binary" dumps the deferred log as records for log_decode on stdout. The
+// end to end latency of the rate controller's probes is printed at the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "network/latency_monitor.hpp"
+#include "network/slimevr_client.hpp"
+#include "utils/boot_timeline.hpp"
+#include "utils/deferred_log.hpp"
+#include "utils/profiler.hpp"
+#include "utils/timing.hpp"
+
+int main(int argc, char **argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 6969;
+    int sensorCount = argc > 2 ? atoi(argv[2]) : 6;
+    unsigned long period = argc > 3 ? strtoul(argv[3], nullptr, 10) : 7000;
+    bool bundle = argc > 4 ? atoi(argv[4]) != 0 : true;
+    int duration = argc > 5 ? atoi(argv[5]) : 30;
+    float minRate = argc > 6 ? atof(argv[6]) : 20.0f;
+    int moving = argc > 7 ? atoi(argv[7]) : sensorCount;
+    const char *server = argc > 8 && strcmp(argv[8], "none") != 0 ? argv[8] : nullptr;
+    bool binaryLog = argc > 9 && strcmp(argv[9], "binary") == 0;
+    BootTimeline::mark(BOOT_APP_MAIN);
+
+    DeferredLog::setOutput(binaryLog ? DEFERRED_LOG_BINARY : DEFERRED_LOG_TEXT);
+    DeferredLog::start();
+
+    SlimeVRClient client;
+    LatencyMonitor latencyMonitor;
+    client.setLatencyMonitor(&latencyMonitor);
+    uint16_t serverPort = 6970;
+    if (server != nullptr)
+    {
+        char host[64];
+        strncpy(host, server, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        char *colon = strchr(host, ':');
+        if (colon == nullptr)
+        {
+            fprintf(stderr, "Server must be HOST:PORT\n");
+            return 1;
+        }
+        *colon = '\0';
+        in_addr address;
+        if (inet_pton(AF_INET, host, &address) != 1)
+        {
+            fprintf(stderr, "Server must be an IPv4 address\n");
+            return 1;
+        }
+        serverPort = atoi(colon + 1);
+        client.setServerHint(address.s_addr, htons(serverPort));
+    }
+    in_addr loopbackBroadcast;
+    inet_pton(AF_INET, "127.255.255.255", &loopbackBroadcast);
+    client.setDiscoveryTarget(loopbackBroadcast.s_addr, htons(serverPort));
+    client.setBundleEnabled(bundle);
+    client.setRateLimits(minRate, 1000000.0f / period);
+    for (int id = 1; id <= sensorCount; id++)
+    {
+        client.registerSensor(id);
+    }
+    if (client.start(port) != ESP_OK)
+    {
+        fprintf(stderr, "Failed to start client on port %d\n", port);
+        return 1;
+    }
+
+    unsigned long end = micros() + duration * 1000000UL;
+    unsigned long next = micros();
+    unsigned long nextReport = micros() + 1000000UL;
+    while (micros() < end)
+    {
+        unsigned long now = micros();
+        if (now < next)
+        {
+            usleep(next - now);
+            continue;
+        }
+        next += period;
+        if (now >= nextReport)
+        {
+            nextReport += 1000000UL;
+            RateControllerState state = client.getRateControllerState();
+            printf("rate=%.1f/s loss=%.3f srtt=%lldus rttvar=%lldus throttled=%lu failures=%lu probes=%lu/%lu lost=%lu up=%lu down=%lu\n",
+                   state.rate, state.lossRate, (long long)state.smoothedRtt, (long long)state.rttVariance,
+                   (unsigned long)state.throttled, (unsigned long)state.sendFailures,
+                   (unsigned long)state.probesAnswered, (unsigned long)state.probesSent,
+                   (unsigned long)state.probesLost, (unsigned long)state.increases, (unsigned long)state.decreases);
+            fflush(stdout);
+            ProfileSummary profile[PROFILER_CORES][PROFILE_STAGE_COUNT];
+            Profiler::collect(profile);
+            client.sendProfile(profile);
+        }
+        if (!client.isConnected())
+        {
+            continue;
+        }
+        for (int id = 1; id <= sensorCount; id++)
+        {
+            float scale = id <= moving ? 1.0f : 0.001f;
+            client.setAcceleration(id,
+                                   scale * esp_random() / (float)UINT32_MAX,
+                                   scale * esp_random() / (float)UINT32_MAX,
+                                   9.81f + scale * esp_random() / (float)UINT32_MAX);
+        }
+        if (client.sendSensorData() == ESP_OK)
+        {
+            BootTimeline::mark(BOOT_FIRST_PACKET);
+        }
+    }
+    int64_t started = BootTimeline::get(BOOT_APP_MAIN);
+    if (BootTimeline::isComplete())
+    {
+        printf("server after %lldus, first packet after %lldus\n",
+               (long long)(BootTimeline::get(BOOT_SERVER_FOUND) - started),
+               (long long)(BootTimeline::get(BOOT_FIRST_PACKET) - started));
+    }
+    DiscoveryStats discovery = client.getDiscoveryStats();
+    printf("discovery rounds=%u broadcasts=%u found=%u cached=%u last=%lldus max=%lldus\n", discovery.attempts,
+           discovery.broadcasts, discovery.found, discovery.foundCached, (long long)discovery.lastDuration,
+           (long long)discovery.maxDuration);
+    LinkQuality link = latencyMonitor.getLinkQuality(LATENCY_APP);
+    printf("latency rtt=%lldus min=%lldus max=%lldus p50<%lldus p99<%lldus jitter=%lldus loss=%.3f answered=%u/%u\n",
+           (long long)link.smoothedRtt, (long long)link.minRtt, (long long)link.maxRtt, (long long)link.p50,
+           (long long)link.p99, (long long)link.jitter, link.loss, link.answered, link.sent);
+    DeferredLog::flush();
+    DeferredLogStats logStats = DeferredLog::getStats();
+    printf("log recorded=%u flushed=%u dropped=%u max depth=%u\n", logStats.recorded, logStats.flushed,
+           logStats.dropped, logStats.maxDepth);
+    for (int id = 1; id <= sensorCount; id++)
+    {
+        SuppressionStats stats;
+        if (client.getSuppressionStats(id, &stats) == ESP_OK && stats.offered > 0)
+        {
+            printf("sensor %d offered=%lu sent=%lu suppressed=%lu (%.1f%%) throttled=%lu keyframes=%lu\n", id,
+                   (unsigned long)stats.offered, (unsigned long)stats.sent, (unsigned long)stats.suppressed,
+                   100.0f * stats.suppressed / stats.offered, (unsigned long)stats.throttled,
+                   (unsigned long)stats.keyframes);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "sensor_fusion.hpp"
+
+#include <string.h>
+#include <math.h>
+
+#define STANDARD_GRAVITY 9.80665f
+
+SensorFusion::SensorFusion()
+{
+    this->configure(defaultConfig());
+    this->reset();
+}
+
+FusionConfig SensorFusion::defaultConfig()
+{
+    FusionConfig config;
+    config.beta = 0.05f;
+    config.restAngularVelocity = 0.05f;
+    config.restAcceleration = 0.3f;
+    config.restDuration = 1000000;
+    config.biasTimeConstant = 1.0f;
+    config.biasRollback = 500000;
+    config.maxStep = 100000;
+    return config;
+}
+
+void SensorFusion::configure(const FusionConfig &config)
+{
+    this->config = config;
+}
+
+void SensorFusion::reset()
+{
+    this->rotation = Quaternion::identity();
+    memset(this->gyroBias, 0, sizeof(this->gyroBias));
+    memset(this->biasHistory, 0, sizeof(this->biasHistory));
+    this->biasHistoryIndex = 0;
+    this->lastBiasSnapshot = 0;
+    this->initialized = false;
+    this->atRest = false;
+    this->lastTimestamp = 0;
+    this->restSince = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+// Tilt straight from gravity, heading is unobservable without a magnetometer
+// and starts at zero
+void SensorFusion::initialize(const ImuSample &sample)
+{
+    const float *a = sample.acceleration;
+    float norm = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    if (norm <= 0.0f)
+    {
+        this->rotation = Quaternion::identity();
+    }
+    else
+    {
+        // Shortest rotation taking the measured up vector onto world z
+        float ux = a[0] / norm, uy = a[1] / norm, uz = a[2] / norm;
+        this->rotation = Quaternion{uy, -ux, 0.0f, 1.0f + uz}.normalized();
+        if (uz < -0.9999f)
+        {
+            this->rotation = Quaternion{1.0f, 0.0f, 0.0f, 0.0f};
+        }
+    }
+    this->lastTimestamp = sample.timestamp;
+    this->restSince = sample.timestamp;
+    this->initialized = true;
+}
+
+void SensorFusion::updateRest(const ImuSample &sample, float dt)
+{
+    const float *g = sample.angularVelocity;
+    const float *a = sample.acceleration;
+    float wx = g[0] - this->gyroBias[0], wy = g[1] - this->gyroBias[1], wz = g[2] - this->gyroBias[2];
+    float threshold = this->config.restAngularVelocity;
+    float gravityError = fabsf(sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) - STANDARD_GRAVITY);
+    if (wx * wx + wy * wy + wz * wz > threshold * threshold || gravityError > this->config.restAcceleration)
+    {
+        if (this->atRest)
+        {
+            // The oldest snapshot predates the slow start of the motion
+            memcpy(this->gyroBias, this->biasHistory[this->biasHistoryIndex], sizeof(this->gyroBias));
+            this->stats.rollbacks++;
+        }
+        this->atRest = false;
+        this->restSince = sample.timestamp;
+        return;
+    }
+    if (!this->atRest)
+    {
+        if (sample.timestamp - this->restSince < this->config.restDuration)
+        {
+            return;
+        }
+        for (size_t i = 0; i < FUSION_BIAS_HISTORY; i++)
+        {
+            memcpy(this->biasHistory[i], this->gyroBias, sizeof(this->gyroBias));
+        }
+        this->lastBiasSnapshot = sample.timestamp;
+        this->atRest = true;
+    }
+    this->stats.restSamples++;
+
+    if (sample.timestamp - this->lastBiasSnapshot >= this->config.biasRollback / FUSION_BIAS_HISTORY)
+    {
+        memcpy(this->biasHistory[this->biasHistoryIndex], this->gyroBias, sizeof(this->gyroBias));
+        this->biasHistoryIndex = (this->biasHistoryIndex + 1) % FUSION_BIAS_HISTORY;
+        this->lastBiasSnapshot = sample.timestamp;
+    }
+    float alpha = dt / (this->config.biasTimeConstant + dt);
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        this->gyroBias[axis] += alpha * (g[axis] - this->gyroBias[axis]);
+    }
+}
+
+void SensorFusion::update(const ImuSample &sample)
+{
+    if (!this->initialized)
+    {
+        this->initialize(sample);
+        this->stats.samples++;
+        return;
+    }
+    int64_t step = sample.timestamp - this->lastTimestamp;
+    if (step <= 0)
+    {
+        this->stats.skipped++;
+        return;
+    }
+    if (step > this->config.maxStep)
+    {
+        // Integrating over a long gap would only add error, restart from gravity
+        this->stats.restarts++;
+        this->initialize(sample);
+        this->stats.samples++;
+        return;
+    }
+    this->lastTimestamp = sample.timestamp;
+    this->stats.samples++;
+    float dt = step * 1e-6f;
+
+    this->updateRest(sample, dt);
+
+    float gx = sample.angularVelocity[0] - this->gyroBias[0];
+    float gy = sample.angularVelocity[1] - this->gyroBias[1];
+    float gz = sample.angularVelocity[2] - this->gyroBias[2];
+    float ax = sample.acceleration[0];
+    float ay = sample.acceleration[1];
+    float az = sample.acceleration[2];
+    float q0 = this->rotation.w, q1 = this->rotation.x, q2 = this->rotation.y, q3 = this->rotation.z;
+
+    // Rate of change from the gyroscope, qDot = q * (0, w) / 2
+    float qDot0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float qDot1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float qDot2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float qDot3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    float norm = ax * ax + ay * ay + az * az;
+    if (norm > 0.0f)
+    {
+        float inverse = 1.0f / sqrtf(norm);
+        ax *= inverse;
+        ay *= inverse;
+        az *= inverse;
+
+        // Gradient of the error between the measured and the estimated gravity direction
+        float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+        float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+        float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+        float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+        float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+        float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+        float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+        float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+        float gradient = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+        if (gradient > 0.0f)
+        {
+            float correction = this->config.beta / sqrtf(gradient);
+            qDot0 -= correction * s0;
+            qDot1 -= correction * s1;
+            qDot2 -= correction * s2;
+            qDot3 -= correction * s3;
+        }
+    }
+
+    this->rotation = Quaternion{q1 + qDot1 * dt, q2 + qDot2 * dt, q3 + qDot3 * dt, q0 + qDot0 * dt}.normalized();
+}
+
+void SensorFusion::update(const ImuSample *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        this->update(samples[i]);
+    }
+}
+
+Quaternion SensorFusion::getRotation()
+{
+    return this->rotation;
+}
+
+bool SensorFusion::isAtRest()
+{
+    return this->atRest;
+}
+
+void SensorFusion::getGyroBias(float bias[3])
+{
+    memcpy(bias, this->gyroBias, sizeof(this->gyroBias));
+}
+
+void SensorFusion::setGyroBias(const float bias[3])
+{
+    memcpy(this->gyroBias, bias, sizeof(this->gyroBias));
+    for (size_t i = 0; i < FUSION_BIAS_HISTORY; i++)
+    {
+        memcpy(this->biasHistory[i], bias, sizeof(this->biasHistory[i]));
+    }
+}
+
+FusionStats SensorFusion::getStats()
+{
+    return this->stats;
+}
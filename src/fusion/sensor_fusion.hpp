@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../sensors/imu_sample.hpp"
+#include "../utils/quaternion.hpp"
+
+#define FUSION_BIAS_HISTORY 4
+
+struct FusionConfig
+{
+    float beta;                // Madgwick gain, how hard gravity pulls the estimate
+    float restAngularVelocity; // rad/s, gyro minus bias must stay below this at rest
+    float restAcceleration;    // m/s^2, allowed deviation from 1 g at rest
+    int64_t restDuration;      // us the thresholds must hold before the sensor is at rest
+    float biasTimeConstant;    // s, averaging time of the gyro bias while at rest
+    int64_t biasRollback;      // us of bias learning undone when the rest ends
+    int64_t maxStep;           // us, longer gaps restart the integration instead
+};
+
+struct FusionStats
+{
+    uint32_t samples;
+    uint32_t restSamples;
+    uint32_t restarts;
+    uint32_t rollbacks;
+    uint32_t skipped;
+};
+
+// Madgwick's gradient descent filter for accelerometer and gyroscope, plus an
+// online gyro bias estimate that only learns while the sensor is at rest.
+// Motion that starts slowly still looks like rest for a moment, so the bias
+// is rolled back to a snapshot from before that moment when the rest ends.
+// Allocation free and a fixed amount of work per sample, there are no loops
+// over anything but the three axes.
+class SensorFusion
+{
+private:
+    FusionConfig config;
+    Quaternion rotation;
+    float gyroBias[3];
+    float biasHistory[FUSION_BIAS_HISTORY][3];
+    size_t biasHistoryIndex;
+    int64_t lastBiasSnapshot;
+    bool initialized;
+    bool atRest;
+    int64_t lastTimestamp;
+    int64_t restSince;
+    FusionStats stats;
+
+public:
+    SensorFusion();
+
+    static FusionConfig defaultConfig();
+
+    void configure(const FusionConfig &config);
+    void reset();
+
+    void update(const ImuSample &sample);
+    void update(const ImuSample *samples, size_t count);
+
+    Quaternion getRotation();
+    bool isAtRest();
+    void getGyroBias(float bias[3]);
+    // Starts from a bias learned in an earlier session instead of zero
+    void setGyroBias(const float bias[3]);
+    FusionStats getStats();
+
+private:
+    void initialize(const ImuSample &sample);
+    void updateRest(const ImuSample &sample, float dt);
+};
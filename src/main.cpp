@@ -1,4 +1,7 @@
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
 #include <esp_timer.h>
 #include <esp_system.h>
 #include <freertos/FreeRTOS.h>
@@ -9,82 +12,730 @@
 
 #include "storage/storage_manager.hpp"
 #include "network/wifi_manager.hpp"
+#include "network/burst_scheduler.hpp"
+#include "network/latency_monitor.hpp"
 #include "network/ping_client.hpp"
+#include "network/raw_udp_transport.hpp"
+#include "network/recording_transport.hpp"
 #include "network/slimevr_client.hpp"
+#include "fusion/sensor_fusion.hpp"
+#include "pipeline/sample_pipeline.hpp"
+#include "sensors/bmi160.hpp"
+#include "sensors/i2c_imu_bus.hpp"
+#include "sensors/imu_acquisition.hpp"
+#include "sensors/tca9548a.hpp"
+#include "sensors/tracing_imu_bus.hpp"
+#include "storage/session_partition.hpp"
+#include "storage/session_recorder.hpp"
+#include "storage/session_replay.hpp"
+#include "utils/boot_timeline.hpp"
+#include "utils/deferred_log.hpp"
+#include "utils/profiler.hpp"
+#include "utils/scheduler.hpp"
+#include "utils/task_topology.hpp"
 #include "utils/timing.hpp"
 
+#define SENSOR_SEND_PERIOD_US 7000
+#define SENSOR_MIN_RATE 20.0f
+#define SENSOR_KEYFRAME_PERIOD_US 250000
+#define SENSOR_ACCELERATION_THRESHOLD 0.05f
+#define SENSOR_ANGLE_THRESHOLD 0.02f
+#define CONNECT_PERIOD_US 100000
+#define STATUS_PERIOD_US 5000000
+#define STORAGE_PERIOD_US 1000000
+#define PROFILE_PERIOD_US 1000000
+#define BEACON_SYNC_PERIOD_US 1000000
+// ICMP echo to the gateway, below the network tasks
+#define GATEWAY_PING_INTERVAL_MS 1000
+#define GATEWAY_PING_PRIORITY 2
+// Learned gyro bias is stored again once it moved this far, rad/s
+#define IMU_BIAS_STORE_THRESHOLD 0.002f
+#define IMU_PORT0_SDA_PIN 21
+#define IMU_PORT0_SCL_PIN 22
+#define IMU_PORT1_SDA_PIN 33
+#define IMU_PORT1_SCL_PIN 32
+#define IMU_I2C_FREQUENCY 400000
+#define IMU_COUNT 6
+// Boot time replays of the session partition run as fast as the CPU goes
+#define SESSION_REPLAY_SPEED 0.0f
+
 StorageManager storageManager;
+StoredConfig config;
 WifiManager wifiManager;
 SlimeVRClient slimeClient;
+#ifdef CONFIG_SLIMEFY_RAW_UDP
+RawUdpTransport rawTransport;
+#endif
+LatencyMonitor latencyMonitor;
+BurstScheduler burstScheduler;
+PingClient pingClient(ESP_PING_COUNT_INFINITE, GATEWAY_PING_INTERVAL_MS, GATEWAY_PING_PRIORITY);
+Scheduler scheduler;
+SamplePipeline samplePipeline;
+#if defined(CONFIG_SLIMEFY_SESSION_RECORD) || defined(CONFIG_SLIMEFY_SESSION_REPLAY)
+SessionPartition sessionPartition;
+#endif
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+SessionRecorder sessionRecorder;
+#ifdef CONFIG_SLIMEFY_RAW_UDP
+RecordingTransport recordingTransport(rawTransport, sessionRecorder);
+#else
+RecordingTransport recordingTransport(slimeClient.udpServer, sessionRecorder);
+#endif
+#endif
+#ifdef CONFIG_SLIMEFY_SESSION_REPLAY
+SessionReplay sessionReplay;
+#endif
+
+// One IMU with its bus, driver and fusion. Each I2C controller has a mux with
+// two BMI160 (0x68, 0x69) on channel 0 and one on channel 1, so both
+// controllers carry three sensors and read them at the same time.
+struct ImuNode
+{
+    uint8_t sensorId;
+    uint8_t port;
+    uint8_t channel;
+    I2cImuBus device;
+    MuxedImuBus bus;
+#ifdef CONFIG_SLIMEFY_IMU_TRACE
+    TracingImuBus traced;
+#endif
+    Bmi160 imu;
+    SensorFusion fusion;
+    bool hasSample;
+    float acceleration[3];
+
+    ImuNode(uint8_t sensorId, Tca9548a &mux, uint8_t channel, uint8_t address)
+        : sensorId(sensorId), port(mux.getPort()), channel(channel), device(mux.getPort(), address),
+#ifdef CONFIG_SLIMEFY_IMU_TRACE
+          bus(device, mux, channel), traced(bus), imu(traced), hasSample(false), acceleration{0, 0, 0} {}
+#else
+          bus(device, mux, channel), imu(bus), hasSample(false), acceleration{0, 0, 0} {}
+#endif
+};
+
+Tca9548a imuMuxes[ACQUISITION_MAX_BUSES] = {Tca9548a(I2C_NUM_0), Tca9548a(I2C_NUM_1)};
+ImuNode imuNodes[IMU_COUNT] = {
+    {1, imuMuxes[0], 0, BMI160_I2C_ADDRESS},
+    {2, imuMuxes[0], 0, BMI160_I2C_ADDRESS_ALT},
+    {3, imuMuxes[0], 1, BMI160_I2C_ADDRESS},
+    {4, imuMuxes[1], 0, BMI160_I2C_ADDRESS},
+    {5, imuMuxes[1], 0, BMI160_I2C_ADDRESS_ALT},
+    {6, imuMuxes[1], 1, BMI160_I2C_ADDRESS},
+};
+ImuAcquisition acquisition;
+AcquiredSample acquiredSamples[ACQUISITION_MAX_SENSORS];
+uint32_t fusionCycles = 0;
+uint32_t fusionSamples = 0;
+// Last profiler interval, sent to the server and logged with the status
+ProfileSummary profile[PROFILER_CORES][PROFILE_STAGE_COUNT];
 
-void telemetry(void *arg);
 void run(void *arg);
 
 extern "C" void app_main()
 {
+    BootTimeline::mark(BOOT_APP_MAIN);
     WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
-    xTaskCreatePinnedToCore(run, "Program", 4096, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY);
-    // xTaskCreatePinnedToCore(telemetry, "Telemetry", 4096, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY + 1);
+    createTask(TaskTopology::PROGRAM, run, NULL);
+}
+
+// Only drawn from on the sampling task, seeded at boot
+uint32_t standInState = 1;
+
+float generateRandomFloat()
+{
+    return nextStandInValue(standInState);
 }
 
-ulong current = 0;
-ulong updateCurrent = 0;
-bool infoSent = false;
 int tps = 0;
-void run(void *arg)
+
+ImuNode *findImuNode(uint8_t sensorId)
 {
-    storageManager.init();
-    wifiManager.init();
-    wifiManager.connect("Ellisium", "18315019");
+    for (ImuNode &node : imuNodes)
+    {
+        if (node.sensorId == sensorId)
+        {
+            return &node;
+        }
+    }
+    return nullptr;
+}
 
-    current = millis();
-    for (;;)
+// Runs on the sampling task. Both I2C controllers drain their IMU FIFOs in
+// parallel, every sample gets fused and the acceleration of the frame is the
+// one interpolated to the frame timestamp. Sensors without an IMU still get
+// random stand-in values.
+bool sampleSensors(SampleFrame &frame, void *arg)
+{
+    size_t count = 0;
+    if (acquisition.isRunning())
     {
-        ulong time = millis();
-        if (time - current >= 5000)
+        ProfileScope scope(PROFILE_SAMPLING);
+        acquisition.acquire(frame.timestamp, acquiredSamples, ACQUISITION_MAX_SENSORS, &count);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const AcquiredSample &acquired = acquiredSamples[i];
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+        if (acquired.sampleCount > 0)
         {
-            current = time;
-            ESP_LOGI("Telemetry", "WIFI state: %s", wifiManager.getStateName());
-            if (wifiManager.state != WifiState::CONNECTED)
-            {
-                return;
-            }
-            if (!slimeClient.isRunning())
-            {
-                slimeClient.start();
-            }
-            ESP_LOGI("Telemetry", "WIFI state: %d", (tps / 5));
-            tps = 0;
+            sessionRecorder.recordSamples(acquired.id, acquired.samples, acquired.sampleCount);
+        }
+#endif
+        ImuNode *node = findImuNode(acquired.id);
+        if (node == nullptr || !acquired.valid)
+        {
+            continue;
+        }
+        if (acquired.sampleCount > 0)
+        {
+            uint32_t start = cycles();
+            node->fusion.update(acquired.samples, acquired.sampleCount);
+            uint32_t elapsed = cycles() - start;
+            Profiler::record(PROFILE_FUSION, elapsed);
+            fusionCycles += elapsed;
+            fusionSamples += acquired.sampleCount;
+        }
+        memcpy(node->acceleration, acquired.aligned.acceleration, sizeof(node->acceleration));
+        node->hasSample = true;
+    }
+    for (uint8_t id = 1; id <= 6; id++)
+    {
+        SensorSample &sample = frame.samples[frame.sensorCount++];
+        sample.id = id;
+        sample.hasRotation = false;
+        ImuNode *node = findImuNode(id);
+        if (node != nullptr && node->hasSample)
+        {
+            memcpy(sample.acceleration, node->acceleration, sizeof(sample.acceleration));
+            sample.rotation = node->fusion.getRotation();
+            sample.hasRotation = true;
+            continue;
+        }
+        sample.acceleration[0] = generateRandomFloat();
+        sample.acceleration[1] = generateRandomFloat();
+        sample.acceleration[2] = generateRandomFloat();
+    }
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+    sessionRecorder.recordTick(frame.timestamp);
+#endif
+    return true;
+}
+
+// Runs on the network TX task
+void transmitSamples(const SampleFrame &frame, void *arg)
+{
+    if (!slimeClient.isConnected())
+    {
+        return;
+    }
+    for (uint8_t i = 0; i < frame.sensorCount; i++)
+    {
+        const SensorSample &sample = frame.samples[i];
+        slimeClient.setAcceleration(sample.id, sample.acceleration[0], sample.acceleration[1], sample.acceleration[2]);
+        if (sample.hasRotation)
+        {
+            slimeClient.setRotation(sample.id, sample.rotation);
+        }
+    }
+    int64_t now = micros64();
+    esp_err_t res = slimeClient.sendSensorData(now);
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+    sessionRecorder.recordSend(frame.timestamp, now, res);
+#endif
+    if (res == ESP_OK)
+    {
+        BootTimeline::mark(BOOT_FIRST_PACKET);
+        tps++;
+    }
+}
+
+// Starts the client as soon as there is an IP, it handshakes with the cached
+// server right away instead of waiting for its discovery broadcast
+void startClient(void *arg)
+{
+    if (wifiManager.state != WifiState::CONNECTED)
+    {
+        // The gateway may change with the next lease
+        pingClient.stop();
+        return;
+    }
+    if (!slimeClient.isRunning())
+    {
+        slimeClient.start();
+    }
+    if (!pingClient.isRunning() && wifiManager.gateway != 0)
+    {
+        pingClient.start(wifiManager.gateway);
+    }
+}
+
+// Keeps the burst schedule in step with the access point's beacons, the two
+// clocks drift apart by some ppm
+void syncBeacon(void *arg)
+{
+    int64_t tbtt;
+    if (wifiManager.getBeaconTime(burstScheduler.getWakePeriod(), &tbtt) == ESP_OK)
+    {
+        burstScheduler.syncBeacon(tbtt);
+    }
+}
+
+void streamProfile(void *arg)
+{
+    Profiler::collect(profile);
+    slimeClient.sendProfile(profile);
+}
+
+bool bootLogged = false;
+
+void reportStatus(void *arg)
+{
+    ESP_LOGI("Telemetry", "WIFI state: %s", wifiManager.getStateName());
+    if (!bootLogged && BootTimeline::isComplete())
+    {
+        BootTimeline::log();
+        bootLogged = true;
+    }
+    if (wifiManager.state != WifiState::CONNECTED)
+    {
+        return;
+    }
+    ESP_LOGI("Telemetry", "Ticks per second: %d", (tps / 5));
+    tps = 0;
+    SamplePipelineStats pipelineStats = samplePipeline.getStats();
+    ESP_LOGI("Telemetry", "Pipeline: produced=%lu consumed=%lu overflows=%lu underflows=%lu max depth=%lu",
+             (unsigned long)pipelineStats.framesProduced, (unsigned long)pipelineStats.framesConsumed,
+             (unsigned long)pipelineStats.overflows, (unsigned long)pipelineStats.underflows,
+             (unsigned long)pipelineStats.maxDepth);
+    PacketPoolStats poolStats = slimeClient.getPacketPoolStats();
+    ESP_LOGI("Telemetry", "Packet pool: in use=%lu/%lu peak=%lu acquired=%lu exhausted=%lu",
+             (unsigned long)poolStats.inUse, (unsigned long)poolStats.capacity, (unsigned long)poolStats.peakInUse,
+             (unsigned long)poolStats.acquired, (unsigned long)poolStats.exhausted);
+#ifdef CONFIG_SLIMEFY_RAW_UDP
+    RawUdpStats rawStats = rawTransport.getStats();
+    ESP_LOGI("Telemetry", "Raw UDP: handed off=%lu hand-off failed=%lu send failed=%lu receive dropped=%lu",
+             (unsigned long)rawStats.handedOff, (unsigned long)rawStats.handOffFailed,
+             (unsigned long)rawStats.sendFailed, (unsigned long)rawStats.receiveDropped);
+#endif
+    ReceiveStats receiveStats = slimeClient.getReceiveStats();
+    ESP_LOGI("Telemetry", "Receive: packets=%lu truncated=%lu dropped=%lu malformed=%lu unknown=%lu timeouts=%lu max batch=%lu",
+             (unsigned long)receiveStats.received, (unsigned long)receiveStats.truncated,
+             (unsigned long)receiveStats.dropped, (unsigned long)receiveStats.malformed,
+             (unsigned long)receiveStats.unknown, (unsigned long)receiveStats.timeouts, (unsigned long)receiveStats.maxBatch);
+    DiscoveryStats discoveryStats = slimeClient.getDiscoveryStats();
+    ESP_LOGI("Telemetry", "Discovery: rounds=%lu broadcasts=%lu found=%lu cached=%lu last=%lldus max=%lldus",
+             (unsigned long)discoveryStats.attempts, (unsigned long)discoveryStats.broadcasts,
+             (unsigned long)discoveryStats.found, (unsigned long)discoveryStats.foundCached,
+             (long long)discoveryStats.lastDuration, (long long)discoveryStats.maxDuration);
+    RateControllerState rateState = slimeClient.getRateControllerState();
+    ESP_LOGI("Telemetry", "Rate: %.1f/s loss=%.3f srtt=%lldus rttvar=%lldus throttled=%lu failures=%lu probes=%lu/%lu lost=%lu up=%lu down=%lu",
+             rateState.rate, rateState.lossRate, (long long)rateState.smoothedRtt, (long long)rateState.rttVariance,
+             (unsigned long)rateState.throttled, (unsigned long)rateState.sendFailures,
+             (unsigned long)rateState.probesAnswered, (unsigned long)rateState.probesSent,
+             (unsigned long)rateState.probesLost, (unsigned long)rateState.increases,
+             (unsigned long)rateState.decreases);
+    for (int source = 0; source < LATENCY_SOURCE_COUNT; source++)
+    {
+        LinkQuality link = latencyMonitor.getLinkQuality((LatencySource)source);
+        if (link.sent == 0)
+        {
+            continue;
         }
-        if (time - updateCurrent >= 7)
+        ESP_LOGI("Telemetry", "Latency %s: rtt=%lldus min=%lldus max=%lldus p50<%lldus p99<%lldus jitter=%lldus loss=%.3f answered=%lu/%lu",
+                 LatencyMonitor::getSourceName((LatencySource)source), (long long)link.smoothedRtt,
+                 (long long)link.minRtt, (long long)link.maxRtt, (long long)link.p50, (long long)link.p99,
+                 (long long)link.jitter, link.loss, (unsigned long)link.answered, (unsigned long)link.sent);
+    }
+    latencyMonitor.resetHistograms();
+    if (wifiManager.isPowerSave())
+    {
+        int64_t now = micros64();
+        BurstStats burst = burstScheduler.getStats(now);
+        ESP_LOGI("Telemetry", "Power save: bursts=%lu aligned=%lu forced=%lu frames/burst=%.1f latency avg=%lldus max=%lldus radio duty=%.1f%%",
+                 (unsigned long)burst.bursts, (unsigned long)burst.aligned, (unsigned long)burst.forced,
+                 burst.bursts > 0 ? (float)burst.frames / burst.bursts : 0.0f,
+                 (long long)(burst.frames > 0 ? burst.totalLatency / burst.frames : 0), (long long)burst.maxLatency,
+                 burst.elapsed > 0 ? 100.0f * burst.awakeTime / burst.elapsed : 0.0f);
+        burstScheduler.resetStats(now);
+    }
+    if (acquisition.isRunning())
+    {
+        AcquisitionStats acquisitionStats = acquisition.getStats();
+        ESP_LOGI("Telemetry", "Acquisition: ticks=%lu timeouts=%lu latency avg=%lldus max=%lldus skew avg=%lldus max=%lldus gap max=%lldus",
+                 (unsigned long)acquisitionStats.ticks, (unsigned long)acquisitionStats.timeouts,
+                 (long long)(acquisitionStats.ticks > 0 ? acquisitionStats.totalLatency / acquisitionStats.ticks : 0),
+                 (long long)acquisitionStats.maxLatency,
+                 (long long)(acquisitionStats.ticks > 0 ? acquisitionStats.totalSkew / acquisitionStats.ticks : 0),
+                 (long long)acquisitionStats.maxSkew, (long long)acquisitionStats.maxAlignmentGap);
+        for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
         {
-            updateCurrent = time;
-            if (!infoSent && slimeClient.isConnected())
+            const AcquisitionBusStats &busStats = acquisitionStats.buses[bus];
+            ESP_LOGI("Telemetry", "I2C %d: sensors=%lu busy=%.1f%% max tick=%lldus reads=%lu errors=%lu skips=%lu mux switches=%lu",
+                     bus, (unsigned long)busStats.sensors, 100.0f * busStats.utilisation,
+                     (long long)busStats.maxTickBusyTime, (unsigned long)busStats.reads,
+                     (unsigned long)busStats.errors, (unsigned long)busStats.busySkips,
+                     (unsigned long)imuMuxes[bus].getSwitches());
+        }
+        acquisition.resetStats();
+        for (ImuNode &node : imuNodes)
+        {
+            if (!node.imu.isInitialized())
             {
-                slimeClient.sendSensorInfo(1);
-                slimeClient.sendSensorInfo(2);
-                slimeClient.sendSensorInfo(3);
-                slimeClient.sendSensorInfo(4);
-                slimeClient.sendSensorInfo(5);
-                slimeClient.sendSensorInfo(6);
-                infoSent = true;
+                continue;
             }
-            if (infoSent && slimeClient.isConnected())
+            ImuStats imuStats = node.imu.getStats();
+            FusionStats fusionStats = node.fusion.getStats();
+            float bias[3];
+            node.fusion.getGyroBias(bias);
+            ESP_LOGI("Telemetry", "IMU %d: frames=%lu empty=%lu overruns=%lu errors=%lu rest=%d bias=%.4f,%.4f,%.4f rollbacks=%lu restarts=%lu",
+                     node.sensorId, (unsigned long)imuStats.frames, (unsigned long)imuStats.emptyReads,
+                     (unsigned long)imuStats.overruns, (unsigned long)imuStats.errors, node.fusion.isAtRest(),
+                     bias[0], bias[1], bias[2], (unsigned long)fusionStats.rollbacks,
+                     (unsigned long)fusionStats.restarts);
+        }
+        ESP_LOGI("Telemetry", "Fusion: %lu cycles/sample",
+                 (unsigned long)(fusionSamples > 0 ? fusionCycles / fusionSamples : 0));
+        fusionCycles = 0;
+        fusionSamples = 0;
+    }
+    for (uint8_t id = 1; id <= 6; id++)
+    {
+        SuppressionStats suppression;
+        if (slimeClient.getSuppressionStats(id, &suppression) != ESP_OK || suppression.offered == 0)
+        {
+            continue;
+        }
+        ESP_LOGI("Telemetry", "Sensor %d: offered=%lu sent=%lu suppressed=%lu (%.1f%%) throttled=%lu keyframes=%lu",
+                 id, (unsigned long)suppression.offered, (unsigned long)suppression.sent,
+                 (unsigned long)suppression.suppressed, 100.0f * suppression.suppressed / suppression.offered,
+                 (unsigned long)suppression.throttled, (unsigned long)suppression.keyframes);
+    }
+    for (int core = 0; core < PROFILER_CORES; core++)
+    {
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+        {
+            const ProfileSummary &summary = profile[core][stage];
+            if (summary.count == 0)
             {
-                slimeClient.sendAcceleration(1);
-                slimeClient.sendAcceleration(2);
-                slimeClient.sendAcceleration(3);
-                slimeClient.sendAcceleration(4);
-                slimeClient.sendAcceleration(5);
-                slimeClient.sendAcceleration(6);
-                tps++;
+                continue;
             }
+            ESP_LOGI("Telemetry", "Profile %s core %d: n=%lu p50=%.1fus p99=%.1fus max=%.1fus",
+                     Profiler::getStageName((ProfileStage)stage), core, (unsigned long)summary.count,
+                     (float)summary.p50 / CPU_CYCLES_PER_MICROSECOND, (float)summary.p99 / CPU_CYCLES_PER_MICROSECOND,
+                     (float)summary.max / CPU_CYCLES_PER_MICROSECOND);
+        }
+    }
+    DeferredLogStats logStats = DeferredLog::getStats();
+    ESP_LOGI("Telemetry", "Deferred log: recorded=%lu flushed=%lu dropped=%lu max depth=%lu",
+             (unsigned long)logStats.recorded, (unsigned long)logStats.flushed, (unsigned long)logStats.dropped,
+             (unsigned long)logStats.maxDepth);
+    StorageStats storageStats = storageManager.getStats();
+    ESP_LOGI("Telemetry", "Storage: changes=%lu writes=%lu coalesced=%lu unchanged=%lu errors=%lu last write=%lldus max=%lldus",
+             (unsigned long)storageStats.changes, (unsigned long)storageStats.writes,
+             (unsigned long)storageStats.coalesced, (unsigned long)storageStats.unchanged,
+             (unsigned long)storageStats.errors, (long long)storageStats.lastWriteDuration,
+             (long long)storageStats.maxWriteDuration);
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+    SessionRecorderStats sessionStats = sessionRecorder.getStats();
+    ESP_LOGI("Telemetry", "Session: %s blocks=%lu/%lu samples=%lu packets=%lu dropped=%lu write errors=%lu max write=%lldus",
+             sessionStats.recording ? "recording" : sessionStats.full ? "full" : sessionStats.overrun ? "overrun" : "stopped",
+             (unsigned long)sessionStats.blocksWritten, (unsigned long)sessionStats.blockCapacity,
+             (unsigned long)sessionStats.samples, (unsigned long)sessionStats.packets,
+             (unsigned long)sessionStats.dropped, (unsigned long)sessionStats.writeErrors,
+             (long long)sessionStats.maxWriteTime);
+#endif
+    scheduler.logStats();
+    scheduler.resetStats();
+}
+
+// Sensors that do not answer are left out, they keep sending random samples
+void startImus()
+{
+    const int pins[ACQUISITION_MAX_BUSES][2] = {{IMU_PORT0_SDA_PIN, IMU_PORT0_SCL_PIN},
+                                                {IMU_PORT1_SDA_PIN, IMU_PORT1_SCL_PIN}};
+    bool portReady[ACQUISITION_MAX_BUSES];
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        esp_err_t res = I2cImuBus::initPort(imuMuxes[bus].getPort(), pins[bus][0], pins[bus][1], IMU_I2C_FREQUENCY);
+        portReady[bus] = res == ESP_OK;
+        if (res != ESP_OK)
+        {
+            ESP_LOGW("Main", "I2C %d unavailable (%s)", bus, esp_err_to_name(res));
+        }
+    }
+#ifdef CONFIG_SLIMEFY_IMU_TRACE
+    imuNodes[0].traced.trace(CONFIG_SLIMEFY_IMU_TRACE_ACCESSES);
+#endif
+    for (ImuNode &node : imuNodes)
+    {
+        esp_err_t res = portReady[node.port] ? node.imu.init(Bmi160::defaultConfig()) : ESP_ERR_INVALID_STATE;
+        if (res == ESP_OK)
+        {
+            res = acquisition.addSensor(node.sensorId, node.imu, node.port, node.channel);
+        }
+        if (res == ESP_OK && node.sensorId < CONFIG_MAX_SENSORS && config.calibration[node.sensorId].valid)
+        {
+            node.fusion.setGyroBias(config.calibration[node.sensorId].gyroBias);
+        }
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+        if (res == ESP_OK)
+        {
+            SessionSensor sensor;
+            sensor.id = node.sensorId;
+            sensor.accelerationScale = node.imu.getAccelerationScale();
+            sensor.angularVelocityScale = node.imu.getAngularVelocityScale();
+            node.fusion.getGyroBias(sensor.gyroBias);
+            sessionRecorder.addSensor(sensor);
+        }
+#endif
+        if (res != ESP_OK)
+        {
+            ESP_LOGW("Main", "No IMU for sensor %d (%s), sending random samples", node.sensorId, esp_err_to_name(res));
+        }
+    }
+    if (acquisition.getSensorCount() > 0)
+    {
+        ESP_ERROR_CHECK(acquisition.start());
+    }
+}
+
+// Used for every field that was never stored, the Wi-Fi, stream and power
+// settings also replace stored ones when this build changed them
+StoredConfig defaultConfig()
+{
+    StoredConfig defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    strncpy(defaults.wifi.ssid, CONFIG_SLIMEFY_WIFI_SSID, sizeof(defaults.wifi.ssid) - 1);
+    strncpy(defaults.wifi.password, CONFIG_SLIMEFY_WIFI_PASSWORD, sizeof(defaults.wifi.password) - 1);
+    defaults.stream.sendPeriod = SENSOR_SEND_PERIOD_US;
+    defaults.stream.minRate = SENSOR_MIN_RATE;
+    defaults.stream.accelerationThreshold = SENSOR_ACCELERATION_THRESHOLD;
+    defaults.stream.angleThreshold = SENSOR_ANGLE_THRESHOLD;
+    defaults.stream.keyframePeriod = SENSOR_KEYFRAME_PERIOD_US;
+    defaults.stream.bundle = true;
+    defaults.stream.compactRotation = false;
+#ifdef CONFIG_SLIMEFY_POWER_SAVE
+    defaults.power.powerSave = true;
+#endif
+    defaults.power.listenInterval = CONFIG_SLIMEFY_LISTEN_INTERVAL;
+    defaults.power.latencyBudget = CONFIG_SLIMEFY_LATENCY_BUDGET_MS * 1000;
+    return defaults;
+}
+
+// Keeps the access point and server of this connection for the fast path of
+// the next boot. Both only change when the network does.
+void storeNetwork()
+{
+    WifiCache cache = wifiManager.getCache();
+    if (cache.valid)
+    {
+        NetworkCache network;
+        memset(&network, 0, sizeof(network));
+        network.valid = true;
+        memcpy(network.bssid, cache.bssid, sizeof(network.bssid));
+        network.channel = cache.channel;
+        storageManager.setNetworkCache(network);
+    }
+    ServerSettings server;
+    memset(&server, 0, sizeof(server));
+    if (slimeClient.getServerEndpoint(&server.address, &server.port))
+    {
+        server.valid = true;
+        storageManager.setServer(server);
+    }
+}
+
+// Keeps the gyro bias learned at rest for the next boot. Small changes are
+// not worth a flash write, the storage manager coalesces the rest.
+void storeCalibration()
+{
+    StoredConfig stored = storageManager.getConfig();
+    for (ImuNode &node : imuNodes)
+    {
+        if (!node.imu.isInitialized() || !node.fusion.isAtRest() || node.sensorId >= CONFIG_MAX_SENSORS)
+        {
+            continue;
+        }
+        SensorCalibration calibration;
+        memset(&calibration, 0, sizeof(calibration));
+        calibration.valid = true;
+        node.fusion.getGyroBias(calibration.gyroBias);
+        const SensorCalibration &previous = stored.calibration[node.sensorId];
+        bool moved = !previous.valid;
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            moved = moved || fabsf(calibration.gyroBias[axis] - previous.gyroBias[axis]) > IMU_BIAS_STORE_THRESHOLD;
+        }
+        if (moved)
+        {
+            storageManager.setCalibration(node.sensorId, calibration);
         }
     }
+}
+
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+// Records from boot until the partition is full. A partition that already
+// holds a session is left alone until it was read out and erased with
+// parttool.py, so a reboot does not lose the last recording.
+void startRecording()
+{
+    if (sessionPartition.init() != ESP_OK)
+    {
+        return;
+    }
+    uint32_t recorded;
+    if (sessionRecorder.findSession(sessionPartition, &recorded) == ESP_OK)
+    {
+        ESP_LOGW("Main", "Session %08lx not read out yet, erase the session partition to record again",
+                 (unsigned long)recorded);
+        return;
+    }
+    SessionStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.bundle = config.stream.bundle;
+    stream.compactRotation = config.stream.compactRotation;
+    stream.accelerationThreshold = config.stream.accelerationThreshold;
+    stream.angleThreshold = config.stream.angleThreshold;
+    stream.keyframePeriod = config.stream.keyframePeriod;
+    for (uint8_t id = 1; id <= 6; id++)
+    {
+        stream.sensorMask |= 1u << id;
+    }
+    stream.standInSeed = standInState;
+    esp_err_t res = sessionRecorder.start(sessionPartition, esp_random() | 1, stream);
+    if (res != ESP_OK)
+    {
+        ESP_LOGW("Main", "Session not recorded (%s)", esp_err_to_name(res));
+    }
+}
+#endif
+
+#ifdef CONFIG_SLIMEFY_SESSION_REPLAY
+// Replays the recorded session through fusion and serialization before the
+// tracker starts, as a benchmark on the device itself
+void replaySession()
+{
+    if (sessionPartition.init() != ESP_OK)
+    {
+        return;
+    }
+    esp_err_t res = sessionReplay.run(sessionPartition, SESSION_REPLAY_SPEED);
+    SessionReplayStats stats = sessionReplay.getStats();
+    if (stats.blocks == 0)
+    {
+        ESP_LOGW("Replay", "No session recorded (%s)", esp_err_to_name(res));
+        return;
+    }
+    ESP_LOGI("Replay", "Session: blocks=%lu ticks=%lu samples=%lu sends=%lu throttled=%lu recorded=%lldus end=%s",
+             (unsigned long)stats.blocks, (unsigned long)stats.ticks, (unsigned long)stats.samples,
+             (unsigned long)stats.sends, (unsigned long)stats.throttled, (long long)stats.recordedDuration,
+             esp_err_to_name(stats.end));
+    ESP_LOGI("Replay", "Packets: recorded=%lu matched=%lu mismatched=%lu missing=%lu extra=%lu fingerprint=%08lx",
+             (unsigned long)stats.packetsRecorded, (unsigned long)stats.packetsMatched,
+             (unsigned long)stats.packetsMismatched, (unsigned long)stats.packetsMissing,
+             (unsigned long)stats.packetsExtra, (unsigned long)stats.fingerprint);
+    ESP_LOGI("Replay", "Took %lldus, fusion %.1f cycles/sample, send %.1f cycles/frame",
+             (long long)stats.replayDuration,
+             stats.samples > 0 ? (float)stats.fusionCycles / stats.samples : 0.0f,
+             stats.sends > 0 ? (float)stats.serializeCycles / stats.sends : 0.0f);
+}
+#endif
+
+void updateStorage(void *arg)
+{
+    storeCalibration();
+    storeNetwork();
+    storageManager.flush(micros64());
+}
+
+void initWifi(void *arg)
+{
+    wifiManager.init();
+    BootTimeline::mark(BOOT_WIFI_READY);
+    xTaskNotifyGive((TaskHandle_t)arg);
     vTaskDelete(NULL);
 }
 
-void telemetry(void *arg)
+void run(void *arg)
 {
+    DeferredLog::start();
+    // netif and the Wi-Fi driver come up while NVS is mounted and read
+    createTask(TaskTopology::WIFI_INIT, initWifi, xTaskGetCurrentTaskHandle());
+    storageManager.init(defaultConfig());
+    config = storageManager.getConfig();
+    BootTimeline::mark(BOOT_STORAGE_READY);
+    standInState = esp_random() | 1;
+#ifdef CONFIG_SLIMEFY_SESSION_REPLAY
+    replaySession();
+#endif
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (config.wifi.ssid[0] != '\0')
+    {
+        WifiCache cache;
+        memset(&cache, 0, sizeof(cache));
+        cache.valid = config.network.valid;
+        memcpy(cache.bssid, config.network.bssid, sizeof(cache.bssid));
+        cache.channel = config.network.channel;
+        wifiManager.setPowerSave(config.power.powerSave, config.power.listenInterval);
+        wifiManager.connect(config.wifi.ssid, config.wifi.password, &cache);
+    }
+    else
+    {
+        ESP_LOGE("Main", "No Wi-Fi credentials stored, set CONFIG_SLIMEFY_WIFI_SSID");
+    }
+    for (uint8_t id = 1; id <= 6; id++)
+    {
+        slimeClient.registerSensor(id);
+    }
+#ifdef CONFIG_SLIMEFY_RAW_UDP
+    slimeClient.setTransport(&rawTransport);
+#endif
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+    slimeClient.setTransport(&recordingTransport);
+#endif
+    slimeClient.setLatencyMonitor(&latencyMonitor);
+    pingClient.setMonitor(&latencyMonitor);
+    if (config.server.valid)
+    {
+        slimeClient.setServerHint(config.server.address, config.server.port);
+    }
+    slimeClient.setRateLimits(config.stream.minRate, 1000000.0f / config.stream.sendPeriod);
+    slimeClient.setBundleEnabled(config.stream.bundle);
+    slimeClient.setCompactRotation(config.stream.compactRotation);
+    SuppressionConfig suppression;
+    suppression.accelerationThreshold = config.stream.accelerationThreshold;
+    suppression.angleThreshold = config.stream.angleThreshold;
+    suppression.keyframePeriod = config.stream.keyframePeriod;
+    slimeClient.setSuppression(suppression);
+    if (config.power.powerSave)
+    {
+        BurstConfig burst = BurstScheduler::defaultConfig();
+        burst.listenInterval = config.power.listenInterval;
+        burst.latencyBudget = config.power.latencyBudget;
+        burstScheduler.configure(burst);
+        burstScheduler.resetStats(micros64());
+        samplePipeline.setBurstScheduler(&burstScheduler);
+        // Replies wait at the access point until the next wakeup
+        slimeClient.setBurstTolerance(SAMPLE_PIPELINE_RING_SIZE, burstScheduler.getWakePeriod());
+    }
+
+#ifdef CONFIG_SLIMEFY_SESSION_RECORD
+    startRecording();
+#endif
+    startImus();
+
+    ESP_ERROR_CHECK(scheduler.init());
+    ESP_ERROR_CHECK(samplePipeline.start(config.stream.sendPeriod, sampleSensors, NULL, transmitSamples, NULL));
+    scheduler.addJob("connect", CONNECT_PERIOD_US, startClient, NULL);
+    scheduler.addJob("status", STATUS_PERIOD_US, reportStatus, NULL);
+    scheduler.addJob("storage", STORAGE_PERIOD_US, updateStorage, NULL);
+    scheduler.addJob("profile", PROFILE_PERIOD_US, streamProfile, NULL);
+    if (config.power.powerSave)
+    {
+        scheduler.addJob("beacon", BEACON_SYNC_PERIOD_US, syncBeacon, NULL);
+    }
+    scheduler.run();
     vTaskDelete(NULL);
 }
+
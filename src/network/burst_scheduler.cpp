@@ -0,0 +1,158 @@
+#include "burst_scheduler.hpp"
+
+#include <string.h>
+
+BurstScheduler::BurstScheduler()
+{
+    this->wakePeriod = BURST_BEACON_INTERVAL_US;
+    this->beaconPhase = 0;
+    this->synced = false;
+    this->statsStart = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+    portMUX_INITIALIZE(&this->lock);
+    this->configure(defaultConfig());
+}
+
+BurstConfig BurstScheduler::defaultConfig()
+{
+    BurstConfig config;
+    config.beaconInterval = BURST_BEACON_INTERVAL_US;
+    config.listenInterval = 1;
+    config.latencyBudget = 110000;
+    return config;
+}
+
+void BurstScheduler::configure(const BurstConfig &config)
+{
+    portENTER_CRITICAL(&this->lock);
+    this->config = config;
+    if (this->config.beaconInterval <= 0)
+    {
+        this->config.beaconInterval = BURST_BEACON_INTERVAL_US;
+    }
+    if (this->config.listenInterval == 0)
+    {
+        this->config.listenInterval = 1;
+    }
+    this->wakePeriod = this->config.beaconInterval * this->config.listenInterval;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+BurstConfig BurstScheduler::getConfig()
+{
+    portENTER_CRITICAL(&this->lock);
+    BurstConfig config = this->config;
+    portEXIT_CRITICAL(&this->lock);
+    return config;
+}
+
+int64_t BurstScheduler::getWakePeriod()
+{
+    return this->wakePeriod;
+}
+
+void BurstScheduler::syncBeacon(int64_t tbtt)
+{
+    portENTER_CRITICAL(&this->lock);
+    this->beaconPhase = tbtt;
+    this->synced = true;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+bool BurstScheduler::isSynced()
+{
+    return this->synced;
+}
+
+int64_t BurstScheduler::getWakeBefore(int64_t time)
+{
+    portENTER_CRITICAL(&this->lock);
+    bool synced = this->synced;
+    int64_t phase = this->beaconPhase;
+    int64_t period = this->wakePeriod;
+    portEXIT_CRITICAL(&this->lock);
+    if (!synced)
+    {
+        return -1;
+    }
+    int64_t offset = (time - phase) % period;
+    if (offset < 0)
+    {
+        offset += period;
+    }
+    return time - offset;
+}
+
+bool BurstScheduler::isAwake(int64_t time)
+{
+    int64_t wake = this->getWakeBefore(time);
+    return wake >= 0 && time < wake + BURST_BEACON_AWAKE_US;
+}
+
+int64_t BurstScheduler::getBurstTime(int64_t oldest, size_t depth, size_t capacity)
+{
+    portENTER_CRITICAL(&this->lock);
+    int64_t budget = this->config.latencyBudget;
+    portEXIT_CRITICAL(&this->lock);
+    if (budget <= 0 || depth + 1 >= capacity)
+    {
+        return oldest;
+    }
+    int64_t deadline = oldest + budget;
+    int64_t wake = this->getWakeBefore(deadline);
+    if (wake < 0)
+    {
+        return deadline;
+    }
+    if (wake >= oldest)
+    {
+        return wake;
+    }
+    // Queued while the radio was still up for that beacon
+    if (oldest < wake + BURST_BEACON_AWAKE_US)
+    {
+        return oldest;
+    }
+    return deadline;
+}
+
+void BurstScheduler::onBurst(int64_t now, uint32_t count, int64_t totalLatency, int64_t maxLatency, bool forced)
+{
+    bool aligned = this->isAwake(now);
+    portENTER_CRITICAL(&this->lock);
+    this->stats.bursts++;
+    this->stats.aligned += aligned ? 1 : 0;
+    this->stats.forced += forced ? 1 : 0;
+    this->stats.frames += count;
+    this->stats.totalLatency += totalLatency;
+    if (maxLatency > this->stats.maxLatency)
+    {
+        this->stats.maxLatency = maxLatency;
+    }
+    this->stats.awakeTime += (aligned ? 0 : BURST_TX_AWAKE_US) + (int64_t)count * BURST_FRAME_AIRTIME_US;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+// Beacon wakeups are added per wake period that passed, whether or not a
+// burst went out in them
+BurstStats BurstScheduler::getStats(int64_t now)
+{
+    portENTER_CRITICAL(&this->lock);
+    BurstStats result = this->stats;
+    result.elapsed = now - this->statsStart;
+    result.awakeTime += result.elapsed / this->wakePeriod * BURST_BEACON_AWAKE_US;
+    portEXIT_CRITICAL(&this->lock);
+    if (result.awakeTime > result.elapsed)
+    {
+        result.awakeTime = result.elapsed;
+    }
+    return result;
+}
+
+void BurstScheduler::resetStats(int64_t now)
+{
+    portENTER_CRITICAL(&this->lock);
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->statsStart = now;
+    portEXIT_CRITICAL(&this->lock);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+
+// 100 TU, the beacon interval of nearly every access point
+#define BURST_BEACON_INTERVAL_US 102400
+// Radio model behind the duty cycle estimate: time awake for a beacon, for a
+// wakeup only to send, and on air per datagram
+#define BURST_BEACON_AWAKE_US 3000
+#define BURST_TX_AWAKE_US 1500
+#define BURST_FRAME_AIRTIME_US 250
+
+struct BurstConfig
+{
+    int64_t beaconInterval; // us
+    uint8_t listenInterval; // beacons from one wakeup to the next
+    int64_t latencyBudget;  // us a sample may wait for its burst
+};
+
+struct BurstStats
+{
+    uint32_t bursts;
+    uint32_t aligned; // sent while the radio was up for a beacon
+    uint32_t forced;  // sent early because the queue was full
+    uint32_t frames;
+    int64_t totalLatency; // us from sampling to sending, over all frames
+    int64_t maxLatency;
+    int64_t awakeTime; // us, estimated from the radio model
+    int64_t elapsed;   // us these stats cover
+};
+
+// Decides when the frames queued for the radio go out. With modem sleep the
+// station only wakes for every listenInterval-th beacon. A burst is sent in
+// the latest wake window that still keeps the oldest queued frame within the
+// latency budget. If no window fits it goes out at the deadline and costs a
+// wakeup of its own. Pure logic, times are in us of the local clock. Beacon
+// times come in through syncBeacon(), so a simulated beacon clock works too.
+class BurstScheduler
+{
+private:
+    BurstConfig config;
+    int64_t wakePeriod;
+    int64_t beaconPhase;
+    bool synced;
+    BurstStats stats;
+    int64_t statsStart;
+    portMUX_TYPE lock;
+
+public:
+    BurstScheduler();
+
+    static BurstConfig defaultConfig();
+
+    void configure(const BurstConfig &config);
+    BurstConfig getConfig();
+    int64_t getWakePeriod();
+    // Local time of a beacon the station wakes for
+    void syncBeacon(int64_t tbtt);
+    bool isSynced();
+
+    // Start of the latest wake window at or before time, -1 before the first sync
+    int64_t getWakeBefore(int64_t time);
+    bool isAwake(int64_t time);
+    // When the depth frames queued since oldest have to go out, a time that
+    // already passed means right away. So does a queue one short of capacity.
+    int64_t getBurstTime(int64_t oldest, size_t depth, size_t capacity);
+    // count frames were sent at now, latency summed and max over them
+    void onBurst(int64_t now, uint32_t count, int64_t totalLatency, int64_t maxLatency, bool forced);
+
+    BurstStats getStats(int64_t now);
+    void resetStats(int64_t now);
+};
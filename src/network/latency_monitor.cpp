@@ -0,0 +1,163 @@
+#include "latency_monitor.hpp"
+
+#include <string.h>
+
+LatencyMonitor::LatencyMonitor()
+{
+    memset(this->tracks, 0, sizeof(this->tracks));
+    for (Track &track : this->tracks)
+    {
+        track.quality.lastRtt = -1;
+    }
+    portMUX_INITIALIZE(&this->lock);
+}
+
+int LatencyMonitor::bucketIndex(int64_t value)
+{
+    int bucket = 0;
+    int64_t bound = LATENCY_FIRST_BUCKET_US;
+    while (value >= bound && bucket < LATENCY_BUCKETS - 1)
+    {
+        bound <<= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+int64_t LatencyMonitor::bucketUpperBound(int bucket)
+{
+    return (int64_t)LATENCY_FIRST_BUCKET_US << bucket;
+}
+
+int64_t LatencyMonitor::percentile(const LatencyHistogram &histogram, float share)
+{
+    if (histogram.count == 0)
+    {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(share * histogram.count + 0.999f);
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram.buckets[i];
+        if (seen >= rank)
+        {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(LATENCY_BUCKETS - 1);
+}
+
+void LatencyMonitor::onProbeSent(LatencySource source)
+{
+    portENTER_CRITICAL(&this->lock);
+    this->tracks[source].quality.sent++;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+void LatencyMonitor::onAnswer(LatencySource source, int64_t rtt, int64_t now)
+{
+    if (rtt < 0)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&this->lock);
+    Track &track = this->tracks[source];
+    LinkQuality &quality = track.quality;
+    if (quality.answered == 0)
+    {
+        quality.minRtt = rtt;
+        quality.maxRtt = rtt;
+        quality.smoothedRtt = rtt;
+        quality.rttDeviation = rtt / 2;
+    }
+    else
+    {
+        int64_t difference = rtt > quality.lastRtt ? rtt - quality.lastRtt : quality.lastRtt - rtt;
+        quality.jitter += (difference - quality.jitter) >> LATENCY_JITTER_SHIFT;
+        track.jitter.buckets[bucketIndex(difference)]++;
+        track.jitter.count++;
+        int64_t error = rtt > quality.smoothedRtt ? rtt - quality.smoothedRtt : quality.smoothedRtt - rtt;
+        quality.rttDeviation += (error - quality.rttDeviation) >> LATENCY_DEVIATION_SHIFT;
+        quality.smoothedRtt += (rtt - quality.smoothedRtt) >> LATENCY_RTT_SHIFT;
+        quality.minRtt = rtt < quality.minRtt ? rtt : quality.minRtt;
+        quality.maxRtt = rtt > quality.maxRtt ? rtt : quality.maxRtt;
+    }
+    quality.loss -= quality.loss * LATENCY_LOSS_WEIGHT;
+    quality.lastRtt = rtt;
+    quality.lastAnswer = now;
+    quality.answered++;
+    track.rtt.buckets[bucketIndex(rtt)]++;
+    track.rtt.count++;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+void LatencyMonitor::onLoss(LatencySource source, uint32_t count)
+{
+    portENTER_CRITICAL(&this->lock);
+    LinkQuality &quality = this->tracks[source].quality;
+    quality.lost += count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        quality.loss += (1.0f - quality.loss) * LATENCY_LOSS_WEIGHT;
+    }
+    portEXIT_CRITICAL(&this->lock);
+}
+
+LinkQuality LatencyMonitor::getLinkQuality(LatencySource source)
+{
+    portENTER_CRITICAL(&this->lock);
+    const Track &track = this->tracks[source];
+    LinkQuality quality = track.quality;
+    LatencyHistogram rtt = track.rtt;
+    portEXIT_CRITICAL(&this->lock);
+    quality.p50 = percentile(rtt, 0.5f);
+    quality.p99 = percentile(rtt, 0.99f);
+    return quality;
+}
+
+void LatencyMonitor::getHistograms(LatencySource source, LatencyHistogram *rtt, LatencyHistogram *jitter)
+{
+    portENTER_CRITICAL(&this->lock);
+    if (rtt != nullptr)
+    {
+        *rtt = this->tracks[source].rtt;
+    }
+    if (jitter != nullptr)
+    {
+        *jitter = this->tracks[source].jitter;
+    }
+    portEXIT_CRITICAL(&this->lock);
+}
+
+bool LatencyMonitor::isFresh(LatencySource source, int64_t now, int64_t maxAge)
+{
+    portENTER_CRITICAL(&this->lock);
+    int64_t lastAnswer = this->tracks[source].quality.lastAnswer;
+    portEXIT_CRITICAL(&this->lock);
+    return lastAnswer > 0 && now - lastAnswer <= maxAge;
+}
+
+void LatencyMonitor::resetHistograms()
+{
+    portENTER_CRITICAL(&this->lock);
+    for (Track &track : this->tracks)
+    {
+        memset(&track.rtt, 0, sizeof(track.rtt));
+        memset(&track.jitter, 0, sizeof(track.jitter));
+    }
+    portEXIT_CRITICAL(&this->lock);
+}
+
+const char *LatencyMonitor::getSourceName(LatencySource source)
+{
+    switch (source)
+    {
+    case LATENCY_ICMP:
+        return "icmp";
+    case LATENCY_APP:
+        return "app";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+// Power of two buckets in us, bucket 0 holds everything below 128 us and the
+// last one everything from 1 s up
+#define LATENCY_BUCKETS 15
+#define LATENCY_FIRST_BUCKET_US 128
+// EWMA weights as shifts: RTT 1/8 and its deviation 1/4 as in TCP, jitter
+// 1/16 as in RTP, loss 1/16 per probe
+#define LATENCY_RTT_SHIFT 3
+#define LATENCY_DEVIATION_SHIFT 2
+#define LATENCY_JITTER_SHIFT 4
+#define LATENCY_LOSS_WEIGHT (1.0f / 16.0f)
+
+enum LatencySource
+{
+    LATENCY_ICMP, // echo to the gateway, the Wi-Fi link alone
+    LATENCY_APP,  // PACKET_PING_PONG to the server, end to end
+    LATENCY_SOURCE_COUNT
+};
+
+struct LatencyHistogram
+{
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+};
+
+struct LinkQuality
+{
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t lost;
+    int64_t lastRtt; // us, -1 before the first answer
+    int64_t minRtt;
+    int64_t maxRtt;
+    int64_t smoothedRtt;
+    int64_t rttDeviation;
+    int64_t jitter;  // smoothed difference between consecutive RTTs
+    float loss;      // smoothed share of lost probes
+    int64_t p50;     // us, upper bucket bound
+    int64_t p99;
+    int64_t lastAnswer; // us since boot, 0 before the first answer
+};
+
+// Link latency from two kinds of probes: ICMP echoes to the gateway sent by
+// PingClient and the client's PACKET_PING_PONG probes to the server. Answers
+// and losses are fed in by the tasks that see them, anything can query the
+// current link quality. Fixed size state under a spinlock, nothing is
+// allocated.
+class LatencyMonitor
+{
+private:
+    struct Track
+    {
+        LinkQuality quality;
+        LatencyHistogram rtt;
+        LatencyHistogram jitter;
+    };
+
+    Track tracks[LATENCY_SOURCE_COUNT];
+    portMUX_TYPE lock;
+
+public:
+    LatencyMonitor();
+
+    void onProbeSent(LatencySource source);
+    void onAnswer(LatencySource source, int64_t rtt, int64_t now);
+    void onLoss(LatencySource source, uint32_t count);
+
+    LinkQuality getLinkQuality(LatencySource source);
+    void getHistograms(LatencySource source, LatencyHistogram *rtt, LatencyHistogram *jitter);
+    // Whether the source answered within maxAge us
+    bool isFresh(LatencySource source, int64_t now, int64_t maxAge);
+    // Clears the histograms, the smoothed values keep running
+    void resetHistograms();
+
+    static const char *getSourceName(LatencySource source);
+    static int64_t bucketUpperBound(int bucket);
+
+private:
+    static int bucketIndex(int64_t value);
+    static int64_t percentile(const LatencyHistogram &histogram, float share);
+};
@@ -0,0 +1,169 @@
+#include "loopback_transport.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include "../utils/profiler.hpp"
+#include "../utils/timing.hpp"
+
+LoopbackTransport::LoopbackTransport()
+{
+    this->running = false;
+    this->sentHead = 0;
+    this->sentCount = 0;
+    this->inboundHead = 0;
+    this->inboundCount = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+    portMUX_INITIALIZE(&this->lock);
+}
+
+esp_err_t LoopbackTransport::start(int port)
+{
+    this->running = true;
+    return ESP_OK;
+}
+
+esp_err_t LoopbackTransport::stop()
+{
+    this->running = false;
+    return ESP_OK;
+}
+
+bool LoopbackTransport::isRunning()
+{
+    return this->running;
+}
+
+ssize_t LoopbackTransport::receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated)
+{
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    portENTER_CRITICAL(&this->lock);
+    if (this->inboundCount == 0)
+    {
+        portEXIT_CRITICAL(&this->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    LoopbackDatagram &datagram = this->inbound[this->inboundHead];
+    size_t length = datagram.size < bufferLength ? datagram.size : bufferLength;
+    memcpy(buffer, datagram.data, length);
+    memcpy(sourceAddress, &datagram.address, sizeof(datagram.address));
+    *sourceAddressLength = sizeof(datagram.address);
+    *truncated = datagram.size > bufferLength;
+    this->inboundHead = (this->inboundHead + 1) % LOOPBACK_TRANSPORT_QUEUE_SIZE;
+    this->inboundCount--;
+    portEXIT_CRITICAL(&this->lock);
+    return length;
+}
+
+esp_err_t LoopbackTransport::waitReadable(int64_t timeoutUs)
+{
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    int64_t deadline = micros64() + timeoutUs;
+    for (;;)
+    {
+        portENTER_CRITICAL(&this->lock);
+        bool readable = this->inboundCount > 0;
+        portEXIT_CRITICAL(&this->lock);
+        if (readable)
+        {
+            return ESP_OK;
+        }
+        if (micros64() >= deadline)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+}
+
+NetBuffer *LoopbackTransport::acquire()
+{
+    return this->packetPool.acquire();
+}
+
+void LoopbackTransport::release(NetBuffer *buffer)
+{
+    this->packetPool.release(buffer);
+}
+
+esp_err_t LoopbackTransport::submit(const sockaddr_in &address, NetBuffer *buffer)
+{
+    {
+        ProfileScope scope(PROFILE_SEND);
+        size_t size = buffer->getCurrentSize();
+        portENTER_CRITICAL(&this->lock);
+        if (this->sentCount == LOOPBACK_TRANSPORT_QUEUE_SIZE)
+        {
+            this->sentHead = (this->sentHead + 1) % LOOPBACK_TRANSPORT_QUEUE_SIZE;
+            this->sentCount--;
+            this->stats.overwritten++;
+        }
+        LoopbackDatagram &datagram = this->sent[(this->sentHead + this->sentCount) % LOOPBACK_TRANSPORT_QUEUE_SIZE];
+        datagram.address = address;
+        datagram.size = size;
+        memcpy(datagram.data, buffer->getBuffer(), size);
+        this->sentCount++;
+        this->stats.sent++;
+        this->stats.sentBytes += size;
+        portEXIT_CRITICAL(&this->lock);
+    }
+    this->packetPool.release(buffer);
+    return ESP_OK;
+}
+
+PacketPoolStats LoopbackTransport::getBufferStats()
+{
+    return this->packetPool.getStats();
+}
+
+esp_err_t LoopbackTransport::inject(const unsigned char *data, size_t size, const sockaddr_in &source)
+{
+    if (size > PACKET_POOL_BUFFER_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    portENTER_CRITICAL(&this->lock);
+    if (this->inboundCount == LOOPBACK_TRANSPORT_QUEUE_SIZE)
+    {
+        this->stats.rejected++;
+        portEXIT_CRITICAL(&this->lock);
+        return ESP_ERR_NO_MEM;
+    }
+    LoopbackDatagram &datagram = this->inbound[(this->inboundHead + this->inboundCount) % LOOPBACK_TRANSPORT_QUEUE_SIZE];
+    datagram.address = source;
+    datagram.size = size;
+    memcpy(datagram.data, data, size);
+    this->inboundCount++;
+    this->stats.injected++;
+    portEXIT_CRITICAL(&this->lock);
+    return ESP_OK;
+}
+
+bool LoopbackTransport::takeSent(LoopbackDatagram *datagram)
+{
+    portENTER_CRITICAL(&this->lock);
+    if (this->sentCount == 0)
+    {
+        portEXIT_CRITICAL(&this->lock);
+        return false;
+    }
+    memcpy(datagram, &this->sent[this->sentHead], sizeof(*datagram));
+    this->sentHead = (this->sentHead + 1) % LOOPBACK_TRANSPORT_QUEUE_SIZE;
+    this->sentCount--;
+    portEXIT_CRITICAL(&this->lock);
+    return true;
+}
+
+LoopbackStats LoopbackTransport::getStats()
+{
+    portENTER_CRITICAL(&this->lock);
+    LoopbackStats stats = this->stats;
+    portEXIT_CRITICAL(&this->lock);
+    return stats;
+}
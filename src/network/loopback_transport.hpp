@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+
+#include "udp_transport.hpp"
+
+// Datagrams kept in each direction
+#define LOOPBACK_TRANSPORT_QUEUE_SIZE 16
+
+struct LoopbackDatagram
+{
+    sockaddr_in address; // destination when sent, source when injected
+    size_t size;
+    unsigned char data[PACKET_POOL_BUFFER_SIZE];
+};
+
+struct LoopbackStats
+{
+    uint32_t sent;
+    uint32_t sentBytes;
+    uint32_t overwritten; // sent datagrams nobody took before the queue wrapped
+    uint32_t injected;
+    uint32_t rejected; // injected while the receive queue was full
+};
+
+// In-memory backend for host tools and benchmarks, nothing goes on the wire.
+// Sent datagrams go to a queue that keeps the latest
+// LOOPBACK_TRANSPORT_QUEUE_SIZE of them for takeSent(). Datagrams passed to
+// inject() come out of receiveNonBlocking() as if they were received.
+class LoopbackTransport : public UdpTransport
+{
+private:
+    bool running;
+    PacketPool packetPool;
+    LoopbackDatagram sent[LOOPBACK_TRANSPORT_QUEUE_SIZE];
+    size_t sentHead;
+    size_t sentCount;
+    LoopbackDatagram inbound[LOOPBACK_TRANSPORT_QUEUE_SIZE];
+    size_t inboundHead;
+    size_t inboundCount;
+    LoopbackStats stats;
+    portMUX_TYPE lock;
+
+public:
+    LoopbackTransport();
+
+    esp_err_t start(int port) override;
+    esp_err_t stop() override;
+    bool isRunning() override;
+    ssize_t receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated) override;
+    // Polls every tick, good enough for tests
+    esp_err_t waitReadable(int64_t timeoutUs) override;
+
+    NetBuffer *acquire() override;
+    void release(NetBuffer *buffer) override;
+    esp_err_t submit(const sockaddr_in &address, NetBuffer *buffer) override;
+    PacketPoolStats getBufferStats() override;
+
+    // ESP_ERR_NO_MEM while the receive queue is full
+    esp_err_t inject(const unsigned char *data, size_t size, const sockaddr_in &source);
+    // Oldest sent datagram still kept, false when there is none
+    bool takeSent(LoopbackDatagram *datagram);
+    LoopbackStats getStats();
+};
@@ -1,21 +1,26 @@
 #include "net_buffer.hpp"
 
 #include <cstring>
+#include "packet_writer.hpp"
 
 template <typename T>
-unsigned char * NetBuffer::toChars(T src)
+esp_err_t NetBuffer::writeValue(T data)
 {
-    union data
+    if (this->currentPosition + sizeof(T) > this->bufferSize)
     {
-        unsigned char buffer[sizeof(T)];
-        T value;
-    } un;
-    un.value = src;
-    for (size_t i = 0; i < sizeof(T); i++)
-    {
-        convBuf[i] = un.buffer[sizeof(T) - i - 1];
+        return ESP_FAIL;
     }
-    return convBuf;
+    endian::storeBigEndian(this->buffer + this->currentPosition, data);
+    this->currentPosition += sizeof(T);
+    return ESP_OK;
+}
+
+NetBuffer::NetBuffer()
+{
+    buffer = nullptr;
+    bufferSize = 0;
+    currentPosition = 0;
+    ownsBuffer = false;
 }
 
 NetBuffer::NetBuffer(size_t size)
@@ -23,16 +28,30 @@ NetBuffer::NetBuffer(size_t size)
     buffer = new unsigned char[size];
     bufferSize = size;
     currentPosition = 0;
+    ownsBuffer = true;
+}
+
+// Wraps caller provided storage, e.g. a statically allocated pool slot, without taking ownership.
+NetBuffer::NetBuffer(unsigned char *storage, size_t size)
+{
+    buffer = storage;
+    bufferSize = size;
+    currentPosition = 0;
+    ownsBuffer = false;
 }
 
 NetBuffer::~NetBuffer()
 {
-    delete[] buffer;
+    if (ownsBuffer)
+    {
+        delete[] buffer;
+    }
 }
 
 NetBuffer::NetBuffer(const NetBuffer &other)
     : bufferSize(other.bufferSize),
-      currentPosition(other.currentPosition)
+      currentPosition(other.currentPosition),
+      ownsBuffer(true)
 {
     buffer = new unsigned char[bufferSize];
     std::memcpy(buffer, other.buffer, bufferSize);
@@ -42,7 +61,11 @@ NetBuffer &NetBuffer::operator=(const NetBuffer &other)
 {
     if (this != &other)
     {
-        delete[] buffer;
+        if (ownsBuffer)
+        {
+            delete[] buffer;
+        }
+        ownsBuffer = true;
         bufferSize = other.bufferSize;
         currentPosition = other.currentPosition;
         buffer = new unsigned char[bufferSize];
@@ -69,92 +92,63 @@ esp_err_t NetBuffer::seek(size_t position)
 
 esp_err_t NetBuffer::writeByte(int8_t data)
 {
-    if (this->currentPosition + sizeof(int8_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(int8_t));
-    this->currentPosition += sizeof(int8_t);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeUByte(uint8_t data)
 {
-    if (this->currentPosition + sizeof(uint8_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(uint8_t));
-    this->currentPosition += sizeof(uint8_t);
-    return ESP_OK;
+    return this->writeValue(data);
+}
+
+esp_err_t NetBuffer::writeShort(int16_t data)
+{
+    return this->writeValue(data);
+}
+
+esp_err_t NetBuffer::writeUShort(uint16_t data)
+{
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeInt(int32_t data)
 {
-    if (this->currentPosition + sizeof(int32_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(int32_t));
-    this->currentPosition += sizeof(int32_t);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeUInt(uint32_t data)
 {
-    if (this->currentPosition + sizeof(uint32_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(uint32_t));
-    this->currentPosition += sizeof(uint32_t);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeLong(int64_t data)
 {
-    if (this->currentPosition + sizeof(int64_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(int64_t));
-    this->currentPosition += sizeof(int64_t);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeULong(uint64_t data)
 {
-    if (this->currentPosition + sizeof(uint64_t) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(uint64_t));
-    this->currentPosition += sizeof(uint64_t);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeFloat(float data)
 {
-    if (this->currentPosition + sizeof(float) > this->bufferSize)
-    {
-        return ESP_FAIL;
-    }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(float));
-    this->currentPosition += sizeof(float);
-    return ESP_OK;
+    return this->writeValue(data);
 }
 
 esp_err_t NetBuffer::writeBool(bool data)
 {
-    if (this->currentPosition + sizeof(bool) > this->bufferSize)
+    return this->writeValue(data);
+}
+
+unsigned char *NetBuffer::reserve(size_t size)
+{
+    if (this->currentPosition + size > this->bufferSize)
     {
-        return ESP_FAIL;
+        return nullptr;
     }
-    std::memcpy(this->buffer + this->currentPosition, toChars(data), sizeof(bool));
-    this->currentPosition += sizeof(bool);
-    return ESP_OK;
+    unsigned char *start = this->buffer + this->currentPosition;
+    this->currentPosition += size;
+    return start;
 }
 
 esp_err_t NetBuffer::writeByteArray(uint8_t *data, size_t size)
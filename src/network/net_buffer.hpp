@@ -9,29 +9,34 @@ private:
     unsigned char *buffer;
     size_t bufferSize;
     size_t currentPosition;
-    unsigned char convBuf[8];
+    bool ownsBuffer;
 
 public:
+    NetBuffer();
     NetBuffer(size_t size);
+    NetBuffer(unsigned char *storage, size_t size);
     ~NetBuffer();
     NetBuffer(const NetBuffer &other);
     NetBuffer &operator=(const NetBuffer &other);
 
 private:
     template <typename T>
-    unsigned char *toChars(T src);
+    esp_err_t writeValue(T data);
 
 public:
     esp_err_t reset();
     esp_err_t seek(size_t position);
     esp_err_t writeByte(int8_t data);
     esp_err_t writeUByte(uint8_t data);
+    esp_err_t writeShort(int16_t data);
+    esp_err_t writeUShort(uint16_t data);
     esp_err_t writeInt(int32_t data);
     esp_err_t writeUInt(uint32_t data);
     esp_err_t writeLong(int64_t data);
     esp_err_t writeULong(uint64_t data);
     esp_err_t writeFloat(float data);
     esp_err_t writeBool(bool data);
+    unsigned char *reserve(size_t size);
     esp_err_t writeByteArray(uint8_t *data, size_t size);
     esp_err_t writeString(char *data, size_t size);
     esp_err_t writeShortString(char *data, size_t size);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "packet_writer.hpp"
+
+// Read cursor over a received datagram, the counterpart of NetBuffer. It never
+// copies or owns the data and every read is checked against the datagram
+// size: a read that does not fit fails with ESP_ERR_INVALID_SIZE and leaves
+// the cursor where it was.
+class NetReader
+{
+private:
+    const unsigned char *buffer;
+    size_t bufferSize;
+    size_t currentPosition;
+
+public:
+    NetReader(const unsigned char *data, size_t size) : buffer(data), bufferSize(data != nullptr ? size : 0), currentPosition(0) {}
+
+    template <typename T>
+    inline esp_err_t read(T *value)
+    {
+        if (sizeof(T) > this->remaining())
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *value = endian::loadBigEndian<T>(this->buffer + this->currentPosition);
+        this->currentPosition += sizeof(T);
+        return ESP_OK;
+    }
+
+    esp_err_t readByte(int8_t *value) { return this->read(value); }
+    esp_err_t readUByte(uint8_t *value) { return this->read(value); }
+    esp_err_t readShort(int16_t *value) { return this->read(value); }
+    esp_err_t readUShort(uint16_t *value) { return this->read(value); }
+    esp_err_t readInt(int32_t *value) { return this->read(value); }
+    esp_err_t readUInt(uint32_t *value) { return this->read(value); }
+    esp_err_t readLong(int64_t *value) { return this->read(value); }
+    esp_err_t readULong(uint64_t *value) { return this->read(value); }
+    esp_err_t readFloat(float *value) { return this->read(value); }
+
+    // Points into the datagram, nullptr if fewer than size bytes are left
+    inline const unsigned char *view(size_t size)
+    {
+        if (size > this->remaining())
+        {
+            return nullptr;
+        }
+        const unsigned char *start = this->buffer + this->currentPosition;
+        this->currentPosition += size;
+        return start;
+    }
+
+    inline esp_err_t skip(size_t size)
+    {
+        return this->view(size) != nullptr ? ESP_OK : ESP_ERR_INVALID_SIZE;
+    }
+
+    inline esp_err_t seek(size_t position)
+    {
+        if (position > this->bufferSize)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        this->currentPosition = position;
+        return ESP_OK;
+    }
+
+    inline size_t remaining() const
+    {
+        return this->bufferSize - this->currentPosition;
+    }
+
+    inline size_t getPosition() const
+    {
+        return this->currentPosition;
+    }
+
+    inline size_t getSize() const
+    {
+        return this->bufferSize;
+    }
+
+    inline const unsigned char *getBuffer() const
+    {
+        return this->buffer;
+    }
+};
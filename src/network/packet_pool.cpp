@@ -0,0 +1,61 @@
+#include "packet_pool.hpp"
+
+#include <new>
+
+static constexpr uint32_t ALL_FREE = PACKET_POOL_SIZE == 32 ? 0xFFFFFFFFu : ((1u << PACKET_POOL_SIZE) - 1);
+
+PacketPool::PacketPool() : freeMask(ALL_FREE), acquired(0), exhausted(0), peakInUse(0)
+{
+    // The default constructed buffers own nothing, so they can be rebuilt in place over the pool storage
+    for (size_t i = 0; i < PACKET_POOL_SIZE; i++)
+    {
+        new (&buffers[i]) NetBuffer(storage[i], PACKET_POOL_BUFFER_SIZE);
+    }
+}
+
+NetBuffer *PacketPool::acquire()
+{
+    uint32_t mask = this->freeMask.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if (mask == 0)
+        {
+            this->exhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uint32_t slot = __builtin_ctz(mask);
+        if (this->freeMask.compare_exchange_weak(mask, mask & ~(1u << slot), std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            uint32_t inUse = PACKET_POOL_SIZE - __builtin_popcount(mask & ~(1u << slot));
+            uint32_t peak = this->peakInUse.load(std::memory_order_relaxed);
+            while (inUse > peak && !this->peakInUse.compare_exchange_weak(peak, inUse, std::memory_order_relaxed))
+            {
+            }
+            this->acquired.fetch_add(1, std::memory_order_relaxed);
+            NetBuffer *buffer = &this->buffers[slot];
+            buffer->reset();
+            return buffer;
+        }
+    }
+}
+
+void PacketPool::release(NetBuffer *buffer)
+{
+    size_t slot = buffer - this->buffers;
+    if (slot >= PACKET_POOL_SIZE)
+    {
+        return;
+    }
+    this->freeMask.fetch_or(1u << slot, std::memory_order_release);
+}
+
+PacketPoolStats PacketPool::getStats()
+{
+    PacketPoolStats stats;
+    stats.capacity = PACKET_POOL_SIZE;
+    stats.inUse = PACKET_POOL_SIZE - __builtin_popcount(this->freeMask.load(std::memory_order_relaxed));
+    stats.peakInUse = this->peakInUse.load(std::memory_order_relaxed);
+    stats.acquired = this->acquired.load(std::memory_order_relaxed);
+    stats.exhausted = this->exhausted.load(std::memory_order_relaxed);
+    return stats;
+}
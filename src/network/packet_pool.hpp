@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "net_buffer.hpp"
+
+#define PACKET_POOL_SIZE 8
+#define PACKET_POOL_BUFFER_SIZE 512
+
+struct PacketPoolStats
+{
+    uint32_t capacity;
+    uint32_t inUse;
+    uint32_t peakInUse;
+    uint32_t acquired;
+    uint32_t exhausted;
+};
+
+// Fixed set of send buffers living inside the pool object itself, no heap use
+// after construction. Free slots are tracked in one atomic bitmask so any task
+// on either core can acquire and release without taking a lock.
+class PacketPool
+{
+    static_assert(PACKET_POOL_SIZE <= 32, "The free mask holds at most 32 slots");
+
+private:
+    unsigned char storage[PACKET_POOL_SIZE][PACKET_POOL_BUFFER_SIZE];
+    NetBuffer buffers[PACKET_POOL_SIZE];
+    std::atomic<uint32_t> freeMask;
+    std::atomic<uint32_t> acquired;
+    std::atomic<uint32_t> exhausted;
+    std::atomic<uint32_t> peakInUse;
+
+public:
+    PacketPool();
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    // Returns a reset buffer, or nullptr when every slot is in use.
+    NetBuffer *acquire();
+    void release(NetBuffer *buffer);
+    PacketPoolStats getStats();
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+#include "packet_writer.hpp"
+
+enum PacketType : uint8_t
+{
+    PACKET_HEARTBEAT = 0,
+    PACKET_HANDSHAKE = 3,
+    PACKET_ACCEL = 4,
+    PACKET_RAW_CALIBRATION_DATA = 6,
+    PACKET_CALIBRATION_FINISHED = 7,
+    PACKET_CONFIG = 8,
+    PACKET_PING_PONG = 10,
+    PACKET_SERIAL = 11,
+    PACKET_BATTERY_LEVEL = 12,
+    PACKET_TAP = 13,
+    PACKET_ERROR = 14,
+    PACKET_SENSOR_INFO = 15,
+    PACKET_ROTATION_DATA = 17,
+    PACKET_MAGNETOMETER_ACCURACY = 18,
+    PACKET_SIGNAL_STRENGTH = 19,
+    PACKET_TEMPERATURE = 20,
+    PACKET_BUNDLE = 100,
+    PACKET_INSPECTION = 105,
+    // Slimefy extension, smallest-three quaternion. Only host/tools/slime_server
+    // understands it, the SlimeVR server expects PACKET_ROTATION_DATA.
+    PACKET_ROTATION_COMPACT = 200,
+};
+
+#define ROTATION_DATA_TYPE_NORMAL 1
+#define ROTATION_DATA_TYPE_CORRECTION 2
+
+enum ReceivePacketType : uint8_t
+{
+    PACKET_RECEIVE_HEARTBEAT = 1,
+    PACKET_RECEIVE_VIBRATE = 2,
+    PACKET_RECEIVE_HANDSHAKE = 3,
+    PACKET_RECEIVE_COMMAND = 4,
+};
+
+#define PACKET_INSPECTION_PACKETTYPE_RAW_IMU_DATA 1
+#define PACKET_INSPECTION_PACKETTYPE_FUSED_IMU_DATA 2
+#define PACKET_INSPECTION_PACKETTYPE_CORRECTION_DATA 3
+// Slimefy extension, latency histogram summary of one hot path stage. The
+// SlimeVR server ignores inspection types it does not know.
+#define PACKET_INSPECTION_PACKETTYPE_PROFILE 4
+#define PACKET_INSPECTION_DATATYPE_INT 1
+#define PACKET_INSPECTION_DATATYPE_FLOAT 2
+
+// Fixed length raw bytes, e.g. a MAC address.
+template <size_t N>
+struct Bytes
+{
+    uint8_t data[N];
+};
+
+// Length prefixed string whose length is part of the layout.
+template <size_t N>
+struct ShortString
+{
+    char data[N];
+};
+
+template <typename T, typename Enable = void>
+struct FieldCodec;
+
+template <typename T>
+struct FieldCodec<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    static constexpr size_t size = sizeof(T);
+
+    static inline void write(unsigned char *destination, const T &value)
+    {
+        endian::storeBigEndian(destination, value);
+    }
+
+    static inline T read(const unsigned char *source)
+    {
+        return endian::loadBigEndian<T>(source);
+    }
+};
+
+template <size_t N>
+struct FieldCodec<Bytes<N>>
+{
+    static constexpr size_t size = N;
+
+    static inline void write(unsigned char *destination, const Bytes<N> &value)
+    {
+        memcpy(destination, value.data, N);
+    }
+
+    static inline Bytes<N> read(const unsigned char *source)
+    {
+        Bytes<N> value;
+        memcpy(value.data, source, N);
+        return value;
+    }
+};
+
+template <size_t N>
+struct FieldCodec<ShortString<N>>
+{
+    static_assert(N <= UINT8_MAX, "ShortString length must fit in one byte");
+    static constexpr size_t size = 1 + N;
+
+    static inline void write(unsigned char *destination, const ShortString<N> &value)
+    {
+        destination[0] = static_cast<uint8_t>(N);
+        memcpy(destination + 1, value.data, N);
+    }
+
+    static inline ShortString<N> read(const unsigned char *source)
+    {
+        ShortString<N> value;
+        memcpy(value.data, source + 1, N);
+        return value;
+    }
+};
+
+// Every datagram starts with the packet type as a 32 bit integer followed by
+// a 64 bit packet number. Packets inside a bundle drop the packet number and
+// are prefixed by their 16 bit length instead.
+static constexpr size_t PACKET_HEADER_SIZE = PacketSize<uint32_t, uint64_t>::value;
+static constexpr size_t BUNDLED_PACKET_HEADER_SIZE = PacketSize<uint16_t, uint32_t>::value;
+
+template <uint8_t Type, typename... Fields>
+struct PacketSchema
+{
+    using FieldTypes = std::tuple<Fields...>;
+
+    static constexpr uint8_t type = Type;
+    static constexpr size_t fieldCount = sizeof...(Fields);
+    static constexpr size_t payloadSize = (FieldCodec<Fields>::size + ... + 0);
+    static constexpr size_t wireSize = PACKET_HEADER_SIZE + payloadSize;
+    static constexpr size_t bundledSize = BUNDLED_PACKET_HEADER_SIZE + payloadSize;
+
+    template <size_t I>
+    using Field = typename std::tuple_element<I, FieldTypes>::type;
+
+    template <size_t I>
+    static constexpr size_t offset()
+    {
+        static_assert(I < sizeof...(Fields), "Field index out of range");
+        constexpr size_t sizes[] = {0, FieldCodec<Fields>::size...};
+        size_t result = 0;
+        for (size_t i = 0; i < I; i++)
+        {
+            result += sizes[i + 1];
+        }
+        return result;
+    }
+
+    static inline void encodePayload(unsigned char *destination, const Fields &...fields)
+    {
+        (void)destination;
+        (writeField<Fields>(destination, fields), ...);
+    }
+
+    // destination must hold at least wireSize bytes
+    static inline void encode(unsigned char *destination, uint64_t packetNumber, const Fields &...fields)
+    {
+        PacketWriter(destination).put<uint32_t>(Type).put(packetNumber);
+        encodePayload(destination + PACKET_HEADER_SIZE, fields...);
+    }
+
+    // destination must hold at least bundledSize bytes
+    static inline void encodeBundled(unsigned char *destination, const Fields &...fields)
+    {
+        PacketWriter(destination).put<uint16_t>(bundledSize - sizeof(uint16_t)).put<uint32_t>(Type);
+        encodePayload(destination + BUNDLED_PACKET_HEADER_SIZE, fields...);
+    }
+
+    // Zero copy view over a received datagram. Callers check isValid() before
+    // reading, the accessors themselves do no bounds checking.
+    struct View
+    {
+        const unsigned char *data;
+        size_t size;
+
+        View(const unsigned char *data, size_t size) : data(data), size(size) {}
+
+        bool isValid() const
+        {
+            return data != nullptr && size >= wireSize && endian::loadBigEndian<uint32_t>(data) == Type;
+        }
+
+        uint64_t packetNumber() const
+        {
+            return endian::loadBigEndian<uint64_t>(data + sizeof(uint32_t));
+        }
+
+        template <size_t I>
+        Field<I> get() const
+        {
+            return FieldCodec<Field<I>>::read(data + PACKET_HEADER_SIZE + offset<I>());
+        }
+    };
+
+private:
+    template <typename T>
+    static inline void writeField(unsigned char *&destination, const T &value)
+    {
+        FieldCodec<T>::write(destination, value);
+        destination += FieldCodec<T>::size;
+    }
+};
+
+// Outbound packets
+using HeartbeatPacket = PacketSchema<PACKET_HEARTBEAT>;
+using HandshakePacket = PacketSchema<PACKET_HANDSHAKE,
+                                     int32_t,          // Board
+                                     int32_t,          // IMU
+                                     int32_t,          // MCU
+                                     int32_t,          // IMU info
+                                     int32_t,          // IMU info
+                                     int32_t,          // IMU info
+                                     int32_t,          // Build version
+                                     ShortString<5>,   // Version string
+                                     Bytes<6>>;        // Mac address
+using AccelPacket = PacketSchema<PACKET_ACCEL, float, float, float, uint8_t>;
+using RotationPacket = PacketSchema<PACKET_ROTATION_DATA,
+                                    uint8_t,             // Sensor id
+                                    uint8_t,             // Data type
+                                    float, float, float, // x, y, z
+                                    float,               // w
+                                    uint8_t>;            // Calibration accuracy
+using CompactRotationPacket = PacketSchema<PACKET_ROTATION_COMPACT,
+                                           uint8_t,                        // Sensor id
+                                           uint16_t, uint16_t, uint16_t>;  // Smallest-three words
+using PingPongPacket = PacketSchema<PACKET_PING_PONG, int32_t>;
+using SensorInfoPacket = PacketSchema<PACKET_SENSOR_INFO, uint8_t, uint8_t, uint8_t>;
+using BundlePacket = PacketSchema<PACKET_BUNDLE>;
+using ProfilePacket = PacketSchema<PACKET_INSPECTION,
+                                   uint8_t,   // PACKET_INSPECTION_PACKETTYPE_PROFILE
+                                   uint8_t,   // ProfileStage
+                                   uint8_t,   // Core
+                                   uint16_t,  // Cycles per microsecond
+                                   uint32_t,  // Count
+                                   uint32_t,  // p50, cycles
+                                   uint32_t,  // p99, cycles
+                                   uint32_t>; // Max, cycles
+
+// Inbound packets
+using ReceiveSensorInfoPacket = PacketSchema<PACKET_SENSOR_INFO, uint8_t, uint8_t>;
+
+static_assert(HeartbeatPacket::wireSize == 12, "Unexpected heartbeat layout");
+static_assert(HandshakePacket::wireSize == 12 + 7 * 4 + 1 + 5 + 6, "Unexpected handshake layout");
+static_assert(AccelPacket::wireSize == 12 + 3 * 4 + 1, "Unexpected accel layout");
+static_assert(AccelPacket::bundledSize == 6 + 3 * 4 + 1, "Unexpected bundled accel layout");
+static_assert(RotationPacket::wireSize == 12 + 2 + 4 * 4 + 1, "Unexpected rotation layout");
+static_assert(CompactRotationPacket::payloadSize == 1 + 3 * 2, "Unexpected compact rotation layout");
+static_assert(PingPongPacket::wireSize == 16, "Unexpected ping pong layout");
+static_assert(SensorInfoPacket::wireSize == 15, "Unexpected sensor info layout");
+static_assert(ProfilePacket::wireSize == 12 + 3 + 2 + 4 * 4, "Unexpected profile layout");
+static_assert(ReceiveSensorInfoPacket::wireSize == 14, "Unexpected sensor info layout");
+static_assert(AccelPacket::offset<3>() == 12, "Unexpected accel field offset");
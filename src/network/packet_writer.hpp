@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+namespace endian
+{
+    template <size_t Size>
+    struct UnsignedOfSize;
+
+    template <>
+    struct UnsignedOfSize<1>
+    {
+        using type = uint8_t;
+    };
+
+    template <>
+    struct UnsignedOfSize<2>
+    {
+        using type = uint16_t;
+    };
+
+    template <>
+    struct UnsignedOfSize<4>
+    {
+        using type = uint32_t;
+    };
+
+    template <>
+    struct UnsignedOfSize<8>
+    {
+        using type = uint64_t;
+    };
+
+    constexpr uint8_t byteSwap(uint8_t value)
+    {
+        return value;
+    }
+
+    constexpr uint16_t byteSwap(uint16_t value)
+    {
+        return static_cast<uint16_t>((value << 8) | (value >> 8));
+    }
+
+    constexpr uint32_t byteSwap(uint32_t value)
+    {
+        return ((value & 0x000000FFu) << 24) |
+               ((value & 0x0000FF00u) << 8) |
+               ((value & 0x00FF0000u) >> 8) |
+               ((value & 0xFF000000u) >> 24);
+    }
+
+    constexpr uint64_t byteSwap(uint64_t value)
+    {
+        return (static_cast<uint64_t>(byteSwap(static_cast<uint32_t>(value))) << 32) |
+               byteSwap(static_cast<uint32_t>(value >> 32));
+    }
+
+    template <typename T>
+    constexpr T toBigEndian(T value)
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return byteSwap(value);
+#else
+        return value;
+#endif
+    }
+
+    static_assert(byteSwap(static_cast<uint16_t>(0x1234)) == 0x3412, "byteSwap(uint16_t) is broken");
+    static_assert(byteSwap(static_cast<uint32_t>(0x12345678u)) == 0x78563412u, "byteSwap(uint32_t) is broken");
+    static_assert(byteSwap(static_cast<uint64_t>(0x0102030405060708ull)) == 0x0807060504030201ull, "byteSwap(uint64_t) is broken");
+
+    // Stores any trivially copyable scalar (integers, floats, bools) in network byte order.
+    // The memcpy calls are folded by the compiler into a single register store.
+    template <typename T>
+    inline void storeBigEndian(unsigned char *destination, T value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be serialized");
+        using Raw = typename UnsignedOfSize<sizeof(T)>::type;
+        Raw raw;
+        memcpy(&raw, &value, sizeof(T));
+        raw = toBigEndian(raw);
+        memcpy(destination, &raw, sizeof(T));
+    }
+
+    template <typename T>
+    inline T loadBigEndian(const unsigned char *source)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be deserialized");
+        using Raw = typename UnsignedOfSize<sizeof(T)>::type;
+        Raw raw;
+        memcpy(&raw, source, sizeof(T));
+        raw = toBigEndian(raw);
+        T value;
+        memcpy(&value, &raw, sizeof(T));
+        return value;
+    }
+}
+
+template <typename... Fields>
+struct PacketSize
+{
+    static constexpr size_t value = (sizeof(Fields) + ... + 0);
+};
+
+// Unchecked big-endian writer. The caller reserves the whole packet up front
+// (see NetBuffer::reserve) so the individual puts never test the capacity.
+class PacketWriter
+{
+private:
+    unsigned char *cursor;
+
+public:
+    explicit PacketWriter(unsigned char *destination) : cursor(destination) {}
+
+    template <typename T>
+    inline PacketWriter &put(T value)
+    {
+        endian::storeBigEndian(cursor, value);
+        cursor += sizeof(T);
+        return *this;
+    }
+
+    inline PacketWriter &putBytes(const uint8_t *data, size_t size)
+    {
+        memcpy(cursor, data, size);
+        cursor += size;
+        return *this;
+    }
+
+    inline unsigned char *position()
+    {
+        return cursor;
+    }
+};
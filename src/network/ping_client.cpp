@@ -5,6 +5,8 @@
 #include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <esp_log.h>
+#include "../utils/deferred_log.hpp"
+#include "../utils/timing.hpp"
 
 static const char *TAG = "PingClient";
 
@@ -20,8 +22,9 @@ PingClient::PingClient(int count, int interval, int taskPriority)
         .on_ping_timeout = PingClient::on_ping_timeout,
         .on_ping_end = PingClient::on_ping_end,
     };
-    handle = esp_ping_handle_t();
+    handle = nullptr;
     running = false;
+    monitor = nullptr;
 }
 
 esp_err_t dnsLookup(const char *target_host, ip_addr_t &target_addr)
@@ -73,20 +76,38 @@ esp_err_t PingClient::start(const char *target_host)
     {
         return err;
     }
+    return startSession(target_addr);
+}
+
+esp_err_t PingClient::start(uint32_t address)
+{
+    if (this->running)
+        return ESP_FAIL;
+    ip_addr_t target_addr;
+    memset(&target_addr, 0, sizeof(target_addr));
+    target_addr.type = IPADDR_TYPE_V4;
+    target_addr.u_addr.ip4.addr = address;
+    return startSession(target_addr);
+}
+
+esp_err_t PingClient::startSession(const ip_addr_t &target_addr)
+{
     ESP_LOGI(TAG, "target_addr.type=%d", target_addr.type);
     ESP_LOGI(TAG, "target_addr.u_addr.ip4=%s", ip4addr_ntoa(&(target_addr.u_addr.ip4)));
     config.target_addr = target_addr;
 
-    /* set callback functions */
-    handle = new esp_ping_handle_t();
-    err = esp_ping_new_session(&config, &callbacks, &handle);
+    // The session handle is written by esp_ping_new_session, nothing to allocate
+    auto err = esp_ping_new_session(&config, &callbacks, &handle);
     if (err != ESP_OK)
     {
+        handle = nullptr;
         return err;
     }
-    esp_ping_start(handle);
+    err = esp_ping_start(handle);
     if (err != ESP_OK)
     {
+        esp_ping_delete_session(handle);
+        handle = nullptr;
         return err;
     }
     ESP_LOGI(TAG, "ping start");
@@ -94,11 +115,20 @@ esp_err_t PingClient::start(const char *target_host)
     return ESP_OK;
 }
 
+// on_ping_end only runs once a finite count is used up, an infinite session
+// is stopped and deleted here
 esp_err_t PingClient::stop()
 {
     if (!running)
         return ESP_OK;
     auto err = esp_ping_stop(handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = esp_ping_delete_session(handle);
+    handle = nullptr;
+    running = false;
     return err;
 }
 
@@ -107,22 +137,30 @@ bool PingClient::isRunning()
     return this->running;
 }
 
+void PingClient::setMonitor(LatencyMonitor *monitor)
+{
+    this->monitor = monitor;
+}
+
 void PingClient::internal_ping_success(esp_ping_handle_t hdl)
 {
     if (this->handle != hdl)
         return;
-    uint8_t ttl;
     uint16_t seqno;
-    uint32_t elapsed_time, recv_len;
+    uint32_t elapsed_time;
     ip_addr_t target_addr;
     esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_TTL, &ttl, sizeof(ttl));
     esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_SIZE, &recv_len, sizeof(recv_len));
     esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &elapsed_time, sizeof(elapsed_time));
 
-    ESP_LOGI(TAG, "%" PRIu32 " bytes from %s icmp_seq=%d ttl=%d time=%" PRIu32 " ms",
-             recv_len, inet_ntoa(target_addr.u_addr.ip4), seqno, ttl, elapsed_time);
+    if (this->monitor != nullptr)
+    {
+        // TIMEGAP only has ms resolution, sub-ms answers land in bucket 0
+        this->monitor->onProbeSent(LATENCY_ICMP);
+        this->monitor->onAnswer(LATENCY_ICMP, (int64_t)elapsed_time * 1000, micros64());
+    }
+    const uint8_t *ip = (const uint8_t *)&target_addr.u_addr.ip4.addr;
+    deferredLog<LOG_PING_REPLY>(ip[0], ip[1], ip[2], ip[3], seqno, elapsed_time);
 }
 
 void PingClient::internal_ping_timeout(esp_ping_handle_t hdl)
@@ -133,7 +171,14 @@ void PingClient::internal_ping_timeout(esp_ping_handle_t hdl)
     ip_addr_t target_addr;
     esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
     esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
-    ESP_LOGW(TAG, "From %s icmp_seq=%d timeout", inet_ntoa(target_addr.u_addr.ip4), seqno);
+
+    if (this->monitor != nullptr)
+    {
+        this->monitor->onProbeSent(LATENCY_ICMP);
+        this->monitor->onLoss(LATENCY_ICMP, 1);
+    }
+    const uint8_t *ip = (const uint8_t *)&target_addr.u_addr.ip4.addr;
+    deferredLog<LOG_PING_TIMEOUT>(ip[0], ip[1], ip[2], ip[3], seqno);
 }
 
 void PingClient::internal_ping_end(esp_ping_handle_t hdl)
@@ -162,6 +207,7 @@ void PingClient::internal_ping_end(esp_ping_handle_t hdl)
     // delete the ping sessions, so that we clean up all resources and can create a new ping session
     // we don't have to call delete function in the callback, instead we can call delete function from other tasks
     esp_ping_delete_session(this->handle);
+    this->handle = nullptr;
     this->running = false;
 }
 
@@ -190,4 +236,4 @@ void PingClient::on_ping_end(esp_ping_handle_t hdl, void *args)
     {
         pingClient->internal_ping_end(hdl);
     }
-}
\ No newline at end of file
+}
@@ -3,6 +3,8 @@
 #include <netdb.h>
 #include <ping/ping_sock.h>
 
+#include "latency_monitor.hpp"
+
 class PingClient
 {
 private:
@@ -10,21 +12,27 @@ private:
     esp_ping_callbacks_t callbacks;
     esp_ping_handle_t handle;
     bool running;
+    LatencyMonitor *monitor;
 
 public:
     PingClient(int count = ESP_PING_COUNT_INFINITE, int interval = 1000, int taskPriority = 5);
 
     esp_err_t start(uint32_t interval, uint32_t taskPriority, const char *target_host);
     esp_err_t start(const char *target_host);
+    // IPv4 address in network byte order, skips the DNS lookup
+    esp_err_t start(uint32_t address);
     esp_err_t stop();
     bool isRunning();
+    // Replies and timeouts are fed into monitor as LATENCY_ICMP
+    void setMonitor(LatencyMonitor *monitor);
 
     void internal_ping_success(esp_ping_handle_t hdl);
     void internal_ping_timeout(esp_ping_handle_t hdl);
     void internal_ping_end(esp_ping_handle_t hdl);
 
 private:
+    esp_err_t startSession(const ip_addr_t &target_addr);
     static void on_ping_success(esp_ping_handle_t hdl, void *args);
     static void on_ping_timeout(esp_ping_handle_t hdl, void *args);
     static void on_ping_end(esp_ping_handle_t hdl, void *args);
-};
\ No newline at end of file
+};
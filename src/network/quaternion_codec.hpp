@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#include "../utils/quaternion.hpp"
+
+// Smallest-three quaternion encoding. The largest component of a unit
+// quaternion is dropped and rebuilt from the other three, which then lie in
+// [-1/sqrt(2), 1/sqrt(2)]. Each is quantized to 15 bits and the index of the
+// dropped component takes the top bits of the first two words: 6 bytes
+// instead of the 16 of four floats. q and -q are the same rotation, so the
+// sign is flipped to make the dropped component positive.
+struct CompactQuaternion
+{
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+namespace smallestThree
+{
+    static constexpr float RANGE = 0.70710678f;
+    static constexpr uint16_t COMPONENT_MAX = 0x7FFF;
+    static constexpr float STEP = 2.0f * RANGE / COMPONENT_MAX;
+
+    // Worst case rotation error of an encode/decode round trip in radians. Each
+    // stored component is off by at most STEP / 2, the rebuilt one (at least
+    // 1/2) by at most 3 * STEP / 2, so |dq| <= sqrt(3) * STEP and the rotation
+    // angle, twice that, stays below 2 * sqrt(3) * STEP (about 0.009 degrees).
+    static constexpr float MAX_ANGLE_ERROR = 2.0f * 1.7320508f * STEP;
+
+    inline uint16_t quantize(float value)
+    {
+        if (value > RANGE)
+        {
+            value = RANGE;
+        }
+        else if (value < -RANGE)
+        {
+            value = -RANGE;
+        }
+        return (uint16_t)lrintf((value + RANGE) / STEP);
+    }
+
+    inline float dequantize(uint16_t value)
+    {
+        return (value & COMPONENT_MAX) * STEP - RANGE;
+    }
+
+    // q must be normalized
+    inline CompactQuaternion encode(const Quaternion &q)
+    {
+        const float components[4] = {q.x, q.y, q.z, q.w};
+        uint8_t largest = 0;
+        for (uint8_t i = 1; i < 4; i++)
+        {
+            if (fabsf(components[i]) > fabsf(components[largest]))
+            {
+                largest = i;
+            }
+        }
+        float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+        uint16_t words[3];
+        for (uint8_t i = 0, j = 0; i < 4; i++)
+        {
+            if (i != largest)
+            {
+                words[j++] = quantize(components[i] * sign);
+            }
+        }
+        return {(uint16_t)(words[0] | (largest & 1) << 15),
+                (uint16_t)(words[1] | (largest >> 1) << 15),
+                words[2]};
+    }
+
+    inline Quaternion decode(const CompactQuaternion &compact)
+    {
+        uint8_t largest = (compact.a >> 15) | (compact.b >> 15) << 1;
+        float small[3] = {dequantize(compact.a), dequantize(compact.b), dequantize(compact.c)};
+        float sum = small[0] * small[0] + small[1] * small[1] + small[2] * small[2];
+        float components[4];
+        for (uint8_t i = 0, j = 0; i < 4; i++)
+        {
+            components[i] = i == largest ? sqrtf(sum < 1.0f ? 1.0f - sum : 0.0f) : small[j++];
+        }
+        return {components[0], components[1], components[2], components[3]};
+    }
+}
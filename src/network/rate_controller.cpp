@@ -0,0 +1,237 @@
+#include "rate_controller.hpp"
+
+#include <string.h>
+
+RateController::RateController()
+{
+    memset(&this->state, 0, sizeof(this->state));
+    this->configure(defaultConfig());
+    this->reset(0);
+}
+
+RateControllerConfig RateController::defaultConfig()
+{
+    RateControllerConfig config;
+    config.minRate = 20.0f;
+    config.maxRate = 143.0f;
+    config.increaseStep = 5.0f;
+    config.decreaseFactor = 0.7f;
+    config.lossThreshold = 0.05f;
+    config.rttMargin = 40000;
+    config.updateInterval = 500000;
+    config.probeTimeout = 500000;
+    config.burst = 2.0f;
+    return config;
+}
+
+void RateController::configure(const RateControllerConfig &config)
+{
+    this->config = config;
+    if (this->config.maxRate < this->config.minRate)
+    {
+        this->config.maxRate = this->config.minRate;
+    }
+    if (this->state.rate > this->config.maxRate)
+    {
+        this->state.rate = this->config.maxRate;
+    }
+    if (this->state.rate < this->config.minRate)
+    {
+        this->state.rate = this->config.minRate;
+    }
+}
+
+RateControllerConfig RateController::getConfig()
+{
+    return this->config;
+}
+
+// Starts again at the maximum rate, e.g. after reconnecting to the server
+void RateController::reset(int64_t now)
+{
+    memset(&this->state, 0, sizeof(this->state));
+    memset(this->probes, 0, sizeof(this->probes));
+    this->state.rate = this->config.maxRate;
+    this->state.tokens = this->config.burst;
+    this->state.minRtt = INT64_MAX;
+    this->nextProbe = 0;
+    this->lastRefill = now;
+    this->nextUpdate = now + this->config.updateInterval;
+    this->intervalSent = 0;
+    this->intervalFailed = 0;
+    this->intervalProbesAnswered = 0;
+    this->intervalProbesLost = 0;
+}
+
+void RateController::refill(int64_t now)
+{
+    if (now <= this->lastRefill)
+    {
+        return;
+    }
+    this->state.tokens += this->state.rate * (float)(now - this->lastRefill) / 1000000.0f;
+    if (this->state.tokens > this->config.burst)
+    {
+        this->state.tokens = this->config.burst;
+    }
+    this->lastRefill = now;
+}
+
+bool RateController::tryConsume(int64_t now)
+{
+    this->refill(now);
+    if (this->state.tokens < 1.0f)
+    {
+        this->state.throttled++;
+        return false;
+    }
+    this->state.tokens -= 1.0f;
+    return true;
+}
+
+void RateController::onSendResult(bool success)
+{
+    this->state.sent++;
+    this->intervalSent++;
+    if (!success)
+    {
+        this->state.sendFailures++;
+        this->intervalFailed++;
+    }
+}
+
+void RateController::expireProbe(Probe &probe)
+{
+    probe.pending = false;
+    if (this->state.probesAnswered > 0)
+    {
+        this->state.probesLost++;
+        this->intervalProbesLost++;
+    }
+}
+
+void RateController::onProbeSent(int32_t id, int64_t now)
+{
+    Probe &probe = this->probes[this->nextProbe];
+    this->nextProbe = (this->nextProbe + 1) % RATE_CONTROLLER_MAX_PROBES;
+    if (probe.pending)
+    {
+        this->expireProbe(probe);
+    }
+    probe.id = id;
+    probe.sentAt = now;
+    probe.used = true;
+    probe.pending = true;
+    this->state.probesSent++;
+}
+
+// Expired probes keep their slot until it is reused, so a late echo is still
+// recognised as ours instead of being echoed back like a server ping
+bool RateController::onProbeReply(int32_t id, int64_t now, int64_t *rtt)
+{
+    if (rtt != nullptr)
+    {
+        *rtt = -1;
+    }
+    for (size_t i = 0; i < RATE_CONTROLLER_MAX_PROBES; i++)
+    {
+        Probe &probe = this->probes[i];
+        if (!probe.used || probe.id != id)
+        {
+            continue;
+        }
+        if (probe.pending)
+        {
+            probe.pending = false;
+            this->state.probesAnswered++;
+            this->intervalProbesAnswered++;
+            this->addRttSample(now - probe.sentAt);
+            if (rtt != nullptr)
+            {
+                *rtt = now - probe.sentAt;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Same smoothing constants as TCP (RFC 6298)
+void RateController::addRttSample(int64_t rtt)
+{
+    if (rtt < this->state.minRtt)
+    {
+        this->state.minRtt = rtt;
+    }
+    if (this->state.smoothedRtt == 0)
+    {
+        this->state.smoothedRtt = rtt;
+        this->state.rttVariance = rtt / 2;
+        return;
+    }
+    int64_t error = rtt - this->state.smoothedRtt;
+    this->state.rttVariance += ((error < 0 ? -error : error) - this->state.rttVariance) / 4;
+    this->state.smoothedRtt += error / 8;
+}
+
+void RateController::update(int64_t now)
+{
+    for (size_t i = 0; i < RATE_CONTROLLER_MAX_PROBES; i++)
+    {
+        Probe &probe = this->probes[i];
+        if (probe.pending && now - probe.sentAt > this->config.probeTimeout)
+        {
+            this->expireProbe(probe);
+        }
+    }
+
+    if (now < this->nextUpdate)
+    {
+        return;
+    }
+    this->nextUpdate = now + this->config.updateInterval;
+
+    float loss = 0.0f;
+    if (this->intervalSent > 0)
+    {
+        loss = (float)this->intervalFailed / this->intervalSent;
+    }
+    uint32_t probesResolved = this->intervalProbesAnswered + this->intervalProbesLost;
+    if (probesResolved > 0)
+    {
+        float probeLoss = (float)this->intervalProbesLost / probesResolved;
+        loss = probeLoss > loss ? probeLoss : loss;
+    }
+    this->state.lossRate += (loss - this->state.lossRate) / 4.0f;
+    bool delayed = this->state.minRtt != INT64_MAX &&
+                   this->state.smoothedRtt > this->state.minRtt + this->config.rttMargin;
+
+    if (loss > this->config.lossThreshold || delayed)
+    {
+        this->state.rate *= this->config.decreaseFactor;
+        this->state.decreases++;
+    }
+    else if (this->state.rate < this->config.maxRate)
+    {
+        this->state.rate += this->config.increaseStep;
+        this->state.increases++;
+    }
+    if (this->state.rate < this->config.minRate)
+    {
+        this->state.rate = this->config.minRate;
+    }
+    if (this->state.rate > this->config.maxRate)
+    {
+        this->state.rate = this->config.maxRate;
+    }
+
+    this->intervalSent = 0;
+    this->intervalFailed = 0;
+    this->intervalProbesAnswered = 0;
+    this->intervalProbesLost = 0;
+}
+
+RateControllerState RateController::getState()
+{
+    return this->state;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RATE_CONTROLLER_MAX_PROBES 8
+
+struct RateControllerConfig
+{
+    float minRate;          // sends per second
+    float maxRate;          // sends per second
+    float increaseStep;     // sends per second added per healthy interval
+    float decreaseFactor;   // multiplier applied on congestion
+    float lossThreshold;    // loss ratio per interval treated as congestion
+    int64_t rttMargin;      // us above the minimum RTT treated as congestion
+    int64_t updateInterval; // us between AIMD steps
+    int64_t probeTimeout;   // us before an unanswered probe counts as lost
+    float burst;            // token bucket depth in packets
+};
+
+struct RateControllerState
+{
+    float rate;
+    float tokens;
+    float lossRate;
+    int64_t smoothedRtt;
+    int64_t rttVariance;
+    int64_t minRtt;
+    uint32_t sent;
+    uint32_t sendFailures;
+    uint32_t throttled;
+    uint32_t probesSent;
+    uint32_t probesAnswered;
+    uint32_t probesLost;
+    uint32_t increases;
+    uint32_t decreases;
+};
+
+// Token bucket whose refill rate follows an AIMD loop. Loss comes from failed
+// sends and from unanswered RTT probes, RTT from answered probes. Servers that
+// never echo probes are fine, probe loss only counts once one was answered.
+// Pure logic, every call takes the current time in microseconds and nothing is
+// locked, the owner serializes access.
+class RateController
+{
+private:
+    struct Probe
+    {
+        int32_t id;
+        int64_t sentAt;
+        bool used;
+        bool pending;
+    };
+
+    RateControllerConfig config;
+    RateControllerState state;
+    Probe probes[RATE_CONTROLLER_MAX_PROBES];
+    size_t nextProbe;
+    int64_t lastRefill;
+    int64_t nextUpdate;
+    uint32_t intervalSent;
+    uint32_t intervalFailed;
+    uint32_t intervalProbesAnswered;
+    uint32_t intervalProbesLost;
+
+public:
+    RateController();
+
+    static RateControllerConfig defaultConfig();
+
+    void configure(const RateControllerConfig &config);
+    RateControllerConfig getConfig();
+    void reset(int64_t now);
+
+    bool tryConsume(int64_t now);
+    void onSendResult(bool success);
+    void onProbeSent(int32_t id, int64_t now);
+    // rtt receives the round trip of a pending probe, -1 for a late duplicate
+    bool onProbeReply(int32_t id, int64_t now, int64_t *rtt = nullptr);
+    void update(int64_t now);
+
+    RateControllerState getState();
+
+private:
+    void refill(int64_t now);
+    void expireProbe(Probe &probe);
+    void addRttSample(int64_t rtt);
+};
@@ -0,0 +1,313 @@
+#include "raw_udp_transport.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <new>
+#include <esp_log.h>
+#include <lwip/tcpip.h>
+#include <lwip/priv/tcpip_priv.h>
+#include "../utils/deferred_log.hpp"
+#include "../utils/profiler.hpp"
+
+static const char *TAG = "RawUdpTransport";
+
+static constexpr uint32_t ALL_FREE = RAW_UDP_SLOTS == 32 ? 0xFFFFFFFFu : ((1u << RAW_UDP_SLOTS) - 1);
+
+struct RawUdpCall
+{
+    struct tcpip_api_call_data call; // first, lwIP casts back to it
+    struct udp_pcb *pcb;
+    void *transport;
+    u16_t port;
+};
+
+RawUdpTransport::RawUdpTransport() : freeMask(ALL_FREE), acquired(0), exhausted(0), peakInUse(0), handedOff(0),
+                                     handOffFailed(0), sendFailed(0), receiveDropped(0)
+{
+    static_assert(RAW_UDP_SLOTS <= 32, "The free mask holds at most 32 slots");
+    this->running = false;
+    this->pcb = nullptr;
+    this->receiveQueue = nullptr;
+    for (size_t i = 0; i < RAW_UDP_SLOTS; i++)
+    {
+        this->slots[i].owner = this;
+        this->slots[i].pbuf = nullptr;
+    }
+}
+
+RawUdpTransport::~RawUdpTransport()
+{
+    this->stop();
+    if (this->receiveQueue != nullptr)
+    {
+        vQueueDelete(this->receiveQueue);
+    }
+}
+
+err_t RawUdpTransport::openPcb(struct tcpip_api_call_data *data)
+{
+    RawUdpCall *call = (RawUdpCall *)data;
+    struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (pcb == NULL)
+    {
+        return ERR_MEM;
+    }
+    // Discovery handshakes go to the broadcast address
+    ip_set_option(pcb, SOF_BROADCAST);
+    err_t err = udp_bind(pcb, IP_ADDR_ANY, call->port);
+    if (err != ERR_OK)
+    {
+        udp_remove(pcb);
+        return err;
+    }
+    udp_recv(pcb, onReceive, call->transport);
+    call->pcb = pcb;
+    return ERR_OK;
+}
+
+err_t RawUdpTransport::closePcb(struct tcpip_api_call_data *data)
+{
+    RawUdpCall *call = (RawUdpCall *)data;
+    udp_remove(call->pcb);
+    return ERR_OK;
+}
+
+esp_err_t RawUdpTransport::start(int port)
+{
+    if (this->running)
+    {
+        return ESP_OK;
+    }
+    if (this->receiveQueue == nullptr)
+    {
+        this->receiveQueue = xQueueCreate(RAW_UDP_RECEIVE_QUEUE_SIZE, sizeof(Datagram));
+        if (this->receiveQueue == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to create receive queue");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    RawUdpCall call;
+    memset(&call, 0, sizeof(call));
+    call.transport = this;
+    call.port = (u16_t)port;
+    err_t err = tcpip_api_call(openPcb, &call.call);
+    if (err != ERR_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open UDP PCB: %d", err);
+        return ESP_FAIL;
+    }
+    this->pcb = call.pcb;
+    this->running = true;
+    return ESP_OK;
+}
+
+// Pbufs still waiting in the tcpip mailbox are freed unsent once they come up
+esp_err_t RawUdpTransport::stop()
+{
+    if (!this->running)
+    {
+        return ESP_OK;
+    }
+    this->running = false;
+    RawUdpCall call;
+    memset(&call, 0, sizeof(call));
+    call.pcb = this->pcb;
+    this->pcb = nullptr;
+    tcpip_api_call(closePcb, &call.call);
+    Datagram datagram;
+    while (xQueueReceive(this->receiveQueue, &datagram, 0) == pdTRUE)
+    {
+        pbuf_free(datagram.pbuf);
+    }
+    return ESP_OK;
+}
+
+bool RawUdpTransport::isRunning()
+{
+    return this->running;
+}
+
+void RawUdpTransport::onReceive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *address, u16_t port)
+{
+    RawUdpTransport *transport = (RawUdpTransport *)arg;
+    Datagram datagram;
+    datagram.pbuf = p;
+    memset(&datagram.source, 0, sizeof(datagram.source));
+    datagram.source.sin_family = AF_INET;
+    datagram.source.sin_addr.s_addr = ip4_addr_get_u32(ip_2_ip4(address));
+    datagram.source.sin_port = htons(port);
+    if (xQueueSend(transport->receiveQueue, &datagram, 0) != pdTRUE)
+    {
+        transport->receiveDropped.fetch_add(1, std::memory_order_relaxed);
+        pbuf_free(p);
+    }
+}
+
+ssize_t RawUdpTransport::receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated)
+{
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    Datagram datagram;
+    if (xQueueReceive(this->receiveQueue, &datagram, 0) != pdTRUE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    u16_t length = pbuf_copy_partial(datagram.pbuf, buffer, (u16_t)bufferLength, 0);
+    *truncated = datagram.pbuf->tot_len > bufferLength;
+    memcpy(sourceAddress, &datagram.source, sizeof(datagram.source));
+    *sourceAddressLength = sizeof(datagram.source);
+    pbuf_free(datagram.pbuf);
+    return length;
+}
+
+// Ticks are rounded up, so this wakes up to a tick late but never spins
+esp_err_t RawUdpTransport::waitReadable(int64_t timeoutUs)
+{
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+    TickType_t ticks = timeoutUs > 0 ? (TickType_t)((timeoutUs + tickUs - 1) / tickUs) : 0;
+    Datagram datagram;
+    return xQueuePeek(this->receiveQueue, &datagram, ticks) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+NetBuffer *RawUdpTransport::acquire()
+{
+    uint32_t mask = this->freeMask.load(std::memory_order_relaxed);
+    uint32_t slot;
+    for (;;)
+    {
+        if (mask == 0)
+        {
+            this->exhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        slot = __builtin_ctz(mask);
+        if (this->freeMask.compare_exchange_weak(mask, mask & ~(1u << slot), std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    // PBUF_TRANSPORT leaves room for every header below UDP
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, PACKET_POOL_BUFFER_SIZE, PBUF_RAM);
+    if (p == nullptr)
+    {
+        this->freeMask.fetch_or(1u << slot, std::memory_order_release);
+        this->exhausted.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    uint32_t inUse = RAW_UDP_SLOTS - __builtin_popcount(mask & ~(1u << slot));
+    uint32_t peak = this->peakInUse.load(std::memory_order_relaxed);
+    while (inUse > peak && !this->peakInUse.compare_exchange_weak(peak, inUse, std::memory_order_relaxed))
+    {
+    }
+    this->acquired.fetch_add(1, std::memory_order_relaxed);
+    Slot &entry = this->slots[slot];
+    entry.pbuf = p;
+    // NetBuffer over the payload owns nothing, so it can be rebuilt in place
+    new (&entry.buffer) NetBuffer((unsigned char *)p->payload, PACKET_POOL_BUFFER_SIZE);
+    return &entry.buffer;
+}
+
+RawUdpTransport::Slot *RawUdpTransport::findSlot(NetBuffer *buffer)
+{
+    for (size_t i = 0; i < RAW_UDP_SLOTS; i++)
+    {
+        if (&this->slots[i].buffer == buffer)
+        {
+            return &this->slots[i];
+        }
+    }
+    return nullptr;
+}
+
+void RawUdpTransport::releaseSlot(Slot *slot)
+{
+    pbuf_free(slot->pbuf);
+    slot->pbuf = nullptr;
+    this->freeMask.fetch_or(1u << (slot - this->slots), std::memory_order_release);
+}
+
+void RawUdpTransport::release(NetBuffer *buffer)
+{
+    Slot *slot = this->findSlot(buffer);
+    if (slot != nullptr)
+    {
+        this->releaseSlot(slot);
+    }
+}
+
+void RawUdpTransport::sendSlot(void *arg)
+{
+    Slot *slot = (Slot *)arg;
+    RawUdpTransport *transport = slot->owner;
+    err_t err = ERR_CLSD;
+    if (transport->pcb != nullptr)
+    {
+        ProfileScope scope(PROFILE_STACK_SEND);
+        err = udp_sendto(transport->pcb, slot->pbuf, &slot->address, slot->port);
+    }
+    if (err != ERR_OK)
+    {
+        transport->sendFailed.fetch_add(1, std::memory_order_relaxed);
+        deferredLog<LOG_PBUF_SEND_FAILED>(-err);
+    }
+    transport->releaseSlot(slot);
+}
+
+esp_err_t RawUdpTransport::submit(const sockaddr_in &address, NetBuffer *buffer)
+{
+    Slot *slot = this->findSlot(buffer);
+    if (slot == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ProfileScope scope(PROFILE_SEND);
+    pbuf_realloc(slot->pbuf, (u16_t)buffer->getCurrentSize());
+    ip_addr_set_ip4_u32_val(slot->address, address.sin_addr.s_addr);
+    slot->port = ntohs(address.sin_port);
+#if LWIP_TCPIP_CORE_LOCKING
+    LOCK_TCPIP_CORE();
+    sendSlot(slot);
+    UNLOCK_TCPIP_CORE();
+    this->handedOff.fetch_add(1, std::memory_order_relaxed);
+    return ESP_OK;
+#else
+    if (tcpip_try_callback(sendSlot, slot) != ERR_OK)
+    {
+        this->handOffFailed.fetch_add(1, std::memory_order_relaxed);
+        deferredLog<LOG_PBUF_SEND_FAILED>(-ERR_MEM);
+        this->releaseSlot(slot);
+        return ESP_FAIL;
+    }
+    this->handedOff.fetch_add(1, std::memory_order_relaxed);
+    return ESP_OK;
+#endif
+}
+
+PacketPoolStats RawUdpTransport::getBufferStats()
+{
+    PacketPoolStats stats;
+    stats.capacity = RAW_UDP_SLOTS;
+    stats.inUse = RAW_UDP_SLOTS - __builtin_popcount(this->freeMask.load(std::memory_order_relaxed));
+    stats.peakInUse = this->peakInUse.load(std::memory_order_relaxed);
+    stats.acquired = this->acquired.load(std::memory_order_relaxed);
+    stats.exhausted = this->exhausted.load(std::memory_order_relaxed);
+    return stats;
+}
+
+RawUdpStats RawUdpTransport::getStats()
+{
+    RawUdpStats stats;
+    stats.handedOff = this->handedOff.load(std::memory_order_relaxed);
+    stats.handOffFailed = this->handOffFailed.load(std::memory_order_relaxed);
+    stats.sendFailed = this->sendFailed.load(std::memory_order_relaxed);
+    stats.receiveDropped = this->receiveDropped.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
+#include <lwip/udp.h>
+
+#include "udp_transport.hpp"
+
+// Send buffers, a slot holds its pbuf from acquire() until the stack sent it
+#define RAW_UDP_SLOTS 8
+// Received datagrams waiting for receiveNonBlocking()
+#define RAW_UDP_RECEIVE_QUEUE_SIZE 16
+
+struct tcpip_api_call_data;
+
+struct RawUdpStats
+{
+    uint32_t handedOff;      // datagrams passed to the tcpip thread
+    uint32_t handOffFailed;  // tcpip mailbox full
+    uint32_t sendFailed;     // udp_sendto() errors, the rate controller does not see these
+    uint32_t receiveDropped; // receive queue full
+};
+
+// Backend on the lwIP raw API. acquire() allocates a PBUF_RAM pbuf with room
+// for the UDP, IP and link headers in front, so packets are serialized
+// straight into the memory the driver sends from and the stack adds its
+// headers in place. submit() hands the pbuf to the tcpip thread with
+// tcpip_try_callback(), or sends it right away under LOCK_TCPIP_CORE() when
+// core locking is enabled, and returns without waiting for the stack.
+// Received pbufs are queued by the receive callback and copied out by
+// receiveNonBlocking().
+class RawUdpTransport : public UdpTransport
+{
+private:
+    struct Slot
+    {
+        RawUdpTransport *owner;
+        struct pbuf *pbuf;
+        NetBuffer buffer;
+        ip_addr_t address;
+        uint16_t port;
+    };
+
+    struct Datagram
+    {
+        struct pbuf *pbuf;
+        sockaddr_in source;
+    };
+
+    bool running;
+    struct udp_pcb *pcb;
+    QueueHandle_t receiveQueue;
+    Slot slots[RAW_UDP_SLOTS];
+    std::atomic<uint32_t> freeMask;
+    std::atomic<uint32_t> acquired;
+    std::atomic<uint32_t> exhausted;
+    std::atomic<uint32_t> peakInUse;
+    std::atomic<uint32_t> handedOff;
+    std::atomic<uint32_t> handOffFailed;
+    std::atomic<uint32_t> sendFailed;
+    std::atomic<uint32_t> receiveDropped;
+
+    Slot *findSlot(NetBuffer *buffer);
+    void releaseSlot(Slot *slot);
+
+    // Run in the tcpip thread
+    static err_t openPcb(struct tcpip_api_call_data *call);
+    static err_t closePcb(struct tcpip_api_call_data *call);
+    static void sendSlot(void *arg);
+    static void onReceive(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *address, u16_t port);
+
+public:
+    RawUdpTransport();
+    ~RawUdpTransport();
+    RawUdpTransport(const RawUdpTransport &) = delete;
+    RawUdpTransport &operator=(const RawUdpTransport &) = delete;
+
+    esp_err_t start(int port) override;
+    esp_err_t stop() override;
+    bool isRunning() override;
+    ssize_t receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated) override;
+    esp_err_t waitReadable(int64_t timeoutUs) override;
+
+    NetBuffer *acquire() override;
+    void release(NetBuffer *buffer) override;
+    esp_err_t submit(const sockaddr_in &address, NetBuffer *buffer) override;
+    PacketPoolStats getBufferStats() override;
+
+    RawUdpStats getStats();
+};
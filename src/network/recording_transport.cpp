@@ -0,0 +1,54 @@
+#include "recording_transport.hpp"
+
+#include "../utils/timing.hpp"
+
+RecordingTransport::RecordingTransport(UdpTransport &inner, SessionRecorder &recorder) : inner(inner), recorder(recorder)
+{
+}
+
+esp_err_t RecordingTransport::start(int port)
+{
+    return this->inner.start(port);
+}
+
+esp_err_t RecordingTransport::stop()
+{
+    return this->inner.stop();
+}
+
+bool RecordingTransport::isRunning()
+{
+    return this->inner.isRunning();
+}
+
+ssize_t RecordingTransport::receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated)
+{
+    return this->inner.receiveNonBlocking(buffer, bufferLength, sourceAddress, sourceAddressLength, truncated);
+}
+
+esp_err_t RecordingTransport::waitReadable(int64_t timeoutUs)
+{
+    return this->inner.waitReadable(timeoutUs);
+}
+
+NetBuffer *RecordingTransport::acquire()
+{
+    return this->inner.acquire();
+}
+
+void RecordingTransport::release(NetBuffer *buffer)
+{
+    this->inner.release(buffer);
+}
+
+// Recorded before the hand-off, the buffer belongs to the inner transport after it
+esp_err_t RecordingTransport::submit(const sockaddr_in &address, NetBuffer *buffer)
+{
+    this->recorder.recordPacket(micros64(), buffer->getBuffer(), buffer->getCurrentSize());
+    return this->inner.submit(address, buffer);
+}
+
+PacketPoolStats RecordingTransport::getBufferStats()
+{
+    return this->inner.getBufferStats();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "udp_transport.hpp"
+#include "../storage/session_recorder.hpp"
+
+// Passes everything through to another transport and records every datagram
+// it submits, so a session holds what went out on the wire next to the
+// samples it came from. The recorder keeps the size and a CRC of each one.
+class RecordingTransport : public UdpTransport
+{
+private:
+    UdpTransport &inner;
+    SessionRecorder &recorder;
+
+public:
+    RecordingTransport(UdpTransport &inner, SessionRecorder &recorder);
+
+    esp_err_t start(int port) override;
+    esp_err_t stop() override;
+    bool isRunning() override;
+    ssize_t receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated) override;
+    esp_err_t waitReadable(int64_t timeoutUs) override;
+
+    NetBuffer *acquire() override;
+    void release(NetBuffer *buffer) override;
+    esp_err_t submit(const sockaddr_in &address, NetBuffer *buffer) override;
+    PacketPoolStats getBufferStats() override;
+};
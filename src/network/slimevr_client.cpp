@@ -1,49 +1,55 @@
 #include "slimevr_client.hpp"
 
+#include <string.h>
+#include <math.h>
+#include <array>
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <esp_system.h>
 #include "net_buffer.hpp"
-
-#define PACKET_HEARTBEAT 0
-#define PACKET_HANDSHAKE 3
-#define PACKET_ACCEL 4
-#define PACKET_RAW_CALIBRATION_DATA 6
-#define PACKET_CALIBRATION_FINISHED 7
-#define PACKET_CONFIG 8
-#define PACKET_PING_PONG 10
-#define PACKET_SERIAL 11
-#define PACKET_BATTERY_LEVEL 12
-#define PACKET_TAP 13
-#define PACKET_ERROR 14
-#define PACKET_SENSOR_INFO 15
-#define PACKET_ROTATION_DATA 17
-#define PACKET_MAGNETOMETER_ACCURACY 18
-#define PACKET_SIGNAL_STRENGTH 19
-#define PACKET_TEMPERATURE 20
-
-#define PACKET_INSPECTION 105
-
-#define PACKET_RECEIVE_HEARTBEAT 1
-#define PACKET_RECEIVE_VIBRATE 2
-#define PACKET_RECEIVE_HANDSHAKE 3
-#define PACKET_RECEIVE_COMMAND 4
-
-#define PACKET_INSPECTION_PACKETTYPE_RAW_IMU_DATA 1
-#define PACKET_INSPECTION_PACKETTYPE_FUSED_IMU_DATA 2
-#define PACKET_INSPECTION_PACKETTYPE_CORRECTION_DATA 3
-#define PACKET_INSPECTION_DATATYPE_INT 1
-#define PACKET_INSPECTION_DATATYPE_FLOAT 2
+#include "packet_schema.hpp"
+#include "quaternion_codec.hpp"
+#include "../utils/boot_timeline.hpp"
+#include "../utils/deferred_log.hpp"
+#include "../utils/task_topology.hpp"
+#include "../utils/timing.hpp"
 
 static const char *TAG = "SlimeVRClient";
 
-SlimeVRClient::SlimeVRClient() : sendBuffer(128)
+static const ShortString<5> FIRMWARE_VERSION = {{'0', '.', '3', '.', '3'}};
+static const Bytes<6> MAC_ADDRESS = {{0xC4, 0xDE, 0xE2, 0x13, 0x95, 0xEC}};
+
+SlimeVRClient::SlimeVRClient()
 {
-    udpServer = UdpServer();
+    transport = &udpServer;
     packetNumber = 0;
     connected = false;
+    running = false;
     lastPacketTime = 0;
-    timeout = 3000;
+    timeout = 3000000;
+    lastKeepaliveTime = 0;
+    lastProbeTime = 0;
+    lastServerPacketNumber = 0;
+    hasServerPacketNumber = false;
+    memset(&serverHint, 0, sizeof(serverHint));
+    hasServerHint = false;
+    this->setDiscoveryTarget(htonl(INADDR_BROADCAST), htons(SLIMEVR_SERVER_PORT));
+    discoveryAttempt = 0;
+    discoveryStart = 0;
+    nextDiscoveryTime = 0;
+    memset(&discoveryStats, 0, sizeof(discoveryStats));
+    memset(&receiveStats, 0, sizeof(receiveStats));
+    bundleEnabled = true;
+    compactRotation = false;
+    memset(sensors, 0, sizeof(sensors));
+    portMUX_INITIALIZE(&rateLock);
+    latencyMonitor = nullptr;
+    reportedProbesLost = 0;
+    SuppressionConfig suppression;
+    suppression.accelerationThreshold = 0.05f;
+    suppression.angleThreshold = 0.02f;
+    suppression.keyframePeriod = 250000;
+    this->setSuppression(suppression);
 }
 
 SlimeVRClient::~SlimeVRClient()
@@ -51,14 +57,16 @@ SlimeVRClient::~SlimeVRClient()
     this->disconnect();
 }
 
-esp_err_t SlimeVRClient::start()
+esp_err_t SlimeVRClient::start(int port)
 {
-    if (this->udpServer.isRunning())
+    if (this->transport->isRunning())
         return ESP_OK;
-    esp_err_t res = this->udpServer.start(6969);
+    esp_err_t res = this->transport->start(port);
     if (res == ESP_OK)
     {
-        xTaskCreate(listen, "SocketReader", 4096, this, tskIDLE_PRIORITY, &taskHandle);
+        // The listen task runs the first discovery round as soon as it starts
+        this->restartDiscovery();
+        createTask(TaskTopology::SOCKET_READER, listen, this, &taskHandle);
         this->running = true;
         ESP_LOGI(TAG, "SlimeServer is now running");
     }
@@ -67,10 +75,10 @@ esp_err_t SlimeVRClient::start()
 
 esp_err_t SlimeVRClient::stop()
 {
-    if (!this->udpServer.isRunning())
+    if (!this->transport->isRunning())
         return ESP_OK;
     vTaskDelete(taskHandle);
-    esp_err_t res = this->udpServer.stop();
+    esp_err_t res = this->transport->stop();
     if (res == ESP_OK)
     {
         this->running = false;
@@ -79,24 +87,63 @@ esp_err_t SlimeVRClient::stop()
     return res;
 }
 
-esp_err_t SlimeVRClient::connect(const char *host, int port)
+esp_err_t SlimeVRClient::disconnect()
 {
-    if (this->udpServer.isConnected())
+    if (!this->transport->isConnected())
     {
         return ESP_OK;
     }
-    ESP_LOGI(TAG, "Connecting to %s:%d", host, port);
-    return this->udpServer.connect(host, port);
+    ESP_LOGI(TAG, "Disconnecting");
+    return this->transport->disconnect();
 }
 
-esp_err_t SlimeVRClient::disconnect()
+void SlimeVRClient::setServerHint(uint32_t address, uint16_t port)
+{
+    memset(&this->serverHint, 0, sizeof(this->serverHint));
+    this->serverHint.sin_family = AF_INET;
+    this->serverHint.sin_addr.s_addr = address;
+    this->serverHint.sin_port = port;
+    this->hasServerHint = address != 0 && port != 0;
+}
+
+bool SlimeVRClient::getServerEndpoint(uint32_t *address, uint16_t *port)
 {
-    if (!this->udpServer.isConnected())
+    if (!this->connected)
     {
-        return ESP_OK;
+        return false;
     }
-    ESP_LOGI(TAG, "Disconnecting");
-    return this->udpServer.disconnect();
+    sockaddr_in server = this->transport->getClientAddress();
+    *address = server.sin_addr.s_addr;
+    *port = server.sin_port;
+    return true;
+}
+
+void SlimeVRClient::setDiscoveryTarget(uint32_t address, uint16_t port)
+{
+    memset(&this->discoveryTarget, 0, sizeof(this->discoveryTarget));
+    this->discoveryTarget.sin_family = AF_INET;
+    this->discoveryTarget.sin_addr.s_addr = address;
+    this->discoveryTarget.sin_port = port;
+}
+
+DiscoveryStats SlimeVRClient::getDiscoveryStats()
+{
+    return this->discoveryStats;
+}
+
+void SlimeVRClient::setTransport(UdpTransport *transport)
+{
+    if (this->running)
+    {
+        ESP_LOGW(TAG, "Transport cannot change while running");
+        return;
+    }
+    this->transport = transport != nullptr ? transport : &this->udpServer;
+}
+
+UdpTransport *SlimeVRClient::getTransport()
+{
+    return this->transport;
 }
 
 bool SlimeVRClient::isConnected()
@@ -109,84 +156,643 @@ bool SlimeVRClient::isRunning()
     return this->running;
 }
 
-void SlimeVRClient::writePacketHeader(uint8_t packetType)
+// Packets are sent from several tasks, the counter is 32 bit so the increment stays
+// a single lock-free atomic on the ESP32. It is widened to 64 bit on the wire.
+uint64_t SlimeVRClient::nextPacketNumber()
 {
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(packetType);
-    this->sendBuffer.writeULong(packetNumber++);
+    return this->packetNumber.fetch_add(1, std::memory_order_relaxed);
 }
 
-esp_err_t SlimeVRClient::sendHeartbeat()
+template <typename Packet, typename... Args>
+esp_err_t SlimeVRClient::sendPacket(uint64_t number, const Args &...args)
 {
-    this->sendBuffer.reset();
-    writePacketHeader(PACKET_HEARTBEAT);
-    ESP_LOGI(TAG, "Sending heartbeat");
-    return this->udpServer.send(this->sendBuffer);
+    return this->sendPacketTo<Packet>(nullptr, number, args...);
 }
 
-esp_err_t SlimeVRClient::sendHandshake()
+template <typename Packet, typename... Args>
+esp_err_t SlimeVRClient::sendPacketTo(const sockaddr_in *address, uint64_t number, const Args &...args)
+{
+    TransportBuffer buffer(*this->transport);
+    if (!buffer.isValid())
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    {
+        ProfileScope scope(PROFILE_SERIALIZE);
+        unsigned char *packet = buffer->reserve(Packet::wireSize);
+        if (packet == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        Packet::encode(packet, number, args...);
+    }
+    return this->trackSend(buffer.send(address));
+}
+
+// Every sendto() result feeds the rate controller, failures count as loss
+esp_err_t SlimeVRClient::trackSend(esp_err_t res)
+{
+    portENTER_CRITICAL(&this->rateLock);
+    this->rateController.onSendResult(res == ESP_OK);
+    portEXIT_CRITICAL(&this->rateLock);
+    return res;
+}
+
+SensorState *SlimeVRClient::findSensor(uint8_t id)
+{
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        if (this->sensors[i].registered && this->sensors[i].id == id)
+        {
+            return &this->sensors[i];
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t SlimeVRClient::registerSensor(uint8_t id)
+{
+    if (this->findSensor(id) != nullptr)
+    {
+        return ESP_OK;
+    }
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        if (!this->sensors[i].registered)
+        {
+            memset(&this->sensors[i], 0, sizeof(SensorState));
+            this->sensors[i].id = id;
+            this->sensors[i].registered = true;
+            if (this->connected)
+            {
+                this->sendSensorInfo(id);
+            }
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "No free slot to register sensor %d", id);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t SlimeVRClient::setAcceleration(uint8_t id, float x, float y, float z)
+{
+    SensorState *sensor = this->findSensor(id);
+    if (sensor == nullptr)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    sensor->acceleration[0] = x;
+    sensor->acceleration[1] = y;
+    sensor->acceleration[2] = z;
+    sensor->hasAcceleration = true;
+    sensor->fresh = true;
+    return ESP_OK;
+}
+
+esp_err_t SlimeVRClient::setRotation(uint8_t id, const Quaternion &rotation)
+{
+    SensorState *sensor = this->findSensor(id);
+    if (sensor == nullptr)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    sensor->rotation = rotation.normalized();
+    sensor->hasRotation = true;
+    sensor->fresh = true;
+    return ESP_OK;
+}
+
+void SlimeVRClient::setBundleEnabled(bool enabled)
+{
+    this->bundleEnabled = enabled;
+}
+
+bool SlimeVRClient::isBundleEnabled()
+{
+    return this->bundleEnabled;
+}
+
+// Compact rotations halve the payload but only our own server stand-in reads them
+void SlimeVRClient::setCompactRotation(bool enabled)
+{
+    this->compactRotation = enabled;
+}
+
+bool SlimeVRClient::isCompactRotation()
+{
+    return this->compactRotation;
+}
+
+PacketPoolStats SlimeVRClient::getPacketPoolStats()
+{
+    return this->transport->getBufferStats();
+}
+
+ReceiveStats SlimeVRClient::getReceiveStats()
+{
+    return this->receiveStats;
+}
+
+// Rates are sensor data sends per second, a bundle counts once
+void SlimeVRClient::setRateLimits(float minRate, float maxRate)
+{
+    portENTER_CRITICAL(&this->rateLock);
+    RateControllerConfig config = this->rateController.getConfig();
+    config.minRate = minRate;
+    config.maxRate = maxRate;
+    this->rateController.configure(config);
+    portEXIT_CRITICAL(&this->rateLock);
+}
+
+void SlimeVRClient::setBurstTolerance(float packets, int64_t delay)
 {
-    this->sendBuffer.reset();
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(0);
-    this->sendBuffer.writeByte(PACKET_HANDSHAKE);
-    this->sendBuffer.writeULong(0);
+    RateControllerConfig defaults = RateController::defaultConfig();
+    portENTER_CRITICAL(&this->rateLock);
+    RateControllerConfig config = this->rateController.getConfig();
+    config.burst = packets > defaults.burst ? packets : defaults.burst;
+    config.rttMargin = defaults.rttMargin + delay;
+    this->rateController.configure(config);
+    portEXIT_CRITICAL(&this->rateLock);
+}
+
+void SlimeVRClient::setLatencyMonitor(LatencyMonitor *monitor)
+{
+    this->latencyMonitor = monitor;
+}
 
-    this->sendBuffer.writeInt(5); // Board
-    this->sendBuffer.writeInt(8); // IMU
-    this->sendBuffer.writeInt(2); // CPU Count
+RateControllerState SlimeVRClient::getRateControllerState()
+{
+    portENTER_CRITICAL(&this->rateLock);
+    RateControllerState state = this->rateController.getState();
+    portEXIT_CRITICAL(&this->rateLock);
+    return state;
+}
 
-    this->sendBuffer.writeInt(0);
-    this->sendBuffer.writeInt(0);
-    this->sendBuffer.writeInt(0);
+void SlimeVRClient::setSuppression(const SuppressionConfig &config)
+{
+    this->suppressionConfig = config;
+    this->cosAngleThreshold = cosf(config.angleThreshold);
+    this->cosHalfAngleThreshold = cosf(config.angleThreshold / 2.0f);
+}
 
-    this->sendBuffer.writeInt(16);              // Build Version
-    this->sendBuffer.writeShortString("0.3.3"); // Version String
-    uint8_t mac[6] = {0xC4, 0xDE, 0xE2, 0x13, 0x95, 0xEC};
-    this->sendBuffer.writeByteArray(mac, sizeof(mac)); // Mac Address
+esp_err_t SlimeVRClient::getSuppressionStats(uint8_t id, SuppressionStats *stats)
+{
+    SensorState *sensor = this->findSensor(id);
+    if (sensor == nullptr)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *stats = sensor->suppression;
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Sending handshake");
-    return this->udpServer.send(sendBuffer);
+// Compares against the last sample that went out rather than the previous one,
+// so slow drift still crosses the threshold eventually
+bool SlimeVRClient::isDue(SensorState &sensor, int64_t now)
+{
+    sensor.keyframe = !sensor.hasSent || now - sensor.lastSentTime >= this->suppressionConfig.keyframePeriod;
+    if (sensor.keyframe)
+    {
+        return true;
+    }
+    if (sensor.hasAcceleration)
+    {
+        const float *a = sensor.acceleration;
+        const float *b = sensor.sentAcceleration;
+        float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+        float threshold = this->suppressionConfig.accelerationThreshold;
+        if (dx * dx + dy * dy + dz * dz > threshold * threshold)
+        {
+            return true;
+        }
+    }
+    if (sensor.hasRotation)
+    {
+        // |q1.q2| is the cosine of half the rotation between them
+        return fabsf(sensor.rotation.dot(sensor.sentRotation)) < this->cosHalfAngleThreshold;
+    }
+    if (!sensor.hasAcceleration)
+    {
+        return false;
+    }
+    // Direction change without taking acos, cos(angle) below cos(threshold)
+    const float *a = sensor.acceleration;
+    const float *b = sensor.sentAcceleration;
+    float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    float lengths = sqrtf((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * (b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+    return lengths > 0.0f && dot < this->cosAngleThreshold * lengths;
+}
+
+// Decides which fresh samples go out with this frame. Samples that are not due
+// are counted as suppressed, the next frame compares the newer sample instead.
+// Due samples end up as sent, or as throttled when the rate controller skips
+// the frame.
+size_t SlimeVRClient::selectDueSensors(int64_t now)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        SensorState &sensor = this->sensors[i];
+        sensor.due = false;
+        if (!sensor.registered || !sensor.fresh)
+        {
+            continue;
+        }
+        sensor.fresh = false;
+        sensor.suppression.offered++;
+        if (this->isDue(sensor, now))
+        {
+            sensor.due = true;
+            count++;
+        }
+        else
+        {
+            sensor.suppression.suppressed++;
+        }
+    }
+    return count;
+}
+
+void SlimeVRClient::markSent(SensorState &sensor, int64_t now)
+{
+    memcpy(sensor.sentAcceleration, sensor.acceleration, sizeof(sensor.sentAcceleration));
+    sensor.sentRotation = sensor.rotation;
+    sensor.lastSentTime = now;
+    sensor.hasSent = true;
+    sensor.suppression.sent++;
+    if (sensor.keyframe)
+    {
+        sensor.suppression.keyframes++;
+    }
+}
+
+esp_err_t SlimeVRClient::sendHeartbeat()
+{
+    deferredLog<LOG_HEARTBEAT_SENT>();
+    return this->sendPacket<HeartbeatPacket>(this->nextPacketNumber());
+}
+
+esp_err_t SlimeVRClient::sendHandshake()
+{
+    return this->sendHandshake(this->transport->getClientAddress());
+}
+
+esp_err_t SlimeVRClient::sendHandshake(const sockaddr_in &address)
+{
+    uint32_t host = ntohl(address.sin_addr.s_addr);
+    deferredLog<LOG_HANDSHAKE_SENT>(host >> 24, (host >> 16) & 0xFF, (host >> 8) & 0xFF, host & 0xFF,
+                                    ntohs(address.sin_port));
+    return this->sendPacketTo<HandshakePacket>(&address, 0,
+                                             5,  // Board
+                                             8,  // IMU
+                                             2,  // MCU
+                                             0, 0, 0,
+                                             16, // Build Version
+                                             FIRMWARE_VERSION,
+                                             MAC_ADDRESS);
 }
 
 esp_err_t SlimeVRClient::sendSensorInfo(uint8_t id)
 {
-    this->sendBuffer.reset();
-    this->writePacketHeader(PACKET_SENSOR_INFO);
-    this->sendBuffer.writeByte(id);
-    this->sendBuffer.writeByte(1);
-    this->sendBuffer.writeByte(8);
-    return this->udpServer.send(sendBuffer);
+    return this->sendPacket<SensorInfoPacket>(this->nextPacketNumber(), id, 1, 8);
+}
+
+void SlimeVRClient::announceSensors()
+{
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        if (this->sensors[i].registered)
+        {
+            this->sendSensorInfo(this->sensors[i].id);
+        }
+    }
+}
+
+// RTT probe, the id is random so echoes can be told apart from server pings
+esp_err_t SlimeVRClient::sendProbe()
+{
+    int32_t id = (int32_t)esp_random();
+    portENTER_CRITICAL(&this->rateLock);
+    this->rateController.onProbeSent(id, micros64());
+    portEXIT_CRITICAL(&this->rateLock);
+    if (this->latencyMonitor != nullptr)
+    {
+        this->latencyMonitor->onProbeSent(LATENCY_APP);
+    }
+    return this->sendPacket<PingPongPacket>(this->nextPacketNumber(), id);
 }
 
-float generateRandomFloat()
+esp_err_t SlimeVRClient::sendProfile(const ProfileSummary summary[PROFILER_CORES][PROFILE_STAGE_COUNT])
 {
-    uint32_t randomValue = esp_random();
-    float randomFloat = (float)randomValue / UINT32_MAX;
-    return randomFloat;
+    if (!this->connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (uint8_t core = 0; core < PROFILER_CORES; core++)
+    {
+        for (uint8_t stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+        {
+            const ProfileSummary &stageSummary = summary[core][stage];
+            if (stageSummary.count == 0)
+            {
+                continue;
+            }
+            esp_err_t res = this->sendPacket<ProfilePacket>(this->nextPacketNumber(),
+                                                            (uint8_t)PACKET_INSPECTION_PACKETTYPE_PROFILE, stage,
+                                                            core, (uint16_t)CPU_CYCLES_PER_MICROSECOND,
+                                                            stageSummary.count, stageSummary.p50,
+                                                            stageSummary.p99, stageSummary.max);
+            if (res != ESP_OK)
+            {
+                return res;
+            }
+        }
+    }
+    return ESP_OK;
 }
 
 esp_err_t SlimeVRClient::sendAcceleration(uint8_t id)
 {
-    this->sendBuffer.reset();
-    this->writePacketHeader(PACKET_ACCEL);
-    this->sendBuffer.writeFloat(generateRandomFloat());
-    this->sendBuffer.writeFloat(generateRandomFloat());
-    this->sendBuffer.writeFloat(generateRandomFloat());
-    this->sendBuffer.writeByte(id);
-    return this->udpServer.send(sendBuffer);
+    SensorState *sensor = this->findSensor(id);
+    if (sensor == nullptr || !sensor->hasAcceleration)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return this->sendPacket<AccelPacket>(this->nextPacketNumber(),
+                                         sensor->acceleration[0],
+                                         sensor->acceleration[1],
+                                         sensor->acceleration[2],
+                                         sensor->id);
+}
+
+esp_err_t SlimeVRClient::sendRotation(uint8_t id)
+{
+    SensorState *sensor = this->findSensor(id);
+    if (sensor == nullptr || !sensor->hasRotation)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    const Quaternion &q = sensor->rotation;
+    if (this->compactRotation)
+    {
+        CompactQuaternion compact = smallestThree::encode(q);
+        return this->sendPacket<CompactRotationPacket>(this->nextPacketNumber(), sensor->id, compact.a, compact.b, compact.c);
+    }
+    return this->sendPacket<RotationPacket>(this->nextPacketNumber(), sensor->id, ROTATION_DATA_TYPE_NORMAL,
+                                            q.x, q.y, q.z, q.w, 0);
 }
 
-void SlimeVRClient::processSensorInfo(unsigned char buffer[], size_t size)
+// Inner packets of a bundle are prefixed by their length and carry only the packet type,
+// the packet number of the enclosing bundle applies to all of them.
+esp_err_t SlimeVRClient::sendBundle()
 {
+    return this->sendBundle(false, micros64());
+}
+
+esp_err_t SlimeVRClient::sendBundle(bool dueOnly, int64_t now)
+{
+    uint32_t serializeStart = cycles();
+    TransportBuffer buffer(*this->transport);
+    if (!buffer.isValid())
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    unsigned char *header = buffer->reserve(BundlePacket::wireSize);
+    if (header == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    BundlePacket::encode(header, this->nextPacketNumber());
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        SensorState &sensor = this->sensors[i];
+        if (!sensor.registered || (dueOnly && !sensor.due))
+        {
+            continue;
+        }
+        if (sensor.hasRotation)
+        {
+            const Quaternion &q = sensor.rotation;
+            unsigned char *packet;
+            if (this->compactRotation)
+            {
+                packet = buffer->reserve(CompactRotationPacket::bundledSize);
+                if (packet == nullptr)
+                {
+                    return ESP_ERR_NO_MEM;
+                }
+                CompactQuaternion compact = smallestThree::encode(q);
+                CompactRotationPacket::encodeBundled(packet, sensor.id, compact.a, compact.b, compact.c);
+            }
+            else
+            {
+                packet = buffer->reserve(RotationPacket::bundledSize);
+                if (packet == nullptr)
+                {
+                    return ESP_ERR_NO_MEM;
+                }
+                RotationPacket::encodeBundled(packet, sensor.id, ROTATION_DATA_TYPE_NORMAL, q.x, q.y, q.z, q.w, 0);
+            }
+        }
+        if (sensor.hasAcceleration)
+        {
+            unsigned char *packet = buffer->reserve(AccelPacket::bundledSize);
+            if (packet == nullptr)
+            {
+                return ESP_ERR_NO_MEM;
+            }
+            AccelPacket::encodeBundled(packet,
+                                       sensor.acceleration[0],
+                                       sensor.acceleration[1],
+                                       sensor.acceleration[2],
+                                       sensor.id);
+        }
+    }
+    if (buffer->getCurrentSize() == BundlePacket::wireSize)
+    {
+        return ESP_OK;
+    }
+    Profiler::record(PROFILE_SERIALIZE, cycles() - serializeStart);
+    esp_err_t res = this->trackSend(buffer.send());
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        SensorState &sensor = this->sensors[i];
+        if (sensor.registered && (sensor.hasAcceleration || sensor.hasRotation) && (!dueOnly || sensor.due))
+        {
+            this->markSent(sensor, now);
+        }
+    }
+    return ESP_OK;
+}
+
+// Only samples that moved or are due for a keyframe go out. Frames over the
+// current rate are skipped, the next one carries the newer sample.
+esp_err_t SlimeVRClient::sendSensorData()
+{
+    return this->sendSensorData(micros64());
+}
+
+esp_err_t SlimeVRClient::sendSensorData(int64_t now)
+{
+    if (this->selectDueSensors(now) == 0)
+    {
+        return ESP_OK;
+    }
+    portENTER_CRITICAL(&this->rateLock);
+    bool allowed = this->rateController.tryConsume(now);
+    portEXIT_CRITICAL(&this->rateLock);
+    return this->sendDueSensors(now, allowed);
+}
+
+esp_err_t SlimeVRClient::replaySensorData(int64_t now, bool allowed)
+{
+    if (this->selectDueSensors(now) == 0)
+    {
+        return ESP_OK;
+    }
+    return this->sendDueSensors(now, allowed);
+}
+
+esp_err_t SlimeVRClient::sendDueSensors(int64_t now, bool allowed)
+{
+    if (!allowed)
+    {
+        for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+        {
+            SensorState &sensor = this->sensors[i];
+            if (sensor.registered && sensor.due)
+            {
+                sensor.suppression.throttled++;
+            }
+        }
+        return ESP_ERR_NOT_FINISHED;
+    }
+    if (this->bundleEnabled)
+    {
+        return this->sendBundle(true, now);
+    }
+    esp_err_t res = ESP_OK;
+    for (size_t i = 0; i < SLIMEVR_MAX_SENSORS; i++)
+    {
+        SensorState &sensor = this->sensors[i];
+        if (!sensor.registered || !sensor.due)
+        {
+            continue;
+        }
+        esp_err_t err = ESP_OK;
+        if (sensor.hasRotation)
+        {
+            err = this->sendRotation(sensor.id);
+        }
+        if (err == ESP_OK && sensor.hasAcceleration)
+        {
+            err = this->sendAcceleration(sensor.id);
+        }
+        if (err == ESP_OK)
+        {
+            this->markSent(sensor, now);
+        }
+        else
+        {
+            res = err;
+        }
+    }
+    return res;
+}
+
+// Echoed probes carry our own packet number, they are consumed here before the
+// server's packet numbers are tracked
+bool SlimeVRClient::processProbeReply(unsigned char buffer[], size_t size)
+{
+    PingPongPacket::View pong(buffer, size);
+    if (!pong.isValid())
+    {
+        return false;
+    }
+    int64_t rtt;
+    portENTER_CRITICAL(&this->rateLock);
+    bool probe = this->rateController.onProbeReply(pong.get<0>(), this->lastPacketTime, &rtt);
+    portEXIT_CRITICAL(&this->rateLock);
+    if (probe && this->latencyMonitor != nullptr)
+    {
+        this->latencyMonitor->onAnswer(LATENCY_APP, rtt, this->lastPacketTime);
+    }
+    return probe;
+}
+
+const InboundRoute *SlimeVRClient::findInboundRoute(uint32_t type)
+{
+    static constexpr std::array<InboundRoute, SLIMEVR_INBOUND_TYPES> routes = []
+    {
+        std::array<InboundRoute, SLIMEVR_INBOUND_TYPES> table{};
+        table[PACKET_HEARTBEAT] = {HeartbeatPacket::wireSize, &SlimeVRClient::onHeartbeat};
+        table[PACKET_RECEIVE_VIBRATE] = {PACKET_HEADER_SIZE, &SlimeVRClient::onVibrate};
+        table[PACKET_RECEIVE_HANDSHAKE] = {PACKET_HEADER_SIZE, &SlimeVRClient::onServerHandshake};
+        table[PACKET_RECEIVE_COMMAND] = {PACKET_HEADER_SIZE, &SlimeVRClient::onCommand};
+        table[PACKET_CONFIG] = {PACKET_HEADER_SIZE, &SlimeVRClient::onConfig};
+        table[PACKET_PING_PONG] = {PingPongPacket::wireSize, &SlimeVRClient::onPingPong};
+        table[PACKET_SENSOR_INFO] = {ReceiveSensorInfoPacket::wireSize, &SlimeVRClient::onSensorInfo};
+        return table;
+    }();
+    if (type >= routes.size() || routes[type].handle == nullptr)
+    {
+        return nullptr;
+    }
+    return &routes[type];
+}
+
+void SlimeVRClient::onHeartbeat(NetReader &reader)
+{
+    deferredLog<LOG_HEARTBEAT_RECEIVED>();
+    this->sendHeartbeat();
+}
+
+void SlimeVRClient::onVibrate(NetReader &reader)
+{
+    deferredLog<LOG_VIBRATE_RECEIVED>();
+}
+
+void SlimeVRClient::onServerHandshake(NetReader &reader)
+{
+    deferredLog<LOG_HANDSHAKE_RECEIVED>();
+}
+
+void SlimeVRClient::onCommand(NetReader &reader)
+{
+    deferredLog<LOG_COMMAND_RECEIVED>();
+}
+
+void SlimeVRClient::onConfig(NetReader &reader)
+{
+    deferredLog<LOG_CONFIG_RECEIVED>();
+}
+
+// Server pings are echoed as they came in
+void SlimeVRClient::onPingPong(NetReader &reader)
+{
+    deferredLog<LOG_PING_RECEIVED>();
+    this->trackSend(this->transport->send(reader.getBuffer(), reader.getSize()));
+}
+
+void SlimeVRClient::onSensorInfo(NetReader &reader)
+{
+    deferredLog<LOG_SENSOR_INFO_RECEIVED>();
 }
 
 void SlimeVRClient::internalPacketReceived(unsigned char buffer[], size_t size, struct sockaddr_in client_addr, socklen_t client_addr_len)
 {
-    lastPacketTime = (uint64_t)(esp_timer_get_time() / 1000ULL);
+    NetReader reader(buffer, size);
+    uint32_t type;
+    if (reader.readUInt(&type) != ESP_OK)
+    {
+        this->receiveStats.malformed++;
+        return;
+    }
+    lastPacketTime = micros64();
 
     /*char hex_buffer[size * 3 + 1];
     memset(hex_buffer, 0, sizeof(hex_buffer));
@@ -198,74 +804,230 @@ void SlimeVRClient::internalPacketReceived(unsigned char buffer[], size_t size,
 
     if (this->connected)
     {
-        switch (buffer[3])
+        uint64_t number;
+        if (reader.readULong(&number) != ESP_OK)
         {
-        case PACKET_HEARTBEAT:
-            ESP_LOGI(TAG, "Heartbeat received");
-            this->sendHeartbeat();
-            break;
-        case PACKET_RECEIVE_VIBRATE:
-            ESP_LOGI(TAG, "Vibrate received");
-            break;
-        case PACKET_RECEIVE_HANDSHAKE:
-            ESP_LOGI(TAG, "Handshake received");
-            break;
-        case PACKET_RECEIVE_COMMAND:
-            ESP_LOGI(TAG, "Command received");
-            break;
-        case PACKET_CONFIG:
-            ESP_LOGI(TAG, "Config received");
-            break;
-        case PACKET_PING_PONG:
-            ESP_LOGI(TAG, "Ping received");
-            this->udpServer.send((unsigned char *)buffer, size);
-            break;
-        case PACKET_SENSOR_INFO:
-            ESP_LOGI(TAG, "Sensor Info received");
-            if (size < 6)
-            {
-                ESP_LOGW(TAG, "Wrong sensor info packet");
-                break;
-            }
-            this->processSensorInfo(buffer, size);
-            break;
+            this->receiveStats.malformed++;
+            return;
+        }
+        if (this->processProbeReply(buffer, size))
+        {
+            return;
+        }
+        // Gaps in the server's packet numbers are datagrams lost on the way in,
+        // including the ones lwIP drops when its receive mailbox is full
+        if (this->hasServerPacketNumber && number > this->lastServerPacketNumber + 1)
+        {
+            this->receiveStats.dropped += (uint32_t)(number - this->lastServerPacketNumber - 1);
+        }
+        if (!this->hasServerPacketNumber || number > this->lastServerPacketNumber)
+        {
+            this->lastServerPacketNumber = number;
+            this->hasServerPacketNumber = true;
         }
-        if (lastPacketTime + timeout < (uint64_t)(esp_timer_get_time() / 1000ULL))
+
+        const InboundRoute *route = findInboundRoute(type);
+        if (route == nullptr)
         {
-            this->connected = false;
-            ESP_LOGW(TAG, "Connection to server timed out");
+            this->receiveStats.unknown++;
+            return;
         }
+        if (size < route->minSize)
+        {
+            deferredLog<LOG_PACKET_MALFORMED>(type, size);
+            this->receiveStats.malformed++;
+            return;
+        }
+        (this->*route->handle)(reader);
     }
     else
     {
-        switch (buffer[0])
+        // The server's handshake reply starts with the packet type as a
+        // single byte instead of a u32
+        uint8_t replyType;
+        reader.seek(0);
+        if (reader.readUByte(&replyType) != ESP_OK)
+        {
+            this->receiveStats.malformed++;
+            return;
+        }
+        switch (replyType)
         {
         case PACKET_HANDSHAKE:
-            ESP_LOGI(TAG, "Handshake successful");
+        {
+            // The server answers from its own address, also to a broadcast
+            bool cached = this->hasServerHint && client_addr.sin_addr.s_addr == this->serverHint.sin_addr.s_addr &&
+                          client_addr.sin_port == this->serverHint.sin_port;
+            int64_t duration = lastPacketTime - this->discoveryStart;
+            this->discoveryStats.found++;
+            this->discoveryStats.foundCached += cached ? 1 : 0;
+            this->discoveryStats.lastDuration = duration;
+            if (duration > this->discoveryStats.maxDuration)
+            {
+                this->discoveryStats.maxDuration = duration;
+            }
+            ESP_LOGI(TAG, "Handshake successful after %lldus (%s)", (long long)duration,
+                     cached ? "cached server" : "discovery");
+            BootTimeline::mark(BOOT_SERVER_FOUND);
+            this->transport->connect(client_addr);
+            // Reconnects after a timeout go straight to the last server
+            this->serverHint = client_addr;
+            this->hasServerHint = true;
+            this->hasServerPacketNumber = false;
+            portENTER_CRITICAL(&this->rateLock);
+            this->rateController.reset(micros64());
+            portEXIT_CRITICAL(&this->rateLock);
+            this->reportedProbesLost = 0;
+            // A server that restarted knows none of the sensors, they are
+            // announced before any of their data can go out
+            this->announceSensors();
             this->connected = true;
             return;
         }
-        this->connect(inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        this->sendHandshake();
+        }
+        // A server announcing itself gets a handshake right away, without
+        // waiting for the next discovery round
+        this->sendHandshake(client_addr);
     }
 }
 
-void SlimeVRClient::listen(void *arg)
+// Drains everything queued on the socket, bounded so a flood cannot starve the
+// timeout and keepalive checks.
+void SlimeVRClient::receiveBatch()
 {
-    SlimeVRClient *client = (SlimeVRClient *)arg;
-    const size_t size = 128;
-    unsigned char recv_buffer[size];
-    memset(recv_buffer, 0, sizeof(recv_buffer));
-    for (;;)
+    uint32_t batch = 0;
+    while (batch < SLIMEVR_RECEIVE_BATCH)
     {
         struct sockaddr_in client_addr;
         socklen_t client_addr_len = sizeof(client_addr);
+        bool truncated = false;
+        ssize_t len = this->transport->receiveNonBlocking((char *)this->receiveBuffer, sizeof(this->receiveBuffer),
+                                                         &client_addr, &client_addr_len, &truncated);
+        if (len < 0)
+        {
+            break;
+        }
+        batch++;
+        this->receiveStats.received++;
+        if (truncated)
+        {
+            this->receiveStats.truncated++;
+            continue;
+        }
+        ProfileScope scope(PROFILE_RECEIVE);
+        this->internalPacketReceived(this->receiveBuffer, len, client_addr, client_addr_len);
+    }
+    if (batch > this->receiveStats.maxBatch)
+    {
+        this->receiveStats.maxBatch = batch;
+    }
+}
+
+void SlimeVRClient::checkConnection(int64_t now)
+{
+    if (!this->connected)
+    {
+        this->discover(now);
+        return;
+    }
+    if (now - this->lastPacketTime > this->timeout)
+    {
+        this->connected = false;
+        this->receiveStats.timeouts++;
+        this->disconnect();
+        ESP_LOGW(TAG, "Connection to server timed out");
+        this->restartDiscovery();
+        this->discover(now);
+        return;
+    }
+    if (now - this->lastKeepaliveTime >= SLIMEVR_KEEPALIVE_PERIOD_US)
+    {
+        this->lastKeepaliveTime = now;
+        this->sendHeartbeat();
+    }
+    // The controller steps its rate from here, probes go out at its own pace so
+    // they do not cost more airtime than the data they protect
+    if (now - this->lastProbeTime >= SLIMEVR_PROBE_PERIOD_US)
+    {
+        this->lastProbeTime = now;
+        this->sendProbe();
+    }
+    portENTER_CRITICAL(&this->rateLock);
+    this->rateController.update(now);
+    uint32_t probesLost = this->rateController.getState().probesLost;
+    portEXIT_CRITICAL(&this->rateLock);
+    // The rate controller expires unanswered probes, the monitor only sees the count
+    if (this->latencyMonitor != nullptr && probesLost > this->reportedProbesLost)
+    {
+        this->latencyMonitor->onLoss(LATENCY_APP, probesLost - this->reportedProbesLost);
+    }
+    this->reportedProbesLost = probesLost;
+}
+
+// One handshake round: the cached server first, for a few rounds alone so it
+// wins over other servers on the network, then the broadcast as well. Rounds
+// back off exponentially with up to a quarter of jitter, so trackers that lost
+// the server at the same time do not broadcast in lockstep.
+void SlimeVRClient::discover(int64_t now)
+{
+    if (now < this->nextDiscoveryTime)
+    {
+        return;
+    }
+    if (this->discoveryAttempt == 0)
+    {
+        this->discoveryStart = now;
+    }
+    this->discoveryStats.attempts++;
+    if (this->hasServerHint)
+    {
+        this->sendHandshake(this->serverHint);
+    }
+    if (!this->hasServerHint || this->discoveryAttempt >= SLIMEVR_DISCOVERY_HINT_ATTEMPTS)
+    {
+        this->sendHandshake(this->discoveryTarget);
+        this->discoveryStats.broadcasts++;
+    }
+    int64_t backoff = SLIMEVR_DISCOVERY_MAX_US;
+    if (this->discoveryAttempt < 16)
+    {
+        backoff = (int64_t)SLIMEVR_DISCOVERY_MIN_US << this->discoveryAttempt;
+        backoff = backoff < SLIMEVR_DISCOVERY_MAX_US ? backoff : SLIMEVR_DISCOVERY_MAX_US;
+    }
+    backoff += esp_random() % (uint32_t)(backoff / 4 + 1);
+    this->nextDiscoveryTime = now + backoff;
+    this->discoveryAttempt++;
+}
+
+void SlimeVRClient::restartDiscovery()
+{
+    this->discoveryAttempt = 0;
+    this->nextDiscoveryTime = 0;
+}
 
-        ssize_t len = client->udpServer.receive((char *)recv_buffer, size, &client_addr, &client_addr_len);
-        if (len > 0)
+void SlimeVRClient::listen(void *arg)
+{
+    SlimeVRClient *client = (SlimeVRClient *)arg;
+    // The first pass runs right away and sends the first handshake
+    int64_t nextMaintenance = micros64();
+    for (;;)
+    {
+        esp_err_t res = client->transport->waitReadable(nextMaintenance - micros64());
+        if (res == ESP_OK)
         {
-            client->internalPacketReceived(recv_buffer, len, client_addr, client_addr_len);
+            client->receiveStats.wakeups++;
+            client->receiveBatch();
+        }
+        else if (res != ESP_ERR_TIMEOUT)
+        {
+            delay(100);
+        }
+        int64_t now = micros64();
+        if (now >= nextMaintenance)
+        {
+            client->checkConnection(now);
+            nextMaintenance = now + SLIMEVR_MAINTENANCE_PERIOD_US;
         }
     }
     vTaskDelete(NULL);
-}
\ No newline at end of file
+}
@@ -1,43 +1,237 @@
 #pragma once
 
 #include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
 #include "udp_server.hpp"
+#include "net_reader.hpp"
+#include "packet_pool.hpp"
+#include "udp_transport.hpp"
+#include "latency_monitor.hpp"
+#include "rate_controller.hpp"
+#include "../utils/profiler.hpp"
+#include "../utils/quaternion.hpp"
+
+#define SLIMEVR_MAX_SENSORS 8
+#define SLIMEVR_RECEIVE_BUFFER_SIZE 512
+#define SLIMEVR_RECEIVE_BATCH 16
+#define SLIMEVR_MAINTENANCE_PERIOD_US 100000
+#define SLIMEVR_KEEPALIVE_PERIOD_US 1000000
+// One RTT probe per step of the rate controller
+#define SLIMEVR_PROBE_PERIOD_US 500000
+#define SLIMEVR_SERVER_PORT 6969
+// Handshakes are retried with exponential backoff between these two periods
+#define SLIMEVR_DISCOVERY_MIN_US 250000
+#define SLIMEVR_DISCOVERY_MAX_US 4000000
+// Attempts that only go to the cached server before the broadcast joins in
+#define SLIMEVR_DISCOVERY_HINT_ATTEMPTS 3
+// Size of the inbound dispatch table, higher packet types are unknown
+#define SLIMEVR_INBOUND_TYPES 16
+
+// A sample is sent when it moved past either threshold since the last one that
+// was sent, or when keyframePeriod passed. Zero thresholds send every sample.
+struct SuppressionConfig
+{
+    float accelerationThreshold; // m/s^2, length of the difference vector
+    float angleThreshold;        // radians, change of rotation (or of direction without one)
+    int64_t keyframePeriod;      // us
+};
+
+struct SuppressionStats
+{
+    uint32_t offered;
+    uint32_t sent;
+    uint32_t suppressed;
+    uint32_t throttled; // due, but the rate controller skipped the frame
+    uint32_t keyframes; // sent because keyframePeriod passed
+};
+
+struct SensorState
+{
+    uint8_t id;
+    bool registered;
+    bool hasAcceleration;
+    bool hasRotation;
+    bool fresh;
+    bool due;
+    bool keyframe;
+    bool hasSent;
+    float acceleration[3];
+    float sentAcceleration[3];
+    Quaternion rotation;
+    Quaternion sentRotation;
+    int64_t lastSentTime;
+    SuppressionStats suppression;
+};
+
+struct ReceiveStats
+{
+    uint32_t received;
+    uint32_t truncated;
+    uint32_t dropped;
+    uint32_t malformed;
+    uint32_t unknown; // packet types without a handler
+    uint32_t timeouts;
+    uint32_t wakeups;
+    uint32_t maxBatch;
+};
+
+struct DiscoveryStats
+{
+    uint32_t attempts;    // handshake rounds, to the cached server and/or broadcast
+    uint32_t broadcasts;
+    uint32_t found;       // handshakes answered
+    uint32_t foundCached; // answered by the cached server
+    int64_t lastDuration; // us from the first round to the answer
+    int64_t maxDuration;
+};
+
+class SlimeVRClient;
+
+// Handler of one inbound packet type. It is only called for datagrams of at
+// least minSize bytes, header included, with the reader past the header.
+struct InboundRoute
+{
+    size_t minSize;
+    void (SlimeVRClient::*handle)(NetReader &reader);
+};
 
 class SlimeVRClient
 {
 public:
+    // Default transport, setTransport() replaces it
     UdpServer udpServer;
 
 private:
-    bool connected;
+    UdpTransport *transport;
+    // Set on the listen task, read by the sending tasks
+    std::atomic<bool> connected;
     bool running;
-    uint64_t packetNumber;
+    std::atomic<uint32_t> packetNumber;
     TaskHandle_t taskHandle;
-    uint64_t lastPacketTime;
-    uint64_t timeout;
-    NetBuffer sendBuffer;
+    int64_t lastPacketTime;
+    int64_t timeout;
+    int64_t lastKeepaliveTime;
+    int64_t lastProbeTime;
+    uint64_t lastServerPacketNumber;
+    bool hasServerPacketNumber;
+    sockaddr_in serverHint;
+    bool hasServerHint;
+    sockaddr_in discoveryTarget;
+    uint32_t discoveryAttempt;
+    int64_t discoveryStart;
+    int64_t nextDiscoveryTime;
+    DiscoveryStats discoveryStats;
+    ReceiveStats receiveStats;
+    unsigned char receiveBuffer[SLIMEVR_RECEIVE_BUFFER_SIZE];
+    SensorState sensors[SLIMEVR_MAX_SENSORS];
+    bool bundleEnabled;
+    SuppressionConfig suppressionConfig;
+    float cosAngleThreshold;
+    float cosHalfAngleThreshold;
+    bool compactRotation;
+    RateController rateController;
+    portMUX_TYPE rateLock;
+    LatencyMonitor *latencyMonitor;
+    uint32_t reportedProbesLost;
 
 public:
     SlimeVRClient();
     ~SlimeVRClient();
 
-    esp_err_t start();
+    esp_err_t start(int port = 6969);
     esp_err_t stop();
 
-    void writePacketHeader(uint8_t packetType);
+    // Only while stopped, nullptr goes back to udpServer
+    void setTransport(UdpTransport *transport);
+    UdpTransport *getTransport();
+
     bool isConnected();
     bool isRunning();
 
+    // Registered sensors are announced with PACKET_SENSOR_INFO on every
+    // handshake, and right away when registered while connected
+    esp_err_t registerSensor(uint8_t id);
+    esp_err_t setAcceleration(uint8_t id, float x, float y, float z);
+    esp_err_t setRotation(uint8_t id, const Quaternion &rotation);
+    void setBundleEnabled(bool enabled);
+    bool isBundleEnabled();
+    void setCompactRotation(bool enabled);
+    bool isCompactRotation();
+    PacketPoolStats getPacketPoolStats();
+    ReceiveStats getReceiveStats();
+    void setRateLimits(float minRate, float maxRate);
+    // For senders that queue frames and send them in bursts: the rate
+    // controller lets packets go back to back, and delay us of extra RTT
+    // from replies held at the access point are not taken as congestion
+    void setBurstTolerance(float packets, int64_t delay);
+    // Server of an earlier session. The client handshakes with it right away
+    // instead of waiting for the server to show up. address and port are in
+    // network byte order.
+    void setServerHint(uint32_t address, uint16_t port);
+    bool getServerEndpoint(uint32_t *address, uint16_t *port);
+    // Where discovery handshakes are broadcast, 255.255.255.255:6969 by
+    // default. Network byte order.
+    void setDiscoveryTarget(uint32_t address, uint16_t port);
+    DiscoveryStats getDiscoveryStats();
+    RateControllerState getRateControllerState();
+    // Receives the RTT and loss of the client's probes as LATENCY_APP
+    void setLatencyMonitor(LatencyMonitor *monitor);
+    void setSuppression(const SuppressionConfig &config);
+    esp_err_t getSuppressionStats(uint8_t id, SuppressionStats *stats);
+
     esp_err_t sendHeartbeat();
     esp_err_t sendHandshake();
     esp_err_t sendSensorInfo(uint8_t id);
+    esp_err_t sendProbe();
     esp_err_t sendAcceleration(uint8_t id);
-    inline void processSensorInfo(unsigned char buffer[], size_t size);
+    esp_err_t sendRotation(uint8_t id);
+    esp_err_t sendBundle();
+    esp_err_t sendSensorData();
+    // now is what the suppression and rate decisions are taken at
+    esp_err_t sendSensorData(int64_t now);
+    // sendSensorData() at a recorded time, with the rate controller's
+    // decision taken from the recording instead of asked for
+    esp_err_t replaySensorData(int64_t now, bool allowed);
+    // One PACKET_INSPECTION per stage and core that saw any samples
+    esp_err_t sendProfile(const ProfileSummary summary[PROFILER_CORES][PROFILE_STAGE_COUNT]);
+    bool processProbeReply(unsigned char buffer[], size_t size);
 
     void internalPacketReceived(unsigned char buffer[], size_t size, struct sockaddr_in client_addr, socklen_t client_addr_len);
 
 private:
-    esp_err_t connect(const char *host, int port);
+    SensorState *findSensor(uint8_t id);
+    uint64_t nextPacketNumber();
+    template <typename Packet, typename... Args>
+    esp_err_t sendPacket(uint64_t number, const Args &...args);
+    // nullptr sends to the connected server
+    template <typename Packet, typename... Args>
+    esp_err_t sendPacketTo(const sockaddr_in *address, uint64_t number, const Args &...args);
+    esp_err_t sendHandshake(const sockaddr_in &address);
+    void announceSensors();
+    esp_err_t trackSend(esp_err_t res);
+    esp_err_t sendBundle(bool dueOnly, int64_t now);
+    esp_err_t sendDueSensors(int64_t now, bool allowed);
+    bool isDue(SensorState &sensor, int64_t now);
+    size_t selectDueSensors(int64_t now);
+    void markSent(SensorState &sensor, int64_t now);
+
+    // nullptr for types nothing handles
+    static const InboundRoute *findInboundRoute(uint32_t type);
+    void onHeartbeat(NetReader &reader);
+    void onVibrate(NetReader &reader);
+    void onServerHandshake(NetReader &reader);
+    void onCommand(NetReader &reader);
+    void onConfig(NetReader &reader);
+    void onPingPong(NetReader &reader);
+    void onSensorInfo(NetReader &reader);
+
+    void receiveBatch();
+    void checkConnection(int64_t now);
+    void discover(int64_t now);
+    void restartDiscovery();
+
     esp_err_t disconnect();
 
     static void listen(void *arg);
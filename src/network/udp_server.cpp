@@ -1,14 +1,19 @@
 #include "udp_server.hpp"
 
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
 #include <esp_log.h>
+#include "../utils/deferred_log.hpp"
+#include "../utils/profiler.hpp"
 
 static const char *TAG = "UdpServer";
 
 UdpServer::UdpServer()
 {
     this->running = false;
-    this->connected = false;
+    this->sock = -1;
 }
 
 UdpServer::~UdpServer()
@@ -32,6 +37,13 @@ esp_err_t UdpServer::start(int port)
 
     this->running = true;
 
+    // Discovery handshakes go to the broadcast address
+    int broadcast = 1;
+    if (setsockopt(this->sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) != 0)
+    {
+        ESP_LOGW(TAG, "Failed to enable broadcast: %d", errno);
+    }
+
     int ret = bind(this->sock, (struct sockaddr *)&this->serverAddress, sizeof(this->serverAddress));
     if (ret != 0)
     {
@@ -49,6 +61,8 @@ esp_err_t UdpServer::stop()
         return ESP_OK;
     }
     int res = close(this->sock);
+    this->running = false;
+    this->sock = -1;
     if (res != 0)
     {
         ESP_LOGE(TAG, "Failed to close socket: %d", errno);
@@ -66,53 +80,88 @@ ssize_t UdpServer::receive(char *buffer, size_t bufferLength, sockaddr_in *sourc
     return recvfrom(this->sock, buffer, bufferLength, 0, (struct sockaddr *)sourceAddress, sourceAddressLength);
 }
 
-esp_err_t UdpServer::connect(const char *host, int port)
+// Returns -1 with errno EAGAIN/EWOULDBLOCK once the socket queue is empty.
+ssize_t UdpServer::receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated)
 {
-    memset(&this->clientAddress, 0, sizeof(this->clientAddress));
-    this->clientAddress.sin_family = AF_INET;
-    this->clientAddress.sin_addr.s_addr = inet_addr(host);
-    this->clientAddress.sin_port = htons(port);
-    this->connected = true;
-    ESP_LOGI(TAG, "Connected to: %s:%d", host, port);
-    return ESP_OK;
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    struct iovec vector;
+    vector.iov_base = buffer;
+    vector.iov_len = bufferLength;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = sourceAddress;
+    message.msg_namelen = *sourceAddressLength;
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    ssize_t length = recvmsg(this->sock, &message, MSG_DONTWAIT);
+    *sourceAddressLength = message.msg_namelen;
+    *truncated = length >= 0 && (message.msg_flags & MSG_TRUNC) != 0;
+    return length;
 }
 
-esp_err_t UdpServer::disconnect()
+// ESP_OK when a datagram is queued, ESP_ERR_TIMEOUT when none arrived within timeoutUs.
+esp_err_t UdpServer::waitReadable(int64_t timeoutUs)
 {
-    this->connected = false;
-    return ESP_OK;
+    if (!this->running)
+    {
+        return ESP_FAIL;
+    }
+    if (timeoutUs < 0)
+    {
+        timeoutUs = 0;
+    }
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(this->sock, &readSet);
+    struct timeval timeout;
+    timeout.tv_sec = timeoutUs / 1000000;
+    timeout.tv_usec = timeoutUs % 1000000;
+    int ready = select(this->sock + 1, &readSet, NULL, NULL, &timeout);
+    if (ready < 0)
+    {
+        ESP_LOGE(TAG, "Failed to wait for socket: %d", errno);
+        return ESP_FAIL;
+    }
+    return ready > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+NetBuffer *UdpServer::acquire()
+{
+    return this->packetPool.acquire();
+}
+
+void UdpServer::release(NetBuffer *buffer)
+{
+    this->packetPool.release(buffer);
 }
 
-esp_err_t UdpServer::send(unsigned char *message, size_t size)
+esp_err_t UdpServer::submit(const sockaddr_in &address, NetBuffer *buffer)
 {
-    /*char hex_buffer[size * 3 + 1];
-    memset(hex_buffer, 0, sizeof(hex_buffer));
-    for (int i = 0; i < size; i++)
+    int sent;
     {
-        snprintf(hex_buffer + i * 3, 4, "%02X ", (unsigned char)message[i]);
+        ProfileScope scope(PROFILE_SEND);
+        sent = sendto(this->sock, buffer->getBuffer(), buffer->getCurrentSize(), 0, (const struct sockaddr *)&address, sizeof(address));
     }
-    ESP_LOGI(TAG, "Sending message (hex): %s", hex_buffer);*/
-
-    int sent = sendto(this->sock, message, size, 0, (struct sockaddr *)&this->clientAddress, sizeof(this->clientAddress));
+    int error = errno;
+    this->packetPool.release(buffer);
     if (sent < 0)
     {
-        ESP_LOGE(TAG, "Failed to send message: %d", errno);
+        // Runs once per datagram while the link is saturated
+        deferredLog<LOG_SEND_FAILED>(error);
         return ESP_FAIL;
     }
     return ESP_OK;
 }
 
-esp_err_t UdpServer::send(NetBuffer &buffer)
+PacketPoolStats UdpServer::getBufferStats()
 {
-    return this->send(buffer.getBuffer(), buffer.getCurrentSize());
+    return this->packetPool.getStats();
 }
 
 bool UdpServer::isRunning()
 {
     return this->running;
 }
-
-bool UdpServer::isConnected()
-{
-    return this->connected;
-}
\ No newline at end of file
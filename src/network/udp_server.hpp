@@ -3,31 +3,33 @@
 #include <esp_err.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
-#include "net_buffer.hpp"
+#include "udp_transport.hpp"
 
-class UdpServer
+// Socket backend, sends are copied into the stack by sendto()
+class UdpServer : public UdpTransport
 {
 private:
     bool running;
-    bool connected;
-    sockaddr_in clientAddress;
     sockaddr_in serverAddress;
     int sock;
+    PacketPool packetPool;
 
 public:
     UdpServer();
     ~UdpServer();
 
-    esp_err_t start(int port);
-    esp_err_t stop();
+    esp_err_t start(int port) override;
+    esp_err_t stop() override;
+    bool isRunning() override;
     ssize_t receive(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength);
+    ssize_t receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated) override;
+    esp_err_t waitReadable(int64_t timeoutUs) override;
 
-    esp_err_t connect(const char *host, int port);
-    esp_err_t disconnect();
-    esp_err_t send(unsigned char *message, size_t size);
-    esp_err_t send(NetBuffer &buffer);
-
-    bool isRunning();
-    bool isConnected();
-};
\ No newline at end of file
+    NetBuffer *acquire() override;
+    void release(NetBuffer *buffer) override;
+    esp_err_t submit(const sockaddr_in &address, NetBuffer *buffer) override;
+    PacketPoolStats getBufferStats() override;
+};
@@ -0,0 +1,67 @@
+#include "udp_transport.hpp"
+
+#include <string.h>
+
+UdpTransport::UdpTransport()
+{
+    this->connected = false;
+    memset(&this->clientAddress, 0, sizeof(this->clientAddress));
+    portMUX_INITIALIZE(&this->endpointLock);
+}
+
+// Retargets the transport even while connected, e.g. when a server answers
+// from another address than the cached one
+esp_err_t UdpTransport::connect(const sockaddr_in &address)
+{
+    portENTER_CRITICAL(&this->endpointLock);
+    this->clientAddress = address;
+    portEXIT_CRITICAL(&this->endpointLock);
+    this->connected = true;
+    return ESP_OK;
+}
+
+sockaddr_in UdpTransport::getClientAddress()
+{
+    portENTER_CRITICAL(&this->endpointLock);
+    sockaddr_in address = this->clientAddress;
+    portEXIT_CRITICAL(&this->endpointLock);
+    return address;
+}
+
+esp_err_t UdpTransport::disconnect()
+{
+    this->connected = false;
+    return ESP_OK;
+}
+
+bool UdpTransport::isConnected()
+{
+    return this->connected;
+}
+
+esp_err_t UdpTransport::send(NetBuffer *buffer)
+{
+    return this->submit(this->getClientAddress(), buffer);
+}
+
+esp_err_t UdpTransport::send(const unsigned char *message, size_t size)
+{
+    return this->sendTo(this->getClientAddress(), message, size);
+}
+
+esp_err_t UdpTransport::sendTo(const sockaddr_in &address, const unsigned char *message, size_t size)
+{
+    NetBuffer *buffer = this->acquire();
+    if (buffer == nullptr)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    unsigned char *payload = buffer->reserve(size);
+    if (payload == nullptr)
+    {
+        this->release(buffer);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(payload, message, size);
+    return this->submit(address, buffer);
+}
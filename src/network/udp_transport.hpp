@@ -0,0 +1,100 @@
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <atomic>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "net_buffer.hpp"
+#include "packet_pool.hpp"
+
+// Datagram backend of SlimeVRClient. Send buffers are handed out by the
+// backend itself, so one that sends from its own memory (lwIP pbufs for
+// RawUdpTransport) gets the payload serialized in place instead of copied.
+class UdpTransport
+{
+private:
+    std::atomic<bool> connected;
+    // Retargeted on the receive task while the other tasks send, a send must
+    // never see half of an address
+    sockaddr_in clientAddress;
+    portMUX_TYPE endpointLock;
+
+public:
+    UdpTransport();
+    virtual ~UdpTransport() {}
+
+    virtual esp_err_t start(int port) = 0;
+    virtual esp_err_t stop() = 0;
+    virtual bool isRunning() = 0;
+    // Returns -1 with errno EAGAIN/EWOULDBLOCK once nothing is queued.
+    virtual ssize_t receiveNonBlocking(char *buffer, size_t bufferLength, sockaddr_in *sourceAddress, socklen_t *sourceAddressLength, bool *truncated) = 0;
+    // ESP_OK when a datagram is queued, ESP_ERR_TIMEOUT when none arrived within timeoutUs.
+    virtual esp_err_t waitReadable(int64_t timeoutUs) = 0;
+
+    // Empty buffer for one datagram, nullptr when the backend has none left.
+    // It goes back through submit() or release().
+    virtual NetBuffer *acquire() = 0;
+    virtual void release(NetBuffer *buffer) = 0;
+    // Sends an acquired buffer and releases it, also when sending failed.
+    // Broadcast addresses are allowed.
+    virtual esp_err_t submit(const sockaddr_in &address, NetBuffer *buffer) = 0;
+    virtual PacketPoolStats getBufferStats() = 0;
+
+    esp_err_t connect(const sockaddr_in &address);
+    sockaddr_in getClientAddress();
+    esp_err_t disconnect();
+    bool isConnected();
+    // Submits to the connected address
+    esp_err_t send(NetBuffer *buffer);
+    // Copy message into a send buffer first
+    esp_err_t send(const unsigned char *message, size_t size);
+    esp_err_t sendTo(const sockaddr_in &address, const unsigned char *message, size_t size);
+};
+
+// Releases the buffer back to its transport when it goes out of scope, unless
+// it was sent.
+class TransportBuffer
+{
+private:
+    UdpTransport &transport;
+    NetBuffer *buffer;
+
+public:
+    explicit TransportBuffer(UdpTransport &transport) : transport(transport), buffer(transport.acquire()) {}
+    ~TransportBuffer()
+    {
+        if (buffer != nullptr)
+        {
+            transport.release(buffer);
+        }
+    }
+    TransportBuffer(const TransportBuffer &) = delete;
+    TransportBuffer &operator=(const TransportBuffer &) = delete;
+
+    bool isValid()
+    {
+        return buffer != nullptr;
+    }
+
+    NetBuffer &operator*()
+    {
+        return *buffer;
+    }
+
+    NetBuffer *operator->()
+    {
+        return buffer;
+    }
+
+    // nullptr sends to the connected address
+    esp_err_t send(const sockaddr_in *address = nullptr)
+    {
+        NetBuffer *sent = buffer;
+        buffer = nullptr;
+        return transport.submit(address != nullptr ? *address : transport.getClientAddress(), sent);
+    }
+};
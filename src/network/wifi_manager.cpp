@@ -4,6 +4,8 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <esp_log.h>
+#include "../utils/boot_timeline.hpp"
+#include "../utils/timing.hpp"
 
 static const char *TAG = "WifiManager";
 
@@ -11,9 +13,16 @@ WifiManager::WifiManager()
 {
     this->state = WifiState::UNKNOWN;
     this->ip = nullptr;
+    this->gateway = 0;
     this->ssid = nullptr;
     this->maxConnectionRetries = 5;
     this->currentRetry = 0;
+    this->fallbacks = 0;
+    this->fastPath = false;
+    this->powerSave = false;
+    this->listenInterval = 1;
+    memset(&this->wifiConfig, 0, sizeof(this->wifiConfig));
+    memset(&this->cache, 0, sizeof(this->cache));
 }
 
 void WifiManager::init()
@@ -28,6 +37,9 @@ void WifiManager::init()
     esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    // The access point is cached by StorageManager, without the driver's own
+    // NVS copy this can run while NVS is still initializing
+    cfg.nvs_enable = false;
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
     esp_event_handler_instance_t instance_any_id;
@@ -53,11 +65,33 @@ void WifiManager::event_handler(void *arg, esp_event_base_t event_base, int32_t
         esp_wifi_connect();
         ESP_LOGI(TAG, "Connecting to AP...");
     }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        BootTimeline::mark(BOOT_WIFI_ASSOCIATED);
+        if (wifiManager != nullptr)
+        {
+            wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+            memcpy(wifiManager->cache.bssid, event->bssid, sizeof(wifiManager->cache.bssid));
+            wifiManager->cache.channel = event->channel;
+            wifiManager->cache.valid = true;
+            if (!BootTimeline::isComplete())
+            {
+                BootTimeline::setFastPath(wifiManager->fastPath);
+            }
+            ESP_LOGI(TAG, "Associated on channel %d%s", event->channel, wifiManager->fastPath ? " (cached)" : "");
+        }
+    }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
         if (wifiManager != nullptr)
         {
             wifiManager->state = WifiState::DISCONNECTED;
+            // The cached access point is gone or moved, look for the SSID everywhere
+            if (wifiManager->fastPath)
+            {
+                wifiManager->fallBackToScan();
+                return;
+            }
             if (wifiManager->currentRetry < wifiManager->maxConnectionRetries)
             {
                 esp_wifi_connect();
@@ -76,8 +110,10 @@ void WifiManager::event_handler(void *arg, esp_event_base_t event_base, int32_t
     {
         if (wifiManager != nullptr)
         {
+            BootTimeline::mark(BOOT_IP_ACQUIRED);
             wifiManager->state = WifiState::CONNECTED;
             wifiManager->ip = inet_ntoa(((ip_event_got_ip_t *)event_data)->ip_info.ip);
+            wifiManager->gateway = ((ip_event_got_ip_t *)event_data)->ip_info.gw.addr;
             ESP_LOGI(TAG, "Connected to AP: %s", wifiManager->ssid);
             ESP_LOGI(TAG, "IP address: %s", wifiManager->ip);
         }
@@ -89,26 +125,96 @@ WifiState WifiManager::startAccessPoint(const char *ssid, const char *password)
     return this->state;
 }
 
-WifiState WifiManager::connect(const char *ssid, const char *password)
+WifiState WifiManager::connect(const char *ssid, const char *password, const WifiCache *cache)
 {
-    wifi_config_t wifiConfig;
-
-    strncpy(reinterpret_cast<char*>(wifiConfig.sta.ssid), ssid, sizeof(wifiConfig.sta.ssid));
-    strncpy(reinterpret_cast<char*>(wifiConfig.sta.password), password, sizeof(wifiConfig.sta.password));
-
-    wifiConfig.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    memset(&this->wifiConfig, 0, sizeof(this->wifiConfig));
+    strncpy(reinterpret_cast<char*>(this->wifiConfig.sta.ssid), ssid, sizeof(this->wifiConfig.sta.ssid));
+    strncpy(reinterpret_cast<char*>(this->wifiConfig.sta.password), password, sizeof(this->wifiConfig.sta.password));
+
+    this->wifiConfig.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    this->wifiConfig.sta.listen_interval = this->listenInterval;
+    this->fastPath = cache != nullptr && cache->valid && cache->channel != 0;
+    if (this->fastPath)
+    {
+        this->wifiConfig.sta.bssid_set = true;
+        memcpy(this->wifiConfig.sta.bssid, cache->bssid, sizeof(this->wifiConfig.sta.bssid));
+        this->wifiConfig.sta.channel = cache->channel;
+        this->wifiConfig.sta.scan_method = WIFI_FAST_SCAN;
+    }
+    else
+    {
+        this->wifiConfig.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
 
-    ESP_LOGI(TAG, "Requesting connection to AP: %s", (char *)ssid);
+    ESP_LOGI(TAG, "Requesting connection to AP: %s%s", (char *)ssid, this->fastPath ? " (cached)" : "");
 
     this->currentRetry = 0;
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifiConfig));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &this->wifiConfig));
     ESP_ERROR_CHECK(esp_wifi_start());
+    // The driver defaults to WIFI_PS_MIN_MODEM, which mostly adds latency at
+    // a 7 ms send period. Either sleep properly or not at all.
+    ESP_ERROR_CHECK(esp_wifi_set_ps(this->powerSave ? WIFI_PS_MAX_MODEM : WIFI_PS_NONE));
     this->ssid = (char *)ssid;
     this->state = WifiState::CONNECTING;
     return this->state;
 }
 
+// Runs on the event loop task after the cached access point failed
+void WifiManager::fallBackToScan()
+{
+    ESP_LOGW(TAG, "Cached access point unavailable, scanning all channels");
+    this->fastPath = false;
+    this->fallbacks++;
+    this->cache.valid = false;
+    this->wifiConfig.sta.bssid_set = false;
+    this->wifiConfig.sta.channel = 0;
+    this->wifiConfig.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    this->currentRetry = 0;
+    this->state = WifiState::CONNECTING;
+    esp_wifi_set_config(WIFI_IF_STA, &this->wifiConfig);
+    esp_wifi_connect();
+}
+
+WifiCache WifiManager::getCache()
+{
+    return this->cache;
+}
+
+bool WifiManager::isFastPath()
+{
+    return this->fastPath;
+}
+
+void WifiManager::setPowerSave(bool enabled, uint8_t listenInterval)
+{
+    this->powerSave = enabled;
+    this->listenInterval = listenInterval > 0 ? listenInterval : 1;
+}
+
+bool WifiManager::isPowerSave()
+{
+    return this->powerSave;
+}
+
+// Beacons go out when the access point's TSF is a multiple of the beacon
+// interval, the station keeps its TSF in step with them
+esp_err_t WifiManager::getBeaconTime(int64_t period, int64_t *tbtt)
+{
+    if (this->state != WifiState::CONNECTED || period <= 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t now = micros64();
+    int64_t tsf = esp_wifi_get_tsf_time(WIFI_IF_STA);
+    if (tsf <= 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *tbtt = now - tsf % period;
+    return ESP_OK;
+}
+
 WifiState WifiManager::disconnect()
 {
     ESP_LOGI(TAG, "Requesting disconnection");
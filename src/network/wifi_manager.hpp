@@ -14,27 +14,53 @@ enum WifiState
     UNKNOWN
 };
 
+// Access point of the last connection. With it connect() probes a single
+// channel for a single BSSID instead of scanning every channel.
+struct WifiCache
+{
+    bool valid;
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
 class WifiManager
 {
 private:
     EventGroupHandle_t wifi_event_group;
+    wifi_config_t wifiConfig;
+    WifiCache cache;
+    bool fastPath;
+    bool powerSave;
+    uint8_t listenInterval;
 
 public:
     WifiState state;
     int maxConnectionRetries;
     int currentRetry;
+    uint32_t fallbacks;
     char *ssid;
     char *ip;
+    uint32_t gateway; // IPv4, network byte order, 0 until an address is assigned
 
 public:
     WifiManager();
 
     void init();
     WifiState startAccessPoint(const char *ssid, const char *password);
-    WifiState connect(const char *ssid, const char *password);
+    WifiState connect(const char *ssid, const char *password, const WifiCache *cache = nullptr);
+    WifiCache getCache();
+    bool isFastPath();
+    // Modem sleep between beacons, waking for every listenInterval-th one.
+    // Off keeps the radio awake. Takes effect with the next connect().
+    void setPowerSave(bool enabled, uint8_t listenInterval);
+    bool isPowerSave();
+    // Local time of the latest beacon whose TSF is a multiple of period, the
+    // ones the station wakes for when period is the wake period
+    esp_err_t getBeaconTime(int64_t period, int64_t *tbtt);
     WifiState disconnect();
     const char *getStateName();
 
 private:
+    void fallBackToScan();
     static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 };
\ No newline at end of file
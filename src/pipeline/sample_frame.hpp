@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include "../network/slimevr_client.hpp"
+#include "../utils/quaternion.hpp"
+
+struct SensorSample
+{
+    uint8_t id;
+    bool hasRotation;
+    float acceleration[3];
+    Quaternion rotation;
+};
+
+// One tick worth of samples, copied by value through the pipeline ring.
+struct SampleFrame
+{
+    int64_t timestamp;
+    uint8_t sensorCount;
+    SensorSample samples[SLIMEVR_MAX_SENSORS];
+};
+
+// Stand-in values for sensors without an IMU, in [0, 1]. A xorshift32 rather
+// than esp_random() so a replayed session draws the same values again from
+// the recorded state. state must not be 0.
+inline float nextStandInValue(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (float)state / UINT32_MAX;
+}
@@ -0,0 +1,208 @@
+#include "sample_pipeline.hpp"
+
+#include <esp_log.h>
+#include "../utils/task_topology.hpp"
+#include "../utils/timing.hpp"
+
+static const char *TAG = "SamplePipeline";
+
+SamplePipeline::SamplePipeline()
+{
+    source = nullptr;
+    sourceArg = nullptr;
+    sink = nullptr;
+    sinkArg = nullptr;
+    period = 0;
+    samplingTask = nullptr;
+    txTask = nullptr;
+    burstScheduler = nullptr;
+    burstTimer = nullptr;
+    framesProduced = 0;
+    framesConsumed = 0;
+    maxDepth = 0;
+    running = false;
+}
+
+void SamplePipeline::setBurstScheduler(BurstScheduler *scheduler)
+{
+    this->burstScheduler = scheduler;
+}
+
+esp_err_t SamplePipeline::start(int64_t period, SampleSource source, void *sourceArg, SampleSink sink, void *sinkArg)
+{
+    if (this->running)
+    {
+        return ESP_OK;
+    }
+    if (period <= 0 || source == nullptr || sink == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->period = period;
+    this->source = source;
+    this->sourceArg = sourceArg;
+    this->sink = sink;
+    this->sinkArg = sinkArg;
+
+    esp_err_t res = this->samplingScheduler.init();
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    res = this->samplingScheduler.addJob("sampling", period, sampleJob, this);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    if (this->burstScheduler != nullptr && this->burstTimer == nullptr)
+    {
+        esp_timer_create_args_t args = {};
+        args.callback = &SamplePipeline::onBurstTimer;
+        args.arg = this;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "BurstWake";
+        res = esp_timer_create(&args, &this->burstTimer);
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+    }
+    if (createTask(TaskTopology::NETWORK_TX, txLoop, this, &this->txTask) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create TX task");
+        return ESP_ERR_NO_MEM;
+    }
+    if (createTask(TaskTopology::SAMPLING, samplingLoop, this, &this->samplingTask) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create sampling task");
+        vTaskDelete(this->txTask);
+        return ESP_ERR_NO_MEM;
+    }
+    this->running = true;
+    return ESP_OK;
+}
+
+bool SamplePipeline::isRunning()
+{
+    return this->running;
+}
+
+esp_err_t SamplePipeline::setPeriod(int64_t period)
+{
+    this->period = period;
+    return this->samplingScheduler.setPeriod(0, period);
+}
+
+SamplePipelineStats SamplePipeline::getStats()
+{
+    SamplePipelineStats stats;
+    stats.framesProduced = this->framesProduced;
+    stats.framesConsumed = this->framesConsumed;
+    stats.overflows = this->ring.getOverflows();
+    stats.underflows = this->ring.getUnderflows();
+    stats.maxDepth = this->maxDepth;
+    return stats;
+}
+
+void SamplePipeline::sample()
+{
+    SampleFrame frame;
+    frame.timestamp = micros64();
+    frame.sensorCount = 0;
+    if (!this->source(frame, this->sourceArg))
+    {
+        return;
+    }
+    if (this->ring.push(frame))
+    {
+        this->framesProduced++;
+        size_t depth = this->ring.size();
+        if (depth > this->maxDepth)
+        {
+            this->maxDepth = depth;
+        }
+    }
+    xTaskNotifyGive(this->txTask);
+}
+
+void SamplePipeline::sampleJob(void *arg)
+{
+    ((SamplePipeline *)arg)->sample();
+}
+
+void SamplePipeline::samplingLoop(void *arg)
+{
+    SamplePipeline *pipeline = (SamplePipeline *)arg;
+    pipeline->samplingScheduler.run();
+    vTaskDelete(NULL);
+}
+
+// Runs on the TX task for every new frame and when the burst timer fires.
+// Frames stay in the ring until their burst is due, then all of them go.
+void SamplePipeline::sendBurst()
+{
+    const SampleFrame *oldest = this->ring.front();
+    if (oldest == nullptr)
+    {
+        return;
+    }
+    size_t depth = this->ring.size();
+    int64_t now = micros64();
+    int64_t burstTime = this->burstScheduler->getBurstTime(oldest->timestamp, depth, this->ring.capacity());
+    if (burstTime > now)
+    {
+        esp_timer_stop(this->burstTimer);
+        esp_timer_start_once(this->burstTimer, (uint64_t)(burstTime - now));
+        return;
+    }
+    bool forced = depth + 1 >= this->ring.capacity();
+    SampleFrame frame;
+    uint32_t count = 0;
+    int64_t totalLatency = 0;
+    int64_t maxLatency = 0;
+    while (!this->ring.empty() && this->ring.pop(frame))
+    {
+        int64_t latency = now - frame.timestamp;
+        totalLatency += latency;
+        if (latency > maxLatency)
+        {
+            maxLatency = latency;
+        }
+        this->sink(frame, this->sinkArg);
+        this->framesConsumed++;
+        count++;
+    }
+    this->burstScheduler->onBurst(now, count, totalLatency, maxLatency, forced);
+}
+
+void SamplePipeline::onBurstTimer(void *arg)
+{
+    SamplePipeline *pipeline = (SamplePipeline *)arg;
+    xTaskNotifyGive(pipeline->txTask);
+}
+
+void SamplePipeline::txLoop(void *arg)
+{
+    SamplePipeline *pipeline = (SamplePipeline *)arg;
+    SampleFrame frame;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pipeline->burstScheduler != nullptr)
+        {
+            pipeline->sendBurst();
+            continue;
+        }
+        // A wakeup without a frame counts as an underflow, draining after that does not
+        if (!pipeline->ring.pop(frame))
+        {
+            continue;
+        }
+        do
+        {
+            pipeline->sink(frame, pipeline->sinkArg);
+            pipeline->framesConsumed++;
+        } while (!pipeline->ring.empty() && pipeline->ring.pop(frame));
+    }
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sample_frame.hpp"
+#include "../network/burst_scheduler.hpp"
+#include "../utils/scheduler.hpp"
+#include "../utils/spsc_ring.hpp"
+
+// Also the longest burst: 32 frames of 7 ms cover a 220 ms latency budget
+#define SAMPLE_PIPELINE_RING_SIZE 32
+
+typedef bool (*SampleSource)(SampleFrame &frame, void *arg);
+typedef void (*SampleSink)(const SampleFrame &frame, void *arg);
+
+struct SamplePipelineStats
+{
+    uint32_t framesProduced;
+    uint32_t framesConsumed;
+    uint32_t overflows;
+    uint32_t underflows;
+    uint32_t maxDepth;
+};
+
+// Sampling task (APP_CPU) -> SPSC ring -> network TX task (PRO_CPU).
+// The source fills a frame every period on the sampling task, the sink gets
+// every frame on the TX task, so a slow sendto() never delays sampling.
+// With a burst scheduler the TX task holds the frames back and hands them to
+// the sink in one go when the scheduler says so.
+class SamplePipeline
+{
+private:
+    SpscRing<SampleFrame, SAMPLE_PIPELINE_RING_SIZE> ring;
+    Scheduler samplingScheduler;
+    SampleSource source;
+    void *sourceArg;
+    SampleSink sink;
+    void *sinkArg;
+    int64_t period;
+    TaskHandle_t samplingTask;
+    TaskHandle_t txTask;
+    BurstScheduler *burstScheduler;
+    esp_timer_handle_t burstTimer;
+    uint32_t framesProduced;
+    uint32_t framesConsumed;
+    uint32_t maxDepth;
+    bool running;
+
+public:
+    SamplePipeline();
+
+    // Before start(), nullptr hands every frame over right away
+    void setBurstScheduler(BurstScheduler *scheduler);
+    esp_err_t start(int64_t period, SampleSource source, void *sourceArg, SampleSink sink, void *sinkArg);
+    bool isRunning();
+    esp_err_t setPeriod(int64_t period);
+    SamplePipelineStats getStats();
+
+private:
+    void sample();
+    void sendBurst();
+    static void onBurstTimer(void *arg);
+    static void sampleJob(void *arg);
+    static void samplingLoop(void *arg);
+    static void txLoop(void *arg);
+};
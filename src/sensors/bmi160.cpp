@@ -0,0 +1,284 @@
+#include "bmi160.hpp"
+
+#include <string.h>
+#include <esp_log.h>
+#include "../utils/timing.hpp"
+
+#define BMI160_REG_CHIP_ID 0x00
+#define BMI160_REG_ERR 0x02
+#define BMI160_REG_FIFO_LENGTH 0x22
+#define BMI160_REG_FIFO_DATA 0x24
+#define BMI160_REG_ACC_CONF 0x40
+#define BMI160_REG_ACC_RANGE 0x41
+#define BMI160_REG_GYR_CONF 0x42
+#define BMI160_REG_GYR_RANGE 0x43
+#define BMI160_REG_FIFO_DOWNS 0x45
+#define BMI160_REG_FIFO_CONFIG_1 0x47
+#define BMI160_REG_CMD 0x7E
+
+#define BMI160_CHIP_ID 0xD1
+#define BMI160_CMD_ACC_NORMAL 0x11
+#define BMI160_CMD_GYR_NORMAL 0x15
+#define BMI160_CMD_FIFO_FLUSH 0xB0
+#define BMI160_CMD_SOFT_RESET 0xB6
+
+#define BMI160_CONF_BWP_NORMAL 0x20
+#define BMI160_FIFO_ACC_GYR_HEADERLESS 0xC0
+// acc_fifo_filt_data and gyr_fifo_filt_data, no downsampling. Unfiltered
+// FIFO data runs at 1600/3200 Hz regardless of the configured ODR.
+#define BMI160_FIFO_DOWNS_FILTERED 0x88
+#define BMI160_FIFO_LENGTH_MASK 0x07FF
+// Reading past the end of the FIFO returns this byte
+#define BMI160_FIFO_EMPTY 0x80
+
+#define STANDARD_GRAVITY 9.80665f
+#define DEGREES_TO_RADIANS 0.017453293f
+
+static const char *TAG = "Bmi160";
+
+Bmi160::Bmi160(ImuBus &bus) : bus(bus)
+{
+    initialized = false;
+    accelerationScale = 0;
+    angularVelocityScale = 0;
+    samplePeriod = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+ImuConfig Bmi160::defaultConfig()
+{
+    ImuConfig config;
+    config.sampleRate = 200;
+    config.accelerometerRange = 4;
+    config.gyroscopeRange = 2000;
+    return config;
+}
+
+// ODR codes 6 (25 Hz) to 12 (1600 Hz), each one doubles the rate
+static bool outputDataRate(uint16_t sampleRate, uint8_t *code)
+{
+    uint16_t rate = 25;
+    for (uint8_t value = 6; value <= 12; value++, rate *= 2)
+    {
+        if (rate == sampleRate)
+        {
+            *code = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool accelerometerRangeCode(uint8_t range, uint8_t *code)
+{
+    switch (range)
+    {
+    case 2:
+        *code = 0x03;
+        return true;
+    case 4:
+        *code = 0x05;
+        return true;
+    case 8:
+        *code = 0x08;
+        return true;
+    case 16:
+        *code = 0x0C;
+        return true;
+    }
+    return false;
+}
+
+static bool gyroscopeRangeCode(uint16_t range, uint8_t *code)
+{
+    switch (range)
+    {
+    case 2000:
+        *code = 0x00;
+        return true;
+    case 1000:
+        *code = 0x01;
+        return true;
+    case 500:
+        *code = 0x02;
+        return true;
+    case 250:
+        *code = 0x03;
+        return true;
+    case 125:
+        *code = 0x04;
+        return true;
+    }
+    return false;
+}
+
+esp_err_t Bmi160::command(uint8_t value, uint32_t waitMs)
+{
+    esp_err_t res = this->bus.writeRegister(BMI160_REG_CMD, value);
+    if (res == ESP_OK && waitMs > 0)
+    {
+        delay(waitMs);
+    }
+    return res;
+}
+
+esp_err_t Bmi160::init(const ImuConfig &config)
+{
+    uint8_t odr, accelerometerRange, gyroscopeRange;
+    if (!outputDataRate(config.sampleRate, &odr) ||
+        !accelerometerRangeCode(config.accelerometerRange, &accelerometerRange) ||
+        !gyroscopeRangeCode(config.gyroscopeRange, &gyroscopeRange))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->initialized = false;
+
+    esp_err_t res = this->command(BMI160_CMD_SOFT_RESET, 2);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    uint8_t chipId = 0;
+    res = this->bus.readRegisters(BMI160_REG_CHIP_ID, &chipId, 1);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    if (chipId != BMI160_CHIP_ID)
+    {
+        ESP_LOGE(TAG, "Unexpected chip id 0x%02X", chipId);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Start up times from the datasheet, 3.8 ms and 80 ms
+    if ((res = this->command(BMI160_CMD_ACC_NORMAL, 4)) != ESP_OK ||
+        (res = this->command(BMI160_CMD_GYR_NORMAL, 80)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_ACC_CONF, BMI160_CONF_BWP_NORMAL | odr)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_ACC_RANGE, accelerometerRange)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_GYR_CONF, BMI160_CONF_BWP_NORMAL | odr)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_GYR_RANGE, gyroscopeRange)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_FIFO_DOWNS, BMI160_FIFO_DOWNS_FILTERED)) != ESP_OK ||
+        (res = this->bus.writeRegister(BMI160_REG_FIFO_CONFIG_1, BMI160_FIFO_ACC_GYR_HEADERLESS)) != ESP_OK ||
+        (res = this->command(BMI160_CMD_FIFO_FLUSH, 0)) != ESP_OK)
+    {
+        return res;
+    }
+
+    uint8_t error = 0;
+    res = this->bus.readRegisters(BMI160_REG_ERR, &error, 1);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    if (error != 0)
+    {
+        ESP_LOGE(TAG, "Configuration rejected, error register 0x%02X", error);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    this->accelerationScale = config.accelerometerRange * STANDARD_GRAVITY / 32768.0f;
+    this->angularVelocityScale = config.gyroscopeRange * DEGREES_TO_RADIANS / 32768.0f;
+    this->samplePeriod = 1000000 / config.sampleRate;
+    this->initialized = true;
+    ESP_LOGI(TAG, "Initialized at %d Hz, +-%dg, +-%d deg/s", config.sampleRate, config.accelerometerRange, config.gyroscopeRange);
+    return ESP_OK;
+}
+
+bool Bmi160::isInitialized()
+{
+    return this->initialized;
+}
+
+static inline int16_t loadLittleEndian(const uint8_t *data)
+{
+    return (int16_t)(data[0] | data[1] << 8);
+}
+
+esp_err_t Bmi160::readFifo(ImuSample *samples, size_t capacity, size_t *count, int64_t now)
+{
+    *count = 0;
+    if (!this->initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t lengthBytes[2];
+    esp_err_t res = this->bus.readRegisters(BMI160_REG_FIFO_LENGTH, lengthBytes, sizeof(lengthBytes));
+    if (res != ESP_OK)
+    {
+        this->stats.errors++;
+        return res;
+    }
+    size_t length = (lengthBytes[0] | lengthBytes[1] << 8) & BMI160_FIFO_LENGTH_MASK;
+    // A full FIFO keeps overwriting its oldest frames until it is drained
+    if (length >= BMI160_FIFO_SIZE)
+    {
+        this->stats.overruns++;
+    }
+    size_t frames = length / BMI160_FRAME_SIZE;
+    // Frames that do not fit the caller stay in the FIFO and are newer than
+    // the ones read, the timestamps count back from the newest of them
+    size_t queued = frames;
+    if (frames > capacity)
+    {
+        frames = capacity;
+    }
+    if (frames > BMI160_FIFO_SIZE / BMI160_FRAME_SIZE)
+    {
+        frames = BMI160_FIFO_SIZE / BMI160_FRAME_SIZE;
+    }
+    if (frames == 0)
+    {
+        this->stats.emptyReads++;
+        return ESP_OK;
+    }
+
+    size_t bytes = frames * BMI160_FRAME_SIZE;
+    res = this->bus.readRegisters(BMI160_REG_FIFO_DATA, this->fifoBuffer, bytes);
+    if (res != ESP_OK)
+    {
+        this->stats.errors++;
+        return res;
+    }
+    this->stats.bursts++;
+    this->stats.bytes += bytes;
+
+    size_t decoded = 0;
+    for (size_t i = 0; i < frames; i++)
+    {
+        const uint8_t *frame = this->fifoBuffer + i * BMI160_FRAME_SIZE;
+        if (frame[0] == BMI160_FIFO_EMPTY && frame[1] == 0)
+        {
+            break;
+        }
+        ImuSample &sample = samples[decoded++];
+        sample.timestamp = now - (int64_t)(queued - 1 - i) * this->samplePeriod;
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            sample.angularVelocity[axis] = loadLittleEndian(frame + axis * 2) * this->angularVelocityScale;
+            sample.acceleration[axis] = loadLittleEndian(frame + 6 + axis * 2) * this->accelerationScale;
+        }
+    }
+    this->stats.frames += decoded;
+    *count = decoded;
+    return ESP_OK;
+}
+
+float Bmi160::getAccelerationScale()
+{
+    return this->accelerationScale;
+}
+
+float Bmi160::getAngularVelocityScale()
+{
+    return this->angularVelocityScale;
+}
+
+ImuStats Bmi160::getStats()
+{
+    return this->stats;
+}
+
+void Bmi160::resetStats()
+{
+    memset(&this->stats, 0, sizeof(this->stats));
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "imu_bus.hpp"
+#include "imu_sample.hpp"
+
+#define BMI160_I2C_ADDRESS 0x68
+// SDO pulled high
+#define BMI160_I2C_ADDRESS_ALT 0x69
+#define BMI160_FIFO_SIZE 1024
+// Headerless FIFO frame: gyroscope x, y, z then accelerometer x, y, z
+#define BMI160_FRAME_SIZE 12
+
+struct ImuConfig
+{
+    uint16_t sampleRate;        // Hz, 25 to 1600 in powers of two from 25
+    uint8_t accelerometerRange; // g, 2, 4, 8 or 16
+    uint16_t gyroscopeRange;    // deg/s, 125 to 2000
+};
+
+struct ImuStats
+{
+    uint32_t bursts;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t emptyReads;
+    uint32_t overruns;
+    uint32_t errors;
+};
+
+// BMI160 read through its hardware FIFO. Accelerometer and gyroscope frames
+// pile up in the FIFO at the output data rate and readFifo() drains all of
+// them with one burst, instead of one register poll per sample.
+class Bmi160
+{
+private:
+    ImuBus &bus;
+    bool initialized;
+    float accelerationScale;
+    float angularVelocityScale;
+    int64_t samplePeriod;
+    ImuStats stats;
+    alignas(4) uint8_t fifoBuffer[BMI160_FIFO_SIZE];
+
+public:
+    explicit Bmi160(ImuBus &bus);
+
+    static ImuConfig defaultConfig();
+
+    esp_err_t init(const ImuConfig &config);
+    bool isInitialized();
+
+    // Timestamps count back from now, one sample period per frame
+    esp_err_t readFifo(ImuSample *samples, size_t capacity, size_t *count, int64_t now);
+    // Per LSB of a raw reading, 0 before init()
+    float getAccelerationScale();
+    float getAngularVelocityScale();
+
+    ImuStats getStats();
+    void resetStats();
+
+private:
+    esp_err_t command(uint8_t value, uint32_t waitMs);
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "imu_bus.hpp"
+
+#define BUS_MUX_NO_CHANNEL 0xFF
+
+// Channel switch in front of several devices on one bus (TCA9548A and
+// friends). The selected channel is cached so consecutive transactions to the
+// same channel cost nothing extra. Not thread safe, a mux belongs to the one
+// task that owns its bus.
+class BusMux
+{
+private:
+    uint8_t selected;
+    uint32_t switches;
+
+public:
+    BusMux() : selected(BUS_MUX_NO_CHANNEL), switches(0) {}
+    virtual ~BusMux() {}
+
+    esp_err_t select(uint8_t channel)
+    {
+        if (channel == this->selected)
+        {
+            return ESP_OK;
+        }
+        if (channel >= 8)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_err_t res = this->writeChannelMask(1 << channel);
+        // After a failed write nobody knows what the mux routes to
+        this->selected = res == ESP_OK ? channel : BUS_MUX_NO_CHANNEL;
+        if (res == ESP_OK)
+        {
+            this->switches++;
+        }
+        return res;
+    }
+
+    uint8_t getSelected()
+    {
+        return this->selected;
+    }
+
+    uint32_t getSwitches()
+    {
+        return this->switches;
+    }
+
+protected:
+    virtual esp_err_t writeChannelMask(uint8_t mask) = 0;
+};
+
+// Device behind one channel of a mux, selects the channel before every access.
+class MuxedImuBus : public ImuBus
+{
+private:
+    ImuBus &device;
+    BusMux &mux;
+    uint8_t channel;
+
+public:
+    MuxedImuBus(ImuBus &device, BusMux &mux, uint8_t channel) : device(device), mux(mux), channel(channel) {}
+
+    uint8_t getChannel()
+    {
+        return this->channel;
+    }
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override
+    {
+        esp_err_t res = this->mux.select(this->channel);
+        return res == ESP_OK ? this->device.readRegisters(reg, data, length) : res;
+    }
+
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override
+    {
+        esp_err_t res = this->mux.select(this->channel);
+        return res == ESP_OK ? this->device.writeRegister(reg, value) : res;
+    }
+};
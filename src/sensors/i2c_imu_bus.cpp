@@ -0,0 +1,39 @@
+#include "i2c_imu_bus.hpp"
+
+#include <freertos/FreeRTOS.h>
+
+I2cImuBus::I2cImuBus(i2c_port_t port, uint8_t address)
+{
+    this->port = port;
+    this->address = address;
+}
+
+esp_err_t I2cImuBus::initPort(i2c_port_t port, int sda, int scl, uint32_t frequency)
+{
+    i2c_config_t config = {};
+    config.mode = I2C_MODE_MASTER;
+    config.sda_io_num = sda;
+    config.scl_io_num = scl;
+    config.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    config.scl_pullup_en = GPIO_PULLUP_ENABLE;
+    config.master.clk_speed = frequency;
+    esp_err_t res = i2c_param_config(port, &config);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    return i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0);
+}
+
+// Register write and the whole read go out as one transaction with a repeated
+// start, however long the burst is.
+esp_err_t I2cImuBus::readRegisters(uint8_t reg, uint8_t *data, size_t length)
+{
+    return i2c_master_write_read_device(this->port, this->address, &reg, 1, data, length, pdMS_TO_TICKS(I2C_IMU_TIMEOUT_MS));
+}
+
+esp_err_t I2cImuBus::writeRegister(uint8_t reg, uint8_t value)
+{
+    uint8_t buffer[2] = {reg, value};
+    return i2c_master_write_to_device(this->port, this->address, buffer, sizeof(buffer), pdMS_TO_TICKS(I2C_IMU_TIMEOUT_MS));
+}
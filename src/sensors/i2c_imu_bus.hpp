@@ -0,0 +1,21 @@
+#pragma once
+
+#include <driver/i2c.h>
+#include "imu_bus.hpp"
+
+#define I2C_IMU_TIMEOUT_MS 10
+
+class I2cImuBus : public ImuBus
+{
+private:
+    i2c_port_t port;
+    uint8_t address;
+
+public:
+    I2cImuBus(i2c_port_t port, uint8_t address);
+
+    static esp_err_t initPort(i2c_port_t port, int sda, int scl, uint32_t frequency);
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override;
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override;
+};
@@ -0,0 +1,381 @@
+#include "imu_acquisition.hpp"
+
+#include <string.h>
+#include <esp_log.h>
+#include "../utils/task_topology.hpp"
+#include "../utils/timing.hpp"
+
+static const char *TAG = "ImuAcquisition";
+
+ImuAcquisition::ImuAcquisition()
+{
+    memset(sensors, 0, sizeof(sensors));
+    sensorCount = 0;
+    for (uint8_t i = 0; i < ACQUISITION_MAX_BUSES; i++)
+    {
+        Lane &lane = lanes[i];
+        lane.owner = this;
+        lane.index = i;
+        lane.sensorCount = 0;
+        lane.task = nullptr;
+        lane.issued = 0;
+        lane.completed = 0;
+        lane.tickBusyTime = 0;
+        lane.tickReads = 0;
+        lane.tickErrors = 0;
+    }
+    caller = nullptr;
+    tickTime = 0;
+    tick = 0;
+    running = false;
+    statsStart = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+esp_err_t ImuAcquisition::addSensor(uint8_t id, Bmi160 &imu, uint8_t bus, uint8_t channel)
+{
+    if (this->running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (bus >= ACQUISITION_MAX_BUSES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < this->sensorCount; i++)
+    {
+        if (this->sensors[i].id == id)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (this->sensorCount >= ACQUISITION_MAX_SENSORS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    AcquisitionSensor &sensor = this->sensors[this->sensorCount++];
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.id = id;
+    sensor.bus = bus;
+    sensor.channel = channel;
+    sensor.imu = &imu;
+    return ESP_OK;
+}
+
+// Lanes run their sensors ordered by mux channel, so a channel is selected
+// once per tick however the sensors were registered. Direct devices go last,
+// they do not care which channel is selected.
+void ImuAcquisition::plan()
+{
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        Lane &lane = this->lanes[bus];
+        lane.sensorCount = 0;
+        for (size_t i = 0; i < this->sensorCount; i++)
+        {
+            if (this->sensors[i].bus != bus)
+            {
+                continue;
+            }
+            size_t position = lane.sensorCount++;
+            while (position > 0 && this->sensors[lane.order[position - 1]].channel > this->sensors[i].channel)
+            {
+                lane.order[position] = lane.order[position - 1];
+                position--;
+            }
+            lane.order[position] = (uint8_t)i;
+        }
+    }
+}
+
+esp_err_t ImuAcquisition::start()
+{
+    if (this->running)
+    {
+        return ESP_OK;
+    }
+    if (this->sensorCount == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    this->plan();
+    this->running = true;
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        Lane &lane = this->lanes[bus];
+        if (lane.sensorCount == 0)
+        {
+            continue;
+        }
+        lane.issued = this->tick;
+        lane.completed = this->tick;
+        if (createTask(TaskTopology::IMU_BUS[bus], laneLoop, &lane, &lane.task) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to create lane task for bus %d", bus);
+            this->stop();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    this->resetStats();
+    return ESP_OK;
+}
+
+void ImuAcquisition::stop()
+{
+    this->running = false;
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        if (this->lanes[bus].task != nullptr)
+        {
+            xTaskNotifyGive(this->lanes[bus].task);
+        }
+    }
+}
+
+bool ImuAcquisition::isRunning()
+{
+    return this->running;
+}
+
+size_t ImuAcquisition::getSensorCount()
+{
+    return this->sensorCount;
+}
+
+esp_err_t ImuAcquisition::acquire(int64_t tickTime, AcquiredSample *samples, size_t capacity, size_t *count)
+{
+    *count = 0;
+    if (!this->running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (capacity < this->sensorCount)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    this->tick++;
+    this->tickTime = tickTime;
+    this->caller = xTaskGetCurrentTaskHandle();
+
+    // A lane still busy from the last tick is skipped rather than queued, its
+    // sensors read again next tick and nothing piles up behind a slow bus
+    bool issued[ACQUISITION_MAX_BUSES] = {};
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        Lane &lane = this->lanes[bus];
+        if (lane.sensorCount == 0)
+        {
+            continue;
+        }
+        if (lane.completed.load(std::memory_order_acquire) != lane.issued.load(std::memory_order_relaxed))
+        {
+            this->stats.buses[bus].busySkips++;
+            continue;
+        }
+        lane.issued.store(this->tick, std::memory_order_release);
+        xTaskNotifyGive(lane.task);
+        issued[bus] = true;
+    }
+
+    esp_err_t res = ESP_OK;
+    int64_t deadline = micros64() + ACQUISITION_TIMEOUT_MS * 1000;
+    bool completed[ACQUISITION_MAX_BUSES] = {};
+    for (;;)
+    {
+        bool done = true;
+        for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+        {
+            completed[bus] = issued[bus] && this->lanes[bus].completed.load(std::memory_order_acquire) == this->tick;
+            done = done && (completed[bus] || !issued[bus]);
+        }
+        if (done)
+        {
+            break;
+        }
+        int64_t remaining = deadline - micros64();
+        if (remaining <= 0)
+        {
+            this->stats.timeouts++;
+            res = ESP_ERR_TIMEOUT;
+            break;
+        }
+        // Notifications of lanes that completed after an earlier timeout only cost a loop
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining / 1000) + 1);
+    }
+    int64_t latency = micros64() - tickTime;
+
+    int64_t firstRead = INT64_MAX;
+    int64_t lastRead = INT64_MIN;
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        if (!completed[bus])
+        {
+            continue;
+        }
+        Lane &lane = this->lanes[bus];
+        AcquisitionBusStats &busStats = this->stats.buses[bus];
+        busStats.reads += lane.tickReads;
+        busStats.errors += lane.tickErrors;
+        busStats.busyTime += lane.tickBusyTime;
+        if (lane.tickBusyTime > busStats.maxTickBusyTime)
+        {
+            busStats.maxTickBusyTime = lane.tickBusyTime;
+        }
+        for (size_t i = 0; i < lane.sensorCount; i++)
+        {
+            const AcquisitionSensor &sensor = this->sensors[lane.order[i]];
+            if (sensor.result != ESP_OK)
+            {
+                continue;
+            }
+            firstRead = sensor.readStart < firstRead ? sensor.readStart : firstRead;
+            lastRead = sensor.readStart > lastRead ? sensor.readStart : lastRead;
+        }
+    }
+
+    this->stats.ticks++;
+    this->stats.totalLatency += latency;
+    if (latency > this->stats.maxLatency)
+    {
+        this->stats.maxLatency = latency;
+    }
+    if (lastRead >= firstRead)
+    {
+        int64_t skew = lastRead - firstRead;
+        this->stats.totalSkew += skew;
+        if (skew > this->stats.maxSkew)
+        {
+            this->stats.maxSkew = skew;
+        }
+    }
+
+    for (size_t i = 0; i < this->sensorCount; i++)
+    {
+        AcquisitionSensor &sensor = this->sensors[i];
+        this->align(sensor, completed[sensor.bus] && sensor.result == ESP_OK, samples[i]);
+    }
+    *count = this->sensorCount;
+    return res;
+}
+
+void ImuAcquisition::align(AcquisitionSensor &sensor, bool fresh, AcquiredSample &out)
+{
+    out.id = sensor.id;
+    out.samples = fresh ? sensor.samples : nullptr;
+    out.sampleCount = fresh ? sensor.sampleCount : 0;
+    int64_t gap;
+    out.valid = alignSamples(this->tickTime, out.samples, out.sampleCount, &sensor.previous, &sensor.hasPrevious,
+                             &out.aligned, &gap);
+    if (out.valid && gap > this->stats.maxAlignmentGap)
+    {
+        this->stats.maxAlignmentGap = gap;
+    }
+}
+
+// Linear interpolation between the two samples around the tick timestamp.
+// The newest sample of the previous tick is kept so a tick that read nothing
+// new, or whose samples all lie after the timestamp, still has a left side.
+bool ImuAcquisition::alignSamples(int64_t tickTime, const ImuSample *samples, size_t count, ImuSample *previous,
+                                  bool *hasPrevious, ImuSample *aligned, int64_t *gap)
+{
+    const ImuSample *before = *hasPrevious ? previous : nullptr;
+    const ImuSample *after = nullptr;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (samples[i].timestamp >= tickTime)
+        {
+            after = &samples[i];
+            break;
+        }
+        before = &samples[i];
+    }
+    if (before == nullptr && after == nullptr)
+    {
+        return false;
+    }
+
+    if (before != nullptr && after != nullptr && after->timestamp > before->timestamp)
+    {
+        float t = (float)(tickTime - before->timestamp) / (float)(after->timestamp - before->timestamp);
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            aligned->acceleration[axis] = before->acceleration[axis] + t * (after->acceleration[axis] - before->acceleration[axis]);
+            aligned->angularVelocity[axis] = before->angularVelocity[axis] + t * (after->angularVelocity[axis] - before->angularVelocity[axis]);
+        }
+        int64_t left = tickTime - before->timestamp;
+        int64_t right = after->timestamp - tickTime;
+        *gap = left < right ? left : right;
+    }
+    else
+    {
+        const ImuSample *nearest = after != nullptr ? after : before;
+        *aligned = *nearest;
+        *gap = nearest->timestamp > tickTime ? nearest->timestamp - tickTime : tickTime - nearest->timestamp;
+    }
+    aligned->timestamp = tickTime;
+
+    if (count > 0)
+    {
+        *previous = samples[count - 1];
+        *hasPrevious = true;
+    }
+    return true;
+}
+
+void ImuAcquisition::readLane(Lane &lane)
+{
+    lane.tickBusyTime = 0;
+    lane.tickReads = 0;
+    lane.tickErrors = 0;
+    for (size_t i = 0; i < lane.sensorCount; i++)
+    {
+        AcquisitionSensor &sensor = this->sensors[lane.order[i]];
+        int64_t start = micros64();
+        sensor.readStart = start;
+        sensor.result = sensor.imu->readFifo(sensor.samples, ACQUISITION_FIFO_BATCH, &sensor.sampleCount, start);
+        lane.tickBusyTime += micros64() - start;
+        lane.tickReads++;
+        if (sensor.result != ESP_OK)
+        {
+            lane.tickErrors++;
+        }
+    }
+}
+
+void ImuAcquisition::laneLoop(void *arg)
+{
+    Lane &lane = *(Lane *)arg;
+    ImuAcquisition *owner = lane.owner;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!owner->running)
+        {
+            break;
+        }
+        owner->readLane(lane);
+        lane.completed.store(lane.issued.load(std::memory_order_acquire), std::memory_order_release);
+        xTaskNotifyGive(owner->caller);
+    }
+    lane.task = nullptr;
+    vTaskDelete(NULL);
+}
+
+AcquisitionStats ImuAcquisition::getStats()
+{
+    AcquisitionStats result = this->stats;
+    result.elapsed = micros64() - this->statsStart;
+    for (uint8_t bus = 0; bus < ACQUISITION_MAX_BUSES; bus++)
+    {
+        AcquisitionBusStats &busStats = result.buses[bus];
+        busStats.sensors = this->lanes[bus].sensorCount;
+        busStats.utilisation = result.elapsed > 0 ? (float)busStats.busyTime / result.elapsed : 0;
+    }
+    return result;
+}
+
+void ImuAcquisition::resetStats()
+{
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->statsStart = micros64();
+}
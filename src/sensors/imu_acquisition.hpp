@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "bmi160.hpp"
+#include "bus_mux.hpp"
+#include "imu_sample.hpp"
+
+// One lane per I2C controller of the ESP32
+#define ACQUISITION_MAX_BUSES 2
+#define ACQUISITION_MAX_SENSORS 8
+#define ACQUISITION_FIFO_BATCH 16
+#define ACQUISITION_TIMEOUT_MS 20
+
+struct AcquisitionSensor
+{
+    uint8_t id;
+    uint8_t bus;
+    uint8_t channel; // BUS_MUX_NO_CHANNEL when wired to the bus directly
+    Bmi160 *imu;
+    // Written by the lane task, read by acquire() once the lane completed
+    ImuSample samples[ACQUISITION_FIFO_BATCH];
+    size_t sampleCount;
+    esp_err_t result;
+    int64_t readStart;
+    // Only touched by acquire()
+    ImuSample previous;
+    bool hasPrevious;
+};
+
+struct AcquiredSample
+{
+    uint8_t id;
+    bool valid;        // false until the sensor delivered its first sample
+    ImuSample aligned; // interpolated to the tick timestamp
+    // Every sample read this tick, valid until the next acquire()
+    const ImuSample *samples;
+    size_t sampleCount;
+};
+
+struct AcquisitionBusStats
+{
+    uint32_t sensors;
+    uint32_t reads;
+    uint32_t errors;
+    uint32_t busySkips;   // ticks the lane was still busy with the previous one
+    int64_t busyTime;     // us spent in bus transactions
+    int64_t maxTickBusyTime;
+    float utilisation;    // busyTime over the time since the stats were reset
+};
+
+struct AcquisitionStats
+{
+    uint32_t ticks;
+    uint32_t timeouts;
+    int64_t elapsed;
+    int64_t totalLatency; // tick start until the last lane finished
+    int64_t maxLatency;
+    int64_t totalSkew;    // spread of the read times within a tick
+    int64_t maxSkew;
+    int64_t maxAlignmentGap; // distance to the nearest real sample
+    AcquisitionBusStats buses[ACQUISITION_MAX_BUSES];
+};
+
+// Reads every IMU once per tick with both I2C controllers working at the same
+// time. Each bus gets its own lane task that runs its sensors back to back,
+// grouped by mux channel so every channel is selected once per tick, while
+// acquire() waits for all lanes and then interpolates every sensor to the
+// tick timestamp, so the samples of a tick line up no matter which lane or
+// position in the lane read them.
+class ImuAcquisition
+{
+private:
+    struct Lane
+    {
+        ImuAcquisition *owner;
+        uint8_t index;
+        uint8_t order[ACQUISITION_MAX_SENSORS];
+        size_t sensorCount;
+        TaskHandle_t task;
+        std::atomic<uint32_t> issued;
+        std::atomic<uint32_t> completed;
+        int64_t tickBusyTime;
+        uint32_t tickReads;
+        uint32_t tickErrors;
+    };
+
+    AcquisitionSensor sensors[ACQUISITION_MAX_SENSORS];
+    size_t sensorCount;
+    Lane lanes[ACQUISITION_MAX_BUSES];
+    TaskHandle_t caller;
+    int64_t tickTime;
+    uint32_t tick;
+    volatile bool running;
+    int64_t statsStart;
+    AcquisitionStats stats;
+
+public:
+    ImuAcquisition();
+
+    // bus is the lane (I2C controller), channel the mux channel if any
+    esp_err_t addSensor(uint8_t id, Bmi160 &imu, uint8_t bus, uint8_t channel = BUS_MUX_NO_CHANNEL);
+    esp_err_t start();
+    void stop();
+    bool isRunning();
+    size_t getSensorCount();
+
+    // Reads all lanes for the tick that started at tickTime and fills one
+    // entry per sensor. A lane that misses ACQUISITION_TIMEOUT_MS returns
+    // ESP_ERR_TIMEOUT, its sensors hold their previous sample.
+    esp_err_t acquire(int64_t tickTime, AcquiredSample *samples, size_t capacity, size_t *count);
+
+    AcquisitionStats getStats();
+    void resetStats();
+
+    // What acquire() does for one sensor, for replays of recorded samples.
+    // Interpolates samples to tickTime, previous is the newest sample of an
+    // earlier tick and moves on to the newest of these. false while there is
+    // no sample at all, gap is the distance to the nearest real sample.
+    static bool alignSamples(int64_t tickTime, const ImuSample *samples, size_t count, ImuSample *previous,
+                             bool *hasPrevious, ImuSample *aligned, int64_t *gap);
+
+private:
+    void plan();
+    void readLane(Lane &lane);
+    void align(AcquisitionSensor &sensor, bool fresh, AcquiredSample &out);
+    static void laneLoop(void *arg);
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+// Register level access to an IMU. A read of length bytes is a single bus
+// transaction starting at reg, the device auto-increments the address or,
+// for FIFO data registers, keeps popping the FIFO.
+class ImuBus
+{
+public:
+    virtual ~ImuBus() {}
+
+    virtual esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) = 0;
+    virtual esp_err_t writeRegister(uint8_t reg, uint8_t value) = 0;
+};
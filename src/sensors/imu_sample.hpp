@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+struct ImuSample
+{
+    int64_t timestamp;        // us
+    float acceleration[3];    // m/s^2
+    float angularVelocity[3]; // rad/s
+};
@@ -0,0 +1,93 @@
+#include "spi_imu_bus.hpp"
+
+#include <string.h>
+#include <esp_heap_caps.h>
+
+#define SPI_IMU_READ_FLAG 0x80
+
+SpiImuBus::SpiImuBus()
+{
+    device = NULL;
+    txBuffer = NULL;
+    rxBuffer = NULL;
+}
+
+SpiImuBus::~SpiImuBus()
+{
+    if (device != NULL)
+    {
+        spi_bus_remove_device(device);
+    }
+    heap_caps_free(txBuffer);
+    heap_caps_free(rxBuffer);
+}
+
+// Transfers above 64 bytes need DMA, let the driver pick a channel
+esp_err_t SpiImuBus::initHost(spi_host_device_t host, int mosi, int miso, int sclk)
+{
+    spi_bus_config_t config = {};
+    config.mosi_io_num = mosi;
+    config.miso_io_num = miso;
+    config.sclk_io_num = sclk;
+    config.quadwp_io_num = -1;
+    config.quadhd_io_num = -1;
+    config.max_transfer_sz = SPI_IMU_MAX_TRANSFER;
+    return spi_bus_initialize(host, &config, SPI_DMA_CH_AUTO);
+}
+
+esp_err_t SpiImuBus::init(spi_host_device_t host, int cs, int clockHz)
+{
+    this->txBuffer = (uint8_t *)heap_caps_malloc(SPI_IMU_MAX_TRANSFER, MALLOC_CAP_DMA);
+    this->rxBuffer = (uint8_t *)heap_caps_malloc(SPI_IMU_MAX_TRANSFER, MALLOC_CAP_DMA);
+    if (this->txBuffer == NULL || this->rxBuffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(this->txBuffer, 0, SPI_IMU_MAX_TRANSFER);
+
+    spi_device_interface_config_t config = {};
+    config.mode = 0;
+    config.clock_speed_hz = clockHz;
+    config.spics_io_num = cs;
+    config.queue_size = 1;
+    esp_err_t res = spi_bus_add_device(host, &config, &this->device);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    // IMUs that power up in I2C mode (BMI160) switch to SPI on the first CS edge
+    uint8_t dummy;
+    return this->readRegisters(0x7F, &dummy, 1);
+}
+
+// The address byte and the burst share one DMA transaction, the data is copied
+// out of the DMA buffer afterwards.
+esp_err_t SpiImuBus::readRegisters(uint8_t reg, uint8_t *data, size_t length)
+{
+    if (length + 1 > SPI_IMU_MAX_TRANSFER)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    this->txBuffer[0] = reg | SPI_IMU_READ_FLAG;
+    spi_transaction_t transaction = {};
+    transaction.length = (length + 1) * 8;
+    transaction.tx_buffer = this->txBuffer;
+    transaction.rx_buffer = this->rxBuffer;
+    esp_err_t res = spi_device_transmit(this->device, &transaction);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    memcpy(data, this->rxBuffer + 1, length);
+    return ESP_OK;
+}
+
+esp_err_t SpiImuBus::writeRegister(uint8_t reg, uint8_t value)
+{
+    spi_transaction_t transaction = {};
+    transaction.flags = SPI_TRANS_USE_TXDATA;
+    transaction.length = 16;
+    transaction.tx_data[0] = reg & ~SPI_IMU_READ_FLAG;
+    transaction.tx_data[1] = value;
+    return spi_device_polling_transmit(this->device, &transaction);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <driver/spi_master.h>
+#include "imu_bus.hpp"
+
+// Largest burst plus the address byte, a full BMI160 FIFO
+#define SPI_IMU_MAX_TRANSFER (1024 + 4)
+
+class SpiImuBus : public ImuBus
+{
+private:
+    spi_device_handle_t device;
+    uint8_t *txBuffer;
+    uint8_t *rxBuffer;
+
+public:
+    SpiImuBus();
+    ~SpiImuBus();
+
+    static esp_err_t initHost(spi_host_device_t host, int mosi, int miso, int sclk);
+    esp_err_t init(spi_host_device_t host, int cs, int clockHz);
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override;
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override;
+};
@@ -0,0 +1,20 @@
+#include "tca9548a.hpp"
+
+#include <freertos/FreeRTOS.h>
+#include "i2c_imu_bus.hpp"
+
+Tca9548a::Tca9548a(i2c_port_t port, uint8_t address)
+{
+    this->port = port;
+    this->address = address;
+}
+
+i2c_port_t Tca9548a::getPort()
+{
+    return this->port;
+}
+
+esp_err_t Tca9548a::writeChannelMask(uint8_t mask)
+{
+    return i2c_master_write_to_device(this->port, this->address, &mask, 1, pdMS_TO_TICKS(I2C_IMU_TIMEOUT_MS));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <driver/i2c.h>
+#include "bus_mux.hpp"
+
+#define TCA9548A_I2C_ADDRESS 0x70
+
+// 8 channel I2C switch. The control register is the only register, a single
+// byte write sets which downstream channels are connected.
+class Tca9548a : public BusMux
+{
+private:
+    i2c_port_t port;
+    uint8_t address;
+
+public:
+    Tca9548a(i2c_port_t port, uint8_t address = TCA9548A_I2C_ADDRESS);
+
+    i2c_port_t getPort();
+
+protected:
+    esp_err_t writeChannelMask(uint8_t mask) override;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <esp_err.h>
+#include "imu_bus.hpp"
+
+// Prints the first accesses to a device as R/W lines of the register trace
+// format imu_replay reads, "R <reg> <bytes...>" and "W <reg> <value>" in hex.
+// Failed accesses are not printed, the driver does not see their bytes
+// either. Goes silent once the budget is spent, the tail of the capture may
+// end inside a FIFO burst.
+class TracingImuBus : public ImuBus
+{
+private:
+    ImuBus &device;
+    uint32_t remaining;
+
+public:
+    TracingImuBus(ImuBus &device) : device(device), remaining(0) {}
+
+    // Traces the next accesses, 0 stops tracing
+    void trace(uint32_t accesses)
+    {
+        this->remaining = accesses;
+    }
+
+    esp_err_t readRegisters(uint8_t reg, uint8_t *data, size_t length) override
+    {
+        esp_err_t res = this->device.readRegisters(reg, data, length);
+        if (res == ESP_OK && this->remaining > 0)
+        {
+            this->remaining--;
+            printf("R %02X", reg);
+            for (size_t i = 0; i < length; i++)
+            {
+                printf(" %02X", data[i]);
+            }
+            printf("\n");
+        }
+        return res;
+    }
+
+    esp_err_t writeRegister(uint8_t reg, uint8_t value) override
+    {
+        esp_err_t res = this->device.writeRegister(reg, value);
+        if (res == ESP_OK && this->remaining > 0)
+        {
+            this->remaining--;
+            printf("W %02X %02X\n", reg, value);
+        }
+        return res;
+    }
+};
@@ -0,0 +1,131 @@
+#include "config_blob.hpp"
+
+#include <string.h>
+
+// Reflected CRC-32 (IEEE 802.3), bitwise. The blob is checked once at boot
+// and once per write, not worth a lookup table.
+uint32_t configCrc(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Fix-ups for fields whose meaning changed between versions. Appended fields
+// need nothing here, they already hold their defaults.
+//   1 -> 2: appended NetworkCache, starts out invalid
+//   2 -> 3: appended PowerSettings, starts out with the Kconfig defaults
+//   3 -> 4: appended defaultsCrc, starts out as 0 so the Kconfig defaults of
+//           the build are applied once
+static void migrate(StoredConfig *config, uint16_t fromVersion)
+{
+    (void)config;
+    (void)fromVersion;
+}
+
+uint32_t configDefaultsCrc(const StoredConfig &defaults)
+{
+    uint8_t fields[sizeof(WifiSettings) + sizeof(StreamSettings) + sizeof(PowerSettings)];
+    memcpy(fields, &defaults.wifi, sizeof(WifiSettings));
+    memcpy(fields + sizeof(WifiSettings), &defaults.stream, sizeof(StreamSettings));
+    memcpy(fields + sizeof(WifiSettings) + sizeof(StreamSettings), &defaults.power, sizeof(PowerSettings));
+    return configCrc(fields, sizeof(fields));
+}
+
+static ConfigLoadResult decodeBlob(const uint8_t *blob, size_t size, StoredConfig *config)
+{
+    if (blob == nullptr || size == 0)
+    {
+        return CONFIG_DEFAULTS;
+    }
+    ConfigHeader header;
+    if (size < sizeof(header))
+    {
+        return CONFIG_CORRUPT;
+    }
+    memcpy(&header, blob, sizeof(header));
+    const uint8_t *payload = blob + sizeof(header);
+    if (header.magic != CONFIG_MAGIC || header.version == 0 || header.size != size - sizeof(header) ||
+        configCrc(payload, header.size) != header.crc)
+    {
+        return CONFIG_CORRUPT;
+    }
+
+    // A newer version only appended fields, its prefix is still readable
+    memcpy(config, payload, header.size < sizeof(StoredConfig) ? header.size : sizeof(StoredConfig));
+    config->wifi.ssid[CONFIG_SSID_SIZE - 1] = '\0';
+    config->wifi.password[CONFIG_PASSWORD_SIZE - 1] = '\0';
+    if (header.version == CONFIG_VERSION && header.size == sizeof(StoredConfig))
+    {
+        return CONFIG_LOADED;
+    }
+    if (header.version < CONFIG_VERSION)
+    {
+        migrate(config, header.version);
+    }
+    return CONFIG_MIGRATED;
+}
+
+ConfigLoadResult configDecode(const uint8_t *blob, size_t size, const StoredConfig &defaults, StoredConfig *config)
+{
+    memcpy(config, &defaults, sizeof(StoredConfig));
+    // Blobs before version 4 do not have it, 0 makes them take the build's defaults
+    config->defaultsCrc = 0;
+    ConfigLoadResult result = decodeBlob(blob, size, config);
+
+    uint32_t defaultsCrc = configDefaultsCrc(defaults);
+    if (config->defaultsCrc == defaultsCrc)
+    {
+        return result;
+    }
+    if (defaults.wifi.ssid[0] != '\0')
+    {
+        config->wifi = defaults.wifi;
+    }
+    config->stream = defaults.stream;
+    config->power = defaults.power;
+    config->defaultsCrc = defaultsCrc;
+    return result == CONFIG_LOADED || result == CONFIG_MIGRATED ? CONFIG_NEW_DEFAULTS : result;
+}
+
+size_t configEncode(const StoredConfig &config, uint8_t *blob, size_t capacity)
+{
+    if (capacity < sizeof(ConfigHeader) + sizeof(StoredConfig))
+    {
+        return 0;
+    }
+    ConfigHeader header;
+    header.magic = CONFIG_MAGIC;
+    header.version = CONFIG_VERSION;
+    header.size = sizeof(StoredConfig);
+    header.crc = configCrc((const uint8_t *)&config, sizeof(StoredConfig));
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &config, sizeof(StoredConfig));
+    return sizeof(header) + sizeof(StoredConfig);
+}
+
+const char *configLoadResultName(ConfigLoadResult result)
+{
+    switch (result)
+    {
+    case CONFIG_LOADED:
+        return "LOADED";
+    case CONFIG_MIGRATED:
+        return "MIGRATED";
+    case CONFIG_DEFAULTS:
+        return "DEFAULTS";
+    case CONFIG_CORRUPT:
+        return "CORRUPT";
+    case CONFIG_NEW_DEFAULTS:
+        return "NEW_DEFAULTS";
+    default:
+        return "UNKNOWN";
+    }
+}
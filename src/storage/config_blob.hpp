@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CONFIG_MAGIC 0x464D4C53 // "SLMF"
+#define CONFIG_VERSION 4
+#define CONFIG_MAX_SENSORS 8
+#define CONFIG_SSID_SIZE 33
+#define CONFIG_PASSWORD_SIZE 65
+// Largest blob load() accepts, leaves room for fields added by newer firmware
+#define CONFIG_BLOB_MAX_SIZE 1024
+
+// The whole configuration is stored as one NVS blob: this header followed by
+// StoredConfig as it is laid out in memory. Fields are only ever appended, so
+// the payload of an older version is a prefix of the current one.
+struct ConfigHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size; // payload bytes after the header
+    uint32_t crc;  // CRC-32 of the payload
+};
+
+struct WifiSettings
+{
+    char ssid[CONFIG_SSID_SIZE];
+    char password[CONFIG_PASSWORD_SIZE];
+};
+
+struct ServerSettings
+{
+    uint8_t valid;
+    uint16_t port;
+    uint32_t address; // IPv4, network byte order
+};
+
+struct StreamSettings
+{
+    uint32_t sendPeriod; // us
+    float minRate;       // packets/s the rate controller never goes below
+    float accelerationThreshold;
+    float angleThreshold;
+    uint32_t keyframePeriod; // us
+    uint8_t bundle;
+    uint8_t compactRotation;
+};
+
+struct SensorCalibration
+{
+    uint8_t valid;
+    float gyroBias[3]; // rad/s
+};
+
+// Access point of the last connection, for the fast connect at boot
+struct NetworkCache
+{
+    uint8_t valid;
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+// Modem sleep with beacon aligned bursts, off keeps the radio awake
+struct PowerSettings
+{
+    uint8_t powerSave;
+    uint8_t listenInterval; // beacons between wakeups
+    uint32_t latencyBudget; // us
+};
+
+struct StoredConfig
+{
+    WifiSettings wifi;
+    ServerSettings server;
+    StreamSettings stream;
+    SensorCalibration calibration[CONFIG_MAX_SENSORS];
+    // Version 2
+    NetworkCache network;
+    // Version 3
+    PowerSettings power;
+    // Version 4
+    uint32_t defaultsCrc; // configDefaultsCrc() of the build this was last adjusted to
+};
+
+static_assert(sizeof(ConfigHeader) + sizeof(StoredConfig) <= CONFIG_BLOB_MAX_SIZE, "Config blob too large");
+
+enum ConfigLoadResult
+{
+    CONFIG_LOADED,
+    CONFIG_MIGRATED, // written by another version, the rest came from the defaults
+    CONFIG_DEFAULTS, // nothing stored yet
+    CONFIG_CORRUPT,  // stored blob failed the checks, defaults used
+    CONFIG_NEW_DEFAULTS, // built with other Kconfig defaults, those were applied
+};
+
+uint32_t configCrc(const uint8_t *data, size_t size);
+
+// CRC of the fields a build sets from Kconfig: Wi-Fi, stream and power
+uint32_t configDefaultsCrc(const StoredConfig &defaults);
+
+// Builds config from a stored blob, starting from defaults. Fields a blob of
+// an older version does not have keep their default value. When the blob was
+// written by a build with other Kconfig defaults, the new stream and power
+// settings replace the stored ones, and so do the credentials unless the new
+// SSID is empty. Stored values only win until the defaults change again.
+ConfigLoadResult configDecode(const uint8_t *blob, size_t size, const StoredConfig &defaults, StoredConfig *config);
+
+// Returns the blob size, 0 if capacity is too small
+size_t configEncode(const StoredConfig &config, uint8_t *blob, size_t capacity);
+
+const char *configLoadResultName(ConfigLoadResult result);
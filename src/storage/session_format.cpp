@@ -0,0 +1,464 @@
+#include "session_format.hpp"
+
+#include <math.h>
+#include <string.h>
+#include "config_blob.hpp"
+
+#define SESSION_TAG(kind, low) (uint8_t)((kind) << 4 | ((low) & 0x0F))
+
+// Bounds checked appends, a record that runs past the end leaves overflow set
+// and nothing is committed
+struct SessionWriter
+{
+    uint8_t *position;
+    uint8_t *end;
+    bool overflow;
+
+    void byte(uint8_t value)
+    {
+        if (this->position >= this->end)
+        {
+            this->overflow = true;
+            return;
+        }
+        *this->position++ = value;
+    }
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            this->byte((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        this->byte((uint8_t)value);
+    }
+
+    // Small magnitudes of either sign take few bytes
+    void zigzag(int64_t value)
+    {
+        this->varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+    void raw(const void *data, size_t size)
+    {
+        const uint8_t *bytes = (const uint8_t *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            this->byte(bytes[i]);
+        }
+    }
+};
+
+struct SessionReader
+{
+    const uint8_t *position;
+    const uint8_t *end;
+    bool overflow;
+
+    uint8_t byte()
+    {
+        if (this->position >= this->end)
+        {
+            this->overflow = true;
+            return 0;
+        }
+        return *this->position++;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t next = this->byte();
+            value |= (uint64_t)(next & 0x7F) << shift;
+            if ((next & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        this->overflow = true;
+        return value;
+    }
+
+    int64_t zigzag()
+    {
+        uint64_t value = this->varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    void raw(void *data, size_t size)
+    {
+        uint8_t *bytes = (uint8_t *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            bytes[i] = this->byte();
+        }
+    }
+};
+
+void SessionDeltaState::reset(int64_t baseTime)
+{
+    for (size_t id = 0; id <= SESSION_MAX_SENSOR_ID; id++)
+    {
+        this->sampleTime[id] = baseTime;
+        this->samplePeriod[id] = 0;
+        memset(this->sampleValues[id], 0, sizeof(this->sampleValues[id]));
+    }
+    this->tickTime = baseTime;
+    this->packetTime = baseTime;
+    this->packetNumber = 0;
+}
+
+int16_t sessionQuantize(float value, float scale)
+{
+    long raw = scale > 0.0f ? lroundf(value / scale) : 0;
+    return (int16_t)(raw > INT16_MAX ? INT16_MAX : raw < INT16_MIN ? INT16_MIN : raw);
+}
+
+void sessionQuantize(const ImuSample &sample, float accelerationScale, float angularVelocityScale, SessionRawSample *raw)
+{
+    raw->timestamp = sample.timestamp;
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        raw->values[axis] = sessionQuantize(sample.angularVelocity[axis], angularVelocityScale);
+        raw->values[3 + axis] = sessionQuantize(sample.acceleration[axis], accelerationScale);
+    }
+}
+
+// Same expression as Bmi160::readFifo(), int16 times the float scale
+void sessionDequantize(const SessionRawSample &raw, float accelerationScale, float angularVelocityScale, ImuSample *sample)
+{
+    sample->timestamp = raw.timestamp;
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        sample->angularVelocity[axis] = raw.values[axis] * angularVelocityScale;
+        sample->acceleration[axis] = raw.values[3 + axis] * accelerationScale;
+    }
+}
+
+void sessionDescribePacket(const unsigned char *data, size_t size, SessionPacketInfo *info)
+{
+    info->type = 0;
+    info->number = 0;
+    info->size = (uint16_t)size;
+    size_t headerSize = 0;
+    if (size >= SESSION_PACKET_HEADER_SIZE)
+    {
+        for (size_t i = 0; i < 4; i++)
+        {
+            info->type = info->type << 8 | data[i];
+        }
+        for (size_t i = 4; i < SESSION_PACKET_HEADER_SIZE; i++)
+        {
+            info->number = info->number << 8 | data[i];
+        }
+        headerSize = SESSION_PACKET_HEADER_SIZE;
+    }
+    info->crc = configCrc(data + headerSize, size - headerSize);
+}
+
+SessionEncoder::SessionEncoder()
+{
+    this->block = nullptr;
+    this->used = 0;
+    memset(&this->header, 0, sizeof(this->header));
+    this->state.reset(0);
+}
+
+void SessionEncoder::begin(uint8_t *block, uint32_t session, uint32_t sequence, int64_t baseTime)
+{
+    this->block = block;
+    this->used = sizeof(SessionBlockHeader);
+    memset(&this->header, 0, sizeof(this->header));
+    this->header.magic = SESSION_MAGIC;
+    this->header.session = session;
+    this->header.sequence = sequence;
+    this->header.version = SESSION_VERSION;
+    this->header.baseTime = baseTime;
+    this->state.reset(baseTime);
+}
+
+void SessionEncoder::close()
+{
+    this->header.size = (uint16_t)(this->used - sizeof(SessionBlockHeader));
+    this->header.crc = 0;
+    memcpy(this->block, &this->header, sizeof(this->header));
+}
+
+void sessionSealBlock(uint8_t *block)
+{
+    SessionBlockHeader header;
+    memcpy(&header, block, sizeof(header));
+    size_t used = sizeof(SessionBlockHeader) + header.size;
+    header.crc = configCrc(block + sizeof(SessionBlockHeader), header.size);
+    memcpy(block, &header, sizeof(header));
+    // Erased flash past the records, like the rest of the partition
+    memset(block + used, 0xFF, SESSION_BLOCK_SIZE - used);
+}
+
+bool SessionEncoder::isEmpty()
+{
+    return this->used == sizeof(SessionBlockHeader);
+}
+
+size_t SessionEncoder::getUsed()
+{
+    return this->used;
+}
+
+static SessionWriter openWriter(uint8_t *block, size_t used)
+{
+    SessionWriter writer;
+    writer.position = block + used;
+    writer.end = block + SESSION_BLOCK_SIZE;
+    writer.overflow = false;
+    return writer;
+}
+
+esp_err_t SessionEncoder::putStream(const SessionStream &stream)
+{
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_STREAM, 0));
+    writer.byte((stream.bundle ? 1 : 0) | (stream.compactRotation ? 2 : 0));
+    writer.raw(&stream.accelerationThreshold, sizeof(float));
+    writer.raw(&stream.angleThreshold, sizeof(float));
+    writer.varint((uint64_t)stream.keyframePeriod);
+    writer.varint(stream.sensorMask);
+    writer.raw(&stream.standInSeed, sizeof(uint32_t));
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    return ESP_OK;
+}
+
+esp_err_t SessionEncoder::putSensor(const SessionSensor &sensor)
+{
+    if (sensor.id > SESSION_MAX_SENSOR_ID)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_SENSOR, sensor.id));
+    writer.raw(&sensor.accelerationScale, sizeof(float));
+    writer.raw(&sensor.angularVelocityScale, sizeof(float));
+    writer.raw(sensor.gyroBias, sizeof(sensor.gyroBias));
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    return ESP_OK;
+}
+
+esp_err_t SessionEncoder::putSamples(uint8_t id, const SessionRawSample *samples, size_t count)
+{
+    if (id > SESSION_MAX_SENSOR_ID || count > SESSION_MAX_BURST)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_SAMPLES, id));
+    writer.varint(count);
+    int64_t time = this->state.sampleTime[id];
+    int64_t period = this->state.samplePeriod[id];
+    int16_t values[6];
+    memcpy(values, this->state.sampleValues[id], sizeof(values));
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t nextPeriod = samples[i].timestamp - time;
+        writer.zigzag(nextPeriod - period);
+        period = nextPeriod;
+        time = samples[i].timestamp;
+        for (size_t axis = 0; axis < 6; axis++)
+        {
+            writer.zigzag((int32_t)samples[i].values[axis] - values[axis]);
+            values[axis] = samples[i].values[axis];
+        }
+    }
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    this->state.sampleTime[id] = time;
+    this->state.samplePeriod[id] = period;
+    memcpy(this->state.sampleValues[id], values, sizeof(values));
+    return ESP_OK;
+}
+
+esp_err_t SessionEncoder::putTick(int64_t time)
+{
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_TICK, 0));
+    writer.zigzag(time - this->state.tickTime);
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    this->state.tickTime = time;
+    return ESP_OK;
+}
+
+// The frame is usually one of the last few ticks and is sent soon after it
+esp_err_t SessionEncoder::putSend(int64_t frameTime, int64_t time, SessionSendResult result)
+{
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_SEND, result));
+    writer.zigzag(frameTime - this->state.tickTime);
+    writer.zigzag(time - frameTime);
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    return ESP_OK;
+}
+
+esp_err_t SessionEncoder::putPacket(int64_t time, const SessionPacketInfo &packet)
+{
+    SessionWriter writer = openWriter(this->block, this->used);
+    writer.byte(SESSION_TAG(SESSION_RECORD_PACKET, 0));
+    writer.zigzag(time - this->state.packetTime);
+    writer.varint(packet.type);
+    writer.zigzag((int64_t)(packet.number - this->state.packetNumber));
+    writer.varint(packet.size);
+    writer.raw(&packet.crc, sizeof(packet.crc));
+    if (writer.overflow)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    this->used = writer.position - this->block;
+    this->state.packetTime = time;
+    this->state.packetNumber = packet.number;
+    return ESP_OK;
+}
+
+SessionDecoder::SessionDecoder()
+{
+    this->records = nullptr;
+    this->size = 0;
+    this->offset = 0;
+    memset(&this->header, 0, sizeof(this->header));
+    this->state.reset(0);
+}
+
+esp_err_t SessionDecoder::open(const uint8_t *block, uint32_t session, uint32_t sequence)
+{
+    memcpy(&this->header, block, sizeof(this->header));
+    if (this->header.magic != SESSION_MAGIC || (session != 0 && this->header.session != session) ||
+        this->header.sequence != sequence)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (this->header.version != SESSION_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (this->header.size > SESSION_BLOCK_SIZE - sizeof(SessionBlockHeader) ||
+        configCrc(block + sizeof(SessionBlockHeader), this->header.size) != this->header.crc)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+    this->records = block + sizeof(SessionBlockHeader);
+    this->size = this->header.size;
+    this->offset = 0;
+    this->state.reset(this->header.baseTime);
+    return ESP_OK;
+}
+
+const SessionBlockHeader &SessionDecoder::getHeader()
+{
+    return this->header;
+}
+
+esp_err_t SessionDecoder::next(SessionRecord *record)
+{
+    if (this->offset >= this->size)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    SessionReader reader;
+    reader.position = this->records + this->offset;
+    reader.end = this->records + this->size;
+    reader.overflow = false;
+    uint8_t tag = reader.byte();
+    uint8_t low = tag & 0x0F;
+    record->kind = (SessionRecordKind)(tag >> 4);
+    switch (record->kind)
+    {
+    case SESSION_RECORD_STREAM:
+    {
+        uint8_t flags = reader.byte();
+        record->stream.bundle = (flags & 1) != 0;
+        record->stream.compactRotation = (flags & 2) != 0;
+        reader.raw(&record->stream.accelerationThreshold, sizeof(float));
+        reader.raw(&record->stream.angleThreshold, sizeof(float));
+        record->stream.keyframePeriod = (int64_t)reader.varint();
+        record->stream.sensorMask = (uint16_t)reader.varint();
+        reader.raw(&record->stream.standInSeed, sizeof(uint32_t));
+        break;
+    }
+    case SESSION_RECORD_SENSOR:
+        record->sensorId = low;
+        record->sensor.id = low;
+        reader.raw(&record->sensor.accelerationScale, sizeof(float));
+        reader.raw(&record->sensor.angularVelocityScale, sizeof(float));
+        reader.raw(record->sensor.gyroBias, sizeof(record->sensor.gyroBias));
+        break;
+    case SESSION_RECORD_SAMPLES:
+    {
+        record->sensorId = low;
+        record->sampleCount = reader.varint();
+        if (record->sampleCount > SESSION_MAX_BURST)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        int64_t &time = this->state.sampleTime[low];
+        int64_t &period = this->state.samplePeriod[low];
+        int16_t *values = this->state.sampleValues[low];
+        for (size_t i = 0; i < record->sampleCount; i++)
+        {
+            period += reader.zigzag();
+            time += period;
+            record->samples[i].timestamp = time;
+            for (size_t axis = 0; axis < 6; axis++)
+            {
+                values[axis] = (int16_t)(values[axis] + reader.zigzag());
+                record->samples[i].values[axis] = values[axis];
+            }
+        }
+        break;
+    }
+    case SESSION_RECORD_TICK:
+        this->state.tickTime += reader.zigzag();
+        record->time = this->state.tickTime;
+        break;
+    case SESSION_RECORD_SEND:
+        record->result = (SessionSendResult)low;
+        record->frameTime = this->state.tickTime + reader.zigzag();
+        record->time = record->frameTime + reader.zigzag();
+        break;
+    case SESSION_RECORD_PACKET:
+        this->state.packetTime += reader.zigzag();
+        record->time = this->state.packetTime;
+        record->packet.type = (uint32_t)reader.varint();
+        this->state.packetNumber += (uint64_t)reader.zigzag();
+        record->packet.number = this->state.packetNumber;
+        record->packet.size = (uint16_t)reader.varint();
+        reader.raw(&record->packet.crc, sizeof(record->packet.crc));
+        break;
+    default:
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (reader.overflow)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    this->offset = reader.position - this->records;
+    return ESP_OK;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "../sensors/imu_sample.hpp"
+
+#define SESSION_MAGIC 0x53534C53 // "SLSS"
+#define SESSION_VERSION 1
+// One block per flash sector, each is erased and written in one go
+#define SESSION_BLOCK_SIZE 4096
+// Sensor ids share the tag byte with the record kind
+#define SESSION_MAX_SENSOR_ID 15
+// Largest FIFO burst one record holds, ACQUISITION_FIFO_BATCH on the device
+#define SESSION_MAX_BURST 16
+// Bytes of a packet covered by its CRC start after the type and packet number,
+// the number of a replayed packet depends on everything else the client sent
+#define SESSION_PACKET_HEADER_SIZE 12
+
+// A recorded session is a run of blocks, each this header followed by records.
+// Records start with a tag byte, the kind in the high nibble and a sensor id
+// or send result in the low one. Times and raw IMU values are stored as
+// zigzag varint deltas to the previous record of the same kind (and sensor),
+// sample timestamps as the change of the sample period, which is 0 for every
+// sample of a FIFO burst but the first. The delta state starts over with
+// every block, so the header's baseTime is the reference of its first times.
+struct SessionBlockHeader
+{
+    uint32_t magic;
+    uint32_t session;  // random per recording, blocks left by an older one end the session
+    uint32_t sequence; // index of the block within the session
+    uint16_t version;
+    uint16_t size; // record bytes after the header
+    uint32_t crc;  // CRC-32 of the records
+    uint32_t reserved;
+    int64_t baseTime; // us
+};
+
+enum SessionRecordKind : uint8_t
+{
+    SESSION_RECORD_STREAM = 1,  // client settings, first record of a session
+    SESSION_RECORD_SENSOR = 2,  // IMU scales and the gyro bias fusion starts from
+    SESSION_RECORD_SAMPLES = 3, // one FIFO burst of a sensor as raw int16 values
+    SESSION_RECORD_TICK = 4,    // sampling tick, takes the samples recorded since the last one
+    SESSION_RECORD_SEND = 5,    // frame handed to the client and what came of it
+    SESSION_RECORD_PACKET = 6,  // outbound datagram, size and CRC only
+};
+
+enum SessionSendResult : uint8_t
+{
+    SESSION_SEND_SENT = 0, // or nothing was due
+    SESSION_SEND_THROTTLED = 1,
+    SESSION_SEND_FAILED = 2,
+};
+
+struct SessionStream
+{
+    bool bundle;
+    bool compactRotation;
+    float accelerationThreshold;
+    float angleThreshold;
+    int64_t keyframePeriod;
+    uint16_t sensorMask;  // sensor ids of every frame, bit n for id n
+    uint32_t standInSeed; // xorshift state of the stand-in values at the first tick
+};
+
+struct SessionSensor
+{
+    uint8_t id;
+    float accelerationScale;    // m/s^2 per LSB
+    float angularVelocityScale; // rad/s per LSB
+    float gyroBias[3];
+};
+
+// Gyroscope x, y, z then accelerometer x, y, z, the order of a BMI160 frame
+struct SessionRawSample
+{
+    int64_t timestamp;
+    int16_t values[6];
+};
+
+// What a PACKET record keeps of a datagram
+struct SessionPacketInfo
+{
+    uint32_t type;
+    uint64_t number;
+    uint16_t size;
+    uint32_t crc; // of the bytes after SESSION_PACKET_HEADER_SIZE
+};
+
+struct SessionRecord
+{
+    SessionRecordKind kind;
+    uint8_t sensorId; // SENSOR and SAMPLES
+    int64_t time;     // TICK, SEND and PACKET
+    SessionStream stream;
+    SessionSensor sensor;
+    size_t sampleCount;
+    SessionRawSample samples[SESSION_MAX_BURST];
+    int64_t frameTime; // SEND, timestamp of the frame
+    SessionSendResult result;
+    SessionPacketInfo packet;
+};
+
+struct SessionDeltaState
+{
+    int64_t sampleTime[SESSION_MAX_SENSOR_ID + 1];
+    int64_t samplePeriod[SESSION_MAX_SENSOR_ID + 1];
+    int16_t sampleValues[SESSION_MAX_SENSOR_ID + 1][6];
+    int64_t tickTime;
+    int64_t packetTime;
+    uint64_t packetNumber;
+
+    void reset(int64_t baseTime);
+};
+
+// Inverse of the driver's raw * scale, so replayed samples are bit for bit
+// the ones the driver produced
+int16_t sessionQuantize(float value, float scale);
+void sessionQuantize(const ImuSample &sample, float accelerationScale, float angularVelocityScale, SessionRawSample *raw);
+void sessionDequantize(const SessionRawSample &raw, float accelerationScale, float angularVelocityScale, ImuSample *sample);
+// Datagrams shorter than the header are covered as a whole with type and number 0
+void sessionDescribePacket(const unsigned char *data, size_t size, SessionPacketInfo *info);
+// Makes a closed block ready for flash: the CRC of its records and erased
+// flash past them. Too slow to run under the recorder's lock, the writer
+// task does it.
+void sessionSealBlock(uint8_t *block);
+
+// Appends records to one block. Every put returns ESP_ERR_NO_MEM and leaves
+// the block as it was when the record does not fit, the caller closes the
+// block and puts the record into the next one.
+class SessionEncoder
+{
+private:
+    uint8_t *block;
+    size_t used;
+    SessionBlockHeader header;
+    SessionDeltaState state;
+
+public:
+    SessionEncoder();
+
+    void begin(uint8_t *block, uint32_t session, uint32_t sequence, int64_t baseTime);
+    // Writes the header without the CRC, sessionSealBlock() adds it
+    void close();
+    bool isEmpty();
+    size_t getUsed();
+
+    esp_err_t putStream(const SessionStream &stream);
+    esp_err_t putSensor(const SessionSensor &sensor);
+    esp_err_t putSamples(uint8_t id, const SessionRawSample *samples, size_t count);
+    esp_err_t putTick(int64_t time);
+    esp_err_t putSend(int64_t frameTime, int64_t time, SessionSendResult result);
+    esp_err_t putPacket(int64_t time, const SessionPacketInfo &packet);
+};
+
+class SessionDecoder
+{
+private:
+    const uint8_t *records;
+    size_t size;
+    size_t offset;
+    SessionBlockHeader header;
+    SessionDeltaState state;
+
+public:
+    SessionDecoder();
+
+    // ESP_ERR_NOT_FOUND for erased flash or a block of another session,
+    // ESP_ERR_INVALID_CRC for a damaged one. session 0 accepts any session.
+    esp_err_t open(const uint8_t *block, uint32_t session, uint32_t sequence);
+    const SessionBlockHeader &getHeader();
+    // ESP_ERR_NOT_FOUND at the end of the block
+    esp_err_t next(SessionRecord *record);
+};
@@ -0,0 +1,57 @@
+#include "session_partition.hpp"
+
+#include <esp_log.h>
+#include "session_format.hpp"
+
+static const char *TAG = "SessionPartition";
+
+SessionPartition::SessionPartition()
+{
+    this->partition = nullptr;
+}
+
+esp_err_t SessionPartition::init()
+{
+    if (this->partition != nullptr)
+    {
+        return ESP_OK;
+    }
+    this->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)SESSION_PARTITION_SUBTYPE,
+                                               SESSION_PARTITION_LABEL);
+    if (this->partition == nullptr)
+    {
+        ESP_LOGW(TAG, "No \"%s\" partition", SESSION_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "%lu blocks at 0x%lx", (unsigned long)this->getBlockCount(), (unsigned long)this->partition->address);
+    return ESP_OK;
+}
+
+uint32_t SessionPartition::getBlockCount()
+{
+    return this->partition != nullptr ? this->partition->size / SESSION_BLOCK_SIZE : 0;
+}
+
+esp_err_t SessionPartition::writeBlock(uint32_t index, const uint8_t *block)
+{
+    if (index >= this->getBlockCount())
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t offset = (size_t)index * SESSION_BLOCK_SIZE;
+    esp_err_t res = esp_partition_erase_range(this->partition, offset, SESSION_BLOCK_SIZE);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    return esp_partition_write(this->partition, offset, block, SESSION_BLOCK_SIZE);
+}
+
+esp_err_t SessionPartition::readBlock(uint32_t index, uint8_t *block)
+{
+    if (index >= this->getBlockCount())
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_partition_read(this->partition, (size_t)index * SESSION_BLOCK_SIZE, block, SESSION_BLOCK_SIZE);
+}
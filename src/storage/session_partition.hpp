@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#include "session_store.hpp"
+
+#define SESSION_PARTITION_LABEL "session"
+// Custom data subtype of the session partition in partitions.csv
+#define SESSION_PARTITION_SUBTYPE 0x40
+
+// The session partition in flash, one sector per block. A block is erased
+// right before it is written, so recording into it costs no up-front erase
+// of the whole partition. Both stall the other core while the cache is off,
+// the IMU FIFOs hold far more than a sector erase takes.
+class SessionPartition : public SessionStore
+{
+private:
+    const esp_partition_t *partition;
+
+public:
+    SessionPartition();
+
+    // ESP_ERR_NOT_FOUND when the partition table has no session partition
+    esp_err_t init();
+
+    uint32_t getBlockCount() override;
+    esp_err_t writeBlock(uint32_t index, const uint8_t *block) override;
+    esp_err_t readBlock(uint32_t index, uint8_t *block) override;
+};
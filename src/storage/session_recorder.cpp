@@ -0,0 +1,343 @@
+#include "session_recorder.hpp"
+
+#include <string.h>
+#include <esp_log.h>
+#include "../utils/task_topology.hpp"
+#include "../utils/timing.hpp"
+
+static const char *TAG = "SessionRecorder";
+
+SessionRecorder::SessionRecorder()
+{
+    this->store = nullptr;
+    for (size_t i = 0; i < SESSION_RECORDER_BLOCKS; i++)
+    {
+        this->blockStates[i] = BLOCK_FREE;
+        this->blockSequences[i] = 0;
+    }
+    this->current = 0;
+    this->session = 0;
+    this->nextSequence = 0;
+    this->recording = false;
+    memset(this->accelerationScales, 0, sizeof(this->accelerationScales));
+    memset(this->angularVelocityScales, 0, sizeof(this->angularVelocityScales));
+    this->writer = nullptr;
+    memset(&this->stats, 0, sizeof(this->stats));
+    portMUX_INITIALIZE(&this->lock);
+}
+
+esp_err_t SessionRecorder::findSession(SessionStore &store, uint32_t *session)
+{
+    if (this->recording)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (store.getBlockCount() == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t res = store.readBlock(0, this->blocks[0]);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    SessionDecoder decoder;
+    if (decoder.open(this->blocks[0], 0, 0) == ESP_ERR_NOT_FOUND)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *session = decoder.getHeader().session;
+    return ESP_OK;
+}
+
+esp_err_t SessionRecorder::start(SessionStore &store, uint32_t session, const SessionStream &stream, bool background)
+{
+    if (this->recording)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t capacity = store.getBlockCount();
+    if (capacity == 0)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (background && this->writer == nullptr &&
+        createTask(TaskTopology::SESSION_WRITER, writerLoop, this, &this->writer) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        return ESP_ERR_NO_MEM;
+    }
+    portENTER_CRITICAL(&this->lock);
+    this->store = &store;
+    this->session = session;
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->stats.blockCapacity = capacity;
+    for (size_t i = 0; i < SESSION_RECORDER_BLOCKS; i++)
+    {
+        this->blockStates[i] = BLOCK_FREE;
+    }
+    this->current = 0;
+    this->blockStates[0] = BLOCK_FILLING;
+    this->blockSequences[0] = 0;
+    this->nextSequence = 1;
+    this->encoder.begin(this->blocks[0], session, 0, micros64());
+    this->encoder.putStream(stream);
+    this->stats.records++;
+    this->recording = true;
+    this->stats.recording = true;
+    portEXIT_CRITICAL(&this->lock);
+    return ESP_OK;
+}
+
+esp_err_t SessionRecorder::finish()
+{
+    portENTER_CRITICAL(&this->lock);
+    if (this->recording)
+    {
+        if (this->encoder.isEmpty())
+        {
+            this->blockStates[this->current] = BLOCK_FREE;
+        }
+        else
+        {
+            this->encoder.close();
+            this->blockStates[this->current] = BLOCK_CLOSED;
+        }
+        this->recording = false;
+        this->stats.recording = false;
+    }
+    portEXIT_CRITICAL(&this->lock);
+    if (this->writer == nullptr)
+    {
+        return this->drain();
+    }
+    xTaskNotifyGive(this->writer);
+    for (;;)
+    {
+        bool pending = false;
+        portENTER_CRITICAL(&this->lock);
+        for (size_t i = 0; i < SESSION_RECORDER_BLOCKS; i++)
+        {
+            pending = pending || this->blockStates[i] == BLOCK_CLOSED || this->blockStates[i] == BLOCK_WRITING;
+        }
+        uint32_t errors = this->stats.writeErrors;
+        portEXIT_CRITICAL(&this->lock);
+        if (!pending)
+        {
+            return errors == 0 ? ESP_OK : ESP_FAIL;
+        }
+        vTaskDelay(1);
+    }
+}
+
+bool SessionRecorder::isRecording()
+{
+    return this->recording;
+}
+
+// Called with the lock held. Closes the current block and moves on to a free
+// one, or stops the recording when there is none.
+bool SessionRecorder::advance()
+{
+    this->encoder.close();
+    this->blockStates[this->current] = BLOCK_CLOSED;
+    if (this->nextSequence >= this->stats.blockCapacity)
+    {
+        this->recording = false;
+        this->stats.recording = false;
+        this->stats.full = true;
+        return false;
+    }
+    for (size_t i = 0; i < SESSION_RECORDER_BLOCKS; i++)
+    {
+        if (this->blockStates[i] == BLOCK_FREE)
+        {
+            this->current = i;
+            this->blockStates[i] = BLOCK_FILLING;
+            this->blockSequences[i] = this->nextSequence;
+            this->encoder.begin(this->blocks[i], this->session, this->nextSequence++, micros64());
+            return true;
+        }
+    }
+    this->recording = false;
+    this->stats.recording = false;
+    this->stats.overrun = true;
+    return false;
+}
+
+template <typename Put>
+bool SessionRecorder::record(Put put)
+{
+    bool closed = false;
+    portENTER_CRITICAL(&this->lock);
+    if (!this->recording)
+    {
+        this->stats.dropped++;
+        portEXIT_CRITICAL(&this->lock);
+        return false;
+    }
+    esp_err_t res = put(this->encoder);
+    if (res == ESP_ERR_NO_MEM)
+    {
+        closed = true;
+        res = this->advance() ? put(this->encoder) : ESP_ERR_INVALID_STATE;
+    }
+    if (res == ESP_OK)
+    {
+        this->stats.records++;
+    }
+    else
+    {
+        this->stats.dropped++;
+    }
+    portEXIT_CRITICAL(&this->lock);
+    if (closed && this->writer != nullptr)
+    {
+        xTaskNotifyGive(this->writer);
+    }
+    return res == ESP_OK;
+}
+
+void SessionRecorder::addSensor(const SessionSensor &sensor)
+{
+    if (sensor.id > SESSION_MAX_SENSOR_ID)
+    {
+        return;
+    }
+    this->accelerationScales[sensor.id] = sensor.accelerationScale;
+    this->angularVelocityScales[sensor.id] = sensor.angularVelocityScale;
+    this->record([&](SessionEncoder &encoder)
+                 { return encoder.putSensor(sensor); });
+}
+
+// Quantized outside the lock, only the encoding runs under it
+void SessionRecorder::recordSamples(uint8_t id, const ImuSample *samples, size_t count)
+{
+    if (id > SESSION_MAX_SENSOR_ID)
+    {
+        return;
+    }
+    SessionRawSample raw[SESSION_MAX_BURST];
+    count = count < SESSION_MAX_BURST ? count : SESSION_MAX_BURST;
+    for (size_t i = 0; i < count; i++)
+    {
+        sessionQuantize(samples[i], this->accelerationScales[id], this->angularVelocityScales[id], &raw[i]);
+    }
+    if (this->record([&](SessionEncoder &encoder)
+                     { return encoder.putSamples(id, raw, count); }))
+    {
+        portENTER_CRITICAL(&this->lock);
+        this->stats.samples += count;
+        portEXIT_CRITICAL(&this->lock);
+    }
+}
+
+void SessionRecorder::recordTick(int64_t time)
+{
+    this->record([&](SessionEncoder &encoder)
+                 { return encoder.putTick(time); });
+}
+
+void SessionRecorder::recordSend(int64_t frameTime, int64_t time, esp_err_t result)
+{
+    SessionSendResult outcome = result == ESP_OK                 ? SESSION_SEND_SENT
+                                : result == ESP_ERR_NOT_FINISHED ? SESSION_SEND_THROTTLED
+                                                                 : SESSION_SEND_FAILED;
+    this->record([&](SessionEncoder &encoder)
+                 { return encoder.putSend(frameTime, time, outcome); });
+}
+
+// The CRC is the expensive part, it is skipped once the recording stopped
+void SessionRecorder::recordPacket(int64_t time, const unsigned char *data, size_t size)
+{
+    if (!this->recording)
+    {
+        portENTER_CRITICAL(&this->lock);
+        this->stats.dropped++;
+        portEXIT_CRITICAL(&this->lock);
+        return;
+    }
+    SessionPacketInfo packet;
+    sessionDescribePacket(data, size, &packet);
+    if (this->record([&](SessionEncoder &encoder)
+                     { return encoder.putPacket(time, packet); }))
+    {
+        portENTER_CRITICAL(&this->lock);
+        this->stats.packets++;
+        portEXIT_CRITICAL(&this->lock);
+    }
+}
+
+esp_err_t SessionRecorder::drain()
+{
+    esp_err_t res = ESP_OK;
+    for (;;)
+    {
+        size_t next = SESSION_RECORDER_BLOCKS;
+        portENTER_CRITICAL(&this->lock);
+        for (size_t i = 0; i < SESSION_RECORDER_BLOCKS; i++)
+        {
+            if (this->blockStates[i] == BLOCK_CLOSED &&
+                (next == SESSION_RECORDER_BLOCKS || this->blockSequences[i] < this->blockSequences[next]))
+            {
+                next = i;
+            }
+        }
+        if (next < SESSION_RECORDER_BLOCKS)
+        {
+            this->blockStates[next] = BLOCK_WRITING;
+        }
+        portEXIT_CRITICAL(&this->lock);
+        if (next == SESSION_RECORDER_BLOCKS)
+        {
+            return res;
+        }
+
+        sessionSealBlock(this->blocks[next]);
+        int64_t start = micros64();
+        esp_err_t err = this->store->writeBlock(this->blockSequences[next], this->blocks[next]);
+        int64_t elapsed = micros64() - start;
+
+        portENTER_CRITICAL(&this->lock);
+        this->blockStates[next] = BLOCK_FREE;
+        if (err == ESP_OK)
+        {
+            this->stats.blocksWritten++;
+        }
+        else
+        {
+            // Anything after a hole cannot be replayed
+            this->stats.writeErrors++;
+            this->recording = false;
+            this->stats.recording = false;
+            res = err;
+        }
+        if (elapsed > this->stats.maxWriteTime)
+        {
+            this->stats.maxWriteTime = elapsed;
+        }
+        portEXIT_CRITICAL(&this->lock);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write block %lu (%s)", (unsigned long)this->blockSequences[next], esp_err_to_name(err));
+        }
+    }
+}
+
+SessionRecorderStats SessionRecorder::getStats()
+{
+    portENTER_CRITICAL(&this->lock);
+    SessionRecorderStats stats = this->stats;
+    portEXIT_CRITICAL(&this->lock);
+    return stats;
+}
+
+void SessionRecorder::writerLoop(void *arg)
+{
+    SessionRecorder *recorder = (SessionRecorder *)arg;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        recorder->drain();
+    }
+}
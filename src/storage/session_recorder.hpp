@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "session_format.hpp"
+#include "session_store.hpp"
+
+// Blocks staged in RAM, one is filled while the others wait for the writer
+#define SESSION_RECORDER_BLOCKS 4
+
+struct SessionRecorderStats
+{
+    uint32_t records;
+    uint32_t samples;
+    uint32_t packets;
+    uint32_t blocksWritten;
+    uint32_t blockCapacity;
+    uint32_t writeErrors;
+    uint32_t dropped;     // records that came after the recording stopped
+    int64_t maxWriteTime; // us to erase and write one block
+    bool recording;
+    bool full;    // stopped at the end of the store
+    bool overrun; // stopped because the writer fell behind
+};
+
+// Records what the tracker sampled and sent into a SessionStore. The sampling
+// and network tasks append records to the block in RAM under a spinlock. Full
+// blocks are only closed there, the writer task (or drain() for callers
+// without one) computes their CRC and writes them, so no producer ever waits
+// for flash or checksums a block with interrupts masked. A session is
+// only worth replaying without holes: once the store is full or no staged
+// block is free, the recording stops for good and later records are counted
+// as dropped.
+class SessionRecorder
+{
+private:
+    enum BlockState : uint8_t
+    {
+        BLOCK_FREE,
+        BLOCK_FILLING,
+        BLOCK_CLOSED, // records done, CRC and write left to the writer
+        BLOCK_WRITING,
+    };
+
+    SessionStore *store;
+    uint8_t blocks[SESSION_RECORDER_BLOCKS][SESSION_BLOCK_SIZE];
+    BlockState blockStates[SESSION_RECORDER_BLOCKS];
+    uint32_t blockSequences[SESSION_RECORDER_BLOCKS];
+    size_t current;
+    SessionEncoder encoder;
+    uint32_t session;
+    uint32_t nextSequence;
+    bool recording;
+    float accelerationScales[SESSION_MAX_SENSOR_ID + 1];
+    float angularVelocityScales[SESSION_MAX_SENSOR_ID + 1];
+    TaskHandle_t writer;
+    SessionRecorderStats stats;
+    portMUX_TYPE lock;
+
+public:
+    SessionRecorder();
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    // ESP_OK with the session id when the first block of the store holds a
+    // session, also a damaged one or one of another format version.
+    // ESP_ERR_NOT_FOUND for an erased store.
+    // Reads through a staged block, not while recording.
+    esp_err_t findSession(SessionStore &store, uint32_t *session);
+    // Overwrites the store from its first block. Without background the
+    // caller writes closed blocks itself with drain().
+    esp_err_t start(SessionStore &store, uint32_t session, const SessionStream &stream, bool background = true);
+    // Closes the partial block and returns once everything is in the store
+    esp_err_t finish();
+    bool isRecording();
+
+    // Before the first tick, with the scales samples are quantized with
+    void addSensor(const SessionSensor &sensor);
+    // Samples read for a tick, before recordTick() of that tick
+    void recordSamples(uint8_t id, const ImuSample *samples, size_t count);
+    void recordTick(int64_t time);
+    // result of SlimeVRClient::sendSensorData() for the frame of frameTime
+    void recordSend(int64_t frameTime, int64_t time, esp_err_t result);
+    void recordPacket(int64_t time, const unsigned char *data, size_t size);
+
+    // Seals and writes the closed blocks, oldest first
+    esp_err_t drain();
+    SessionRecorderStats getStats();
+
+private:
+    // false when the record was dropped
+    template <typename Put>
+    bool record(Put put);
+    bool advance();
+    static void writerLoop(void *arg);
+};
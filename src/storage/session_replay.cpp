@@ -0,0 +1,353 @@
+#include "session_replay.hpp"
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <freertos/task.h>
+#include "../network/packet_schema.hpp"
+#include "../sensors/imu_acquisition.hpp"
+#include "../utils/timing.hpp"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+SessionReplay::SessionReplay()
+{
+    this->configured = false;
+    memset(&this->stream, 0, sizeof(this->stream));
+    this->standInState = 1;
+    for (ReplaySensor &sensor : this->sensors)
+    {
+        sensor.active = false;
+    }
+    this->frameHead = 0;
+    this->frameCount = 0;
+    this->pendingCount = 0;
+    this->firstTick = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+esp_err_t SessionReplay::run(SessionStore &store, float speed)
+{
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->stats.fingerprint = FNV_OFFSET;
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+    int64_t start = micros64();
+    uint32_t session = 0;
+    esp_err_t res = ESP_ERR_NOT_FOUND;
+    for (uint32_t index = 0; index < store.getBlockCount(); index++)
+    {
+        res = store.readBlock(index, this->block);
+        if (res != ESP_OK)
+        {
+            break;
+        }
+        SessionDecoder decoder;
+        res = decoder.open(this->block, session, index);
+        if (res != ESP_OK)
+        {
+            break;
+        }
+        session = decoder.getHeader().session;
+        this->stats.blocks++;
+        while ((res = decoder.next(&this->record)) == ESP_OK)
+        {
+            bool timed = this->record.kind == SESSION_RECORD_TICK || this->record.kind == SESSION_RECORD_SEND;
+            if (speed > 0.0f && timed && this->stats.ticks > 0)
+            {
+                int64_t due = start + (int64_t)((this->record.time - this->firstTick) / speed);
+                int64_t wait = due - micros64();
+                if (wait >= tickUs)
+                {
+                    vTaskDelay(wait / tickUs);
+                }
+            }
+            res = this->apply(this->record);
+            if (res != ESP_OK)
+            {
+                break;
+            }
+        }
+        if (res != ESP_ERR_NOT_FOUND)
+        {
+            break;
+        }
+    }
+    // A recording that stopped between a packet and its send record ends with
+    // packets nothing can be compared to
+    this->pendingCount = 0;
+    this->stats.replayDuration = micros64() - start;
+    this->stats.end = res;
+    if (this->stats.blocks == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return res == ESP_ERR_NOT_FOUND ? ESP_OK : res;
+}
+
+SessionReplayStats SessionReplay::getStats()
+{
+    return this->stats;
+}
+
+esp_err_t SessionReplay::apply(const SessionRecord &record)
+{
+    if (!this->configured && record.kind != SESSION_RECORD_STREAM)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    switch (record.kind)
+    {
+    case SESSION_RECORD_STREAM:
+        this->configure(record.stream);
+        break;
+    case SESSION_RECORD_SENSOR:
+    {
+        ReplaySensor *sensor = this->findSensor(record.sensorId);
+        for (size_t i = 0; sensor == nullptr && i < SESSION_REPLAY_SENSORS; i++)
+        {
+            if (!this->sensors[i].active)
+            {
+                sensor = &this->sensors[i];
+            }
+        }
+        if (sensor == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        sensor->active = true;
+        sensor->id = record.sensorId;
+        sensor->accelerationScale = record.sensor.accelerationScale;
+        sensor->angularVelocityScale = record.sensor.angularVelocityScale;
+        sensor->pendingCount = 0;
+        sensor->hasPrevious = false;
+        sensor->hasSample = false;
+        sensor->fusion.reset();
+        sensor->fusion.setGyroBias(record.sensor.gyroBias);
+        break;
+    }
+    case SESSION_RECORD_SAMPLES:
+    {
+        ReplaySensor *sensor = this->findSensor(record.sensorId);
+        if (sensor == nullptr)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        for (size_t i = 0; i < record.sampleCount && sensor->pendingCount < SESSION_MAX_BURST; i++)
+        {
+            sessionDequantize(record.samples[i], sensor->accelerationScale, sensor->angularVelocityScale,
+                              &sensor->pending[sensor->pendingCount++]);
+        }
+        this->stats.samples += record.sampleCount;
+        break;
+    }
+    case SESSION_RECORD_TICK:
+        this->tick(record.time);
+        break;
+    case SESSION_RECORD_SEND:
+        this->send(record);
+        break;
+    case SESSION_RECORD_PACKET:
+        if (!isSensorPacket(record.packet.type))
+        {
+            break;
+        }
+        this->stats.packetsRecorded++;
+        if (this->pendingCount < SESSION_REPLAY_PENDING)
+        {
+            this->pending[this->pendingCount++] = record.packet;
+        }
+        else
+        {
+            this->stats.packetsMissing++;
+        }
+        break;
+    }
+    return ESP_OK;
+}
+
+// The client as the firmware sets it up, sending into the loopback
+void SessionReplay::configure(const SessionStream &stream)
+{
+    this->stream = stream;
+    this->standInState = stream.standInSeed != 0 ? stream.standInSeed : 1;
+    this->client.setTransport(&this->transport);
+    this->transport.start(0);
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(6969);
+    this->transport.connect(server);
+    for (uint8_t id = 0; id <= SESSION_MAX_SENSOR_ID; id++)
+    {
+        if (stream.sensorMask & (1u << id))
+        {
+            this->client.registerSensor(id);
+        }
+    }
+    this->client.setBundleEnabled(stream.bundle);
+    this->client.setCompactRotation(stream.compactRotation);
+    SuppressionConfig suppression;
+    suppression.accelerationThreshold = stream.accelerationThreshold;
+    suppression.angleThreshold = stream.angleThreshold;
+    suppression.keyframePeriod = stream.keyframePeriod;
+    this->client.setSuppression(suppression);
+    this->configured = true;
+}
+
+SessionReplay::ReplaySensor *SessionReplay::findSensor(uint8_t id)
+{
+    for (ReplaySensor &sensor : this->sensors)
+    {
+        if (sensor.active && sensor.id == id)
+        {
+            return &sensor;
+        }
+    }
+    return nullptr;
+}
+
+// sampleSensors() of the firmware, with the recorded samples in place of acquire()
+void SessionReplay::tick(int64_t time)
+{
+    if (this->stats.ticks == 0)
+    {
+        this->firstTick = time;
+    }
+    this->stats.ticks++;
+    this->stats.recordedDuration = time - this->firstTick;
+    for (ReplaySensor &sensor : this->sensors)
+    {
+        if (!sensor.active)
+        {
+            continue;
+        }
+        ImuSample aligned;
+        int64_t gap;
+        bool valid = ImuAcquisition::alignSamples(time, sensor.pending, sensor.pendingCount, &sensor.previous,
+                                                  &sensor.hasPrevious, &aligned, &gap);
+        if (valid && sensor.pendingCount > 0)
+        {
+            uint32_t start = cycles();
+            sensor.fusion.update(sensor.pending, sensor.pendingCount);
+            this->stats.fusionCycles += cycles() - start;
+        }
+        if (valid)
+        {
+            memcpy(sensor.acceleration, aligned.acceleration, sizeof(sensor.acceleration));
+            sensor.hasSample = true;
+        }
+        sensor.pendingCount = 0;
+    }
+
+    if (this->frameCount == SESSION_REPLAY_FRAMES)
+    {
+        this->frameHead = (this->frameHead + 1) % SESSION_REPLAY_FRAMES;
+        this->frameCount--;
+    }
+    SampleFrame &frame = this->frames[(this->frameHead + this->frameCount++) % SESSION_REPLAY_FRAMES];
+    frame.timestamp = time;
+    frame.sensorCount = 0;
+    for (uint8_t id = 0; id <= SESSION_MAX_SENSOR_ID && frame.sensorCount < SLIMEVR_MAX_SENSORS; id++)
+    {
+        if ((this->stream.sensorMask & (1u << id)) == 0)
+        {
+            continue;
+        }
+        SensorSample &sample = frame.samples[frame.sensorCount++];
+        sample.id = id;
+        sample.hasRotation = false;
+        ReplaySensor *sensor = this->findSensor(id);
+        if (sensor != nullptr && sensor->hasSample)
+        {
+            memcpy(sample.acceleration, sensor->acceleration, sizeof(sample.acceleration));
+            sample.rotation = sensor->fusion.getRotation();
+            sample.hasRotation = true;
+            continue;
+        }
+        sample.acceleration[0] = nextStandInValue(this->standInState);
+        sample.acceleration[1] = nextStandInValue(this->standInState);
+        sample.acceleration[2] = nextStandInValue(this->standInState);
+    }
+}
+
+// transmitSamples() of the firmware. Frames older than the one sent were never
+// handed to the client, e.g. while it was not connected.
+void SessionReplay::send(const SessionRecord &record)
+{
+    while (this->frameCount > 0 && this->frames[this->frameHead].timestamp < record.frameTime)
+    {
+        this->frameHead = (this->frameHead + 1) % SESSION_REPLAY_FRAMES;
+        this->frameCount--;
+    }
+    if (this->frameCount == 0 || this->frames[this->frameHead].timestamp != record.frameTime)
+    {
+        this->stats.framesMissing++;
+        this->compare();
+        return;
+    }
+    const SampleFrame &frame = this->frames[this->frameHead];
+    this->frameHead = (this->frameHead + 1) % SESSION_REPLAY_FRAMES;
+    this->frameCount--;
+
+    this->stats.sends++;
+    if (record.result == SESSION_SEND_THROTTLED)
+    {
+        this->stats.throttled++;
+    }
+    else if (record.result == SESSION_SEND_FAILED)
+    {
+        this->stats.failed++;
+    }
+    uint32_t start = cycles();
+    for (uint8_t i = 0; i < frame.sensorCount; i++)
+    {
+        const SensorSample &sample = frame.samples[i];
+        this->client.setAcceleration(sample.id, sample.acceleration[0], sample.acceleration[1], sample.acceleration[2]);
+        if (sample.hasRotation)
+        {
+            this->client.setRotation(sample.id, sample.rotation);
+        }
+    }
+    this->client.replaySensorData(record.time, record.result != SESSION_SEND_THROTTLED);
+    this->stats.serializeCycles += cycles() - start;
+    this->compare();
+}
+
+// Matches what the replayed send produced against the packets recorded for it
+void SessionReplay::compare()
+{
+    LoopbackDatagram datagram;
+    size_t index = 0;
+    while (this->transport.takeSent(&datagram))
+    {
+        SessionPacketInfo produced;
+        sessionDescribePacket(datagram.data, datagram.size, &produced);
+        for (size_t i = SESSION_PACKET_HEADER_SIZE; i < datagram.size; i++)
+        {
+            this->stats.fingerprint = (this->stats.fingerprint ^ datagram.data[i]) * FNV_PRIME;
+        }
+        if (index >= this->pendingCount)
+        {
+            this->stats.packetsExtra++;
+            continue;
+        }
+        const SessionPacketInfo &recorded = this->pending[index++];
+        if (produced.type == recorded.type && produced.size == recorded.size && produced.crc == recorded.crc)
+        {
+            this->stats.packetsMatched++;
+        }
+        else
+        {
+            this->stats.packetsMismatched++;
+        }
+    }
+    this->stats.packetsMissing += this->pendingCount - index;
+    this->pendingCount = 0;
+}
+
+bool SessionReplay::isSensorPacket(uint32_t type)
+{
+    return type == PACKET_BUNDLE || type == PACKET_ROTATION_DATA || type == PACKET_ACCEL ||
+           type == PACKET_ROTATION_COMPACT;
+}
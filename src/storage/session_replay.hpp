@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "session_format.hpp"
+#include "session_store.hpp"
+#include "../fusion/sensor_fusion.hpp"
+#include "../network/loopback_transport.hpp"
+#include "../network/slimevr_client.hpp"
+#include "../pipeline/sample_frame.hpp"
+
+// IMUs of a session, ACQUISITION_MAX_SENSORS on the device
+#define SESSION_REPLAY_SENSORS 8
+// Frames between their tick and their send, SAMPLE_PIPELINE_RING_SIZE and then some
+#define SESSION_REPLAY_FRAMES 32
+// Recorded sensor packets between two sends, one rotation and one
+// acceleration per sensor without bundles
+#define SESSION_REPLAY_PENDING (2 * SLIMEVR_MAX_SENSORS)
+
+struct SessionReplayStats
+{
+    uint32_t blocks;
+    uint32_t samples;
+    uint32_t ticks;
+    uint32_t sends;
+    uint32_t throttled;
+    uint32_t failed;        // failed on the device, replayed as sent
+    uint32_t framesMissing; // sends of a frame that was not queued any more
+    uint32_t packetsRecorded; // sensor data packets, other packets are not replayed
+    uint32_t packetsMatched;
+    uint32_t packetsMismatched;
+    uint32_t packetsMissing; // recorded but not produced by the replay
+    uint32_t packetsExtra;   // produced but not recorded
+    uint32_t fingerprint;    // FNV-1a of every replayed payload
+    int64_t recordedDuration; // us from the first to the last tick
+    int64_t replayDuration;
+    uint64_t fusionCycles;
+    uint64_t serializeCycles;
+    esp_err_t end; // ESP_ERR_NOT_FOUND when the session ended cleanly
+};
+
+// Feeds a recorded session back through the same steps as the firmware:
+// samples go through ImuAcquisition::alignSamples() and SensorFusion, frames
+// are built like sampleSensors() builds them, and every recorded send hands
+// its frame to a SlimeVRClient on a LoopbackTransport at the recorded time
+// with the recorded rate decision. The sensor data packets that come out
+// must match the recorded ones byte for byte, apart from the packet number.
+// The replay runs in the calling task, one per instance.
+class SessionReplay
+{
+private:
+    struct ReplaySensor
+    {
+        bool active;
+        uint8_t id;
+        float accelerationScale;
+        float angularVelocityScale;
+        ImuSample pending[SESSION_MAX_BURST];
+        size_t pendingCount;
+        ImuSample previous;
+        bool hasPrevious;
+        bool hasSample;
+        float acceleration[3];
+        SensorFusion fusion;
+    };
+
+    bool configured;
+    SessionStream stream;
+    uint32_t standInState;
+    ReplaySensor sensors[SESSION_REPLAY_SENSORS];
+    SampleFrame frames[SESSION_REPLAY_FRAMES];
+    size_t frameHead;
+    size_t frameCount;
+    SessionPacketInfo pending[SESSION_REPLAY_PENDING];
+    size_t pendingCount;
+    int64_t firstTick;
+    LoopbackTransport transport;
+    SlimeVRClient client;
+    uint8_t block[SESSION_BLOCK_SIZE];
+    SessionRecord record;
+    SessionReplayStats stats;
+
+public:
+    SessionReplay();
+    SessionReplay(const SessionReplay &) = delete;
+    SessionReplay &operator=(const SessionReplay &) = delete;
+
+    // speed 1 replays in real time, 10 ten times as fast and 0 as fast as
+    // the CPU goes. ESP_ERR_NOT_FOUND when the store holds no session.
+    esp_err_t run(SessionStore &store, float speed);
+    SessionReplayStats getStats();
+
+private:
+    esp_err_t apply(const SessionRecord &record);
+    void configure(const SessionStream &stream);
+    ReplaySensor *findSensor(uint8_t id);
+    void tick(int64_t time);
+    void send(const SessionRecord &record);
+    void compare();
+    static bool isSensorPacket(uint32_t type);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+// Where recorded sessions live, SESSION_BLOCK_SIZE bytes per block. The
+// firmware keeps them in a flash partition, host tools in an image file with
+// the same layout.
+class SessionStore
+{
+public:
+    virtual ~SessionStore() {}
+
+    virtual uint32_t getBlockCount() = 0;
+    // Replaces the whole block, erasing it first where the medium needs that
+    virtual esp_err_t writeBlock(uint32_t index, const uint8_t *block) = 0;
+    virtual esp_err_t readBlock(uint32_t index, uint8_t *block) = 0;
+};
@@ -1,12 +1,27 @@
 #include "storage_manager.hpp"
 
+#include <string.h>
+#include <esp_log.h>
 #include <nvs_flash.h>
+#include "../utils/timing.hpp"
+
+static const char *TAG = "StorageManager";
 
 StorageManager::StorageManager() {
     this->initialized = false;
+    this->handle = 0;
+    memset(&this->config, 0, sizeof(this->config));
+    this->loadResult = CONFIG_DEFAULTS;
+    this->storedCrc = 0;
+    this->dirty = false;
+    this->firstChange = 0;
+    this->lastChange = 0;
+    this->pendingChanges = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+    portMUX_INITIALIZE(&this->lock);
 }
 
-void StorageManager::init()
+void StorageManager::init(const StoredConfig &defaults)
 {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -15,5 +30,195 @@ void StorageManager::init()
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    ESP_ERROR_CHECK(nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &this->handle));
+
+    size_t size = sizeof(this->blob);
+    ret = nvs_get_blob(this->handle, STORAGE_CONFIG_KEY, this->blob, &size);
+    if (ret == ESP_ERR_NVS_NOT_FOUND)
+    {
+        size = 0;
+    }
+    else if (ret != ESP_OK)
+    {
+        // Most likely a blob larger than anything this version can read
+        ESP_LOGW(TAG, "Failed to read config (%s)", esp_err_to_name(ret));
+        size = 0;
+        this->stats.errors++;
+    }
+    this->loadResult = configDecode(size > 0 ? this->blob : nullptr, size, defaults, &this->config);
+    this->storedCrc = this->loadResult == CONFIG_LOADED
+                          ? configCrc((const uint8_t *)&this->config, sizeof(this->config))
+                          : 0;
+    // Anything but an exact match is rewritten in the current layout
+    this->dirty = this->loadResult != CONFIG_LOADED;
+    this->firstChange = micros64();
+    this->lastChange = this->firstChange;
+    ESP_LOGI(TAG, "Config %s, %d bytes stored, version %d", configLoadResultName(this->loadResult), (int)size, CONFIG_VERSION);
     this->initialized = true;
-}
\ No newline at end of file
+}
+
+bool StorageManager::isInitialized()
+{
+    return this->initialized;
+}
+
+StoredConfig StorageManager::getConfig()
+{
+    StoredConfig result;
+    portENTER_CRITICAL(&this->lock);
+    memcpy(&result, &this->config, sizeof(result));
+    portEXIT_CRITICAL(&this->lock);
+    return result;
+}
+
+ConfigLoadResult StorageManager::getLoadResult()
+{
+    return this->loadResult;
+}
+
+void StorageManager::update(void *field, const void *value, size_t size)
+{
+    int64_t now = micros64();
+    portENTER_CRITICAL(&this->lock);
+    if (memcmp(field, value, size) != 0)
+    {
+        memcpy(field, value, size);
+        if (!this->dirty)
+        {
+            this->dirty = true;
+            this->firstChange = now;
+        }
+        this->lastChange = now;
+        this->pendingChanges++;
+        this->stats.changes++;
+    }
+    portEXIT_CRITICAL(&this->lock);
+}
+
+esp_err_t StorageManager::setWifiCredentials(const char *ssid, const char *password)
+{
+    if (ssid == nullptr || password == nullptr || strlen(ssid) >= CONFIG_SSID_SIZE ||
+        strlen(password) >= CONFIG_PASSWORD_SIZE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    WifiSettings wifi;
+    memset(&wifi, 0, sizeof(wifi));
+    strcpy(wifi.ssid, ssid);
+    strcpy(wifi.password, password);
+    this->update(&this->config.wifi, &wifi, sizeof(wifi));
+    return ESP_OK;
+}
+
+void StorageManager::setServer(const ServerSettings &server)
+{
+    this->update(&this->config.server, &server, sizeof(server));
+}
+
+void StorageManager::setStreamSettings(const StreamSettings &stream)
+{
+    this->update(&this->config.stream, &stream, sizeof(stream));
+}
+
+esp_err_t StorageManager::setCalibration(uint8_t sensorId, const SensorCalibration &calibration)
+{
+    if (sensorId >= CONFIG_MAX_SENSORS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->update(&this->config.calibration[sensorId], &calibration, sizeof(calibration));
+    return ESP_OK;
+}
+
+void StorageManager::setNetworkCache(const NetworkCache &network)
+{
+    this->update(&this->config.network, &network, sizeof(network));
+}
+
+void StorageManager::setPowerSettings(const PowerSettings &power)
+{
+    this->update(&this->config.power, &power, sizeof(power));
+}
+
+esp_err_t StorageManager::flush(int64_t now)
+{
+    if (!this->initialized || !this->dirty)
+    {
+        return ESP_OK;
+    }
+    if (now - this->lastChange < STORAGE_QUIET_PERIOD_US && now - this->firstChange < STORAGE_MAX_DELAY_US)
+    {
+        return ESP_OK;
+    }
+    return this->write();
+}
+
+esp_err_t StorageManager::commit()
+{
+    if (!this->initialized || !this->dirty)
+    {
+        return ESP_OK;
+    }
+    return this->write();
+}
+
+// Snapshot under the lock, flash access outside of it. A setter that runs
+// during the write marks the config dirty again and gets the next flush.
+esp_err_t StorageManager::write()
+{
+    StoredConfig snapshot;
+    portENTER_CRITICAL(&this->lock);
+    memcpy(&snapshot, &this->config, sizeof(snapshot));
+    uint32_t changes = this->pendingChanges;
+    this->pendingChanges = 0;
+    this->dirty = false;
+    portEXIT_CRITICAL(&this->lock);
+
+    size_t size = configEncode(snapshot, this->blob, sizeof(this->blob));
+    ConfigHeader header;
+    memcpy(&header, this->blob, sizeof(header));
+    if (header.crc == this->storedCrc)
+    {
+        // Changed and changed back before the flush
+        this->stats.unchanged++;
+        this->stats.coalesced += changes;
+        return ESP_OK;
+    }
+
+    int64_t start = micros64();
+    esp_err_t res = nvs_set_blob(this->handle, STORAGE_CONFIG_KEY, this->blob, size);
+    if (res == ESP_OK)
+    {
+        res = nvs_commit(this->handle);
+    }
+    int64_t duration = micros64() - start;
+    if (res != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write config (%s)", esp_err_to_name(res));
+        this->stats.errors++;
+        portENTER_CRITICAL(&this->lock);
+        if (!this->dirty)
+        {
+            this->dirty = true;
+            this->firstChange = start;
+        }
+        this->lastChange = start;
+        this->pendingChanges += changes;
+        portEXIT_CRITICAL(&this->lock);
+        return res;
+    }
+    this->storedCrc = header.crc;
+    this->stats.writes++;
+    this->stats.coalesced += changes > 0 ? changes - 1 : 0;
+    this->stats.lastWriteDuration = duration;
+    if (duration > this->stats.maxWriteDuration)
+    {
+        this->stats.maxWriteDuration = duration;
+    }
+    return ESP_OK;
+}
+
+StorageStats StorageManager::getStats()
+{
+    return this->stats;
+}
@@ -1,12 +1,75 @@
 #pragma once
 
+#include <stdint.h>
+#include <esp_err.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+
+#include "config_blob.hpp"
+
+#define STORAGE_NAMESPACE "slimefy"
+#define STORAGE_CONFIG_KEY "config"
+// A change is written once nothing changed for the quiet period, but never
+// later than the max delay after the first unwritten change
+#define STORAGE_QUIET_PERIOD_US 2000000
+#define STORAGE_MAX_DELAY_US 30000000
+
+struct StorageStats
+{
+    uint32_t changes;   // setter calls that changed something
+    uint32_t writes;    // blobs written to flash
+    uint32_t coalesced; // changes that did not need a write of their own
+    uint32_t unchanged; // flushes skipped because the blob matched flash
+    uint32_t errors;
+    int64_t lastWriteDuration; // us
+    int64_t maxWriteDuration;
+};
+
+// Typed configuration kept in RAM. It is loaded with one blob read at boot.
+// Setters only touch the RAM copy and can be called from any task. flush()
+// runs on a slow task and writes the whole blob back once the changes have
+// settled, so a burst of updates costs one flash write.
 struct StorageManager
 {
 private:
     bool initialized = false;
+    nvs_handle_t handle;
+    StoredConfig config;
+    ConfigLoadResult loadResult;
+    uint32_t storedCrc;
+    bool dirty;
+    int64_t firstChange;
+    int64_t lastChange;
+    uint32_t pendingChanges;
+    StorageStats stats;
+    portMUX_TYPE lock;
+    uint8_t blob[CONFIG_BLOB_MAX_SIZE];
 
 public:
     StorageManager();
 
-    void init();
-};
\ No newline at end of file
+    // defaults fills every field nothing was stored for yet, and replaces the
+    // Kconfig fields once when they differ from the build that stored them.
+    // Zero it before filling it in, padding bytes are part of the CRC.
+    void init(const StoredConfig &defaults);
+    bool isInitialized();
+
+    StoredConfig getConfig();
+    ConfigLoadResult getLoadResult();
+    esp_err_t setWifiCredentials(const char *ssid, const char *password);
+    void setServer(const ServerSettings &server);
+    void setStreamSettings(const StreamSettings &stream);
+    esp_err_t setCalibration(uint8_t sensorId, const SensorCalibration &calibration);
+    void setNetworkCache(const NetworkCache &network);
+    void setPowerSettings(const PowerSettings &power);
+
+    // Writes pending changes when they are due, now in us
+    esp_err_t flush(int64_t now);
+    // Writes pending changes right away, e.g. before a restart
+    esp_err_t commit();
+    StorageStats getStats();
+
+private:
+    void update(void *field, const void *value, size_t size);
+    esp_err_t write();
+};
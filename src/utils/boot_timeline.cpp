@@ -0,0 +1,80 @@
+#include "boot_timeline.hpp"
+
+#include <esp_log.h>
+#include "timing.hpp"
+
+static const char *TAG = "Boot";
+
+static volatile int64_t phaseTimes[BOOT_PHASE_COUNT];
+static volatile bool fastPath = false;
+
+void BootTimeline::mark(BootPhase phase)
+{
+    // esp_timer starts counting before app_main, so 0 never is a real mark
+    if (phase < BOOT_PHASE_COUNT && phaseTimes[phase] == 0)
+    {
+        phaseTimes[phase] = micros64();
+    }
+}
+
+int64_t BootTimeline::get(BootPhase phase)
+{
+    return phase < BOOT_PHASE_COUNT ? phaseTimes[phase] : 0;
+}
+
+bool BootTimeline::isComplete()
+{
+    return phaseTimes[BOOT_FIRST_PACKET] != 0;
+}
+
+void BootTimeline::setFastPath(bool value)
+{
+    fastPath = value;
+}
+
+bool BootTimeline::isFastPath()
+{
+    return fastPath;
+}
+
+const char *BootTimeline::getPhaseName(BootPhase phase)
+{
+    switch (phase)
+    {
+    case BOOT_APP_MAIN:
+        return "app_main";
+    case BOOT_STORAGE_READY:
+        return "storage";
+    case BOOT_WIFI_READY:
+        return "wifi init";
+    case BOOT_WIFI_ASSOCIATED:
+        return "associated";
+    case BOOT_IP_ACQUIRED:
+        return "ip";
+    case BOOT_SERVER_FOUND:
+        return "server";
+    case BOOT_FIRST_PACKET:
+        return "first packet";
+    default:
+        return "unknown";
+    }
+}
+
+void BootTimeline::log()
+{
+    int64_t previous = 0;
+    for (int phase = 0; phase < BOOT_PHASE_COUNT; phase++)
+    {
+        int64_t time = phaseTimes[phase];
+        if (time == 0)
+        {
+            ESP_LOGI(TAG, "%-12s not reached", getPhaseName((BootPhase)phase));
+            continue;
+        }
+        ESP_LOGI(TAG, "%-12s at %6lldms (+%lldms)", getPhaseName((BootPhase)phase), (long long)(time / 1000),
+                 (long long)((time - previous) / 1000));
+        previous = time;
+    }
+    ESP_LOGI(TAG, "Boot to first packet: %lldms over the %s path", (long long)(phaseTimes[BOOT_FIRST_PACKET] / 1000),
+             fastPath ? "cached" : "full scan");
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+enum BootPhase
+{
+    BOOT_APP_MAIN,
+    BOOT_STORAGE_READY,
+    BOOT_WIFI_READY,
+    BOOT_WIFI_ASSOCIATED,
+    BOOT_IP_ACQUIRED,
+    BOOT_SERVER_FOUND,
+    BOOT_FIRST_PACKET,
+    BOOT_PHASE_COUNT
+};
+
+// Time at which each boot phase was first reached, in us on the esp_timer
+// clock (starts when the bootloader hands over), 0 if not reached yet. The
+// modules that see a phase mark it, marking twice keeps the first time.
+namespace BootTimeline
+{
+    void mark(BootPhase phase);
+    int64_t get(BootPhase phase);
+    bool isComplete();
+    // Whether Wi-Fi connected through the cached access point
+    void setFastPath(bool fastPath);
+    bool isFastPath();
+    const char *getPhaseName(BootPhase phase);
+    void log();
+}
@@ -0,0 +1,196 @@
+#include "deferred_log.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+#include "spsc_ring.hpp"
+#include "task_topology.hpp"
+#include "timing.hpp"
+
+static SpscRing<LogRecord, DEFERRED_LOG_RING_SIZE> rings[DEFERRED_LOG_CORES];
+static portMUX_TYPE ringLocks[DEFERRED_LOG_CORES] = {portMUX_INITIALIZER_UNLOCKED, portMUX_INITIALIZER_UNLOCKED};
+static uint32_t reportedDrops[DEFERRED_LOG_CORES];
+static std::atomic<bool> started(false);
+static std::atomic<uint8_t> output(DEFERRED_LOG_TEXT);
+static std::atomic_flag flushing = ATOMIC_FLAG_INIT;
+static std::atomic<uint32_t> recorded(0);
+static uint32_t flushed = 0;
+static uint32_t maxDepth = 0;
+
+static esp_log_level_t logLevel(char level)
+{
+    switch (level)
+    {
+    case 'E':
+        return ESP_LOG_ERROR;
+    case 'W':
+        return ESP_LOG_WARN;
+    case 'D':
+        return ESP_LOG_DEBUG;
+    case 'V':
+        return ESP_LOG_VERBOSE;
+    default:
+        return ESP_LOG_INFO;
+    }
+}
+
+static void dumpRecord(const LogRecord &record)
+{
+    static const char HEX[] = "0123456789ABCDEF";
+    uint8_t bytes[8 + 4 * DEFERRED_LOG_MAX_ARGS];
+    size_t size = 0;
+    bytes[size++] = record.core;
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        bytes[size++] = (uint8_t)(record.timestamp >> shift);
+    }
+    bytes[size++] = (uint8_t)(record.format >> 8);
+    bytes[size++] = (uint8_t)record.format;
+    bytes[size++] = record.argCount;
+    for (uint8_t i = 0; i < record.argCount; i++)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            bytes[size++] = (uint8_t)(record.args[i] >> shift);
+        }
+    }
+    char line[sizeof(DEFERRED_LOG_DUMP_PREFIX) + 2 * sizeof(bytes) + 1];
+    size_t length = sizeof(DEFERRED_LOG_DUMP_PREFIX) - 1;
+    memcpy(line, DEFERRED_LOG_DUMP_PREFIX, length);
+    for (size_t i = 0; i < size; i++)
+    {
+        line[length++] = HEX[bytes[i] >> 4];
+        line[length++] = HEX[bytes[i] & 0x0F];
+    }
+    line[length++] = '\n';
+    fwrite(line, 1, length, stdout);
+}
+
+static void printRecord(const LogRecord &record)
+{
+    if (record.format >= LOG_FORMAT_COUNT)
+    {
+        return;
+    }
+    if (output.load(std::memory_order_relaxed) == DEFERRED_LOG_BINARY)
+    {
+        dumpRecord(record);
+        return;
+    }
+    const LogFormatInfo &info = LOG_FORMATS[record.format];
+    const uint32_t *args = record.args;
+    char message[128];
+    snprintf(message, sizeof(message), info.format, (unsigned long)args[0], (unsigned long)args[1],
+             (unsigned long)args[2], (unsigned long)args[3], (unsigned long)args[4], (unsigned long)args[5]);
+    esp_log_write(logLevel(info.level), info.tag, "%c (%lu) %s: %s\n", info.level, (unsigned long)record.timestamp,
+                  info.tag, message);
+}
+
+void IRAM_ATTR DeferredLog::write(LogFormat format, const uint32_t *args, uint8_t argCount)
+{
+    LogRecord record;
+    record.timestamp = (uint32_t)millis();
+    record.format = format;
+    record.argCount = argCount < DEFERRED_LOG_MAX_ARGS ? argCount : DEFERRED_LOG_MAX_ARGS;
+    memset(record.args, 0, sizeof(record.args));
+    memcpy(record.args, args, record.argCount * sizeof(uint32_t));
+    if (output.load(std::memory_order_relaxed) == DEFERRED_LOG_DISCARD)
+    {
+        recorded.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!started.load(std::memory_order_acquire))
+    {
+        record.core = 0;
+        printRecord(record);
+        return;
+    }
+    int core = esp_cpu_get_core_id();
+    record.core = core;
+    portENTER_CRITICAL(&ringLocks[core]);
+    rings[core].push(record);
+    portEXIT_CRITICAL(&ringLocks[core]);
+    recorded.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Single consumer: a flush that finds another one running leaves the records
+// to it
+void DeferredLog::flush()
+{
+    if (flushing.test_and_set(std::memory_order_acquire))
+    {
+        return;
+    }
+    for (int core = 0; core < DEFERRED_LOG_CORES; core++)
+    {
+        SpscRing<LogRecord, DEFERRED_LOG_RING_SIZE> &ring = rings[core];
+        uint32_t depth = ring.size();
+        maxDepth = depth > maxDepth ? depth : maxDepth;
+        LogRecord record;
+        while (!ring.empty() && ring.pop(record))
+        {
+            printRecord(record);
+            flushed++;
+        }
+        uint32_t drops = ring.getOverflows();
+        if (drops != reportedDrops[core])
+        {
+            memset(&record, 0, sizeof(record));
+            record.timestamp = (uint32_t)millis();
+            record.format = LOG_RECORDS_DROPPED;
+            record.argCount = 2;
+            record.core = core;
+            record.args[0] = drops - reportedDrops[core];
+            record.args[1] = core;
+            printRecord(record);
+            reportedDrops[core] = drops;
+        }
+    }
+    flushing.clear(std::memory_order_release);
+}
+
+static void flushLoop(void *arg)
+{
+    for (;;)
+    {
+        delay(DEFERRED_LOG_FLUSH_PERIOD_MS);
+        DeferredLog::flush();
+    }
+}
+
+esp_err_t DeferredLog::start()
+{
+    if (started.load(std::memory_order_relaxed))
+    {
+        return ESP_OK;
+    }
+    if (createTask(TaskTopology::LOG_FLUSH, flushLoop, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    started.store(true, std::memory_order_release);
+    return ESP_OK;
+}
+
+void DeferredLog::setOutput(DeferredLogOutput value)
+{
+    output.store(value, std::memory_order_relaxed);
+}
+
+DeferredLogStats DeferredLog::getStats()
+{
+    DeferredLogStats stats;
+    stats.recorded = recorded.load(std::memory_order_relaxed);
+    stats.dropped = 0;
+    for (int core = 0; core < DEFERRED_LOG_CORES; core++)
+    {
+        stats.dropped += rings[core].getOverflows();
+    }
+    stats.flushed = flushed;
+    stats.maxDepth = maxDepth;
+    return stats;
+}
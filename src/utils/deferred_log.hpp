@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "deferred_log_formats.hpp"
+
+#define DEFERRED_LOG_CORES 2
+#define DEFERRED_LOG_RING_SIZE 128 // records per core
+#define DEFERRED_LOG_FLUSH_PERIOD_MS 50
+
+struct LogRecord
+{
+    uint32_t timestamp; // ms since boot
+    uint16_t format;
+    uint8_t argCount;
+    uint8_t core;
+    uint32_t args[DEFERRED_LOG_MAX_ARGS];
+};
+
+enum DeferredLogOutput : uint8_t
+{
+    DEFERRED_LOG_TEXT,
+    DEFERRED_LOG_BINARY, // #DL hex lines for host/tools/log_decode
+    DEFERRED_LOG_DISCARD, // counted as recorded, never queued or printed
+};
+
+struct DeferredLogStats
+{
+    uint32_t recorded;
+    uint32_t dropped; // rings were full, the flush task fell behind
+    uint32_t flushed;
+    uint32_t maxDepth;
+};
+
+// Logging for hot paths. A record is the format index and raw arguments,
+// pushed into a ring of the calling core. The tasks of one core take turns
+// through a per-core critical section that only spans the copy, the other
+// core never takes it. A low priority task formats and prints the rings
+// every DEFERRED_LOG_FLUSH_PERIOD_MS, or dumps them as hex lines for
+// host/tools/log_decode. Records of the two cores are flushed core by core,
+// the timestamps give the order. Before start() records are printed
+// right away. Host benchmarks and fuzzers log far more than the flush task
+// is meant to keep up with, they discard the records instead.
+namespace DeferredLog
+{
+    esp_err_t start();
+    void write(LogFormat format, const uint32_t *args, uint8_t argCount);
+    // Prints everything recorded so far, e.g. before a restart
+    void flush();
+    void setOutput(DeferredLogOutput output);
+    DeferredLogStats getStats();
+}
+
+template <LogFormat Format, typename... Args>
+inline void deferredLog(Args... args)
+{
+    static_assert(sizeof...(Args) == LOG_FORMATS[Format].argCount, "Argument count does not match the format");
+    static_assert(sizeof...(Args) <= DEFERRED_LOG_MAX_ARGS, "Too many arguments");
+    const uint32_t values[] = {static_cast<uint32_t>(args)..., 0};
+    DeferredLog::write(Format, values, sizeof...(Args));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every message of the deferred log. A record only carries the index into
+// this table and its raw arguments, the text is put together later by the
+// flush task or by host/tools/log_decode from a captured dump. Dumps refer to
+// formats by index, so new ones are only ever appended. Arguments are 32 bit
+// and formatted as unsigned long: use %lu, %lx or %lX and nothing else.
+// Formats that are no longer logged stay, e.g. LOG_SENSOR_INFO_MALFORMED.
+#define DEFERRED_LOG_FORMATS(X)                                                                 \
+    X(LOG_RECORDS_DROPPED, 'W', "DeferredLog", "%lu records dropped on core %lu")               \
+    X(LOG_HEARTBEAT_SENT, 'I', "SlimeVRClient", "Sending heartbeat")                            \
+    X(LOG_HANDSHAKE_SENT, 'I', "SlimeVRClient", "Sending handshake to %lu.%lu.%lu.%lu:%lu")     \
+    X(LOG_HEARTBEAT_RECEIVED, 'I', "SlimeVRClient", "Heartbeat received")                       \
+    X(LOG_VIBRATE_RECEIVED, 'I', "SlimeVRClient", "Vibrate received")                           \
+    X(LOG_HANDSHAKE_RECEIVED, 'I', "SlimeVRClient", "Handshake received")                       \
+    X(LOG_COMMAND_RECEIVED, 'I', "SlimeVRClient", "Command received")                           \
+    X(LOG_CONFIG_RECEIVED, 'I', "SlimeVRClient", "Config received")                             \
+    X(LOG_PING_RECEIVED, 'I', "SlimeVRClient", "Ping received")                                 \
+    X(LOG_SENSOR_INFO_RECEIVED, 'I', "SlimeVRClient", "Sensor Info received")                   \
+    X(LOG_SENSOR_INFO_MALFORMED, 'W', "SlimeVRClient", "Wrong sensor info packet, %lu bytes")   \
+    X(LOG_SEND_FAILED, 'E', "UdpServer", "Failed to send message: %lu")                         \
+    X(LOG_PING_REPLY, 'I', "PingClient", "Reply from %lu.%lu.%lu.%lu icmp_seq=%lu time=%lu ms") \
+    X(LOG_PING_TIMEOUT, 'W', "PingClient", "From %lu.%lu.%lu.%lu icmp_seq=%lu timeout")         \
+    X(LOG_PACKET_MALFORMED, 'W', "SlimeVRClient", "Packet type %lu too short, %lu bytes")       \
+    X(LOG_PBUF_SEND_FAILED, 'E', "RawUdpTransport", "Failed to send pbuf: lwIP error -%lu")
+
+enum LogFormat : uint16_t
+{
+#define DEFERRED_LOG_FORMAT_ID(id, level, tag, format) id,
+    DEFERRED_LOG_FORMATS(DEFERRED_LOG_FORMAT_ID)
+#undef DEFERRED_LOG_FORMAT_ID
+    LOG_FORMAT_COUNT
+};
+
+struct LogFormatInfo
+{
+    char level; // 'E', 'W', 'I', 'D' or 'V' as in ESP_LOGx
+    const char *tag;
+    const char *format;
+    size_t argCount;
+};
+
+// Conversions in a format, "%%" is not one
+constexpr size_t countLogArguments(const char *format)
+{
+    size_t count = 0;
+    for (size_t i = 0; format[i] != '\0'; i++)
+    {
+        if (format[i] == '%')
+        {
+            if (format[i + 1] == '%')
+            {
+                i++;
+                continue;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+static constexpr LogFormatInfo LOG_FORMATS[] = {
+#define DEFERRED_LOG_FORMAT_INFO(id, level, tag, format) {level, tag, format, countLogArguments(format)},
+    DEFERRED_LOG_FORMATS(DEFERRED_LOG_FORMAT_INFO)
+#undef DEFERRED_LOG_FORMAT_INFO
+};
+
+static_assert(sizeof(LOG_FORMATS) / sizeof(LOG_FORMATS[0]) == LOG_FORMAT_COUNT, "Format table out of sync");
+
+// A record in a dump is one line: DEFERRED_LOG_DUMP_PREFIX followed by the
+// hex of core (1 byte), timestamp in ms (4), format (2), argument count (1)
+// and the arguments (4 each), all big endian.
+#define DEFERRED_LOG_DUMP_PREFIX "#DL "
+#define DEFERRED_LOG_MAX_ARGS 6
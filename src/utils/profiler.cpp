@@ -0,0 +1,115 @@
+#include "profiler.hpp"
+
+#include <string.h>
+#include <atomic>
+#include <esp_cpu.h>
+
+struct ProfileHistogram
+{
+    std::atomic<uint32_t> buckets[PROFILER_BUCKETS];
+    std::atomic<uint32_t> max;
+};
+
+static ProfileHistogram histograms[PROFILER_CORES][PROFILE_STAGE_COUNT];
+
+// 0..3 map to themselves, above that the two bits after the leading one pick
+// one of four buckets per power of two
+static inline uint32_t IRAM_ATTR bucketIndex(uint32_t cycleCount)
+{
+    if (cycleCount < PROFILER_SUB_BUCKETS)
+    {
+        return cycleCount;
+    }
+    uint32_t msb = 31 - __builtin_clz(cycleCount);
+    uint32_t index = (msb - 1) * PROFILER_SUB_BUCKETS + ((cycleCount >> (msb - 2)) & (PROFILER_SUB_BUCKETS - 1));
+    return index < PROFILER_BUCKETS ? index : PROFILER_BUCKETS - 1;
+}
+
+static uint32_t bucketUpperBound(uint32_t index)
+{
+    if (index < PROFILER_SUB_BUCKETS)
+    {
+        return index;
+    }
+    uint32_t msb = index / PROFILER_SUB_BUCKETS + 1;
+    uint32_t sub = index % PROFILER_SUB_BUCKETS;
+    return ((PROFILER_SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+#ifdef CONFIG_SLIMEFY_PROFILER
+void IRAM_ATTR Profiler::record(ProfileStage stage, uint32_t cycleCount)
+{
+    ProfileHistogram &histogram = histograms[esp_cpu_get_core_id()][stage];
+    histogram.buckets[bucketIndex(cycleCount)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = histogram.max.load(std::memory_order_relaxed);
+    while (cycleCount > max && !histogram.max.compare_exchange_weak(max, cycleCount, std::memory_order_relaxed))
+    {
+    }
+}
+#endif
+
+// Each bucket is swapped for zero on its own. A record() racing with the
+// drain lands in this interval or the next one, it is never lost.
+void Profiler::collect(ProfileSummary summary[PROFILER_CORES][PROFILE_STAGE_COUNT])
+{
+    uint32_t counts[PROFILER_BUCKETS];
+    for (int core = 0; core < PROFILER_CORES; core++)
+    {
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+        {
+            ProfileHistogram &histogram = histograms[core][stage];
+            ProfileSummary &result = summary[core][stage];
+            memset(&result, 0, sizeof(result));
+            for (uint32_t i = 0; i < PROFILER_BUCKETS; i++)
+            {
+                counts[i] = histogram.buckets[i].exchange(0, std::memory_order_relaxed);
+                result.count += counts[i];
+            }
+            result.max = histogram.max.exchange(0, std::memory_order_relaxed);
+            if (result.count == 0)
+            {
+                continue;
+            }
+            uint32_t p50Rank = (result.count + 1) / 2;
+            uint32_t p99Rank = result.count - result.count / 100;
+            uint32_t seen = 0;
+            for (uint32_t i = 0; i < PROFILER_BUCKETS && seen < p99Rank; i++)
+            {
+                bool belowMedian = seen < p50Rank;
+                seen += counts[i];
+                if (belowMedian && seen >= p50Rank)
+                {
+                    result.p50 = bucketUpperBound(i);
+                }
+                if (seen >= p99Rank)
+                {
+                    result.p99 = bucketUpperBound(i);
+                }
+            }
+            // The last bucket is open ended and the max can be below a bound
+            result.p50 = result.p50 < result.max ? result.p50 : result.max;
+            result.p99 = result.p99 < result.max ? result.p99 : result.max;
+        }
+    }
+}
+
+const char *Profiler::getStageName(ProfileStage stage)
+{
+    switch (stage)
+    {
+    case PROFILE_SAMPLING:
+        return "sampling";
+    case PROFILE_FUSION:
+        return "fusion";
+    case PROFILE_SERIALIZE:
+        return "serialize";
+    case PROFILE_SEND:
+        return "send";
+    case PROFILE_RECEIVE:
+        return "receive";
+    case PROFILE_STACK_SEND:
+        return "stack send";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <sdkconfig.h>
+
+#include "timing.hpp"
+
+#define PROFILER_CORES 2
+// Log-linear buckets, four per power of two. Counts from 2^23 cycles up
+// (about 50 ms at 160 MHz) share the last bucket, max is kept exactly.
+#define PROFILER_SUB_BUCKETS 4
+#define PROFILER_BUCKETS 92
+
+enum ProfileStage
+{
+    PROFILE_SAMPLING,   // reading the IMUs for one tick
+    PROFILE_FUSION,     // one fusion update over a FIFO burst
+    PROFILE_SERIALIZE,  // building a datagram
+    PROFILE_SEND,       // handing one datagram to the transport, sendto() for sockets
+    PROFILE_RECEIVE,    // dispatching one received datagram
+    PROFILE_STACK_SEND, // udp_sendto() in the tcpip thread, raw lwIP transport only
+    PROFILE_STAGE_COUNT
+};
+
+// Latency of one stage on one core over the last collect() interval, in CPU
+// cycles. p50 and p99 are the upper bound of their bucket, at most 25% high.
+struct ProfileSummary
+{
+    uint32_t count;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+};
+
+// Hot path timing on the CPU cycle counter. Every core records into its own
+// histograms with relaxed atomic increments, so recording takes no lock and
+// two tasks on one core cannot lose counts. collect() drains the histograms
+// of both cores from a slow task.
+namespace Profiler
+{
+#ifdef CONFIG_SLIMEFY_PROFILER
+    void record(ProfileStage stage, uint32_t cycleCount);
+#else
+    inline void record(ProfileStage stage, uint32_t cycleCount) {}
+#endif
+    void collect(ProfileSummary summary[PROFILER_CORES][PROFILE_STAGE_COUNT]);
+    const char *getStageName(ProfileStage stage);
+}
+
+// Records the cycles from construction to the end of the scope
+#ifdef CONFIG_SLIMEFY_PROFILER
+class ProfileScope
+{
+private:
+    ProfileStage stage;
+    uint32_t start;
+
+public:
+    explicit ProfileScope(ProfileStage stage) : stage(stage), start(cycles()) {}
+    ~ProfileScope() { Profiler::record(this->stage, cycles() - this->start); }
+};
+#else
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileStage stage) {}
+};
+#endif
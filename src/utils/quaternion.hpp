@@ -0,0 +1,64 @@
+#pragma once
+
+#include <math.h>
+
+// Rotation from the sensor frame into the world frame, z up
+struct Quaternion
+{
+    float x;
+    float y;
+    float z;
+    float w;
+
+    static inline Quaternion identity()
+    {
+        return {0.0f, 0.0f, 0.0f, 1.0f};
+    }
+
+    // axis must be normalized
+    static inline Quaternion fromAxisAngle(float ax, float ay, float az, float angle)
+    {
+        float s = sinf(angle / 2.0f);
+        return {ax * s, ay * s, az * s, cosf(angle / 2.0f)};
+    }
+
+    inline float dot(const Quaternion &other) const
+    {
+        return x * other.x + y * other.y + z * other.z + w * other.w;
+    }
+
+    inline Quaternion conjugate() const
+    {
+        return {-x, -y, -z, w};
+    }
+
+    inline Quaternion operator*(const Quaternion &o) const
+    {
+        return {w * o.x + x * o.w + y * o.z - z * o.y,
+                w * o.y - x * o.z + y * o.w + z * o.x,
+                w * o.z + x * o.y - y * o.x + z * o.w,
+                w * o.w - x * o.x - y * o.y - z * o.z};
+    }
+
+    inline Quaternion normalized() const
+    {
+        float length = sqrtf(this->dot(*this));
+        if (length <= 0.0f)
+        {
+            return identity();
+        }
+        float inverse = 1.0f / length;
+        return {x * inverse, y * inverse, z * inverse, w * inverse};
+    }
+
+    // Rotates v by this quaternion, v' = q v q*
+    inline void rotate(const float v[3], float out[3]) const
+    {
+        float tx = 2.0f * (y * v[2] - z * v[1]);
+        float ty = 2.0f * (z * v[0] - x * v[2]);
+        float tz = 2.0f * (x * v[1] - y * v[0]);
+        out[0] = v[0] + w * tx + (y * tz - z * ty);
+        out[1] = v[1] + w * ty + (z * tx - x * tz);
+        out[2] = v[2] + w * tz + (x * ty - y * tx);
+    }
+};
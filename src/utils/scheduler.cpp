@@ -0,0 +1,223 @@
+#include "scheduler.hpp"
+
+#include <string.h>
+#include <esp_log.h>
+#include "timing.hpp"
+
+static const char *TAG = "Scheduler";
+
+Scheduler::Scheduler()
+{
+    memset(jobs, 0, sizeof(jobs));
+    jobCount = 0;
+    wakeTimer = nullptr;
+    taskHandle = nullptr;
+    running = false;
+}
+
+Scheduler::~Scheduler()
+{
+    if (wakeTimer != nullptr)
+    {
+        esp_timer_stop(wakeTimer);
+        esp_timer_delete(wakeTimer);
+    }
+}
+
+esp_err_t Scheduler::init()
+{
+    if (this->wakeTimer != nullptr)
+    {
+        return ESP_OK;
+    }
+    esp_timer_create_args_t args = {};
+    args.callback = &Scheduler::onWakeTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "SchedulerWake";
+    return esp_timer_create(&args, &this->wakeTimer);
+}
+
+esp_err_t Scheduler::addJob(const char *name, int64_t period, SchedulerJobFunction function, void *arg, size_t *jobId)
+{
+    if (period <= 0 || function == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (this->jobCount >= SCHEDULER_MAX_JOBS)
+    {
+        ESP_LOGE(TAG, "No free slot for job %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+    SchedulerJob &job = this->jobs[this->jobCount];
+    memset(&job, 0, sizeof(SchedulerJob));
+    job.name = name;
+    job.function = function;
+    job.arg = arg;
+    job.period = period;
+    job.nextDeadline = micros64() + period;
+    job.enabled = true;
+    if (jobId != nullptr)
+    {
+        *jobId = this->jobCount;
+    }
+    this->jobCount++;
+    return ESP_OK;
+}
+
+esp_err_t Scheduler::setPeriod(size_t jobId, int64_t period)
+{
+    if (jobId >= this->jobCount || period <= 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SchedulerJob &job = this->jobs[jobId];
+    job.nextDeadline += period - job.period;
+    job.period = period;
+    return ESP_OK;
+}
+
+esp_err_t Scheduler::setEnabled(size_t jobId, bool enabled)
+{
+    if (jobId >= this->jobCount)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SchedulerJob &job = this->jobs[jobId];
+    if (enabled && !job.enabled)
+    {
+        job.nextDeadline = micros64() + job.period;
+    }
+    job.enabled = enabled;
+    return ESP_OK;
+}
+
+void Scheduler::run()
+{
+    this->taskHandle = xTaskGetCurrentTaskHandle();
+    this->running = true;
+    while (this->running)
+    {
+        int64_t now = micros64();
+        int64_t nextDeadline = INT64_MAX;
+        for (size_t i = 0; i < this->jobCount; i++)
+        {
+            if (this->jobs[i].enabled && this->jobs[i].nextDeadline < nextDeadline)
+            {
+                nextDeadline = this->jobs[i].nextDeadline;
+            }
+        }
+        if (nextDeadline == INT64_MAX)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (nextDeadline > now)
+        {
+            esp_timer_stop(this->wakeTimer);
+            esp_timer_start_once(this->wakeTimer, (uint64_t)(nextDeadline - now));
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        this->runDueJobs(now);
+    }
+    this->taskHandle = nullptr;
+}
+
+void Scheduler::stop()
+{
+    this->running = false;
+    if (this->taskHandle != nullptr)
+    {
+        xTaskNotifyGive(this->taskHandle);
+    }
+}
+
+void Scheduler::runDueJobs(int64_t now)
+{
+    for (size_t i = 0; i < this->jobCount; i++)
+    {
+        SchedulerJob &job = this->jobs[i];
+        if (!job.enabled || job.nextDeadline > now)
+        {
+            continue;
+        }
+        int64_t lateness = now - job.nextDeadline;
+        int64_t change = lateness - job.stats.lastLateness;
+        if (change < 0)
+        {
+            change = -change;
+        }
+        job.stats.jitter += (change - job.stats.jitter) / 16;
+        job.stats.lastLateness = lateness;
+        job.stats.totalLateness += lateness;
+        if (lateness > job.stats.maxLateness)
+        {
+            job.stats.maxLateness = lateness;
+        }
+
+        // Deadlines advance by whole periods so the rate does not drift,
+        // periods that were missed entirely are skipped and counted
+        job.nextDeadline += job.period;
+        if (job.nextDeadline <= now)
+        {
+            int64_t missed = (now - job.nextDeadline) / job.period + 1;
+            job.stats.missedPeriods += (uint32_t)missed;
+            job.nextDeadline += missed * job.period;
+        }
+
+        job.function(job.arg);
+        job.stats.runs++;
+
+        int64_t finished = micros64();
+        if (finished - now > job.stats.maxDuration)
+        {
+            job.stats.maxDuration = finished - now;
+        }
+        now = finished;
+    }
+}
+
+size_t Scheduler::getJobCount()
+{
+    return this->jobCount;
+}
+
+const SchedulerJob *Scheduler::getJob(size_t jobId)
+{
+    if (jobId >= this->jobCount)
+    {
+        return nullptr;
+    }
+    return &this->jobs[jobId];
+}
+
+void Scheduler::resetStats()
+{
+    for (size_t i = 0; i < this->jobCount; i++)
+    {
+        memset(&this->jobs[i].stats, 0, sizeof(SchedulerJobStats));
+    }
+}
+
+void Scheduler::logStats()
+{
+    for (size_t i = 0; i < this->jobCount; i++)
+    {
+        const SchedulerJob &job = this->jobs[i];
+        const SchedulerJobStats &stats = job.stats;
+        ESP_LOGI(TAG, "%s: runs=%lu missed=%lu lateness avg=%lldus max=%lldus jitter=%lldus duration max=%lldus",
+                 job.name, (unsigned long)stats.runs, (unsigned long)stats.missedPeriods,
+                 (long long)(stats.runs > 0 ? stats.totalLateness / stats.runs : 0), (long long)stats.maxLateness,
+                 (long long)stats.jitter, (long long)stats.maxDuration);
+    }
+}
+
+void Scheduler::onWakeTimer(void *arg)
+{
+    Scheduler *scheduler = (Scheduler *)arg;
+    if (scheduler != nullptr && scheduler->taskHandle != nullptr)
+    {
+        xTaskNotifyGive(scheduler->taskHandle);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define SCHEDULER_MAX_JOBS 8
+
+typedef void (*SchedulerJobFunction)(void *arg);
+
+struct SchedulerJobStats
+{
+    uint32_t runs;
+    uint32_t missedPeriods;
+    int64_t lastLateness;
+    int64_t maxLateness;
+    int64_t totalLateness;
+    int64_t jitter;
+    int64_t maxDuration;
+};
+
+struct SchedulerJob
+{
+    const char *name;
+    SchedulerJobFunction function;
+    void *arg;
+    int64_t period;
+    int64_t nextDeadline;
+    bool enabled;
+    SchedulerJobStats stats;
+};
+
+// Runs periodic jobs from a single task. Between deadlines the task blocks on a
+// task notification that a one-shot esp_timer delivers at the next deadline, so
+// periods keep microsecond resolution instead of the FreeRTOS tick.
+// All times are in microseconds.
+class Scheduler
+{
+private:
+    SchedulerJob jobs[SCHEDULER_MAX_JOBS];
+    size_t jobCount;
+    esp_timer_handle_t wakeTimer;
+    TaskHandle_t taskHandle;
+    volatile bool running;
+
+public:
+    Scheduler();
+    ~Scheduler();
+
+    esp_err_t init();
+    esp_err_t addJob(const char *name, int64_t period, SchedulerJobFunction function, void *arg, size_t *jobId = nullptr);
+    esp_err_t setPeriod(size_t jobId, int64_t period);
+    esp_err_t setEnabled(size_t jobId, bool enabled);
+
+    void run();
+    void stop();
+
+    size_t getJobCount();
+    const SchedulerJob *getJob(size_t jobId);
+    void resetStats();
+    void logStats();
+
+private:
+    void runDueJobs(int64_t now);
+    static void onWakeTimer(void *arg);
+};
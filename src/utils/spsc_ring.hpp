@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free ring buffer for exactly one producer task and one consumer task.
+// Capacity must be a power of two. A full ring rejects the new element and
+// counts an overflow, an empty ring counts an underflow on pop.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+private:
+    T items[Capacity];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> overflows;
+    std::atomic<uint32_t> underflows;
+
+public:
+    SpscRing() : head(0), tail(0), overflows(0), underflows(0) {}
+
+    // Producer side
+    bool push(const T &item)
+    {
+        uint32_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead - tail.load(std::memory_order_acquire) >= Capacity)
+        {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[currentHead & (Capacity - 1)] = item;
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &item)
+    {
+        uint32_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail == head.load(std::memory_order_acquire))
+        {
+            underflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        item = items[currentTail & (Capacity - 1)];
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, the oldest element without removing it, nullptr if empty
+    const T *front() const
+    {
+        uint32_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail == head.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &items[currentTail & (Capacity - 1)];
+    }
+
+    bool empty() const
+    {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return Capacity;
+    }
+
+    uint32_t getOverflows() const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+    uint32_t getUnderflows() const
+    {
+        return underflows.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <soc/soc.h>
+
+// Single place that decides where every firmware task runs. Network work
+// stays on PRO_CPU next to the Wi-Fi and lwIP tasks, sampling and fusion get
+// APP_CPU to themselves.
+struct TaskConfig
+{
+    const char *name;
+    uint32_t stackSize;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+namespace TaskTopology
+{
+    static constexpr TaskConfig PROGRAM = {"Program", 4096, 5, PRO_CPU_NUM};
+    static constexpr TaskConfig SAMPLING = {"Sampling", 4096, 10, APP_CPU_NUM};
+    static constexpr TaskConfig NETWORK_TX = {"NetworkTx", 4096, 9, PRO_CPU_NUM};
+    static constexpr TaskConfig SOCKET_READER = {"SocketReader", 4096, 8, PRO_CPU_NUM};
+    // Brings up netif and the Wi-Fi driver while Program initializes NVS
+    static constexpr TaskConfig WIFI_INIT = {"WifiInit", 4096, 5, PRO_CPU_NUM};
+    // Formats the deferred log, anything else runs before it
+    static constexpr TaskConfig LOG_FLUSH = {"LogFlush", 4096, 1, PRO_CPU_NUM};
+    // Writes recorded session blocks to flash, a sector erase takes tens of ms
+    static constexpr TaskConfig SESSION_WRITER = {"SessionWriter", 3072, 2, PRO_CPU_NUM};
+    // One per I2C controller. They sleep in the I2C driver for most of a read,
+    // so both fit on APP_CPU and preempt sampling as soon as a tick starts.
+    static constexpr TaskConfig IMU_BUS[] = {
+        {"ImuBus0", 3072, 11, APP_CPU_NUM},
+        {"ImuBus1", 3072, 11, APP_CPU_NUM},
+    };
+}
+
+inline BaseType_t createTask(const TaskConfig &config, TaskFunction_t function, void *arg, TaskHandle_t *handle = nullptr)
+{
+    return xTaskCreatePinnedToCore(function, config.name, config.stackSize, arg, config.priority, handle, config.core);
+}
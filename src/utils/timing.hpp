@@ -1,10 +1,39 @@
 #pragma once
 
+#include <sdkconfig.h>
+#include <esp_attr.h>
+#include <esp_cpu.h>
 #include <esp_timer.h>
 #include <esp_system.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#define CPU_CYCLES_PER_MICROSECOND CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+// 32 bit cycle counter, wraps every 2^32 / CPU_CYCLES_PER_MICROSECOND us
+// (about 26 s at 160 MHz). Only use differences between two readings.
+inline uint32_t IRAM_ATTR cycles()
+{
+    return (uint32_t)esp_cpu_get_cycle_count();
+}
+
+inline uint32_t IRAM_ATTR cyclesToMicros(uint32_t cycleCount)
+{
+    return cycleCount / CPU_CYCLES_PER_MICROSECOND;
+}
+
+// Wrap-safe comparison of two 32 bit timestamps taken less than 2^31 units apart.
+inline bool IRAM_ATTR timeReached(uint32_t now, uint32_t deadline)
+{
+    return (int32_t)(now - deadline) >= 0;
+}
+
+// Monotonic microseconds since boot, does not wrap.
+inline int64_t IRAM_ATTR micros64()
+{
+    return esp_timer_get_time();
+}
+
 inline unsigned long IRAM_ATTR micros()
 {
     return (unsigned long)(esp_timer_get_time());
@@ -12,21 +41,18 @@ inline unsigned long IRAM_ATTR micros()
 
 inline void IRAM_ATTR delayMicroseconds(uint32_t us)
 {
-    uint32_t m = micros();
-    if (us)
+    // Busy waits on the cycle counter in chunks short enough to never see it wrap
+    const uint32_t chunk = 1000000;
+    while (us > 0)
     {
-        uint32_t e = (m + us);
-        if (m > e)
-        { //overflow
-            while (micros() > e)
-            {
-                __asm__ volatile ("nop");
-            }
-        }
-        while (micros() < e)
+        uint32_t step = us > chunk ? chunk : us;
+        uint32_t start = cycles();
+        uint32_t target = step * CPU_CYCLES_PER_MICROSECOND;
+        while (cycles() - start < target)
         {
-            __asm__ volatile ("nop");
+            __asm__ volatile("nop");
         }
+        us -= step;
     }
 }
 
@@ -37,4 +63,4 @@ inline void IRAM_ATTR delay(int ms) {
 inline int64_t IRAM_ATTR millis()
 {
     return (int64_t)(esp_timer_get_time() / 1000ULL);
-}
\ No newline at end of file
+}